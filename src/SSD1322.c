@@ -5,6 +5,7 @@
 #include <gpio.h>
 #include <mem.h>
 #include "drivers/spi.h"
+#include "spibus.h"
 #include "SSD1322.h"
 #include "common.h"
 #include "graphics.h"
@@ -46,6 +47,8 @@ typedef enum{
 #define REG_MUX_RATIO               0xCA
 #define REG_CMD_LOCK                0xFD
 
+#define WORD_BITS					9
+
 
 // Adapted from Espressif example:
 // http://bbs.espressif.com/viewtopic.php?f=31&t=1346
@@ -79,6 +82,12 @@ void SSD1322_write(uchar low_8bit, uchar high_bit)
 	SET_PERI_REG_MASK(SPI_CMD(HSPI), SPI_USR);	// transmission start
 }
 
+// once per transfer, SSD1322_write runs from IRAM without bus bookkeeping
+LOCAL void ICACHE_FLASH_ATTR SSD1322_select(uint words)
+{
+	spiBusSelect(SpiDevDisplay);
+	spiBusStats[SpiDevDisplay].bits += words*WORD_BITS;
+}
 
 LOCAL void ICACHE_FLASH_ATTR SSD1322_setRowAddr(uchar addr)
 {
@@ -87,33 +96,38 @@ LOCAL void ICACHE_FLASH_ATTR SSD1322_setRowAddr(uchar addr)
 	SSD1322_write(addr+63, eData);
 }
 
-LOCAL void ICACHE_FLASH_ATTR SSD1322_setColumnAddr(uchar addr)
+// one column address covers 4 pixels, panel starts at column 0x1c
+LOCAL void ICACHE_FLASH_ATTR SSD1322_setColumnAddr(uchar first, uchar last)
 {
     SSD1322_write(REG_COLUMN_ADDR, eCmd);
-	SSD1322_write(0x1c|addr, eData);
-	SSD1322_write(0x5b, eData);
+	SSD1322_write(0x1c+first, eData);
+	SSD1322_write(0x1c+last, eData);
 }
 
 void ICACHE_FLASH_ATTR SSD1322_setStartLine(uchar line)
 {
+	SSD1322_select(2);
 	SSD1322_write(REG_START_LINE, eCmd);
 	SSD1322_write(line, eData);
 }
 
 void ICACHE_FLASH_ATTR SSD1322_setOnOff(DispState state)
 {
+	SSD1322_select(1);
 	SSD1322_write(state == stateOn ? REG_DISPLAY_ON : REG_DISPLAY_OFF, eCmd);
 	displayState = state;
 }
 
 void ICACHE_FLASH_ATTR SSD1322_setContrast(uchar value)
 {
+	SSD1322_select(2);
 	SSD1322_write(REG_CONTRAST_CURRENT, eCmd);
 	SSD1322_write(value, eData);
 }
 
 LOCAL void ICACHE_FLASH_ATTR SSD1322_setGrayLevel(uchar level)
 {
+	SSD1322_select(17);
 	SSD1322_write(REG_GRAYSCALE_TABLE, eCmd);
 	int i;
 	for (i = 0; i < 14; i++)
@@ -127,6 +141,7 @@ LOCAL void ICACHE_FLASH_ATTR SSD1322_setGrayLevel(uchar level)
 
 void ICACHE_FLASH_ATTR SSD1322_partialDispEn(uchar startRow, uchar endRow)
 {
+	SSD1322_select(3);
 	SSD1322_write(REG_PART_DISP_EN, eCmd);
 	SSD1322_write(startRow, eData);
 	SSD1322_write(endRow, eData);
@@ -134,63 +149,87 @@ void ICACHE_FLASH_ATTR SSD1322_partialDispEn(uchar startRow, uchar endRow)
 
 void ICACHE_FLASH_ATTR SSD1322_partialDispDis(void)
 {
+	SSD1322_select(1);
 	SSD1322_write(REG_PART_DISP_DIS, eCmd);
 }
 
 void ICACHE_FLASH_ATTR SSD1322_setRemap(uchar paramA, uchar paramB)
 {
+	SSD1322_select(3);
 	SSD1322_write(REG_REMAP_CONFIG, eCmd);
 	SSD1322_write(paramA, eData);
 	SSD1322_write(paramB, eData);
 }
 
-void ICACHE_FLASH_ATTR SSD1322_cpyMemBuf(uchar mem[][DISP_MEMWIDTH], int memRow, uchar dispRow, int height)
+LOCAL void ICACHE_FLASH_ATTR SSD1322_writeMemByte(uchar temp)
 {
-    int x, y;
-	uchar temp,temp1,temp2,temp3,temp4,temp5,temp6,temp7,temp8;
+	uchar temp1,temp2,temp3,temp4,temp5,temp6,temp7,temp8;
 	uchar h11,h12,h13,h14,h15,h16,h17,h18;
 	uint d1,d2,d3,d4;
 
+	// form 8 pixel width block
+	temp1=temp&0x80;
+	temp2=(temp&0x40)>>3;
+	temp3=(temp&0x20)<<2;
+	temp4=(temp&0x10)>>1;
+	temp5=(temp&0x08)<<4;
+	temp6=(temp&0x04)<<1;
+	temp7=(temp&0x02)<<6;
+	temp8=(temp&0x01)<<3;
+	h11=temp1|temp1>>1|temp1>>2|temp1>>3;
+	h12=temp2|temp2>>1|temp2>>2|temp2>>3;
+	h13=temp3|temp3>>1|temp3>>2|temp3>>3;
+	h14=temp4|temp4>>1|temp4>>2|temp4>>3;
+	h15=temp5|temp5>>1|temp5>>2|temp5>>3;
+	h16=temp6|temp6>>1|temp6>>2|temp6>>3;
+	h17=temp7|temp7>>1|temp7>>2|temp7>>3;
+	h18=temp8|temp8>>1|temp8>>2|temp8>>3;
+	d1=h11|h12;
+	d2=h13|h14;
+	d3=h15|h16;
+	d4=h17|h18;
+
+	// write 8 pixels to display
+	SSD1322_write(d1, eData);
+	SSD1322_write(d2, eData);
+	SSD1322_write(d3, eData);
+	SSD1322_write(d4, eData);
+}
+
+void ICACHE_FLASH_ATTR SSD1322_cpyMemBuf(uchar mem[][DISP_MEMWIDTH], int memRow, uchar dispRow, int height)
+{
+    int x, y;
+
+	// addresses and RAM write command, then 4 words per mem byte
+	SSD1322_select(7 + height*DISP_MEMWIDTH*4);
    	SSD1322_setRowAddr(dispRow);
-    SSD1322_setColumnAddr(0);
+    SSD1322_setColumnAddr(0, 2*DISP_MEMWIDTH-1);
  	SSD1322_write(REG_WRITE_RAM_CMD, eCmd);
 
 	for (y = memRow; y < (memRow+height); y++)
 	{
         for (x = 0; x < DISP_MEMWIDTH; x++)
 		{
-        	// form 8 pixel width block
-			temp = mem[y][x];
-			temp1=temp&0x80;
-			temp2=(temp&0x40)>>3;
-			temp3=(temp&0x20)<<2;
-			temp4=(temp&0x10)>>1;
-			temp5=(temp&0x08)<<4;
-			temp6=(temp&0x04)<<1;
-			temp7=(temp&0x02)<<6;
-			temp8=(temp&0x01)<<3;
-			h11=temp1|temp1>>1|temp1>>2|temp1>>3;
-			h12=temp2|temp2>>1|temp2>>2|temp2>>3;
-			h13=temp3|temp3>>1|temp3>>2|temp3>>3;
-			h14=temp4|temp4>>1|temp4>>2|temp4>>3;
-			h15=temp5|temp5>>1|temp5>>2|temp5>>3;
-			h16=temp6|temp6>>1|temp6>>2|temp6>>3;
-			h17=temp7|temp7>>1|temp7>>2|temp7>>3;
-			h18=temp8|temp8>>1|temp8>>2|temp8>>3;
-			d1=h11|h12;
-			d2=h13|h14;
-			d3=h15|h16;
-			d4=h17|h18;
-
-			// write 8 pixels to display
-			SSD1322_write(d1, eData);
-			SSD1322_write(d2, eData);
-			SSD1322_write(d3, eData);
-			SSD1322_write(d4, eData);
+        	SSD1322_writeMemByte(mem[y][x]);
 		}
 	}
 }
 
+// writes mem bytes first..last of a single row, rest of the GDDRAM row is kept
+void ICACHE_FLASH_ATTR SSD1322_cpyMemRowSpan(const uchar *row, uchar dispRow, int first, int last)
+{
+	int x;
+
+	SSD1322_select(7 + (last-first+1)*4);
+   	SSD1322_setRowAddr(dispRow);
+    SSD1322_setColumnAddr(2*first, 2*last+1);
+ 	SSD1322_write(REG_WRITE_RAM_CMD, eCmd);
+	for (x = first; x <= last; x++)
+	{
+		SSD1322_writeMemByte(row[x]);
+	}
+}
+
 
 void ICACHE_FLASH_ATTR SSD1322_init(void)
 {
@@ -198,10 +237,8 @@ void ICACHE_FLASH_ATTR SSD1322_init(void)
 	PIN_FUNC_SELECT(RST_GPIO_MUX, RST_GPIO_FUNC);
 	GPIO_OUTPUT_SET(RST_GPIO, 1);
 	
-	// enable hw-controlled CS
-	PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDO_U, 2);
-
-	spi_clock(HSPI, 5, 2);	// 8 MHz
+	// enable hw-controlled CS, 8 MHz, init commands are not counted in the bits
+	spiBusSelect(SpiDevDisplay);
 
 	GPIO_OUTPUT_SET(RST_GPIO, 0);
 	os_delay_us(5000);
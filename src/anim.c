@@ -0,0 +1,144 @@
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+#include "graphics.h"
+#include "SSD1322.h"
+#include "display.h"
+#include "anim.h"
+
+
+#define ANIM_TICK_INTERVAL		5		// ms
+#define ANIM_TICK_US			(ANIM_TICK_INTERVAL*1000)
+
+typedef struct{
+	AnimStepFunc step;
+	uint due;	// system time (us) of the next step
+	uint gen;	// changes on every start/stop
+}AnimChanState;
+
+LOCAL AnimChanState channels[AnimChanCount];
+LOCAL os_timer_t animTmr;
+LOCAL int tickRunning = FALSE;
+LOCAL uint dirtyFlags = 0;
+LOCAL uint lastTickTime = 0;
+
+LOCAL uint frames = 0;
+LOCAL uint skippedFrames = 0;
+LOCAL uint frameTimeSum = 0;
+LOCAL uint frameTimeMax = 0;
+
+
+LOCAL void ICACHE_FLASH_ATTR flush(void)
+{
+	if (dirtyFlags & ANIM_DIRTY_START_LINE)
+	{
+		SSD1322_setStartLine(dispScrollCurLine);
+	}
+	if (dirtyFlags & ANIM_DIRTY_TITLE)
+	{
+		dispUpdateTitle();
+	}
+	dirtyFlags = 0;
+}
+
+LOCAL void ICACHE_FLASH_ATTR animTick(void)
+{
+	uint now = system_get_time();
+	if (lastTickTime)
+	{
+		// something (usually a network callback) held the cpu,
+		// steps which are due are done at once and shown in this frame
+		uint late = now - lastTickTime;
+		if (late >= 2*ANIM_TICK_US)
+		{
+			skippedFrames += late/ANIM_TICK_US - 1;
+		}
+	}
+	lastTickTime = now;
+
+	int active = 0;
+	int i;
+	for (i = 0; i < AnimChanCount; i++)
+	{
+		AnimChanState *ch = &channels[i];
+		while (ch->step && (int)(now - ch->due) >= 0)
+		{
+			uint gen = ch->gen;
+			int next = ch->step();
+			if (gen != ch->gen)
+			{
+				break;		// replaced or stopped by its own step
+			}
+			if (next <= 0)
+			{
+				ch->step = NULL;
+				break;
+			}
+			ch->due += next*1000;
+		}
+		if (ch->step)
+		{
+			active++;
+		}
+	}
+
+	flush();
+
+	uint frameTime = system_get_time() - now;
+	frames++;
+	frameTimeSum += frameTime;
+	if (frameTime > frameTimeMax)
+	{
+		frameTimeMax = frameTime;
+	}
+
+	if (!active)
+	{
+		os_timer_disarm(&animTmr);
+		tickRunning = FALSE;
+		lastTickTime = 0;
+	}
+}
+
+void ICACHE_FLASH_ATTR animStart(AnimChannel chan, AnimStepFunc step, int delay)
+{
+	AnimChanState *ch = &channels[chan];
+	ch->step = step;
+	ch->gen++;
+	ch->due = system_get_time() + delay*1000;
+	if (!tickRunning)
+	{
+		tickRunning = TRUE;
+		os_timer_disarm(&animTmr);
+		os_timer_setfn(&animTmr, (os_timer_func_t*)animTick, NULL);
+		os_timer_arm(&animTmr, ANIM_TICK_INTERVAL, 1);
+	}
+}
+
+void ICACHE_FLASH_ATTR animStop(AnimChannel chan)
+{
+	channels[chan].step = NULL;
+	channels[chan].gen++;
+}
+
+int ICACHE_FLASH_ATTR animIsRunning(AnimChannel chan)
+{
+	return channels[chan].step != NULL;
+}
+
+void ICACHE_FLASH_ATTR animInvalidate(uint flags)
+{
+	dirtyFlags |= flags;
+}
+
+void ICACHE_FLASH_ATTR animPrintStats(void)
+{
+	os_printf("anim: %u frames, %u skipped, frame time avg %u us, max %u us\n",
+			frames, skippedFrames,
+			frames ? frameTimeSum/frames : 0,
+			frameTimeMax);
+	frames = 0;
+	skippedFrames = 0;
+	frameTimeSum = 0;
+	frameTimeMax = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef SRC_ANIM_H_
+#define SRC_ANIM_H_
+
+#include "typedefs.h"
+
+// one animation at a time per channel, starting a new one replaces the old
+typedef enum{
+	AnimChanScroll,		// display scroll and pager
+	AnimChanTitle,		// title and menu transitions
+	AnimChanDimming,	// contrast and squeeze
+	AnimChanCount
+}AnimChannel;
+
+// display updates collected from all animations, pushed once per frame
+#define ANIM_DIRTY_TITLE		0x01
+#define ANIM_DIRTY_START_LINE	0x02
+
+// performs one step, returns ms until the next step or 0 when done
+typedef int (*AnimStepFunc)(void);
+
+void animStart(AnimChannel chan, AnimStepFunc step, int delay);
+void animStop(AnimChannel chan);
+int animIsRunning(AnimChannel chan);
+void animInvalidate(uint flags);
+void animPrintStats(void);
+
+
+#endif /* SRC_ANIM_H_ */
@@ -0,0 +1,397 @@
+#include <os_type.h>
+#include <osapi.h>
+#include <user_interface.h>
+#include <sntp.h>
+#include "common.h"
+#include "debug.h"
+#include "conn.h"
+#include "apisched.h"
+#include "journal.h"
+
+
+#define DISPATCH_DELAY			10		// ms, next request is not sent from the receive callback
+#define RATE_LIMIT_WINDOW		900		// s, when 429 comes without x-rate-limit-reset
+#define PIPELINE_DEPTH			3		// requests sent before the first reply
+#define DEFER_TIMEOUT			15000	// ms without a reply until the user is not kept waiting
+#define SEND_ATTEMPTS			3		// before an action which can't be sent is dropped
+#define SEND_RETRY_DELAY		2		// s, doubled on each failure
+
+typedef struct{
+	int limit;			// -1 until the first reply with rate limit headers
+	int remaining;		// -1 until the first reply with rate limit headers
+	uint reset;			// epoch seconds
+}RateLimit;
+
+typedef struct{
+	uint added;
+	uint merged;
+	uint rejected;		// queue full
+	uint sent;
+	uint deferred;
+	uint limited;		// 429 replies
+	uint resent;		// requests sent again on a new connection
+	uint replayed;		// from the journal after a reset
+	uint sendErrors;	// request could not be built or written
+	uint dropped;		// after SEND_ATTEMPTS send errors
+}ApiSchedStats;
+
+// actions in flight are at the front of the queue, in the order they were
+// sent, and the server replies in the same order
+LOCAL ApiAction queue[API_QUEUE_LEN];
+LOCAL int queueLen = 0;
+LOCAL int inFlight = 0;
+LOCAL int sent = 0;			// in flight actions written to the current connection
+LOCAL uint sentSerial = 0;	// connection they were written to
+LOCAL RateLimit limits[ApiEndpointCount];
+LOCAL const ApiSendFunc *sendFuncs = NULL;
+LOCAL ApiReplyFunc replyFunc = NULL;
+LOCAL os_timer_t dispatchTmr;
+LOCAL os_timer_t deferTmr;
+LOCAL int deferArmed = FALSE;
+LOCAL ApiSchedStats stats;
+
+LOCAL const char *endpointNames[ApiEndpointCount] = {
+	"user info", "direct message", "retweet", "like"
+};
+
+LOCAL void onReply(const HttpResp *resp, char *data, int length);
+LOCAL void dispatch(void);
+LOCAL void deferTmrCb(void);
+
+
+void ICACHE_FLASH_ATTR apiSchedInit(const char *host, const ApiSendFunc *funcs, ApiReplyFunc func)
+{
+	sendFuncs = funcs;
+	replyFunc = func;
+	int i;
+	for (i = 0; i < ApiEndpointCount; i++)
+	{
+		limits[i].limit = -1;
+		limits[i].remaining = -1;
+	}
+	os_timer_disarm(&dispatchTmr);
+	os_timer_setfn(&dispatchTmr, (os_timer_func_t*)dispatch, NULL);
+	os_timer_disarm(&deferTmr);
+	os_timer_setfn(&deferTmr, (os_timer_func_t*)deferTmrCb, NULL);
+	deferArmed = FALSE;
+	connInit(ConnApi, host, onReply);
+}
+
+LOCAL void ICACHE_FLASH_ATTR scheduleDispatch(uint delay)
+{
+	os_timer_disarm(&dispatchTmr);
+	os_timer_arm(&dispatchTmr, delay, 0);
+}
+
+// restarted by each reply, or by a new action while it isn't running
+LOCAL void ICACHE_FLASH_ATTR armDeferTmr(void)
+{
+	os_timer_disarm(&deferTmr);
+	os_timer_arm(&deferTmr, DEFER_TIMEOUT, 0);
+	deferArmed = TRUE;
+}
+
+// seconds until the endpoint has budget again, 0 when it has it now
+LOCAL int ICACHE_FLASH_ATTR budgetWait(ApiEndpoint endpoint)
+{
+	RateLimit *limit = &limits[endpoint];
+	if (limit->remaining != 0)
+	{
+		return 0;
+	}
+	int wait = (int)(limit->reset - sntp_get_current_timestamp());
+	return wait > 0 ? wait : 0;
+}
+
+// seconds until the action can be sent, budget and send retry
+LOCAL int ICACHE_FLASH_ATTR actionWait(const ApiAction *action)
+{
+	int wait = budgetWait(action->endpoint);
+	int retryWait = (int)(action->retryTime - sntp_get_current_timestamp());
+	return MAX(wait, retryWait);
+}
+
+// moves action from index to the given position, others keep their order
+LOCAL void ICACHE_FLASH_ATTR moveAction(int from, int to)
+{
+	ApiAction action = queue[from];
+	if (from > to)
+	{
+		os_memmove(&queue[to+1], &queue[to], (from-to)*sizeof(ApiAction));
+	}
+	else
+	{
+		os_memmove(&queue[from], &queue[from+1], (to-from)*sizeof(ApiAction));
+	}
+	queue[to] = action;
+}
+
+LOCAL void ICACHE_FLASH_ATTR removeAction(int index)
+{
+	queueLen--;
+	os_memmove(&queue[index], &queue[index+1], (queueLen-index)*sizeof(ApiAction));
+}
+
+// no reply comes for a request which was not written, the action leaves
+// the pipeline and is retried later, or dropped with status 0 as its reply
+LOCAL void ICACHE_FLASH_ATTR sendFailed(int index)
+{
+	stats.sendErrors++;
+	connCancelRequest(ConnApi);
+	moveAction(index, --inFlight);
+	ApiAction *action = &queue[inFlight];
+	action->sendFailures++;
+	if (action->sendFailures < SEND_ATTEMPTS)
+	{
+		uint delay = SEND_RETRY_DELAY << (action->sendFailures-1);
+		debug("%s not sent, retry in %u s\n", endpointNames[action->endpoint], delay);
+		action->retryTime = sntp_get_current_timestamp() + delay;
+		scheduleDispatch(DISPATCH_DELAY);
+		return;
+	}
+
+	debug("%s not sent, dropped\n", endpointNames[action->endpoint]);
+	stats.dropped++;
+	ApiAction done = *action;
+	removeAction(inFlight);
+	if (done.journalSeq)
+	{
+		journalDone(done.journalSeq);	// would fail again after a reset
+	}
+	HttpResp resp;
+	os_memset(&resp, 0, sizeof(resp));
+	replyFunc(&done, &resp, NULL, 0);
+}
+
+// one request at a time, the next one when the previous has been sent
+LOCAL void ICACHE_FLASH_ATTR sendPipeline(void)
+{
+	if (connSerial(ConnApi) != sentSerial)
+	{
+		// connection was reopened, replies to these will never come
+		stats.resent += sent;
+		sent = 0;
+		sentSerial = connSerial(ConnApi);
+	}
+	while (sent < inFlight && connCanSend(ConnApi))
+	{
+		if (sendFuncs[queue[sent].endpoint](queue[sent].arg) == OK)
+		{
+			sent++;
+			break;
+		}
+		sendFailed(sent);
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR deferAction(ApiAction *action)
+{
+	debug("%s deferred, budget in %d s\n", endpointNames[action->endpoint], budgetWait(action->endpoint));
+	action->deferred = TRUE;
+	stats.deferred++;
+	replyFunc(action, NULL, NULL, 0);
+}
+
+// no reply for a while: offline or the connect keeps failing,
+// actions stay queued (and journaled) but the user can go on
+LOCAL void ICACHE_FLASH_ATTR deferTmrCb(void)
+{
+	deferArmed = FALSE;
+	int i;
+	for (i = 0; i < queueLen; i++)
+	{
+		if (!queue[i].deferred)
+		{
+			deferAction(&queue[i]);
+		}
+	}
+}
+
+// sends the oldest actions which have budget, others wait for their window
+LOCAL void ICACHE_FLASH_ATTR dispatch(void)
+{
+	int minWait = 0;
+	int i;
+	for (i = inFlight; i < queueLen && inFlight < PIPELINE_DEPTH; i++)
+	{
+		ApiAction *action = &queue[i];
+		int wait = actionWait(action);
+		if (wait > 0)
+		{
+			if (!action->deferred)
+			{
+				deferAction(action);
+			}
+			if (!minWait || wait < minWait)
+			{
+				minWait = wait;
+			}
+			continue;
+		}
+		if (limits[action->endpoint].remaining > 0)
+		{
+			limits[action->endpoint].remaining--;	// until the reply tells the real value
+		}
+		moveAction(i, inFlight++);
+		stats.sent++;
+		connRequest(ConnApi, sendPipeline);
+	}
+	if (minWait)
+	{
+		scheduleDispatch(minWait*1000 + 1000);	// reset time has 1 s resolution
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR onReply(const HttpResp *resp, char *data, int length)
+{
+	if (!inFlight)
+	{
+		debug("unexpected api reply %d\n", resp->status);
+		return;
+	}
+
+	ApiAction *action = &queue[0];
+	RateLimit *limit = &limits[action->endpoint];
+	if (resp->rateLimitRemaining >= 0)
+	{
+		limit->limit = resp->rateLimitLimit;
+		limit->remaining = resp->rateLimitRemaining;
+		limit->reset = resp->rateLimitReset;
+	}
+
+	if (resp->status == 429 || resp->status == 420)
+	{
+		// action stays queued and is sent when the window resets
+		stats.limited++;
+		limit->remaining = 0;
+		if (resp->rateLimitRemaining < 0)
+		{
+			limit->reset = sntp_get_current_timestamp() + RATE_LIMIT_WINDOW;
+		}
+		// back behind the ones still in flight
+		moveAction(0, --inFlight);
+		sent--;
+		scheduleDispatch(DISPATCH_DELAY);
+		return;
+	}
+
+	// slot is freed before the reply is handled, handler may add actions
+	ApiAction done = *action;
+	removeAction(0);
+	inFlight--;
+	sent--;
+	if (done.journalSeq)
+	{
+		journalDone(done.journalSeq);	// final answer, also for errors
+	}
+	replyFunc(&done, resp, data, length);
+	scheduleDispatch(DISPATCH_DELAY);
+	os_timer_disarm(&deferTmr);
+	deferArmed = FALSE;
+	if (queueLen)
+	{
+		armDeferTmr();
+	}
+}
+
+LOCAL int ICACHE_FLASH_ATTR findAction(ApiEndpoint endpoint, const char *arg)
+{
+	int i;
+	for (i = 0; i < queueLen; i++)
+	{
+		if (queue[i].endpoint == endpoint && !os_strcmp(queue[i].arg, arg))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+LOCAL ApiAction* ICACHE_FLASH_ATTR appendAction(ApiEndpoint endpoint, const char *arg)
+{
+	if (queueLen == API_QUEUE_LEN || os_strlen(arg) >= API_ARG_SIZE)
+	{
+		stats.rejected++;
+		return NULL;
+	}
+	ApiAction *action = &queue[queueLen++];
+	action->endpoint = endpoint;
+	os_strcpy(action->arg, arg);
+	action->deferred = FALSE;
+	action->journalSeq = 0;
+	action->sendFailures = 0;
+	action->retryTime = 0;
+	return action;
+}
+
+// identical actions already in the queue are merged, e.g. double Like,
+// user actions are journaled to survive a reset
+int ICACHE_FLASH_ATTR apiSchedAdd(ApiEndpoint endpoint, const char *arg)
+{
+	int i = findAction(endpoint, arg);
+	if (i >= 0)
+	{
+		debug("%s merged\n", endpointNames[endpoint]);
+		stats.merged++;
+		if (queue[i].deferred)
+		{
+			replyFunc(&queue[i], NULL, NULL, 0);
+		}
+		return OK;
+	}
+
+	ApiAction *action = appendAction(endpoint, arg);
+	if (!action)
+	{
+		return ERROR;
+	}
+	if (endpoint != ApiUserInfo && journalAdd(endpoint, arg, &action->journalSeq) != OK)
+	{
+		action->journalSeq = 0;		// still sent, only lost on a reset
+	}
+	stats.added++;
+	// nor is the new one kept waiting behind a stuck pipeline
+	if (!inFlight || !deferArmed)
+	{
+		armDeferTmr();
+	}
+	dispatch();
+	return OK;
+}
+
+LOCAL void ICACHE_FLASH_ATTR replayAction(uint seq, int endpoint, const char *arg)
+{
+	if (endpoint >= ApiEndpointCount || findAction(endpoint, arg) >= 0)
+	{
+		return;
+	}
+	ApiAction *action = appendAction(endpoint, arg);
+	if (action)		// otherwise left for the next replay
+	{
+		action->deferred = TRUE;	// nobody is waiting for the result
+		action->journalSeq = seq;
+		stats.replayed++;
+	}
+}
+
+// actions which did not get their reply before the last reset
+void ICACHE_FLASH_ATTR apiSchedReplay(void)
+{
+	journalReplay(replayAction);
+	dispatch();
+}
+
+void ICACHE_FLASH_ATTR apiSchedPrintStats(void)
+{
+	os_printf("api: %u added, %u merged, %u rejected, %u sent, %u deferred, %u rate limited, %u resent, %u replayed\n",
+			stats.added, stats.merged, stats.rejected, stats.sent,
+			stats.deferred, stats.limited, stats.resent, stats.replayed);
+	os_printf("api: %u send errors, %u dropped\n", stats.sendErrors, stats.dropped);
+	os_printf("api: %d queued, %d in flight\n", queueLen, inFlight);
+	int i;
+	for (i = 0; i < ApiEndpointCount; i++)
+	{
+		os_printf("api %s: %d/%d remaining, reset in %d s\n", endpointNames[i],
+				limits[i].remaining, limits[i].limit, budgetWait(i));
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef SRC_APISCHED_H_
+#define SRC_APISCHED_H_
+
+#include "typedefs.h"
+#include "httpresp.h"
+
+#define API_QUEUE_LEN		4
+#define API_ARG_SIZE		130		// direct message text is the longest
+
+// REST endpoints with their own rate limit
+typedef enum{
+	ApiUserInfo,
+	ApiDirectMsg,
+	ApiRetweet,
+	ApiLike,
+	ApiEndpointCount
+}ApiEndpoint;
+
+// returns ERROR when the request could not be built or written
+typedef int (*ApiSendFunc)(const char *arg);
+
+typedef struct{
+	ApiEndpoint endpoint;
+	char arg[API_ARG_SIZE];
+	int deferred;		// rate limited, offline, or replayed after a reset
+	uint journalSeq;	// 0 when not in the flash journal
+	int sendFailures;
+	uint retryTime;		// epoch seconds, not sent again before it
+}ApiAction;
+
+// resp is NULL when the action is deferred (rate limit, no connection),
+// it is called again with the reply when the action has been sent later,
+// status is 0 when it could not be sent at all
+typedef void (*ApiReplyFunc)(const ApiAction *action, const HttpResp *resp, char *data, int length);
+
+void apiSchedInit(const char *host, const ApiSendFunc *sendFuncs, ApiReplyFunc replyFunc);
+int apiSchedAdd(ApiEndpoint endpoint, const char *arg);
+void apiSchedReplay(void);
+void apiSchedPrintStats(void);
+
+
+#endif /* SRC_APISCHED_H_ */
@@ -0,0 +1,76 @@
+#include <os_type.h>
+#include <osapi.h>
+#include "common.h"
+#include "backoff.h"
+
+
+// delays follow the streaming API reconnect guidelines:
+// network errors back off linearly, HTTP errors exponentially
+// and rate limiting starts at a full minute
+typedef struct{
+	uint initial;	// ms
+	uint cap;		// ms
+	int linear;
+}BackoffPolicy;
+
+LOCAL const BackoffPolicy policies[FailClassCount] = {
+	{1000,		60000,	FALSE},		// FailDns
+	{250,		16000,	TRUE},		// FailTcp
+	{2000,		120000,	FALSE},		// FailTls
+	{5000,		320000,	FALSE},		// FailHttp
+	{60000,		960000,	FALSE}		// FailRateLimit
+};
+
+LOCAL const char *classNames[FailClassCount] = {"dns", "tcp", "tls", "http", "rate limit"};
+
+
+// called when a connection delivered data again
+void ICACHE_FLASH_ATTR backoffReset(Backoff *backoff)
+{
+	backoff->consecutive = 0;
+	backoff->classAttempts = 0;
+	backoff->lastDelay = 0;
+}
+
+// returns the delay before the next attempt,
+// random is any 32 bit random value used for the jitter
+uint ICACHE_FLASH_ATTR backoffNext(Backoff *backoff, FailClass failClass, uint random)
+{
+	const BackoffPolicy *policy = &policies[failClass];
+	if (backoff->consecutive == 0 || failClass != backoff->lastClass)
+	{
+		backoff->classAttempts = 0;
+	}
+	backoff->failures[failClass]++;
+	backoff->consecutive++;
+	backoff->lastClass = failClass;
+
+	uint delay;
+	if (policy->linear)
+	{
+		delay = policy->initial * (backoff->classAttempts+1);
+	}
+	else
+	{
+		// initial << attempts, without overflowing the shift
+		uint shift = MIN(backoff->classAttempts, 16);
+		delay = policy->initial << shift;
+		if ((delay >> shift) != policy->initial)
+		{
+			delay = policy->cap;
+		}
+	}
+	delay = MIN(delay, policy->cap);
+	backoff->classAttempts++;
+
+	// equal jitter: keep half, randomize the other half,
+	// so that devices failing together do not retry together
+	delay = delay/2 + random % (delay/2 + 1);
+	backoff->lastDelay = delay;
+	return delay;
+}
+
+const char* ICACHE_FLASH_ATTR backoffClassName(FailClass failClass)
+{
+	return classNames[failClass];
+}
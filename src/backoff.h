@@ -0,0 +1,28 @@
+#ifndef SRC_BACKOFF_H_
+#define SRC_BACKOFF_H_
+
+#include "typedefs.h"
+
+typedef enum{
+	FailDns,		// host could not be resolved
+	FailTcp,		// connect timeout, reset, connection dropped
+	FailTls,		// handshake failed
+	FailHttp,		// server replied with an error status
+	FailRateLimit,	// HTTP 420/429
+	FailClassCount
+}FailClass;
+
+typedef struct{
+	uint failures[FailClassCount];	// since boot
+	uint consecutive;		// failures since the last success, all classes
+	uint classAttempts;		// consecutive failures of lastClass
+	FailClass lastClass;
+	uint lastDelay;			// ms
+}Backoff;
+
+void backoffReset(Backoff *backoff);
+uint backoffNext(Backoff *backoff, FailClass failClass, uint random);
+const char* backoffClassName(FailClass failClass);
+
+
+#endif /* SRC_BACKOFF_H_ */
@@ -6,6 +6,26 @@ int ICACHE_FLASH_ATTR clampInt(int value, int min, int max)
     return value < min ? min : (value > max ? max : value);
 }
 
+// decimal, str needs 11 bytes, returns the length
+int ICACHE_FLASH_ATTR uintToStr(uint value, char *str)
+{
+	char digits[10];
+	int len = 0;
+	do
+	{
+		digits[len++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	int i;
+	for (i = 0; i < len; i++)
+	{
+		str[i] = digits[len-1-i];
+	}
+	str[len] = '\0';
+	return len;
+}
+
 
 uint spiFlashReadDword(const uint *addr)
 {
@@ -9,6 +9,7 @@
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
 int clampInt(int value, int min, int max);
+int uintToStr(uint value, char *str);
 
 
 #define spiFlashRead(dst, addr, length) do{ spi_flash_read((uint)addr, dst, length); }while(0)
@@ -3,6 +3,16 @@
 #include <user_interface.h>
 #include <spi_flash.h>
 #include "config.h"
+#include "common.h"
+#include "spibus.h"
+#include "anim.h"
+#include "conn.h"
+#include "dnscache.h"
+#include "apisched.h"
+#include "journal.h"
+#include "oauth.h"
+#include "httpreq.h"
+#include "mute.h"
 
 extern void createTrackList(const char *trackStr);
 extern void connectToStreamHost(void);
@@ -31,6 +41,12 @@ void ICACHE_FLASH_ATTR configInit(Config *config)
 	config->titleScrollEn = TRUE;
     
     config->debugEn = FALSE;
+
+	config->stallTimeout = DEFAULT_STALL_TIMEOUT;
+	config->apiIdleTimeout = DEFAULT_API_IDLE_TIMEOUT;
+	config->gzipEn = FALSE;
+
+	os_strcpy(config->muteStr, DEFAULT_MUTE);
 }
 
 void ICACHE_FLASH_ATTR configRead(Config *config)
@@ -45,6 +61,23 @@ void ICACHE_FLASH_ATTR configRead(Config *config)
 	else
 	{
 		os_printf("valid config found\n");
+		// config saved by an older firmware ends before this field
+		if (config->stallTimeout < 0 || config->stallTimeout > MAX_STALL_TIMEOUT)
+		{
+			config->stallTimeout = DEFAULT_STALL_TIMEOUT;
+		}
+		if (config->apiIdleTimeout < 0 || config->apiIdleTimeout > MAX_API_IDLE_TIMEOUT)
+		{
+			config->apiIdleTimeout = DEFAULT_API_IDLE_TIMEOUT;
+		}
+		if (config->gzipEn != TRUE)
+		{
+			config->gzipEn = FALSE;
+		}
+		if (config->muteStr[sizeof(config->muteStr)-1] != '\0')		// erased flash
+		{
+			os_strcpy(config->muteStr, DEFAULT_MUTE);
+		}
 	}
 }
 
@@ -125,6 +158,7 @@ LOCAL int ICACHE_FLASH_ATTR setConsumerKey(const char *value, uint valueLen)
 	{
 		return ERROR;
 	}
+	twitterStreamChanged();
 	connectToApiHost();
 	return OK;
 }
@@ -135,6 +169,7 @@ LOCAL int ICACHE_FLASH_ATTR setAccessToken(const char *value, uint valueLen)
 	{
 		return ERROR;
 	}
+	twitterStreamChanged();
 	connectToApiHost();
 	return OK;
 }
@@ -145,6 +180,7 @@ LOCAL int ICACHE_FLASH_ATTR setConsumerSecret(const char *value, uint valueLen)
 	{
 		return ERROR;
 	}
+	oauthSetSignKey();
 	connectToApiHost();
 	return OK;
 }
@@ -155,6 +191,7 @@ LOCAL int ICACHE_FLASH_ATTR setTokenSecret(const char *value, uint valueLen)
 	{
 		return ERROR;
 	}
+	oauthSetSignKey();
 	connectToApiHost();
 	return OK;
 }
@@ -166,6 +203,7 @@ LOCAL int ICACHE_FLASH_ATTR setTrack(const char *value, uint valueLen)
 	{
 		return ERROR;
 	}
+	twitterStreamChanged();
 	createTrackList(config.trackStr);
 	connectToStreamHost();
 	return OK;
@@ -177,6 +215,7 @@ LOCAL int ICACHE_FLASH_ATTR setFilter(const char *value, uint valueLen)
 	{
 		return ERROR;
 	}
+	twitterStreamChanged();
 	connectToStreamHost();
 	return OK;
 }
@@ -187,6 +226,7 @@ LOCAL int ICACHE_FLASH_ATTR setLanguage(const char *value, uint valueLen)
 	{
 		return ERROR;
 	}
+	twitterStreamChanged();
 	connectToStreamHost();
 	return OK;
 }
@@ -206,6 +246,68 @@ LOCAL int ICACHE_FLASH_ATTR setDebug(const char *value, uint valueLen)
 	return setBoolParam(&config.debugEn, value, valueLen);
 }
 
+// returns ERROR for anything but digits, or a value above max
+LOCAL int ICACHE_FLASH_ATTR parseSeconds(const char *value, uint valueLen, int max)
+{
+	if (!value || !*value || !valueLen)
+		return ERROR;
+
+	int seconds = 0;
+	uint i;
+	for (i = 0; i < valueLen; i++)
+	{
+		if (value[i] < '0' || value[i] > '9')
+			return ERROR;
+		seconds = seconds*10 + (value[i] - '0');
+		if (seconds > max)
+			return ERROR;
+	}
+	return seconds;
+}
+
+LOCAL int ICACHE_FLASH_ATTR setStallTimeout(const char *value, uint valueLen)
+{
+	int timeout = parseSeconds(value, valueLen, MAX_STALL_TIMEOUT);
+	if (timeout == ERROR)
+		return ERROR;
+	config.stallTimeout = timeout;
+	connSetStallTimeout(ConnStream, timeout);
+	return OK;
+}
+
+LOCAL int ICACHE_FLASH_ATTR setApiIdleTimeout(const char *value, uint valueLen)
+{
+	int timeout = parseSeconds(value, valueLen, MAX_API_IDLE_TIMEOUT);
+	if (timeout == ERROR)
+		return ERROR;
+	config.apiIdleTimeout = timeout;
+	connSetIdleTimeout(ConnApi, timeout);
+	return OK;
+}
+
+// compressed replies, used from the next request on
+LOCAL int ICACHE_FLASH_ATTR setGzip(const char *value, uint valueLen)
+{
+	if (setBoolParam(&config.gzipEn, value, valueLen) != OK)
+		return ERROR;
+	connSetGzip(ConnStream, config.gzipEn);
+	connSetGzip(ConnApi, config.gzipEn);
+	return OK;
+}
+
+// checked before it is stored, the old rules stay when these are not valid
+LOCAL int ICACHE_FLASH_ATTR setMute(const char *value, uint valueLen)
+{
+	char rules[sizeof(config.muteStr)];
+	if (setParam(rules, sizeof(rules), value, valueLen) != OK ||
+		muteSetRules(rules) != OK)
+	{
+		return ERROR;
+	}
+	os_strcpy(config.muteStr, rules);
+	return OK;
+}
+
 
 typedef struct
 {
@@ -226,9 +328,68 @@ CmdEntry commands[] = {
 	{"disp_scroll", setDispScroll},
 	{"title_scroll", setTitleScroll},
 	{"debug", setDebug},
+	{"stall_timeout", setStallTimeout},
+	{"api_idle_timeout", setApiIdleTimeout},
+	{"gzip", setGzip},
+	{"mute", setMute},
 	{"reset", resetConfig},
 };
 
+LOCAL int ICACHE_FLASH_ATTR printStats(const char *value, uint valueLen)
+{
+	if (!os_strcmp(value, "spi"))
+	{
+		spiBusPrintStats();
+		return OK;
+	}
+	if (!os_strcmp(value, "anim"))
+	{
+		animPrintStats();
+		return OK;
+	}
+	if (!os_strcmp(value, "conn"))
+	{
+		connPrintStats();
+		return OK;
+	}
+	if (!os_strcmp(value, "dns"))
+	{
+		dnsCachePrintStats();
+		return OK;
+	}
+	if (!os_strcmp(value, "api"))
+	{
+		apiSchedPrintStats();
+		return OK;
+	}
+	if (!os_strcmp(value, "journal"))
+	{
+		journalPrintStats();
+		return OK;
+	}
+	if (!os_strcmp(value, "oauth"))
+	{
+		oauthPrintStats();
+		return OK;
+	}
+	if (!os_strcmp(value, "http"))
+	{
+		httpReqPrintStats();
+		return OK;
+	}
+	if (!os_strcmp(value, "mute"))
+	{
+		mutePrintStats();
+		return OK;
+	}
+	return ERROR;
+}
+
+// commands which only print something, config is not saved
+CmdEntry infoCommands[] = {
+	{"stats", printStats},
+};
+
 void ICACHE_FLASH_ATTR onUartCmdReceived(char* command, int length)
 {
 	if (length < 5)
@@ -243,6 +404,18 @@ void ICACHE_FLASH_ATTR onUartCmdReceived(char* command, int length)
 	int valueLen = os_strlen(value);
 
 	uint i;
+	for (i = 0; i < NELEMENTS(infoCommands); i++)
+	{
+		if (!os_strcmp(command, infoCommands[i].cmd))
+		{
+			if (infoCommands[i].func(value, valueLen) != OK)
+			{
+				os_printf("invalid parameter\n");
+			}
+			return;
+		}
+	}
+
 	uint nrCmds = sizeof(commands)/sizeof(commands[0]);
 	for (i = 0; i < nrCmds; i++)
 	{
@@ -15,12 +15,27 @@
 #define DEFAULT_TRACK			""
 #define DEFAULT_FILTER			""
 #define DEFAULT_LANGUAGE		""
+#define DEFAULT_MUTE			""
+
+#define DEFAULT_STALL_TIMEOUT	90		// s, stream sends keep-alives every 30 s
+#define MAX_STALL_TIMEOUT		3600
+#define DEFAULT_API_IDLE_TIMEOUT	5	// s, REST connection kept open for further requests,
+#define MAX_API_IDLE_TIMEOUT	30		// the stream is down until it is closed
 
 
 #define CONFIG_SAVE_FLASH_SECTOR	0x0F
 #define CONFIG_SAVE_FLASH_ADDR		(CONFIG_SAVE_FLASH_SECTOR * SPI_FLASH_SEC_SIZE)
 #define VALID_MAGIC_NUMBER			0xAABBCCDD
 
+// resolved host addresses, kept apart so that frequent writes can't corrupt the config
+#define DNS_CACHE_FLASH_SECTOR		0x0E
+#define DNS_CACHE_FLASH_ADDR		(DNS_CACHE_FLASH_SECTOR * SPI_FLASH_SEC_SIZE)
+
+// offline action journal, two sectors written in turns,
+// 0x00000.bin must end below these (about 0x9a00 now)
+#define JOURNAL_FLASH_SECTOR		0x0C
+#define JOURNAL_FLASH_SECTORS		2
+
 typedef struct{
 	uint magic;
 	char ssid[36];
@@ -39,6 +54,12 @@ typedef struct{
 	int titleScrollEn;
     
     int debugEn;
+
+	int stallTimeout;
+	int apiIdleTimeout;
+	int gzipEn;
+
+	char muteStr[128];		// rules, see mute.h
 }Config;
 extern Config config;
 
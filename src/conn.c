@@ -0,0 +1,1027 @@
+#include <os_type.h>
+#include <osapi.h>
+#include <ip_addr.h>
+#include <lwip/err.h>
+#include <lwip/dns.h>
+#include <user_interface.h>
+#include <espconn.h>
+#include <mem.h>
+#include "common.h"
+#include "debug.h"
+#include "conn.h"
+#include "dnscache.h"
+#include "backoff.h"
+#include "inflate.h"
+
+
+#define STREAM_RX_BUF_SIZE		8192
+#define API_RX_BUF_SIZE			6144
+
+#define DNS_CHECK_INTERVAL		100
+#define DNS_TIMEOUT				10000
+#define CONNECT_TIMEOUT			10000
+#define RX_IDLE_TIMEOUT			1000
+#define SESSION_WAIT_INTERVAL	200
+#define LIVENESS_CHECK_INTERVAL	5000
+// REST replies longer than the rx buffer are cut anyway,
+// the stream never ends and needs the server's whole window
+#define API_INFLATE_WINDOW_BITS	13
+#define GZIP_HEAP_RESERVE		6144	// left after the inflate window
+
+typedef enum{
+	connIdle,
+	connResolving,
+	connConnecting,
+	connConnected,
+	connDisconnecting,
+	connBackoff			// waiting before the next attempt
+}ConnState;
+
+typedef struct{
+	uint connects;
+	uint drops;
+	uint requests;
+	uint replies;
+	uint rttSum;	// ms
+	uint rttMax;	// ms
+	uint handshakeSum;	// ms
+	uint handshakeMax;	// ms
+	uint sessionHeap;	// heap held by the TLS session after the last handshake
+	uint sessionWaits;		// connects which waited for the other slot's TLS session
+	uint sessionYields;		// connections closed to let the other slot connect
+	uint connectErrors;		// espconn_secure_connect refused to start
+	uint connectTimeouts;
+	uint dnsLookups;		// connects which had to wait for the resolver
+	uint dnsRefreshes;
+	uint stalls;			// connections closed for staying silent
+	uint stallSilenceSum;	// ms from the last byte until the stall was detected
+	uint idleCloses;		// kept alive connections closed after the idle period
+	uint pipelineMax;		// most requests waiting for their replies at once
+	uint messages;			// replies and stream messages given to the parser
+	uint parseTime;			// us spent in the parser
+	uint gzipIn;			// compressed body bytes
+	uint gzipOut;
+	uint inflateTime;		// us, parser time excluded
+	uint gzipErrors;
+	uint gzipDeclined;		// not asked for, too little heap for the window
+	uint streamedBodies;	// requests sent in segments
+	uint bodySegments;
+	uint bodyErrors;		// segment not sent, connection restarted
+	uint upTime;			// ms from the first to the last byte of each connection
+	uint gaps;				// stream closed to let REST requests through
+	uint gapSum;			// ms until the stream was connected again
+	uint gapMax;			// ms
+}ConnStats;
+
+typedef struct{
+	const char *host;
+	ConnRequestFunc requestFunc;
+	ConnParserFunc parserFunc;
+	struct espconn espConn;
+	struct _esp_tcp espConnTcp;
+	os_timer_t tmr;			// dns polling, connect timeout, delayed (re)connect
+	os_timer_t rxTmr;		// end of a reply without length
+	os_timer_t dnsTmr;
+	char *rxBuf;
+	int rxBufSize;
+	int rxLen;
+	HttpResp resp;
+	Inflater *inflater;		// while a compressed reply is received
+	int gzip;				// ask for compressed replies
+	ConnState state;
+	int wanted;				// reconnect when the connection drops
+	int requestsPending;	// requests without a parsed reply, replies come in the same order
+	int txBusy;				// previous data not yet sent
+	ConnBodyFunc bodyFunc;	// rest of the request body, sent after each segment
+	int disconnExpected;
+	int reconnCbCalled;
+	int refreshing;			// resolving in the background while connected with the cached address
+	uint requestTime;
+	uint connectTime;
+	uint heapBeforeConnect;
+	uint dnsPolls;
+	int httpStatus;			// of the first reply on this connection
+	Backoff backoff;
+	uint lastRxTime;		// any byte, keep-alive newlines included
+	uint upMark;			// us, counted into upTime up to here
+	uint gapStart;			// us, when the session was given up
+	int inGap;
+	uint stallTimeout;		// ms, 0 when not watched
+	uint idleTimeout;		// ms, 0 when kept until the server closes
+	ConnStats stats;
+}ConnSlot;
+
+LOCAL char streamRxBuf[STREAM_RX_BUF_SIZE];
+LOCAL char apiRxBuf[API_RX_BUF_SIZE];
+
+LOCAL ConnSlot slots[ConnCount];
+// The SDK supports one TLS client connection, the slots take turns:
+// the stream gives its session up while REST requests are sent and is
+// reopened when their replies are in. Only one secure buffer is
+// allocated at a time this way.
+LOCAL ConnSlot *sessionOwner = NULL;	// connecting or connected
+LOCAL ConnSlot *sessionWaiter = NULL;	// next to get the session
+// stream replies which arrived while a REST request was in flight, with
+// a single session only those before the stream has given it up
+LOCAL uint streamRepliesDuringRequests = 0;
+LOCAL os_timer_t livenessTmr;
+
+
+LOCAL void connect(ConnSlot *slot);
+LOCAL void reconnect(ConnSlot *slot);
+LOCAL void releaseSession(ConnSlot *slot);
+LOCAL void resolve(ConnSlot *slot);
+LOCAL void getHostByNameCb(const char *name, ip_addr_t *ipaddr, void *arg);
+LOCAL void onTcpConnected(void *arg);
+LOCAL void onTcpDataSent(void *arg);
+LOCAL void onTcpDataRecv(void *arg, char *pusrdata, unsigned short length);
+LOCAL void onTcpDisconnected(void *arg);
+LOCAL void onTcpReconnCb(void *arg, sint8 err);
+LOCAL int onBodyData(void *arg, const char *data, int length);
+LOCAL void resetReply(ConnSlot *slot);
+
+
+void ICACHE_FLASH_ATTR connInit(ConnId id, const char *host, ConnParserFunc parserFunc)
+{
+	ConnSlot *slot = &slots[id];
+	os_memset(slot, 0, sizeof(ConnSlot));
+	slot->host = host;
+	slot->parserFunc = parserFunc;
+	slot->rxBuf = id == ConnStream ? streamRxBuf : apiRxBuf;
+	slot->rxBufSize = id == ConnStream ? sizeof(streamRxBuf) : sizeof(apiRxBuf);
+
+	slot->espConn.proto.tcp = &slot->espConnTcp;
+	slot->espConn.type = ESPCONN_TCP;
+	slot->espConn.state = ESPCONN_NONE;
+	slot->espConn.reverse = slot;
+
+	os_timer_disarm(&slot->tmr);
+	os_timer_disarm(&slot->rxTmr);
+	os_timer_disarm(&slot->dnsTmr);
+}
+
+// half-open connections are only noticed by the silence,
+// the TCP stack gives up on them many minutes later
+LOCAL void ICACHE_FLASH_ATTR livenessTmrCb(void)
+{
+	uint now = system_get_time();
+	int id;
+	for (id = 0; id < ConnCount; id++)
+	{
+		ConnSlot *slot = &slots[id];
+		if (slot->state != connConnected)
+		{
+			continue;
+		}
+		uint silence = (now - slot->lastRxTime) / 1000;
+		if (slot->idleTimeout && !slot->wanted && !slot->requestsPending &&
+			silence >= slot->idleTimeout)
+		{
+			debug("%s idle for %u ms, closing\n", slot->host, silence);
+			slot->stats.idleCloses++;
+			slot->state = connDisconnecting;
+			slot->disconnExpected = TRUE;	// not reopened, nothing is wanted
+			espconn_secure_disconnect(&slot->espConn);
+		}
+		else if (slot->stallTimeout && silence >= slot->stallTimeout)
+		{
+			debug("%s silent for %u ms, reconnecting\n", slot->host, silence);
+			slot->stats.stalls++;
+			slot->stats.stallSilenceSum += silence;
+			slot->state = connDisconnecting;
+			slot->disconnExpected = TRUE;	// reopened right away
+			espconn_secure_disconnect(&slot->espConn);
+		}
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR armLivenessTmr(void)
+{
+	os_timer_disarm(&livenessTmr);
+	os_timer_setfn(&livenessTmr, (os_timer_func_t*)livenessTmrCb, NULL);
+	os_timer_arm(&livenessTmr, LIVENESS_CHECK_INTERVAL, 1);
+}
+
+// seconds of silence after which the connection is reopened, 0 disables the check
+void ICACHE_FLASH_ATTR connSetStallTimeout(ConnId id, uint seconds)
+{
+	slots[id].stallTimeout = seconds*1000;
+	armLivenessTmr();
+}
+
+// seconds a connection without requests is kept open for further ones, the
+// stream waits that long for the session too; 0 gives the session back as
+// soon as the replies are in and otherwise leaves the connection to the server
+void ICACHE_FLASH_ATTR connSetIdleTimeout(ConnId id, uint seconds)
+{
+	slots[id].idleTimeout = seconds*1000;
+	armLivenessTmr();
+}
+
+// a body cut off with its connection, the rest is not sent
+LOCAL void ICACHE_FLASH_ATTR abortBody(ConnSlot *slot)
+{
+	if (slot->bodyFunc)
+	{
+		slot->bodyFunc(NULL);
+		slot->bodyFunc = NULL;
+	}
+}
+
+// adds one request to the open connection or connects first,
+// connection stays open after the reply
+void ICACHE_FLASH_ATTR connRequest(ConnId id, ConnRequestFunc requestFunc)
+{
+	ConnSlot *slot = &slots[id];
+	slot->requestFunc = requestFunc;
+	slot->wanted = TRUE;
+	if (!slot->requestsPending)
+	{
+		slot->requestTime = system_get_time();
+	}
+	slot->requestsPending++;
+	slot->stats.requests++;
+	slot->stats.pipelineMax = MAX(slot->stats.pipelineMax, slot->requestsPending);
+
+	switch (slot->state)
+	{
+	case connConnected:
+		if (!slot->txBusy)
+		{
+			requestFunc();
+		}
+		break;
+	case connIdle:
+		connect(slot);
+		break;
+	default:	// request is sent when connected
+		break;
+	}
+}
+
+// request was not sent after all, no reply is waited for
+void ICACHE_FLASH_ATTR connCancelRequest(ConnId id)
+{
+	ConnSlot *slot = &slots[id];
+	if (slot->requestsPending)
+	{
+		slot->requestsPending--;
+		slot->wanted = slot->requestsPending > 0;
+	}
+}
+
+// closes the current connection (if any) and sends the request on a new one
+void ICACHE_FLASH_ATTR connRestart(ConnId id, ConnRequestFunc requestFunc)
+{
+	ConnSlot *slot = &slots[id];
+	slot->requestFunc = requestFunc;
+	slot->wanted = TRUE;
+
+	switch (slot->state)
+	{
+	case connConnected:		// reconnect when disconnection occurs
+		slot->state = connDisconnecting;
+		slot->disconnExpected = TRUE;
+		// disconnect should not be called directly from here
+		os_timer_disarm(&slot->tmr);
+		os_timer_setfn(&slot->tmr, (os_timer_func_t*)espconn_secure_disconnect, &slot->espConn);
+		os_timer_arm(&slot->tmr, 100, 0);
+		break;
+	case connIdle:
+		connect(slot);
+		break;
+	default:	// already on the way
+		break;
+	}
+}
+
+void ICACHE_FLASH_ATTR connClose(ConnId id)
+{
+	ConnSlot *slot = &slots[id];
+	slot->wanted = FALSE;
+	slot->requestsPending = 0;
+	abortBody(slot);
+	os_timer_disarm(&slot->tmr);
+	os_timer_disarm(&slot->dnsTmr);
+	slot->refreshing = FALSE;
+	if (sessionOwner == slot && slot->state != connIdle)	// espconn is in use
+	{
+		slot->state = connDisconnecting;
+		slot->disconnExpected = TRUE;
+		espconn_secure_disconnect(&slot->espConn);		// session released in the callback
+	}
+	else
+	{
+		slot->state = connIdle;
+		releaseSession(slot);
+	}
+}
+
+int ICACHE_FLASH_ATTR connIsConnected(ConnId id)
+{
+	return slots[id].state == connConnected;
+}
+
+// Accept-Encoding: gzip in the requests, turned off again by an inflate error
+void ICACHE_FLASH_ATTR connSetGzip(ConnId id, int enable)
+{
+	slots[id].gzip = enable;
+}
+
+// the inflate window is allocated next to the TLS session,
+// compression is not asked for when the heap can't take it
+int ICACHE_FLASH_ATTR connAcceptsGzip(ConnId id)
+{
+	ConnSlot *slot = &slots[id];
+	if (!slot->gzip)
+	{
+		return FALSE;
+	}
+	uint window = 1 << (id == ConnStream ? INFLATE_MAX_WINDOW_BITS : API_INFLATE_WINDOW_BITS);
+	if (system_get_free_heap_size() < window + GZIP_HEAP_RESERVE)
+	{
+		slot->stats.gzipDeclined++;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// connection is up and the previous data has been sent
+int ICACHE_FLASH_ATTR connCanSend(ConnId id)
+{
+	return slots[id].state == connConnected && !slots[id].txBusy;
+}
+
+// changes whenever a new connection is established, requests
+// without a reply have to be sent again on the new one
+uint ICACHE_FLASH_ATTR connSerial(ConnId id)
+{
+	return slots[id].stats.connects;
+}
+
+int ICACHE_FLASH_ATTR connSend(ConnId id, const char *data, int length)
+{
+	ConnSlot *slot = &slots[id];
+	if (slot->state != connConnected || slot->txBusy)
+	{
+		return ERROR;
+	}
+	if (espconn_secure_send(&slot->espConn, (uint8*)data, length) != 0)
+	{
+		return ERROR;
+	}
+	slot->txBusy = TRUE;
+	return OK;
+}
+
+// sends the head, then each segment from bodyFunc when the previous
+// one is sent, the connection is busy until bodyFunc returns 0
+int ICACHE_FLASH_ATTR connSendStreamed(ConnId id, const char *data, int length, ConnBodyFunc bodyFunc)
+{
+	if (connSend(id, data, length) != OK)
+	{
+		return ERROR;
+	}
+	slots[id].bodyFunc = bodyFunc;
+	slots[id].stats.streamedBodies++;
+	return OK;
+}
+
+const char* ICACHE_FLASH_ATTR connHost(ConnId id)
+{
+	return slots[id].host;
+}
+
+
+LOCAL void ICACHE_FLASH_ATTR scheduleReconnect(ConnSlot *slot, FailClass failClass)
+{
+	uint delay = backoffNext(&slot->backoff, failClass, os_random());
+	debug("%s %s failure, reconnect in %u ms\n", slot->host, backoffClassName(failClass), delay);
+	slot->state = connBackoff;
+	os_timer_disarm(&slot->tmr);
+	os_timer_setfn(&slot->tmr, (os_timer_func_t*)connect, slot);
+	os_timer_arm(&slot->tmr, delay, 0);
+}
+
+// the server tells why it closes the connection in the status line
+LOCAL FailClass ICACHE_FLASH_ATTR classifyDrop(ConnSlot *slot, FailClass netFailClass)
+{
+	if (slot->httpStatus == 420 || slot->httpStatus == 429)
+	{
+		return FailRateLimit;
+	}
+	if (slot->httpStatus >= 400)
+	{
+		return FailHttp;
+	}
+	return netFailClass;
+}
+
+LOCAL void ICACHE_FLASH_ATTR resolve(ConnSlot *slot)
+{
+	ip_addr_t ip = {0};
+	if (espconn_gethostbyname(&slot->espConn, slot->host, &ip, getHostByNameCb) == ESPCONN_OK)
+	{
+		// answered from the resolver's own table, no callback follows
+		getHostByNameCb(slot->host, &ip, &slot->espConn);
+		return;
+	}
+	os_timer_disarm(&slot->dnsTmr);
+	if (++slot->dnsPolls > DNS_TIMEOUT/DNS_CHECK_INTERVAL)
+	{
+		debug("dns timeout %s\n", slot->host);
+		slot->refreshing = FALSE;
+		if (slot->state == connResolving)
+		{
+			scheduleReconnect(slot, FailDns);
+		}
+		return;
+	}
+	os_timer_setfn(&slot->dnsTmr, (os_timer_func_t*)resolve, slot);
+	os_timer_arm(&slot->dnsTmr, DNS_CHECK_INTERVAL, 0);
+}
+
+LOCAL void ICACHE_FLASH_ATTR connect(ConnSlot *slot)
+{
+	int expired = FALSE;
+	uint ip = dnsCacheLookup(slot->host, &expired);
+	if (ip)		// we have ip of the host
+	{
+		// use this ip and try to connect,
+		// an old address is checked while the handshake runs
+		os_memcpy(slot->espConnTcp.remote_ip, &ip, 4);
+		if (expired && !slot->refreshing)
+		{
+			slot->refreshing = TRUE;
+			slot->stats.dnsRefreshes++;
+			slot->dnsPolls = 0;
+			resolve(slot);
+		}
+		reconnect(slot);
+		return;
+	}
+
+	// we don't yet have ip of the host
+	slot->state = connResolving;
+	slot->stats.dnsLookups++;
+	slot->dnsPolls = 0;
+	resolve(slot);
+}
+
+LOCAL void ICACHE_FLASH_ATTR getHostByNameCb(const char *name, ip_addr_t *ipaddr, void *arg)
+{
+	struct espconn *pespconn = (struct espconn *)arg;
+	ConnSlot *slot = pespconn->reverse;
+
+	if (ipaddr == NULL || ipaddr->addr == 0)
+	{
+		debug("getHostByNameCb ip NULL\n");
+		return;		// keep polling
+	}
+	os_timer_disarm(&slot->dnsTmr);
+	debug("getHostByNameCb %s ip: "IPSTR"\n", slot->host, IP2STR(ipaddr));
+	dnsCacheUpdate(slot->host, ipaddr->addr);
+	slot->refreshing = FALSE;
+
+	if (slot->state == connResolving)
+	{
+		// connect to host
+		os_memcpy(slot->espConnTcp.remote_ip, &ipaddr->addr, 4);
+		reconnect(slot);
+	}
+}
+
+// the pending connect is dropped, callbacks still coming
+// for it are ignored while the slot waits in backoff
+LOCAL void ICACHE_FLASH_ATTR connectTimeout(ConnSlot *slot)
+{
+	debug("connect timeout %s\n", slot->host);
+	slot->stats.connectTimeouts++;
+	espconn_secure_disconnect(&slot->espConn);
+	releaseSession(slot);
+	dnsCacheMarkStale(slot->host);
+	scheduleReconnect(slot, FailTcp);
+}
+
+LOCAL void ICACHE_FLASH_ATTR releaseSession(ConnSlot *slot)
+{
+	if (sessionOwner == slot)
+	{
+		sessionOwner = NULL;
+	}
+	if (sessionWaiter == slot)
+	{
+		sessionWaiter = NULL;
+	}
+}
+
+// asks the session owner to close for the slot waiting for it: the
+// stream right away, a REST connection once its replies are in and
+// it has been idle for a while, requests made until then reuse it
+LOCAL void ICACHE_FLASH_ATTR yieldSession(ConnSlot *owner)
+{
+	if (owner->state != connConnected)
+	{
+		return;
+	}
+	if (owner != &slots[ConnStream] && (owner->requestsPending ||
+		(system_get_time() - owner->lastRxTime) / 1000 < owner->idleTimeout))
+	{
+		return;
+	}
+	debug("%s gives the TLS session up\n", owner->host);
+	owner->stats.sessionYields++;
+	if (owner == &slots[ConnStream])
+	{
+		// whatever the stream sends until it is back is lost
+		owner->stats.gaps++;
+		owner->gapStart = system_get_time();
+		owner->inGap = TRUE;
+	}
+	owner->state = connDisconnecting;
+	owner->disconnExpected = TRUE;	// stream is reopened when the session is free again
+	os_timer_disarm(&owner->tmr);
+	os_timer_setfn(&owner->tmr, (os_timer_func_t*)espconn_secure_disconnect, &owner->espConn);
+	os_timer_arm(&owner->tmr, 100, 0);
+}
+
+LOCAL void ICACHE_FLASH_ATTR reconnect(ConnSlot *slot)
+{
+	os_timer_disarm(&slot->tmr);
+	slot->state = connConnecting;
+	if ((sessionOwner && sessionOwner != slot) || (sessionWaiter && sessionWaiter != slot))
+	{
+		// other slot holds the session, or is next for it
+		if (!sessionWaiter)
+		{
+			sessionWaiter = slot;
+			slot->stats.sessionWaits++;
+		}
+		if (sessionOwner && sessionWaiter == slot)
+		{
+			yieldSession(sessionOwner);
+		}
+		os_timer_setfn(&slot->tmr, (os_timer_func_t*)reconnect, slot);
+		os_timer_arm(&slot->tmr, SESSION_WAIT_INTERVAL, 0);
+		return;
+	}
+	sessionWaiter = NULL;
+	sessionOwner = slot;
+	slot->httpStatus = 0;
+	slot->connectTime = system_get_time();
+	slot->heapBeforeConnect = system_get_free_heap_size();
+
+	debug("reconnect %s\n", slot->host);
+	slot->espConnTcp.remote_port = 443;	// use HTTPS port
+	slot->espConnTcp.local_port = espconn_port();	// get next free local port number
+
+	// register callbacks
+	espconn_regist_connectcb(&slot->espConn, onTcpConnected);
+	espconn_regist_reconcb(&slot->espConn, onTcpReconnCb);
+
+	espconn_secure_set_size(ESPCONN_CLIENT, 8192);
+	int rv = espconn_secure_connect(&slot->espConn);	// tcp SSL connect
+	if (rv != ESPCONN_OK)
+	{
+		// no route is a network failure, anything else (no memory,
+		// a session still held) means the TLS client could not start
+		debug("espconn_secure_connect %s %d\n", slot->host, rv);
+		slot->stats.connectErrors++;
+		releaseSession(slot);
+		scheduleReconnect(slot, rv == ESPCONN_RTE ? FailTcp : FailTls);
+		return;
+	}
+
+	os_timer_setfn(&slot->tmr, (os_timer_func_t*)connectTimeout, slot);
+	os_timer_arm(&slot->tmr, CONNECT_TIMEOUT, 0);
+}
+
+LOCAL void ICACHE_FLASH_ATTR onTcpConnected(void *arg)
+{
+	struct espconn *pespconn = arg;
+	ConnSlot *slot = pespconn->reverse;
+	debug("onTcpConnected %s\n", slot->host);
+	os_timer_disarm(&slot->tmr);
+	slot->state = connConnected;
+	slot->reconnCbCalled = FALSE;
+	slot->lastRxTime = system_get_time();
+	slot->upMark = slot->lastRxTime;
+	slot->txBusy = FALSE;
+	abortBody(slot);
+	slot->rxLen = 0;
+	resetReply(slot);
+
+	uint handshake = (system_get_time() - slot->connectTime) / 1000;
+	uint heap = system_get_free_heap_size();
+	slot->stats.connects++;
+	slot->stats.handshakeSum += handshake;
+	slot->stats.handshakeMax = MAX(slot->stats.handshakeMax, handshake);
+	slot->stats.sessionHeap = slot->heapBeforeConnect > heap ? slot->heapBeforeConnect-heap : 0;
+	debug("%s handshake %u ms\n", slot->host, handshake);
+	if (slot->inGap)
+	{
+		uint gap = (system_get_time() - slot->gapStart) / 1000;
+		slot->stats.gapSum += gap;
+		slot->stats.gapMax = MAX(slot->stats.gapMax, gap);
+		slot->inGap = FALSE;
+	}
+
+	// register callbacks
+	espconn_regist_recvcb(pespconn, onTcpDataRecv);
+	espconn_regist_sentcb(pespconn, onTcpDataSent);
+	espconn_regist_disconcb(pespconn, onTcpDisconnected);
+
+	if (!slot->wanted)	// closed while connecting
+	{
+		slot->state = connDisconnecting;
+		slot->disconnExpected = TRUE;
+		os_timer_setfn(&slot->tmr, (os_timer_func_t*)espconn_secure_disconnect, pespconn);
+		os_timer_arm(&slot->tmr, 100, 0);
+		return;
+	}
+	if (slot->requestFunc)
+	{
+		slot->requestFunc();
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR onTcpDataSent(void *arg)
+{
+	struct espconn *pespconn = arg;
+	ConnSlot *slot = pespconn->reverse;
+	debug("onTcpDataSent\n");
+	slot->txBusy = FALSE;
+	if (slot->bodyFunc)
+	{
+		const char *data;
+		int length = slot->bodyFunc(&data);
+		if (length == 0)
+		{
+			slot->bodyFunc = NULL;
+		}
+		else if (connSend((ConnId)(slot - slots), data, length) == OK)
+		{
+			slot->stats.bodySegments++;
+			return;
+		}
+		else
+		{
+			// server got a partial request, its requests are sent again
+			// on the new connection
+			slot->stats.bodyErrors++;
+			abortBody(slot);
+			connRestart((ConnId)(slot - slots), slot->requestFunc);
+			return;
+		}
+	}
+	// next pipelined request can go out now
+	if (slot->requestsPending && slot->requestFunc)
+	{
+		slot->requestFunc();
+	}
+}
+
+
+// parser starts over for the next reply on the same connection
+LOCAL void ICACHE_FLASH_ATTR resetReply(ConnSlot *slot)
+{
+	httpRespInit(&slot->resp, onBodyData, slot);
+	if (slot->inflater)
+	{
+		inflateFree(slot->inflater);
+		slot->inflater = NULL;
+	}
+}
+
+// a complete reply, or one message of the stream, is in rxBuf
+LOCAL void ICACHE_FLASH_ATTR replyReceived(ConnSlot *slot)
+{
+	os_timer_disarm(&slot->rxTmr);
+	slot->rxBuf[slot->rxLen] = '\0';
+
+	if (slot->requestsPending)
+	{
+		// pipelined replies are timed from the previous one
+		uint rtt = (system_get_time() - slot->requestTime) / 1000;
+		slot->stats.replies++;
+		slot->stats.rttSum += rtt;
+		if (rtt > slot->stats.rttMax)
+		{
+			slot->stats.rttMax = rtt;
+		}
+		debug("%s reply after %u ms\n", slot->host, rtt);
+		slot->requestTime = system_get_time();
+		// connection is kept open, but not reopened if the server closes it
+		slot->requestsPending--;
+		slot->wanted = slot->requestsPending > 0;
+	}
+	else if (slot == &slots[ConnStream] && slots[ConnApi].requestsPending)
+	{
+		streamRepliesDuringRequests++;
+	}
+
+	int length = slot->rxLen;
+	slot->rxLen = 0;
+	uint start = system_get_time();
+	slot->parserFunc(&slot->resp, slot->rxBuf, length);
+	slot->stats.messages++;
+	slot->stats.parseTime += system_get_time() - start;
+}
+
+LOCAL void ICACHE_FLASH_ATTR replyComplete(ConnSlot *slot)
+{
+	replyReceived(slot);
+	resetReply(slot);
+}
+
+LOCAL void ICACHE_FLASH_ATTR appendRxData(ConnSlot *slot, const char *data, int length)
+{
+	int bytes = MIN(length, slot->rxBufSize-1-slot->rxLen);
+	if (bytes < length)
+	{
+		debug("%s rx buffer full\n", slot->host);
+	}
+	os_memcpy(slot->rxBuf+slot->rxLen, data, bytes);
+	slot->rxLen += bytes;
+}
+
+// body bytes, chunk framing and compression already removed
+LOCAL void ICACHE_FLASH_ATTR frameBody(ConnSlot *slot, const char *data, int length)
+{
+	if (slot != &slots[ConnStream])
+	{
+		appendRxData(slot, data, length);
+		return;
+	}
+
+	// stream messages end with CRLF, empty lines are keep-alives
+	while (length > 0)
+	{
+		const char *newline = data;
+		while (newline < data+length && *newline != '\n')
+		{
+			newline++;
+		}
+		int bytes = newline - data;
+		appendRxData(slot, data, bytes);
+		if (newline == data+length)
+		{
+			break;
+		}
+		if (slot->rxLen > 0 && slot->rxBuf[slot->rxLen-1] == '\r')
+		{
+			slot->rxLen--;
+		}
+		if (slot->rxLen > 0)
+		{
+			replyReceived(slot);
+		}
+		data += bytes+1;
+		length -= bytes+1;
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR onInflated(void *arg, const char *data, int length)
+{
+	ConnSlot *slot = arg;
+	slot->stats.gzipOut += length;
+	frameBody(slot, data, length);
+}
+
+// body bytes from the HTTP parser, chunk framing already removed
+LOCAL int ICACHE_FLASH_ATTR onBodyData(void *arg, const char *data, int length)
+{
+	ConnSlot *slot = arg;
+	if (!slot->resp.gzip)
+	{
+		frameBody(slot, data, length);
+		return OK;
+	}
+
+	if (!slot->inflater)
+	{
+		slot->inflater = inflateNew(slot == &slots[ConnStream] ? INFLATE_MAX_WINDOW_BITS : API_INFLATE_WINDOW_BITS,
+				onInflated, slot);
+		if (!slot->inflater)
+		{
+			debug("%s no heap for inflater\n", slot->host);
+			return ERROR;
+		}
+	}
+	uint start = system_get_time();
+	uint parseTime = slot->stats.parseTime;
+	int rc = inflateFeed(slot->inflater, data, length);
+	slot->stats.inflateTime += system_get_time() - start - (slot->stats.parseTime - parseTime);
+	slot->stats.gzipIn += length;
+	return rc;
+}
+
+LOCAL void ICACHE_FLASH_ATTR onTcpDataRecv(void *arg, char *pusrdata, unsigned short length)
+{
+	struct espconn *pespconn = arg;
+	ConnSlot *slot = pespconn->reverse;
+	debug("onTcpDataRecv %d\n", length);
+	os_timer_disarm(&slot->rxTmr);
+	slot->lastRxTime = system_get_time();
+	// keep-alives come often enough for the clock not to wrap in between
+	uint up = (slot->lastRxTime - slot->upMark) / 1000;
+	slot->stats.upTime += up;
+	slot->upMark += up*1000;
+
+	while (length > 0)
+	{
+		int used = httpRespFeed(&slot->resp, pusrdata, length);
+		pusrdata += used;
+		length -= used;
+
+		if (!slot->httpStatus && slot->resp.status)
+		{
+			slot->httpStatus = slot->resp.status;
+			if (slot->httpStatus == 200)
+			{
+				backoffReset(&slot->backoff);
+			}
+		}
+
+		if (slot->resp.state == HttpRespDone)
+		{
+			// handled right away, no need to wait for more data
+			replyComplete(slot);
+		}
+		else if (slot->resp.state == HttpRespError)
+		{
+			debug("%s malformed reply\n", slot->host);
+			if (slot->resp.gzip)
+			{
+				slot->stats.gzipErrors++;
+				slot->gzip = FALSE;		// uncompressed on the next connection
+			}
+			slot->rxLen = 0;
+			resetReply(slot);
+			// rest of the connection can't be framed, treated as a drop
+			slot->state = connDisconnecting;
+			os_timer_disarm(&slot->tmr);
+			os_timer_setfn(&slot->tmr, (os_timer_func_t*)espconn_secure_disconnect, &slot->espConn);
+			os_timer_arm(&slot->tmr, 100, 0);
+			return;
+		}
+	}
+
+	if (slot->resp.state == HttpRespBody && slot->resp.contentLength < 0 &&
+		slot != &slots[ConnStream])
+	{
+		// reply without length ends with the connection,
+		// or when the server stops sending
+		os_timer_setfn(&slot->rxTmr, (os_timer_func_t*)replyComplete, slot);
+		os_timer_arm(&slot->rxTmr, RX_IDLE_TIMEOUT, 0);
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR onTcpDisconnected(void *arg)
+{
+	// on unexpected disconnection the following might happen:
+	// usually: only onTcpReconnCb is called
+	// sometimes: only onTcpDisconnected is called
+	// rarely: both onTcpReconnCb and onTcpDisconnected are called
+
+	struct espconn *pespconn = arg;
+	ConnSlot *slot = pespconn->reverse;
+	debug("onTcpDisconnected %s\n", slot->host);
+	debug("disconnExpected %d\n", slot->disconnExpected);
+	if (slot->state == connBackoff)
+	{
+		return;		// connect timed out, the next attempt is scheduled
+	}
+	slot->state = connIdle;
+	releaseSession(slot);
+	abortBody(slot);
+	if (httpRespFinish(&slot->resp))	// reply without length is complete now
+	{
+		replyComplete(slot);
+	}
+	resetReply(slot);	// inflater is not needed until the next reply
+	if (!slot->disconnExpected)	// we got unexpectedly disconnected
+	{
+		debug("reconnCbCalled %d\n", slot->reconnCbCalled);
+		if (slot->reconnCbCalled)	// if onTcpReconnCb was also called
+		{							// just ignore this callback
+			slot->reconnCbCalled = FALSE;
+			return;
+		}
+		slot->stats.drops++;
+
+		// stream is reopened, idle REST connection only when there is a request
+		if (slot->wanted)
+		{
+			scheduleReconnect(slot, classifyDrop(slot, FailTcp));
+		}
+		return;
+	}
+
+	slot->disconnExpected = FALSE;
+	if (slot->wanted)	// restarted on purpose
+	{
+		connect(slot);
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR onTcpReconnCb(void *arg, sint8 err)
+{
+	struct espconn *pespconn = arg;
+	ConnSlot *slot = pespconn->reverse;
+	debug("onTcpReconnCb %s %d\n", slot->host, err);
+	if (slot->state == connBackoff)
+	{
+		return;		// connect timed out, the next attempt is scheduled
+	}
+	FailClass failClass = err == ESPCONN_HANDSHAKE ? FailTls : FailTcp;
+	if (slot->state == connConnecting && failClass == FailTcp)
+	{
+		dnsCacheMarkStale(slot->host);	// resolve again before the next attempt
+	}
+	slot->state = connIdle;
+	slot->stats.drops++;
+	slot->reconnCbCalled = TRUE;
+	releaseSession(slot);
+	abortBody(slot);
+
+	// ok, something went wrong and we got disconnected,
+	// try to reconnect after a delay depending on what failed
+	os_timer_disarm(&slot->tmr);
+	if (slot->wanted)
+	{
+		scheduleReconnect(slot, classifyDrop(slot, failClass));
+	}
+}
+
+
+void ICACHE_FLASH_ATTR connPrintStats(void)
+{
+	int id;
+	for (id = 0; id < ConnCount; id++)
+	{
+		ConnStats *stats = &slots[id].stats;
+		os_printf("conn %s: %u connects, %u drops, %u requests, %u replies, rtt avg %u ms, max %u ms\n",
+				slots[id].host ? slots[id].host : "-",
+				stats->connects, stats->drops, stats->requests, stats->replies,
+				stats->replies ? stats->rttSum/stats->replies : 0,
+				stats->rttMax);
+		os_printf("conn %s: handshake avg %u ms, max %u ms, session heap %u\n",
+				slots[id].host ? slots[id].host : "-",
+				stats->connects ? stats->handshakeSum/stats->connects : 0,
+				stats->handshakeMax, stats->sessionHeap);
+		os_printf("conn %s: %u session waits, %u yields, %u connect errors, %u timeouts\n",
+				slots[id].host ? slots[id].host : "-",
+				stats->sessionWaits, stats->sessionYields, stats->connectErrors, stats->connectTimeouts);
+		os_printf("conn %s: %u dns lookups, %u background refreshes\n",
+				slots[id].host ? slots[id].host : "-",
+				stats->dnsLookups, stats->dnsRefreshes);
+		os_printf("conn %s: %u ms since last byte, %u stalls, avg silence before reconnect %u ms\n",
+				slots[id].host ? slots[id].host : "-",
+				slots[id].state == connConnected ? (system_get_time() - slots[id].lastRxTime) / 1000 : 0,
+				stats->stalls, stats->stalls ? stats->stallSilenceSum/stats->stalls : 0);
+		os_printf("conn %s: %d requests pending, %u max pipelined, %u idle closes\n",
+				slots[id].host ? slots[id].host : "-",
+				slots[id].requestsPending, stats->pipelineMax, stats->idleCloses);
+		os_printf("conn %s: %u messages, parse avg %u us\n",
+				slots[id].host ? slots[id].host : "-",
+				stats->messages, stats->messages ? stats->parseTime/stats->messages : 0);
+		os_printf("conn %s: gzip %s, %u bytes in, %u out, inflate avg %u us per message, %u errors\n",
+				slots[id].host ? slots[id].host : "-",
+				slots[id].gzip ? "on" : "off", stats->gzipIn, stats->gzipOut,
+				stats->messages ? stats->inflateTime/stats->messages : 0, stats->gzipErrors);
+		os_printf("conn %s: gzip declined %u times for heap\n",
+				slots[id].host ? slots[id].host : "-", stats->gzipDeclined);
+		os_printf("conn %s: %u streamed bodies, %u segments, %u errors\n",
+				slots[id].host ? slots[id].host : "-",
+				stats->streamedBodies, stats->bodySegments, stats->bodyErrors);
+	}
+	for (id = 0; id < ConnCount; id++)
+	{
+		Backoff *backoff = &slots[id].backoff;
+		os_printf("reconnect %s: state %d, %u consecutive failures, last %s, delay %u ms\n",
+				slots[id].host ? slots[id].host : "-",
+				slots[id].state, backoff->consecutive,
+				backoff->consecutive ? backoffClassName(backoff->lastClass) : "-",
+				backoff->lastDelay);
+		int failClass;
+		for (failClass = 0; failClass < FailClassCount; failClass++)
+		{
+			os_printf("reconnect %s: %u %s failures\n",
+					slots[id].host ? slots[id].host : "-",
+					backoff->failures[failClass], backoffClassName(failClass));
+		}
+	}
+	os_printf("conn: TLS session %s, %s waiting\n",
+			sessionOwner ? sessionOwner->host : "free", sessionWaiter ? sessionWaiter->host : "none");
+
+	// the server doesn't send again what the stream missed, the
+	// loss is estimated from its message rate over the gaps
+	ConnStats *stream = &slots[ConnStream].stats;
+	uint requests = slots[ConnApi].stats.requests;
+	uint missed = stream->upTime ? (uint)((uint64)stream->messages * stream->gapSum * 100 / stream->upTime) : 0;
+	os_printf("conn: stream closed %u times for %u requests, gap avg %u ms, max %u ms\n",
+			stream->gaps, requests, stream->gaps ? stream->gapSum/stream->gaps : 0, stream->gapMax);
+	os_printf("conn: %u stream replies during requests, about %u.%02u messages missed per request\n",
+			streamRepliesDuringRequests, requests ? missed/requests/100 : 0, requests ? missed/requests%100 : 0);
+}
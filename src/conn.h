@@ -0,0 +1,41 @@
+#ifndef SRC_CONN_H_
+#define SRC_CONN_H_
+
+#include "typedefs.h"
+#include "httpresp.h"
+
+typedef enum{
+	ConnStream,		// streaming API, kept open except while REST requests are sent
+	ConnApi,		// REST API, opened on demand, closed after the idle timeout when the stream waits
+	ConnCount
+}ConnId;
+
+// sends the request(s) not yet sent on this connection: called when the
+// connection is up, and again after each send while replies are pending
+typedef void (*ConnRequestFunc)(void);
+// called with the (null terminated) body of a complete reply,
+// or with one message of the stream
+typedef void (*ConnParserFunc)(const HttpResp *resp, char *data, int length);
+// next segment of a request body, returns its length, 0 when complete,
+// data is NULL when the connection is gone and the rest is not needed
+typedef int (*ConnBodyFunc)(const char **data);
+
+void connInit(ConnId id, const char *host, ConnParserFunc parserFunc);
+void connRequest(ConnId id, ConnRequestFunc requestFunc);
+void connRestart(ConnId id, ConnRequestFunc requestFunc);
+void connCancelRequest(ConnId id);
+void connClose(ConnId id);
+void connSetStallTimeout(ConnId id, uint seconds);
+void connSetIdleTimeout(ConnId id, uint seconds);
+void connSetGzip(ConnId id, int enable);
+int connAcceptsGzip(ConnId id);
+int connIsConnected(ConnId id);
+int connCanSend(ConnId id);
+uint connSerial(ConnId id);
+int connSend(ConnId id, const char *data, int length);
+int connSendStreamed(ConnId id, const char *data, int length, ConnBodyFunc bodyFunc);
+const char* connHost(ConnId id);
+void connPrintStats(void);
+
+
+#endif /* SRC_CONN_H_ */
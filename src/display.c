@@ -1,62 +1,162 @@
 #include <osapi.h>
 #include <os_type.h>
+#include "common.h"
 #include "graphics.h"
 #include "SSD1322.h"
 #include "display.h"
+#include "anim.h"
 
 #define TITLE_SCROLL_INTERVAL		20
+#define PAGER_SCROLL_INTERVAL		4
+#define PAGER_STEP					(DISP_HEIGHT-TITLE_HEIGHT)
+
+
+DispState displayState = stateOff;
+Orientation dispOrient = orient0deg;
+int dispScrollCurLine = 0;
+
+LOCAL int contrastCurValue = CONTRAST_LEVEL_INIT;
+LOCAL int contrastSetPointValue = CONTRAST_LEVEL_INIT;
+LOCAL int contrastIncValue = 0;
+LOCAL int contrastCtrlTrmInt = 5;
+
+typedef enum{
+	scrollNone,
+	scrollPage,		// new content is scrolled in from the other GDDRAM page
+	scrollPager		// moving within the current canvas
+}ScrollState;
+LOCAL ScrollState scrollState = scrollNone;
+
+// GDDRAM row holding the first canvas row (0 or 64)
+LOCAL int pageBaseLine = 0;
+// canvas rows below pageBaseLine currently scrolled out of view
+LOCAL int pagerOffset = 0;
+LOCAL int pagerMaxOffset = 0;
+LOCAL int pagerTarget = 0;
+LOCAL int lowerHalfPending = FALSE;
+
+
+// title rows as they are in GDDRAM at pageBaseLine
+LOCAL uchar titleShadow[TITLE_HEIGHT][DISP_MEMWIDTH];
 
 
 extern void SSD1322_cpyMemBuf(uchar mem[][DISP_MEMWIDTH], int memRow, uchar dispRow, int height);
+extern void SSD1322_cpyMemRowSpan(const uchar *row, uchar dispRow, int first, int last);
+
+// uploads the top of the canvas to pageBaseLine
+LOCAL void ICACHE_FLASH_ATTR uploadTopHalf(void)
+{
+	SSD1322_cpyMemBuf(mem, 0, pageBaseLine, DISP_HEIGHT);
+	os_memcpy(titleShadow, mem, sizeof(titleShadow));
+}
+
 void ICACHE_FLASH_ATTR dispUpdate(DispPage page)
 {
 	SSD1322_cpyMemBuf(mem, 0, page*DISP_HEIGHT, DISP_HEIGHT);
+	if (page*DISP_HEIGHT == pageBaseLine)
+	{
+		os_memcpy(titleShadow, mem, sizeof(titleShadow));
+	}
 }
 
+// title belongs to the top of the canvas, which might be scrolled out of view.
+// Only bytes which differ from GDDRAM are sent: blank rows and the area
+// outside of the text cost nothing during title transitions.
 void ICACHE_FLASH_ATTR dispUpdateTitle(void)
 {
-	SSD1322_cpyMemBuf(mem, 0, dispScrollCurLine, TITLE_HEIGHT);
+	int y;
+	for (y = 0; y < TITLE_HEIGHT; y++)
+	{
+		int first = 0;
+		int last = DISP_MEMWIDTH-1;
+		while (first <= last && mem[y][first] == titleShadow[y][first])
+		{
+			first++;
+		}
+		if (first > last)
+		{
+			continue;
+		}
+		while (mem[y][last] == titleShadow[y][last])
+		{
+			last--;
+		}
+		SSD1322_cpyMemRowSpan(mem[y], pageBaseLine+y, first, last);
+		os_memcpy(&titleShadow[y][first], &mem[y][first], last-first+1);
+	}
 }
 
-DispState displayState = stateOff;
-Orientation dispOrient = orient0deg;
-int dispScrollCurLine = 0;
+LOCAL void ICACHE_FLASH_ATTR setCanvasHeight(int height)
+{
+	pagerMaxOffset = clampInt(height-DISP_HEIGHT, 0, CANVAS_HEIGHT-DISP_HEIGHT);
+	pagerOffset = 0;
+	lowerHalfPending = FALSE;
+}
 
+// canvas rows which do not fit on the first screen go to the other GDDRAM page,
+// after that reading further only changes the start line
+LOCAL void ICACHE_FLASH_ATTR updateLowerHalf(void)
+{
+	if (pagerMaxOffset > 0)
+	{
+		SSD1322_cpyMemBuf(mem, DISP_HEIGHT, pageBaseLine^DISP_HEIGHT, pagerMaxOffset);
+	}
+	lowerHalfPending = FALSE;
+}
+
+void ICACHE_FLASH_ATTR dispRefresh(int canvasHeight)
+{
+	if (scrollState == scrollPager)
+	{
+		animStop(AnimChanScroll);
+		scrollState = scrollNone;
+	}
+	setCanvasHeight(canvasHeight);
+	uploadTopHalf();
+	if (scrollState == scrollNone)
+	{
+		dispScrollCurLine = pageBaseLine;
+		SSD1322_setStartLine(dispScrollCurLine);
+		updateLowerHalf();
+	}
+	else	// other page is still on screen, update it when scrolling is done
+	{
+		lowerHalfPending = TRUE;
+	}
+}
+
+int ICACHE_FLASH_ATTR dispIsScrolling(void)
+{
+	return scrollState != scrollNone;
+}
 
-os_timer_t scrollTmr;
-LOCAL os_timer_t dimmingTmr;
-LOCAL int contrastCurValue = CONTRAST_LEVEL_INIT;
-LOCAL int contrastSetPointValue = CONTRAST_LEVEL_INIT;
-LOCAL int contrastIncValue = 0;
-LOCAL int contrastCtrlTrmInt = 5;
 
 LOCAL int squeezeRow = 0;
 LOCAL int squeezeColumn = 0;
 
-LOCAL void ICACHE_FLASH_ATTR horizontalSqueezeTmrCb(void)
+LOCAL int ICACHE_FLASH_ATTR horizontalSqueezeStep(void)
 {
 	if (squeezeColumn <= 127)
 	{
 		drawPixel(squeezeColumn, 0, 0);
 		drawPixel(255-squeezeColumn, 0, 0);
-		SSD1322_cpyMemBuf(mem2, 0, dispScrollCurLine+squeezeRow, 1);
+		SSD1322_cpyMemBuf(mem2, 0, (dispScrollCurLine+squeezeRow) & 0x7F, 1);
 		squeezeColumn++;
+		return 5;
 	}
-	else
-	{
-		os_timer_disarm(&dimmingTmr);
-		SSD1322_setOnOff(stateOff);
-		SSD1322_partialDispDis();
 
-		if (contrastCurValue > 0)
-		{
-			contrastCurValue = 0;	// for smooth undimm
-			SSD1322_setContrast(contrastCurValue);
-		}
+	SSD1322_setOnOff(stateOff);
+	SSD1322_partialDispDis();
 
-		SSD1322_cpyMemBuf(mem, squeezeRow, dispScrollCurLine+squeezeRow, 1);	// restore middle row
-		dispSetActiveMemBuf(MainMemBuf);
+	if (contrastCurValue > 0)
+	{
+		contrastCurValue = 0;	// for smooth undimm
+		SSD1322_setContrast(contrastCurValue);
 	}
+
+	SSD1322_cpyMemBuf(mem, pagerOffset+squeezeRow, (dispScrollCurLine+squeezeRow) & 0x7F, 1);	// restore middle row
+	dispSetActiveMemBuf(MainMemBuf);
+	return 0;
 }
 
 LOCAL void ICACHE_FLASH_ATTR horizontalSqueezeStart(void)
@@ -69,54 +169,48 @@ LOCAL void ICACHE_FLASH_ATTR horizontalSqueezeStart(void)
 	{
 		drawPixel(x, 0, 1);
 	}
-	SSD1322_cpyMemBuf(mem2, 0, dispScrollCurLine+squeezeRow, 1);
+	SSD1322_cpyMemBuf(mem2, 0, (dispScrollCurLine+squeezeRow) & 0x7F, 1);
 
-	os_timer_disarm(&dimmingTmr);
-	os_timer_setfn(&dimmingTmr, (os_timer_func_t *)horizontalSqueezeTmrCb, NULL);
-	os_timer_arm(&dimmingTmr, 5, 1);
+	animStart(AnimChanDimming, horizontalSqueezeStep, 5);
 }
 
-LOCAL void ICACHE_FLASH_ATTR verticalSqueezeTmrCb(void)
+LOCAL int ICACHE_FLASH_ATTR verticalSqueezeStep(void)
 {
 	squeezeRow++;
 	if (squeezeRow <= 31)
 	{
 		SSD1322_partialDispEn(squeezeRow, 63-squeezeRow);
+		return 10;
 	}
-	else
-	{
-		SSD1322_partialDispEn(squeezeRow, squeezeRow);
-		horizontalSqueezeStart();
-	}
+	SSD1322_partialDispEn(squeezeRow, squeezeRow);
+	horizontalSqueezeStart();
+	return 0;
 }
 
 void ICACHE_FLASH_ATTR dispVerticalSqueezeStart(void)
 {
 	squeezeRow = 0;
-	os_timer_disarm(&dimmingTmr);
-	os_timer_setfn(&dimmingTmr, (os_timer_func_t *)verticalSqueezeTmrCb, NULL);
-	os_timer_arm(&dimmingTmr, 10, 1);
+	animStart(AnimChanDimming, verticalSqueezeStep, 10);
 }
 
-LOCAL void ICACHE_FLASH_ATTR SSD1322_constrastCtrlTmrCb(void)
+LOCAL int ICACHE_FLASH_ATTR contrastCtrlStep(void)
 {
 	contrastCurValue += contrastIncValue;
 	SSD1322_setContrast(contrastCurValue);
 	if (contrastCurValue != contrastSetPointValue)
 	{
-		os_timer_arm(&dimmingTmr, contrastCtrlTrmInt, 0);
+		return contrastCtrlTrmInt;
 	}
+	return 0;
 }
 
 void ICACHE_FLASH_ATTR dispDimmingStart(void)
 {
-	os_timer_disarm(&dimmingTmr);
-	os_timer_setfn(&dimmingTmr, (os_timer_func_t *)SSD1322_constrastCtrlTmrCb, NULL);
 	contrastCurValue = 254;
 	contrastSetPointValue = 0;
 	contrastIncValue = -2;
 	contrastCtrlTrmInt = 15;
-	SSD1322_constrastCtrlTmrCb();
+	animStart(AnimChanDimming, contrastCtrlStep, 0);
 	displayState = stateDimmed;
 }
 
@@ -132,20 +226,11 @@ void ICACHE_FLASH_ATTR dispUndimmStart(void)
 		SSD1322_setOnOff(stateOn);
 		// fallthrough
 	case stateDimmed:
-		os_timer_disarm(&dimmingTmr);
-		os_timer_setfn(&dimmingTmr, (os_timer_func_t *)SSD1322_constrastCtrlTmrCb, NULL);
 		//contrastCurValue = 0;
 		contrastSetPointValue = 254;
 		contrastIncValue = 2;
 		contrastCtrlTrmInt = 5;
-		if (prevState == stateOff)
-		{
-			os_timer_arm(&dimmingTmr, 300, 0);
-		}
-		else
-		{
-			SSD1322_constrastCtrlTmrCb();
-		}
+		animStart(AnimChanDimming, contrastCtrlStep, prevState == stateOff ? 300 : 0);
 		displayState = stateOn;
 		break;
 	}
@@ -155,63 +240,108 @@ void ICACHE_FLASH_ATTR dispUndimmStart(void)
 extern void displayScrollDone(void);
 // exponential easing in (approx. 0.5s): pow(2, 10*(((curLine-1)/62)-1))*40+1
 LOCAL const uchar scrollIntervals[63] = {1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,2,2,2,2,2,2,2,2,2,2,3,3,3,3,3,4,4,4,5,5,6,6,7,8,8,9,10,11,13,14,16,17,19,21,24,27,30,33,37,41};
-LOCAL void ICACHE_FLASH_ATTR displayScrollTmrCb(void)
+LOCAL int ICACHE_FLASH_ATTR displayScrollStep(void)
 {
 	dispScrollCurLine++;
 	dispScrollCurLine &= 0x7F;
-	SSD1322_setStartLine(dispScrollCurLine);
-	if (dispScrollCurLine == 0 || dispScrollCurLine == 64)
+	animInvalidate(ANIM_DIRTY_START_LINE);
+	if (dispScrollCurLine == pageBaseLine)
 	{
+		scrollState = scrollNone;
+		if (lowerHalfPending)
+		{
+			updateLowerHalf();
+		}
 		displayScrollDone();
+		return 0;
 	}
-	else
+	int line = dispScrollCurLine >= 65 ? dispScrollCurLine-65 : dispScrollCurLine-1;
+	return scrollIntervals[line];
+}
+
+void ICACHE_FLASH_ATTR scrollDisplay(int canvasHeight)
+{
+	// title of the previous content is going away
+	animStop(AnimChanTitle);
+
+	// new content goes to the page which is not (or is less) visible,
+	// this also covers interrupted scroll and scrolled long tweet
+	pageBaseLine = dispScrollCurLine < DISP_HEIGHT ? DISP_HEIGHT : 0;
+	setCanvasHeight(canvasHeight);
+	uploadTopHalf();
+	lowerHalfPending = TRUE;	// lower half would overwrite what is shown now
+	scrollState = scrollPage;
+
+	animStart(AnimChanScroll, displayScrollStep, 1);
+}
+
+extern void pagerScrollDone(void);
+LOCAL int ICACHE_FLASH_ATTR pagerScrollStep(void)
+{
+	pagerOffset += pagerTarget > pagerOffset ? 1 : -1;
+	dispScrollCurLine = (pageBaseLine+pagerOffset) & 0x7F;
+	animInvalidate(ANIM_DIRTY_START_LINE);
+	if (pagerOffset == pagerTarget)
 	{
-		int line = dispScrollCurLine >= 65 ? dispScrollCurLine-65 : dispScrollCurLine-1;
-		os_timer_arm(&scrollTmr, scrollIntervals[line], 0);
+		scrollState = scrollNone;
+		pagerScrollDone();
+		return 0;
 	}
+	return PAGER_SCROLL_INTERVAL;
 }
 
-void ICACHE_FLASH_ATTR scrollDisplay(void)
+int ICACHE_FLASH_ATTR dispPagerScroll(int down)
 {
-	os_timer_disarm(&scrollTmr);
-
-	if (dispScrollCurLine == 0 || dispScrollCurLine == 64)
+	if (scrollState != scrollNone)
 	{
-		dispUpdate(dispScrollCurLine == 0 ? Page1 : Page0);
+		return FALSE;
 	}
-	else	// interrupted scroll
+	int target = pagerOffset + (down ? PAGER_STEP : -PAGER_STEP);
+	target = clampInt(target, 0, pagerMaxOffset);
+	if (target == pagerOffset)
 	{
-		dispUpdate(dispScrollCurLine < 64 ? Page1 : Page0);
+		return FALSE;	// already on the first/last page
 	}
+	pagerTarget = target;
+	scrollState = scrollPager;
+	animStart(AnimChanScroll, pagerScrollStep, PAGER_SCROLL_INTERVAL);
+	return TRUE;
+}
 
-	os_timer_disarm(&scrollTmr);
-	os_timer_setfn(&scrollTmr, (os_timer_func_t *)displayScrollTmrCb, NULL);
-	os_timer_arm(&scrollTmr, 1, 0);
+void ICACHE_FLASH_ATTR dispPagerHome(void)
+{
+	if (scrollState != scrollNone || pagerOffset == 0)
+	{
+		return;
+	}
+	pagerOffset = 0;
+	dispScrollCurLine = pageBaseLine;
+	SSD1322_setStartLine(dispScrollCurLine);
 }
 
 extern void titleScrollDone(void);
-LOCAL void ICACHE_FLASH_ATTR titleScrollTmrCb(void)
+LOCAL int ICACHE_FLASH_ATTR titleScrollStep(void)
 {
-	if (dispTitleScrollStep(FALSE))
+	int done = dispTitleScrollStep(FALSE);
+	animInvalidate(ANIM_DIRTY_TITLE);
+	if (done)
 	{
-		os_timer_disarm(&scrollTmr);
 		titleScrollDone();
+		return 0;
 	}
-	dispUpdateTitle();
+	return TITLE_SCROLL_INTERVAL;
 }
 
 void ICACHE_FLASH_ATTR scrollTitle(void)
 {
-	os_timer_disarm(&scrollTmr);
-	os_timer_setfn(&scrollTmr, (os_timer_func_t *)titleScrollTmrCb, NULL);
-	os_timer_arm(&scrollTmr, TITLE_SCROLL_INTERVAL, 1);
 	dispTitleScrollStep(TRUE);
+	animStart(AnimChanTitle, titleScrollStep, TITLE_SCROLL_INTERVAL);
 }
 
 
 void ICACHE_FLASH_ATTR dispSetOrientation(Orientation orientation)
 {
-	if (dispScrollCurLine != 0 && dispScrollCurLine != 64)
+	if (dispIsScrolling())
 	{
 		return;		// do not rotate while scrolling
 	}
@@ -225,7 +355,8 @@ void ICACHE_FLASH_ATTR dispSetOrientation(Orientation orientation)
 		break;
 	default: return;
 	}
-	dispUpdate(dispScrollCurLine == 0 ? Page0 : Page1);
+	uploadTopHalf();
+	updateLowerHalf();
 	dispOrient = orientation;
 }
 
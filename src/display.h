@@ -21,6 +21,8 @@ typedef enum{
 
 void dispUpdate(DispPage page);
 void dispUpdateTitle(void);
+void dispRefresh(int canvasHeight);
+int dispIsScrolling(void);
 
 extern int dispScrollCurLine;
 
@@ -28,9 +30,12 @@ void dispDimmingStart(void);
 void dispVerticalSqueezeStart(void);
 void dispUndimmStart(void);
 
-void scrollDisplay(void);
+void scrollDisplay(int canvasHeight);
 void scrollTitle(void);
 
+int dispPagerScroll(int down);
+void dispPagerHome(void);
+
 void dispSetOrientation(Orientation orientation);
 
 
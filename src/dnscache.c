@@ -0,0 +1,150 @@
+#include <os_type.h>
+#include <osapi.h>
+#include <ip_addr.h>
+#include <user_interface.h>
+#include <spi_flash.h>
+#include <sntp.h>
+#include "config.h"
+#include "debug.h"
+#include "dnscache.h"
+
+
+#define DNS_CACHE_MAGIC			0xD15CAC4E
+#define DNS_CACHE_ENTRIES		4
+#define DNS_CACHE_HOST_LEN		32
+// resolver does not tell the record's TTL, older entries are still used
+// but refreshed in the background, failed connects make them stale at once
+#define DNS_CACHE_TTL			3600	// s
+
+typedef struct{
+	char host[DNS_CACHE_HOST_LEN];
+	uint ip;
+	uint resolvedAt;	// sntp timestamp
+	int stale;
+}DnsCacheEntry;
+
+typedef struct{
+	uint magic;
+	DnsCacheEntry entries[DNS_CACHE_ENTRIES];
+}DnsCache;
+
+LOCAL DnsCache cache;
+
+LOCAL uint hits = 0;
+LOCAL uint misses = 0;
+LOCAL uint expiredHits = 0;
+LOCAL uint flashWrites = 0;
+
+
+void ICACHE_FLASH_ATTR dnsCacheInit(void)
+{
+	spi_flash_read(DNS_CACHE_FLASH_ADDR, (uint*)&cache, sizeof(DnsCache));
+	if (cache.magic != DNS_CACHE_MAGIC)
+	{
+		os_memset(&cache, 0, sizeof(DnsCache));
+		cache.magic = DNS_CACHE_MAGIC;
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR dnsCacheWrite(void)
+{
+	spi_flash_erase_sector(DNS_CACHE_FLASH_SECTOR);
+	spi_flash_write(DNS_CACHE_FLASH_ADDR, (uint*)&cache, sizeof(DnsCache));
+	flashWrites++;
+}
+
+LOCAL DnsCacheEntry* ICACHE_FLASH_ATTR findEntry(const char *host)
+{
+	int i;
+	for (i = 0; i < DNS_CACHE_ENTRIES; i++)
+	{
+		if (!os_strncmp(cache.entries[i].host, host, DNS_CACHE_HOST_LEN))
+		{
+			return &cache.entries[i];
+		}
+	}
+	return NULL;
+}
+
+// returns 0 when the host has to be resolved first
+uint ICACHE_FLASH_ATTR dnsCacheLookup(const char *host, int *expired)
+{
+	DnsCacheEntry *entry = findEntry(host);
+	if (!entry || !entry->ip || entry->stale)
+	{
+		misses++;
+		return 0;
+	}
+	uint now = sntp_get_current_timestamp();
+	*expired = (now - entry->resolvedAt) > DNS_CACHE_TTL;
+	if (*expired)
+	{
+		expiredHits++;
+	}
+	else
+	{
+		hits++;
+	}
+	return entry->ip;
+}
+
+void ICACHE_FLASH_ATTR dnsCacheUpdate(const char *host, uint ip)
+{
+	if (os_strlen(host) >= DNS_CACHE_HOST_LEN)
+	{
+		return;
+	}
+	DnsCacheEntry *entry = findEntry(host);
+	if (!entry)
+	{
+		// take a free entry or the oldest one
+		int i;
+		entry = &cache.entries[0];
+		for (i = 1; i < DNS_CACHE_ENTRIES && entry->host[0]; i++)
+		{
+			if (!cache.entries[i].host[0] ||
+				cache.entries[i].resolvedAt < entry->resolvedAt)
+			{
+				entry = &cache.entries[i];
+			}
+		}
+		os_memset(entry, 0, sizeof(DnsCacheEntry));
+		os_strcpy(entry->host, host);
+	}
+
+	entry->resolvedAt = sntp_get_current_timestamp();
+	// flash is only written when the address changes,
+	// the time of a refresh alone is not worth a sector erase
+	entry->stale = FALSE;
+	if (entry->ip != ip)
+	{
+		entry->ip = ip;
+		dnsCacheWrite();
+	}
+}
+
+void ICACHE_FLASH_ATTR dnsCacheMarkStale(const char *host)
+{
+	DnsCacheEntry *entry = findEntry(host);
+	if (entry && !entry->stale)
+	{
+		debug("dns cache: %s stale\n", host);
+		entry->stale = TRUE;	// kept in RAM only, next resolve writes the new address
+	}
+}
+
+void ICACHE_FLASH_ATTR dnsCachePrintStats(void)
+{
+	os_printf("dns cache: %u hits, %u expired hits, %u misses, %u flash writes\n",
+			hits, expiredHits, misses, flashWrites);
+	int i;
+	for (i = 0; i < DNS_CACHE_ENTRIES; i++)
+	{
+		DnsCacheEntry *entry = &cache.entries[i];
+		if (entry->host[0])
+		{
+			os_printf("dns cache: %s "IPSTR"%s\n", entry->host,
+					IP2STR((ip_addr_t*)&entry->ip), entry->stale ? " stale" : "");
+		}
+	}
+}
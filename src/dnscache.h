@@ -0,0 +1,13 @@
+#ifndef SRC_DNSCACHE_H_
+#define SRC_DNSCACHE_H_
+
+#include "typedefs.h"
+
+void dnsCacheInit(void);
+uint dnsCacheLookup(const char *host, int *expired);
+void dnsCacheUpdate(const char *host, uint ip);
+void dnsCacheMarkStale(const char *host);
+void dnsCachePrintStats(void);
+
+
+#endif /* SRC_DNSCACHE_H_ */
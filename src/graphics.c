@@ -14,7 +14,7 @@ LOCAL const uchar maskLutInv[8] = {0x7F, 0xBF, 0xDF, 0xEF, 0xF7, 0xFB, 0xFD, 0xF
 int inverseColor = FALSE;
 
 
-uchar mem[DISP_HEIGHT][DISP_MEMWIDTH];
+uchar mem[CANVAS_HEIGHT][DISP_MEMWIDTH];
 uchar mem2[TITLE_HEIGHT][DISP_MEMWIDTH];
 static uchar (*pMem)[DISP_MEMWIDTH] = mem;
 int memHeight = DISP_HEIGHT;
@@ -32,6 +32,10 @@ void ICACHE_FLASH_ATTR dispSetActiveMemBuf(MemBufType memBuf)
 		pMem = mem2;
 		memHeight = TITLE_HEIGHT;
 		break;
+	case CanvasMemBuf:
+		pMem = mem;
+		memHeight = CANVAS_HEIGHT;
+		break;
 	}
 }
 
@@ -11,13 +11,18 @@
 
 #define TITLE_HEIGHT	13
 
-extern uchar mem[DISP_HEIGHT][DISP_MEMWIDTH];
+// SSD1322 GDDRAM holds two screens (128 rows),
+// long tweets are laid out over all of it
+#define CANVAS_HEIGHT	(2*DISP_HEIGHT)
+
+extern uchar mem[CANVAS_HEIGHT][DISP_MEMWIDTH];
 extern uchar mem2[TITLE_HEIGHT][DISP_MEMWIDTH];
 extern int memHeight;
 
 typedef enum{
 	MainMemBuf,
-	SecondaryMemBuf
+	SecondaryMemBuf,
+	CanvasMemBuf
 }MemBufType;
 
 
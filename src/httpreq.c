@@ -4,14 +4,16 @@
 #include <lwip/err.h>
 #include <lwip/dns.h>
 #include <user_interface.h>
-#include <espconn.h>
 #include <mem.h>
+#include <espconn.h>
 #include <sntp.h>
 #include "typedefs.h"
 #include "oauth.h"
 #include "config.h"
 #include "debug.h"
 #include "httpreq.h"
+#include "conn.h"
+#include "common.h"
 
 LOCAL const char *twitterStatusUrl = "/1.1/statuses/update.json";
 LOCAL const char *twitterStreamUrl = "/1.1/user.json";
@@ -23,395 +25,559 @@ LOCAL const char *twitterFavoritesUrl = "/1.1/favorites/create.json";
 #define HTTP_REQ_MAX_LEN	1024
 char httpRequest[HTTP_REQ_MAX_LEN];
 
-extern struct espconn espConn;
-
-
-LOCAL ParamItem* ICACHE_FLASH_ATTR paramListAppend(ParamList *list, const char *param, const char *value)
+#define NONCE_LEN			42
+#define TIMESTAMP_LEN		10		// template slot, epoch seconds until 2286
+
+typedef struct{
+	uint requests;
+	uint failed;		// did not fit
+	uint maxLen;
+	uint buildTime;		// us
+	uint templateRenders;
+	uint templateUses;
+	uint streamed;		// body sent in segments after the head
+}HttpReqStats;
+
+LOCAL HttpReqStats stats = {0};
+
+// The stream request is rendered once, a reconnect only patches
+// nonce and timestamp and signs from the hashed base string prefix.
+// Rendered again after the stream parameters or credentials change.
+typedef struct{
+	char *request;		// head up to the signature, then the tail
+	int headLen;
+	int tailLen;
+	int nonceOffset;
+	int timestampOffset;
+	const char *host;
+	int gzip;
+	OAuthSignPrefix prefix;
+	int valid;
+}StreamTemplate;
+
+LOCAL StreamTemplate streamTemplate = {0};
+
+#define BODY_MAX_PARAMS		2
+
+// Body of a request which does not fit into httpRequest with its head,
+// encoded into it segment by segment while the connection sends.
+typedef struct{
+	char *values;		// copies, the caller's strings may be gone before the end
+	ParamItem params[BODY_MAX_PARAMS];
+	int count;
+	int param;			// next one to encode
+	int offset;			// in its value, -1 before the name
+}BodyStream;
+
+LOCAL BodyStream bodyStream = {0};
+
+// output position in httpRequest, appends stop at the end
+typedef struct{
+	char *pos;
+	char *end;
+	int overflow;
+}ReqBuf;
+
+
+LOCAL void ICACHE_FLASH_ATTR appendData(ReqBuf *buf, const char *data, int len)
 {
-	ParamItem *newItem = (ParamItem*)os_malloc(sizeof(ParamItem));
-	if (!newItem)
+	if (buf->overflow || len > buf->end - buf->pos)
 	{
-		return NULL;
+		buf->overflow = TRUE;
+		return;
 	}
-	newItem->param = param;
-	newItem->value = value;
-	newItem->valueEncoded = NULL;
-	newItem->paramLen = os_strlen(param);
-	newItem->valueLen = os_strlen(value);
-	newItem->next = NULL;
+	os_memcpy(buf->pos, data, len);
+	buf->pos += len;
+}
 
-	if (list->last)
-	{
-		list->last->next = newItem;
-	}
-	else	// this is a first item
+LOCAL void ICACHE_FLASH_ATTR appendStr(ReqBuf *buf, const char *str)
+{
+	appendData(buf, str, os_strlen(str));
+}
+
+LOCAL void ICACHE_FLASH_ATTR appendUint(ReqBuf *buf, uint value)
+{
+	char str[11];
+	appendData(buf, str, uintToStr(value, str));
+}
+
+LOCAL void ICACHE_FLASH_ATTR appendEncoded(ReqBuf *buf, const char *str)
+{
+	int len = percentEncode(str, os_strlen(str), buf->pos, buf->end - buf->pos);
+	if (len == 0 && *str)
 	{
-		list->first = newItem;
+		buf->overflow = TRUE;
+		return;
 	}
-	list->last = newItem;
-	list->count++;
-	return newItem;
+	buf->pos += len;
 }
 
-LOCAL void ICACHE_FLASH_ATTR paramListClear(ParamList *list)
+// name=value&... with the values percent encoded
+LOCAL void ICACHE_FLASH_ATTR appendParams(ReqBuf *buf, const ParamList *paramList)
 {
-	ParamItem *item = list->first;
-	ParamItem *next;
-	while (item)
+	int i;
+	for (i = 0; i < paramList->count; i++)
 	{
-		next = item->next;
-		os_free(item);
-		item = next;
+		if (i > 0)
+		{
+			appendData(buf, "&", 1);
+		}
+		appendStr(buf, paramList->items[i].param);
+		appendData(buf, "=", 1);
+		appendEncoded(buf, paramList->items[i].value);
 	}
-	list->count = 0;
 }
 
-
-LOCAL int ICACHE_FLASH_ATTR paramListStrLen(ParamList *list)
+LOCAL int ICACHE_FLASH_ATTR paramListStrLen(const ParamList *paramList)
 {
 	int length = 0;
-	ParamItem *item = list->first;
-	while (item)
+	int i;
+	for (i = 0; i < paramList->count; i++)
 	{
-		length += (item->paramLen + item->valueLen + 2);
-		item = item->next;
+		const ParamItem *param = &paramList->items[i];
+		length += os_strlen(param->param) + 1 + percentEncodedStrLen(param->value, os_strlen(param->value));
 	}
 	if (length > 0)
 	{
-		length--;	// remove last '&'
+		length += paramList->count - 1;		// '&' between
 	}
 	return length;
 }
 
-LOCAL int paramListEncodeValues(ParamList *list)
+LOCAL const char* ICACHE_FLASH_ATTR methodName(HttpMethod httpMethod)
 {
-	ParamItem *param = list->first;
-	int len;
-	while (param)
+	switch (httpMethod)
 	{
-		len = percentEncodedStrLen(param->value, param->valueLen);
-		param->valueEncoded = (char*)os_malloc(len+1);
-		if (!param->valueEncoded)
-		{
-			return ERROR;
-		}
-		if (percentEncode(param->value, param->valueLen, param->valueEncoded, len+1) != len)
-		{
-			return ERROR;
-		}
-		param->valueLen = len;
-		param = param->next;
+	case httpGET:
+		return "GET";
+	case httpPOST:
+		return "POST";
+	case httpPUT:
+		return "PUT";
+	default:
+		return NULL;
 	}
-	return OK;
 }
 
-LOCAL void paramListClearEncodedValues(ParamList *list)
+// request line and headers up to the signature value,
+// nonceAt and timestampAt get where their values are
+LOCAL void ICACHE_FLASH_ATTR appendRequestHead(ReqBuf *buf,
+		HttpMethod httpMethod, const char *url, const ParamList *paramList,
+		ConnId connId, const char *nonce, const char *timestamp,
+		char **nonceAt, char **timestampAt)
 {
-	ParamItem *param = list->first;
-	while (param)
+	appendStr(buf, methodName(httpMethod));
+	appendData(buf, " ", 1);
+	appendStr(buf, url);
+	if (httpMethod == httpGET && paramList->count > 0)
 	{
-		os_free(param->valueEncoded);
-		param->valueEncoded = NULL;
-		param = param->next;
+		appendData(buf, "?", 1);
+		appendParams(buf, paramList);
 	}
-}
-
 
+	appendStr(buf,
+			" HTTP/1.1\r\n"
+			"Accept: */*\r\n"
+			//"Connection: close\r\n"
+			"Connection: keep-alive\r\n");
+	if (connAcceptsGzip(connId))
+	{
+		appendStr(buf, "Accept-Encoding: gzip\r\n");
+	}
+	appendStr(buf,
+			"User-Agent: ESP8266\r\n"
+			"Content-Type: application/x-www-form-urlencoded\r\n"
+			"Authorization: OAuth "
+			"oauth_consumer_key=\"");
+	appendStr(buf, config.consumer_key);
+	appendStr(buf, "\", oauth_nonce=\"");
+	if (nonceAt) *nonceAt = buf->pos;
+	appendStr(buf, nonce);
+	appendStr(buf,
+			"\", oauth_signature_method=\"HMAC-SHA1\", "
+			"oauth_timestamp=\"");
+	if (timestampAt) *timestampAt = buf->pos;
+	appendStr(buf, timestamp);
+	appendStr(buf, "\", oauth_token=\"");
+	appendStr(buf, config.access_token);
+	appendStr(buf,
+			"\", oauth_version=\"1.0\", "
+			"oauth_signature=\"");		// last, its length varies
+}
 
-LOCAL int appendParams(char *dst, int dstSize, const ParamList *paramList)
+// from the end of the signature value
+LOCAL void ICACHE_FLASH_ATTR appendRequestTail(ReqBuf *buf,
+		HttpMethod httpMethod, const char *host, const ParamList *paramList, int withBody)
 {
-	int len = 0;
-	char *pDst = dst;
+	int contentLen = 0;
+	if (httpMethod == httpPOST || httpMethod == httpPUT)
+	{
+		contentLen = paramListStrLen(paramList);
+	}
+
+	appendStr(buf,
+			"\"\r\n"
+			"Content-Length: ");
+	appendUint(buf, contentLen);
+	appendStr(buf, "\r\nHost: ");
+	appendStr(buf, host);
+	appendStr(buf, "\r\n\r\n");
 
-	ParamItem *param = paramList->first;
-	while (param)
+	if (contentLen > 0 && withBody)
 	{
-		len = ets_snprintf(pDst, dstSize, "%s=%s&", param->param, param->valueEncoded);
-		if (len < 0 || len >= dstSize) return 0;
-		pDst += len;
-		dstSize -= len;
-		param = param->next;
+		appendParams(buf, paramList);
 	}
+}
 
-	if (len > 0)
+LOCAL int ICACHE_FLASH_ATTR requestDone(ReqBuf *buf, char *dst)
+{
+	if (buf->overflow)
 	{
-		dstSize++;
-		pDst--;
-		*pDst = '\0';	// remove last '&'
+		return 0;
 	}
-	return pDst - dst;
+	*buf->pos = '\0';
+
+	int requestLen = buf->pos - dst;
+	debug("\nrequestLen %d\n", requestLen);
+	debug("%s\n\n", dst);
+	return requestLen;
 }
 
+// written straight into dst, no allocation
 LOCAL int ICACHE_FLASH_ATTR formHttpRequest(char *dst, int dstSize,
 		HttpMethod httpMethod, const char *host, const char *url,
-		ParamList *paramList)
+		const ParamList *paramList, ConnId connId, int withBody)
 {
-	int requestLen = 0;
-	int baseurlSize = sizeof("https://") + os_strlen(host) + os_strlen(url) + 1;
-	char *baseurl = (char*)os_malloc(baseurlSize);
-	if (!baseurl) goto out;
-	int len = ets_snprintf(baseurl, baseurlSize, "https://%s%s", host, url);
-	if (len < 0 || len >= baseurlSize) goto out;
-
-	if (paramListEncodeValues(paramList) != OK)
+	const char *method = methodName(httpMethod);
+	if (!method)
 	{
-		goto out;
+		return 0;
 	}
 
-	const char *method;
-	switch (httpMethod)
+	char nonce[NONCE_LEN+1];
+	randomAlphanumericString(nonce, NONCE_LEN);
+
+	char timestamp[11];
+	uintToStr(sntp_get_current_timestamp(), timestamp);
+
+	ReqBuf buf = {dst, dst + dstSize - 1, FALSE};	// room for '\0'
+	appendRequestHead(&buf, httpMethod, url, paramList, connId, nonce, timestamp, NULL, NULL);
+	if (!buf.overflow)
 	{
-	case httpGET:
-		method = "GET";
-		break;
-	case httpPOST:
-		method = "POST";
-		break;
-	case httpPUT:
-		method = "PUT";
-		break;
-	default: goto out;
+		int len = createSignature(buf.pos, buf.end - buf.pos, method, host, url, nonce, timestamp, paramList);
+		if (len == 0)
+		{
+			return 0;
+		}
+		buf.pos += len;
 	}
+	appendRequestTail(&buf, httpMethod, host, paramList, withBody);
+	return requestDone(&buf, dst);
+}
 
-	char nonce[43];
-	randomAlphanumericString(nonce, 42);
+LOCAL int ICACHE_FLASH_ATTR streamTemplateValid(const char *host)
+{
+	return streamTemplate.valid &&
+		streamTemplate.host == host &&
+		streamTemplate.gzip == connAcceptsGzip(ConnStream) &&
+		oauthSignPrefixValid(&streamTemplate.prefix);
+}
 
-	char timestamp[11];
-	ets_snprintf(timestamp, sizeof(timestamp), "%u", sntp_get_current_timestamp());
+// rendered in httpRequest with placeholder nonce and timestamp,
+// then kept in a buffer of its size
+LOCAL int ICACHE_FLASH_ATTR renderStreamTemplate(const char *host, const ParamList *paramList)
+{
+	StreamTemplate *tpl = &streamTemplate;
+	tpl->valid = FALSE;
+	os_free(tpl->request);
+	tpl->request = NULL;
+
+	char *nonceAt;
+	char *timestampAt;
+	ReqBuf buf = {httpRequest, httpRequest + HTTP_REQ_MAX_LEN - 1, FALSE};
+	appendRequestHead(&buf, httpGET, twitterStreamUrl, paramList, ConnStream,
+			"------------------------------------------", "0000000000",
+			&nonceAt, &timestampAt);
+	char *tail = buf.pos;
+	appendRequestTail(&buf, httpGET, host, paramList, TRUE);
+	if (buf.overflow)
+	{
+		return ERROR;
+	}
 
+	tpl->headLen = tail - httpRequest;
+	tpl->tailLen = buf.pos - tail;
+	tpl->request = (char*)os_malloc(tpl->headLen + tpl->tailLen);
+	if (!tpl->request)
+	{
+		return ERROR;
+	}
+	os_memcpy(tpl->request, httpRequest, tpl->headLen + tpl->tailLen);
+	tpl->nonceOffset = nonceAt - httpRequest;
+	tpl->timestampOffset = timestampAt - httpRequest;
+	tpl->host = host;
+	tpl->gzip = connAcceptsGzip(ConnStream);
+	if (oauthSignPrefixInit(&tpl->prefix, "GET", host, twitterStreamUrl, paramList) != OK)
+	{
+		return ERROR;
+	}
+	tpl->valid = TRUE;
+	stats.templateRenders++;
+	return OK;
+}
 
-	char *pDst = dst;
-	len = ets_snprintf(pDst, dstSize, "%s %s", method, url);
-	if (len < 0 || len >= dstSize) goto out;
-	pDst += len;
-	dstSize -= len;
+LOCAL int ICACHE_FLASH_ATTR formStreamRequest(char *dst, int dstSize, const ParamList *paramList)
+{
+	const StreamTemplate *tpl = &streamTemplate;
+	char nonce[NONCE_LEN+1];
+	randomAlphanumericString(nonce, NONCE_LEN);
 
-	if (httpMethod == httpGET && paramList->count > 0)
+	char timestamp[11];
+	if (uintToStr(sntp_get_current_timestamp(), timestamp) != TIMESTAMP_LEN)
 	{
-		*pDst = '?';
-		pDst++;
-		dstSize--;
-		len = appendParams(pDst, dstSize, paramList);
-		if (len == 0) goto out;
-		pDst += len;
-		dstSize -= len;
+		return 0;
 	}
 
-	len = ets_snprintf(pDst, dstSize,
-			" HTTP/1.1\r\n"
-			"Accept: */*\r\n"
-			//"Connection: close\r\n"
-			"Connection: keep-alive\r\n"
-			"User-Agent: ESP8266\r\n"
-			"Content-Type: application/x-www-form-urlencoded\r\n"
-			"Authorization: OAuth "
-			"oauth_consumer_key=\"%s\", "
-			"oauth_nonce=\"%s\", "
-			"oauth_signature=\"",
-			config.consumer_key, nonce);
-	if (len < 0 || len >= dstSize) goto out;
-	pDst += len;
-	dstSize -= len;
-
-	len = createSignature(pDst, dstSize, method, baseurl, nonce, timestamp, paramList);
-	if (len == 0) goto out;
-	pDst += len;
-	dstSize -= len;
-
-	int contentLen = 0;
-	if (httpMethod == httpPOST || httpMethod == httpPUT)
+	if (tpl->headLen + tpl->tailLen >= dstSize)
 	{
-		contentLen = paramListStrLen(paramList);
+		return 0;
 	}
-    
-	len = ets_snprintf(pDst, dstSize,
-			"\", "		// oauth_signature="",
-			"oauth_signature_method=\"HMAC-SHA1\", "
-			"oauth_timestamp=\"%s\", "
-			"oauth_token=\"%s\", "
-			"oauth_version=\"1.0\"\r\n"
-			"Content-Length: %d\r\n"
-			"Host: %s\r\n\r\n",
-			timestamp, config.access_token,
-			contentLen, host);
-	if (len < 0 || len >= dstSize) goto out;
-	pDst += len;
-	dstSize -= len;
+	os_memcpy(dst, tpl->request, tpl->headLen);
+	os_memcpy(dst + tpl->nonceOffset, nonce, NONCE_LEN);
+	os_memcpy(dst + tpl->timestampOffset, timestamp, TIMESTAMP_LEN);
+
+	ReqBuf buf = {dst + tpl->headLen, dst + dstSize - 1, FALSE};
+	int len = createSignaturePrefixed(buf.pos, buf.end - buf.pos - tpl->tailLen,
+			&tpl->prefix, nonce, timestamp, paramList);
+	if (len == 0)
+	{
+		return 0;
+	}
+	buf.pos += len;
+	appendData(&buf, tpl->request + tpl->headLen, tpl->tailLen);
+	stats.templateUses++;
+	return requestDone(&buf, dst);
+}
+
+// the stream parameters or the credentials have changed
+void ICACHE_FLASH_ATTR twitterStreamChanged(void)
+{
+	streamTemplate.valid = FALSE;
+}
 
-	if (dstSize < contentLen)
+LOCAL int ICACHE_FLASH_ATTR bodyStreamStart(const ParamList *paramList)
+{
+	BodyStream *body = &bodyStream;
+	if (paramList->count > BODY_MAX_PARAMS)
 	{
-		goto out;
+		return ERROR;
 	}
 
-	if (contentLen > 0)
+	int size = 0;
+	int i;
+	for (i = 0; i < paramList->count; i++)
+	{
+		size += os_strlen(paramList->items[i].value) + 1;
+	}
+	body->values = (char*)os_malloc(size);
+	if (!body->values)
+	{
+		return ERROR;
+	}
+	char *value = body->values;
+	for (i = 0; i < paramList->count; i++)
 	{
-		len = appendParams(pDst, dstSize, paramList);
-		if (len == 0) goto out;
-		pDst += len;
-		dstSize -= len;
+		os_strcpy(value, paramList->items[i].value);
+		body->params[i].param = paramList->items[i].param;
+		body->params[i].value = value;
+		value += os_strlen(value) + 1;
 	}
+	body->count = paramList->count;
+	body->param = 0;
+	body->offset = -1;
+	return OK;
+}
 
-	requestLen = pDst - dst;
-	debug("\nrequestLen %d\n", requestLen);
-	debug("%s\n\n", dst);
+// ConnBodyFunc: the next segment encoded into httpRequest
+LOCAL int ICACHE_FLASH_ATTR bodyStreamNext(const char **data)
+{
+	BodyStream *body = &bodyStream;
+	if (!data)		// aborted
+	{
+		os_free(body->values);
+		body->values = NULL;
+		return 0;
+	}
+	char *pos = httpRequest;
+	char *end = httpRequest + HTTP_REQ_MAX_LEN - 1;	// room for '\0'
+	while (body->param < body->count)
+	{
+		const ParamItem *param = &body->params[body->param];
+		if (body->offset < 0)
+		{
+			int nameLen = os_strlen(param->param);
+			if (end - pos < nameLen + 2)
+			{
+				break;
+			}
+			if (body->param > 0)
+			{
+				*pos++ = '&';
+			}
+			os_memcpy(pos, param->param, nameLen);
+			pos += nameLen;
+			*pos++ = '=';
+			body->offset = 0;
+		}
+		int valueLeft = os_strlen(param->value + body->offset);
+		int n = MIN(valueLeft, (end - pos) / 3);	// 3 bytes per character at most
+		if (n > 0)
+		{
+			pos += percentEncode(param->value + body->offset, n, pos, end - pos + 1);
+			body->offset += n;
+		}
+		if (n < valueLeft)
+		{
+			break;		// segment full
+		}
+		body->param++;
+		body->offset = -1;
+	}
 
-out:
-	os_free(baseurl);
-	paramListClearEncodedValues(paramList);
-	return requestLen;
+	if (pos == httpRequest)		// all sent
+	{
+		os_free(body->values);
+		body->values = NULL;
+		return 0;
+	}
+	*data = httpRequest;
+	return pos - httpRequest;
 }
 
-
-int ICACHE_FLASH_ATTR twitterGetUserInfo(const char *host)
+// params in alphabetical order
+LOCAL int ICACHE_FLASH_ATTR sendRequest(ConnId connId, HttpMethod httpMethod,
+		const char *host, const char *url, const ParamItem *params, int count)
 {
-    int rv = ERROR;    
-	ParamList params;
-	os_memset(&params, 0, sizeof(ParamList));
+	ParamList paramList = {params, count};
+	uint t0 = system_get_time();
 	int requestLen = formHttpRequest(httpRequest, HTTP_REQ_MAX_LEN,
-			httpGET, host, twitterVerifyUrl, &params);
-	if (requestLen > 0)
+			httpMethod, host, url, &paramList, connId, TRUE);
+	int streamed = FALSE;
+	if (requestLen == 0 && httpMethod != httpGET && count > 0)
+	{
+		// body too long, the head goes first and the body after it
+		requestLen = formHttpRequest(httpRequest, HTTP_REQ_MAX_LEN,
+				httpMethod, host, url, &paramList, connId, FALSE);
+		streamed = requestLen > 0 && bodyStreamStart(&paramList) == OK;
+		if (!streamed)
+		{
+			requestLen = 0;
+		}
+	}
+	stats.buildTime += system_get_time() - t0;
+	stats.requests++;
+	if (requestLen == 0)
 	{
-		if (espconn_secure_send(&espConn, (uint8*)httpRequest, requestLen) == OK)
-        {
-            rv = OK;            
-        }
+		debug("formHttpRequest failed %s\n", url);
+		stats.failed++;
+		return ERROR;
 	}
-	else
+	stats.maxLen = MAX(stats.maxLen, requestLen);
+	if (streamed)
 	{
-		debug("getUserInfo formHttpRequest failed\n");
+		stats.streamed++;
+		if (connSendStreamed(connId, httpRequest, requestLen, bodyStreamNext) != OK)
+		{
+			bodyStreamNext(NULL);	// head not sent, nor will the body be
+			return ERROR;
+		}
+		return OK;
 	}
-	paramListClear(&params);
-    return rv;
+	return connSend(connId, httpRequest, requestLen);
+}
+
+
+int ICACHE_FLASH_ATTR twitterGetUserInfo(const char *host)
+{
+	return sendRequest(ConnApi, httpGET, host, twitterVerifyUrl, NULL, 0);
 }
 
 int ICACHE_FLASH_ATTR twitterRequestStream(const char *host, const char *track, const char *language, const char *filter)
 {
-    int rv = ERROR;
-	ParamList params;
-	os_memset(&params, 0, sizeof(ParamList));
+	ParamItem params[3];
+	int count = 0;
 	// parameters must be added in alphabetical order
 	if (filter && *filter)
 	{
-		paramListAppend(&params, "filter_level", filter);
+		params[count].param = "filter_level";
+		params[count++].value = filter;
 	}
 	if (language && *language)
 	{
-		paramListAppend(&params, "language", language);
+		params[count].param = "language";
+		params[count++].value = language;
 	}
 	if (track && *track)
 	{
-		paramListAppend(&params, "track", track);
+		params[count].param = "track";
+		params[count++].value = track;
 	}
-	int requestLen = formHttpRequest(httpRequest, HTTP_REQ_MAX_LEN,
-			httpGET, host, twitterStreamUrl, &params);
-	if (requestLen > 0)
+	ParamList paramList = {params, count};
+
+	uint t0 = system_get_time();
+	int requestLen = 0;
+	if (streamTemplateValid(host) || renderStreamTemplate(host, &paramList) == OK)
 	{
-		if (espconn_secure_send(&espConn, (uint8*)httpRequest, requestLen) == OK)
-        {
-            rv = OK;            
-        }
+		requestLen = formStreamRequest(httpRequest, HTTP_REQ_MAX_LEN, &paramList);
 	}
-	else
+	if (requestLen == 0)	// built in full instead
 	{
-		debug("requestStream formHttpRequest failed\n");
+		return sendRequest(ConnStream, httpGET, host, twitterStreamUrl, params, count);
 	}
-	paramListClear(&params);
-    return rv;
+	stats.buildTime += system_get_time() - t0;
+	stats.requests++;
+	stats.maxLen = MAX(stats.maxLen, requestLen);
+	return connSend(ConnStream, httpRequest, requestLen);
 }
 
 int ICACHE_FLASH_ATTR twitterSendDirectMsg(const char *host, const char *text, const char *userId)
 {
-    int rv = ERROR;
-	ParamList params;
-	os_memset(&params, 0, sizeof(ParamList));
-	paramListAppend(&params, "text", text);
-	paramListAppend(&params, "user_id", userId);
-	int requestLen = formHttpRequest(httpRequest, HTTP_REQ_MAX_LEN,
-			httpPOST, host, twitterNewDMUrl, &params);
-	if (requestLen > 0)
-	{
-		if (espconn_secure_send(&espConn, (uint8*)httpRequest, requestLen) == OK)
-        {
-            rv = OK;
-        }
-	}
-	else
-	{
-		debug("sendDirectMsg formHttpRequest failed\n");
-	}
-	paramListClear(&params);
-    return OK;
+	ParamItem params[] = {
+		{"text", text},
+		{"user_id", userId}};
+	return sendRequest(ConnApi, httpPOST, host, twitterNewDMUrl, params, 2);
 }
 
 int ICACHE_FLASH_ATTR twitterRetweetTweet(const char *host, const char *tweetId)
 {
-    int rv = ERROR;
 	char url[80];
 	int len = ets_snprintf(url, sizeof(url), twitterRetweeetUrl, tweetId);
 	if (len < 0 || len >= sizeof(url)) return ERROR;
-
-	ParamList params;
-	os_memset(&params, 0, sizeof(ParamList));
-	int requestLen = formHttpRequest(httpRequest, HTTP_REQ_MAX_LEN,
-			httpPOST, host, url, &params);
-	if (requestLen > 0)
-	{
-		if (espconn_secure_send(&espConn, (uint8*)httpRequest, requestLen) == OK)
-        {
-            rv = OK;
-        }
-	}
-	else
-	{
-		debug("retweetTweet formHttpRequest failed\n");
-	}
-	paramListClear(&params);
-    return rv;
+	return sendRequest(ConnApi, httpPOST, host, url, NULL, 0);
 }
 
 int ICACHE_FLASH_ATTR twitterLikeTweet(const char *host, const char *tweetId)
 {
-    int rv = ERROR;
-	ParamList params;
-	os_memset(&params, 0, sizeof(ParamList));
-	paramListAppend(&params, "id", tweetId);
-	int requestLen = formHttpRequest(httpRequest, HTTP_REQ_MAX_LEN,
-			httpPOST, host, twitterFavoritesUrl, &params);
-	if (requestLen > 0)
-	{
-		if (espconn_secure_send(&espConn, (uint8*)httpRequest, requestLen) == OK)
-        {
-            rv = OK;
-        }
-	}
-	else
-	{
-		debug("likeTweet formHttpRequest failed\n");
-	}
-	paramListClear(&params);
-    return rv;
+	ParamItem params[] = {
+		{"id", tweetId}};
+	return sendRequest(ConnApi, httpPOST, host, twitterFavoritesUrl, params, 1);
 }
 
 int ICACHE_FLASH_ATTR twitterPostTweet(const char *host, const char *text)
 {
-    int rv = ERROR;
-	ParamList params;
-	os_memset(&params, 0, sizeof(ParamList));
-	paramListAppend(&params, "status", text);
-	int requestLen = formHttpRequest(httpRequest, HTTP_REQ_MAX_LEN,
-			httpPOST, host, twitterStatusUrl, &params);
-	if (requestLen > 0)
-	{
-		if (espconn_secure_send(&espConn, (uint8*)httpRequest, requestLen) == OK)
-        {
-            rv = OK;
-        }
-	}
-	else
-	{
-		debug("formHttpRequest failed\n");
-	}
-	paramListClear(&params);
-    return rv;
+	ParamItem params[] = {
+		{"status", text}};
+	return sendRequest(ConnApi, httpPOST, host, twitterStatusUrl, params, 1);
+}
+
+void ICACHE_FLASH_ATTR httpReqPrintStats(void)
+{
+	os_printf("http: %u requests, %u failed, %u us avg build, %u bytes max\n",
+			stats.requests, stats.failed,
+			stats.requests ? stats.buildTime/stats.requests : 0, stats.maxLen);
+	os_printf("http: %u bodies streamed\n", stats.streamed);
+	os_printf("http: stream template %u renders, %u uses, %s\n",
+			stats.templateRenders, stats.templateUses,
+			streamTemplate.valid ? "valid" : "invalid");
 }
 
@@ -7,17 +7,12 @@ typedef struct ParamList ParamList;
 struct ParamItem
 {
 	const char *param;
-	const char *value;
-	char *valueEncoded;
-	int paramLen;
-	int valueLen;
-	ParamItem *next;
+	const char *value;		// not encoded
 };
 
 struct ParamList
 {
-	ParamItem *first;
-	ParamItem *last;
+	const ParamItem *items;	// in alphabetical order
 	int count;
 };
 
@@ -30,10 +25,12 @@ typedef enum{
 
 int twitterGetUserInfo(const char *host);
 int twitterRequestStream(const char *host, const char *track, const char *language, const char *filter);
+void twitterStreamChanged(void);
 int twitterSendDirectMsg(const char *host, const char *text, const char *userId);
 int twitterRetweetTweet(const char *host, const char *tweetId);
 int twitterLikeTweet(const char *host, const char *tweetId);
 int twitterPostTweet(const char *host, const char *text);
+void httpReqPrintStats(void);
 
 
 #endif /* SRC_HTTPREQ_H_ */
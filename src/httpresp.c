@@ -0,0 +1,237 @@
+#include <os_type.h>
+#include <osapi.h>
+#include "common.h"
+#include "httpresp.h"
+
+
+void ICACHE_FLASH_ATTR httpRespInit(HttpResp *resp, HttpBodyFunc bodyFunc, void *arg)
+{
+	os_memset(resp, 0, sizeof(HttpResp));
+	resp->state = HttpRespStatusLine;
+	resp->contentLength = -1;
+	resp->keepAlive = TRUE;		// HTTP/1.1 default
+	resp->rateLimitLimit = -1;
+	resp->rateLimitRemaining = -1;
+	resp->bodyFunc = bodyFunc;
+	resp->arg = arg;
+}
+
+LOCAL uint ICACHE_FLASH_ATTR parseUint(const char *str, int base)
+{
+	uint value = 0;
+	for (;; str++)
+	{
+		int digit;
+		if (*str >= '0' && *str <= '9') digit = *str - '0';
+		else if (base == 16 && *str >= 'a' && *str <= 'f') digit = *str - 'a' + 10;
+		else if (base == 16 && *str >= 'A' && *str <= 'F') digit = *str - 'A' + 10;
+		else break;
+		value = value*base + digit;
+	}
+	return value;
+}
+
+LOCAL const char* ICACHE_FLASH_ATTR skipSpaces(const char *str)
+{
+	while (*str == ' ' || *str == '\t')
+	{
+		str++;
+	}
+	return str;
+}
+
+LOCAL void ICACHE_FLASH_ATTR parseHeader(HttpResp *resp)
+{
+	char *colon = os_strchr(resp->line, ':');
+	if (!colon)
+	{
+		return;
+	}
+	*colon = '\0';
+
+	// header names are case insensitive
+	char *ch;
+	for (ch = resp->line; ch < colon; ch++)
+	{
+		if (*ch >= 'A' && *ch <= 'Z')
+		{
+			*ch += 'a' - 'A';
+		}
+	}
+	const char *name = resp->line;
+	const char *value = skipSpaces(colon+1);
+
+	if (!os_strcmp(name, "content-length"))
+	{
+		resp->contentLength = parseUint(value, 10);
+	}
+	else if (!os_strcmp(name, "transfer-encoding"))
+	{
+		resp->chunked = os_strstr(value, "chunked") != NULL;
+	}
+	else if (!os_strcmp(name, "content-encoding"))
+	{
+		resp->gzip = os_strstr(value, "gzip") != NULL;
+	}
+	else if (!os_strcmp(name, "connection"))
+	{
+		resp->keepAlive = !(value[0] == 'c' || value[0] == 'C');	// close
+	}
+	else if (!os_strcmp(name, "x-rate-limit-limit"))
+	{
+		resp->rateLimitLimit = parseUint(value, 10);
+	}
+	else if (!os_strcmp(name, "x-rate-limit-remaining"))
+	{
+		resp->rateLimitRemaining = parseUint(value, 10);
+	}
+	else if (!os_strcmp(name, "x-rate-limit-reset"))
+	{
+		resp->rateLimitReset = parseUint(value, 10);
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR headersDone(HttpResp *resp)
+{
+	// no body for 1xx, 204 and 304
+	if ((resp->status >= 100 && resp->status < 200) ||
+		resp->status == 204 || resp->status == 304)
+	{
+		resp->state = HttpRespDone;
+	}
+	else if (resp->chunked)
+	{
+		resp->state = HttpRespChunkSize;
+	}
+	else if (resp->contentLength >= 0)
+	{
+		resp->bodyRemaining = resp->contentLength;
+		resp->state = resp->contentLength ? HttpRespBody : HttpRespDone;
+	}
+	else	// body ends when the connection closes
+	{
+		resp->keepAlive = FALSE;
+		resp->state = HttpRespBody;
+	}
+}
+
+// a complete line (without CRLF) is in resp->line
+LOCAL void ICACHE_FLASH_ATTR lineDone(HttpResp *resp)
+{
+	switch (resp->state)
+	{
+	case HttpRespStatusLine:
+		// HTTP/1.1 200 OK
+		if (os_strncmp(resp->line, "HTTP/1.", 7) || resp->lineLen < 12)
+		{
+			resp->state = HttpRespError;
+			break;
+		}
+		resp->status = parseUint(resp->line+9, 10);
+		if (resp->line[7] == '0')
+		{
+			resp->keepAlive = FALSE;	// HTTP/1.0
+		}
+		resp->state = HttpRespHeaders;
+		break;
+	case HttpRespHeaders:
+		if (resp->lineLen == 0)
+		{
+			headersDone(resp);
+		}
+		else
+		{
+			parseHeader(resp);
+		}
+		break;
+	case HttpRespChunkSize:
+		resp->bodyRemaining = parseUint(resp->line, 16);	// extensions after ';' are ignored
+		resp->state = resp->bodyRemaining ? HttpRespChunkData : HttpRespTrailer;
+		break;
+	case HttpRespChunkDataEnd:
+		resp->state = HttpRespChunkSize;
+		break;
+	case HttpRespTrailer:
+		if (resp->lineLen == 0)
+		{
+			resp->state = HttpRespDone;
+		}
+		break;
+	default:
+		break;
+	}
+	resp->lineLen = 0;
+}
+
+// returns number of bytes used, the rest belongs to the next reply
+int ICACHE_FLASH_ATTR httpRespFeed(HttpResp *resp, const char *data, int length)
+{
+	const char *start = data;
+	const char *end = data + length;
+	while (data < end)
+	{
+		switch (resp->state)
+		{
+		case HttpRespBody:
+		case HttpRespChunkData:
+		{
+			int bytes = end - data;
+			if (resp->state == HttpRespChunkData || resp->contentLength >= 0)
+			{
+				bytes = MIN(bytes, resp->bodyRemaining);
+				resp->bodyRemaining -= bytes;
+			}
+			if (resp->bodyFunc && bytes && resp->bodyFunc(resp->arg, data, bytes) != OK)
+			{
+				resp->state = HttpRespError;
+				return data - start;
+			}
+			data += bytes;
+			if (resp->bodyRemaining == 0)
+			{
+				if (resp->state == HttpRespChunkData)
+				{
+					resp->state = HttpRespChunkDataEnd;
+				}
+				else if (resp->contentLength >= 0)
+				{
+					resp->state = HttpRespDone;
+				}
+			}
+			break;
+		}
+		case HttpRespDone:
+		case HttpRespError:
+			return data - start;
+		default:	// line based states
+		{
+			char ch = *data++;
+			if (ch == '\n')
+			{
+				if (resp->lineLen > 0 && resp->line[resp->lineLen-1] == '\r')
+				{
+					resp->lineLen--;
+				}
+				resp->line[resp->lineLen] = '\0';
+				lineDone(resp);
+			}
+			else if (resp->lineLen < HTTP_RESP_LINE_MAX-1)
+			{
+				resp->line[resp->lineLen++] = ch;
+			}
+			break;
+		}
+		}
+	}
+	return data - start;
+}
+
+// connection closed, returns TRUE when this ended a complete reply
+int ICACHE_FLASH_ATTR httpRespFinish(HttpResp *resp)
+{
+	if (resp->state == HttpRespBody && resp->contentLength < 0)
+	{
+		resp->state = HttpRespDone;
+	}
+	return resp->state == HttpRespDone;
+}
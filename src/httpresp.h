@@ -0,0 +1,46 @@
+#ifndef SRC_HTTPRESP_H_
+#define SRC_HTTPRESP_H_
+
+#include "typedefs.h"
+
+#define HTTP_RESP_LINE_MAX		96	// longer header lines are truncated
+
+typedef enum{
+	HttpRespStatusLine,
+	HttpRespHeaders,
+	HttpRespBody,
+	HttpRespChunkSize,
+	HttpRespChunkData,
+	HttpRespChunkDataEnd,	// CRLF after the chunk data
+	HttpRespTrailer,
+	HttpRespDone,
+	HttpRespError
+}HttpRespState;
+
+// called with body bytes as they arrive, chunk framing removed,
+// returning ERROR stops the parser
+typedef int (*HttpBodyFunc)(void *arg, const char *data, int length);
+
+typedef struct{
+	HttpRespState state;
+	int status;
+	int contentLength;		// -1 when not given
+	int chunked;
+	int gzip;				// Content-Encoding
+	int keepAlive;
+	int rateLimitLimit;		// -1 when not given
+	int rateLimitRemaining;	// -1 when not given
+	uint rateLimitReset;	// epoch seconds
+	uint bodyRemaining;		// of the body or the current chunk
+	char line[HTTP_RESP_LINE_MAX];
+	int lineLen;
+	HttpBodyFunc bodyFunc;
+	void *arg;
+}HttpResp;
+
+void httpRespInit(HttpResp *resp, HttpBodyFunc bodyFunc, void *arg);
+int httpRespFeed(HttpResp *resp, const char *data, int length);
+int httpRespFinish(HttpResp *resp);
+
+
+#endif /* SRC_HTTPRESP_H_ */
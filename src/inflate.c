@@ -0,0 +1,635 @@
+#include <os_type.h>
+#include <osapi.h>
+#include <mem.h>
+#include "common.h"
+#include "debug.h"
+#include "inflate.h"
+
+// Streaming gzip/deflate decoder (RFC 1951, RFC 1952).
+// Input may be cut anywhere: every step either has all the bits it
+// needs and consumes them, or consumes nothing and waits for more data.
+
+#define MAX_CODE_LEN		15
+#define NEED_MORE			-1		// from decodeSymbol
+#define BAD_CODE			-2
+
+#define GZIP_FHCRC			0x02
+#define GZIP_FEXTRA			0x04
+#define GZIP_FNAME			0x08
+#define GZIP_FCOMMENT		0x10
+
+typedef enum{
+	InflGzipHeader,
+	InflGzipExtraLen,
+	InflGzipExtra,
+	InflGzipName,
+	InflGzipComment,
+	InflGzipHcrc,
+	InflBlockHeader,
+	InflStoredLen,
+	InflStored,
+	InflTableSizes,
+	InflCodeLenLens,
+	InflCodeLens,
+	InflLength,			// literal/length symbol with its extra bits
+	InflDistance,		// distance symbol with its extra bits, then the copy
+	InflTrailer,
+	InflDone,
+	InflError
+}InflateState;
+
+typedef struct{
+	ushort counts[MAX_CODE_LEN+1];	// number of codes of each length
+	ushort *symbols;				// ordered by code
+}HuffTable;
+
+struct Inflater{
+	InflateState state;
+	uint bitBuf;
+	int bitCount;
+	const uchar *in;
+	const uchar *inEnd;
+
+	int final;			// last block of the member
+	int flags;			// gzip header flags
+	uint counter;		// header bytes, stored bytes, code lengths
+	uint isize;			// from the trailer
+
+	int hlit;
+	int hdist;
+	int hclen;
+	uchar lens[288+32];
+	ushort litSymbols[288];
+	ushort distSymbols[32];	// also holds the code length code
+	HuffTable lit;
+	HuffTable dist;
+	int length;			// of the match waiting for its distance
+
+	uint total;			// bytes out
+	uchar *window;		// allocated right after the struct
+	uint windowSize;
+	uint windowPos;
+	uint flushPos;		// first window byte not yet given to outFunc
+	InflateOutFunc outFunc;
+	void *arg;
+};
+
+LOCAL const ushort lengthBase[29] = {
+	3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+LOCAL const uchar lengthExtra[29] = {
+	0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+LOCAL const ushort distBase[30] = {
+	1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,
+	1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+LOCAL const uchar distExtra[30] = {
+	0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+LOCAL const uchar codeLenOrder[19] = {
+	16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+
+Inflater* ICACHE_FLASH_ATTR inflateNew(int windowBits, InflateOutFunc outFunc, void *arg)
+{
+	if (windowBits > INFLATE_MAX_WINDOW_BITS)
+	{
+		return NULL;
+	}
+	uint windowSize = 1 << windowBits;
+	Inflater *inf = (Inflater*)os_malloc(sizeof(Inflater) + windowSize);
+	if (!inf)
+	{
+		return NULL;
+	}
+	os_memset(inf, 0, sizeof(Inflater));
+	inf->window = (uchar*)(inf+1);
+	inf->windowSize = windowSize;
+	inf->state = InflGzipHeader;
+	inf->lit.symbols = inf->litSymbols;
+	inf->dist.symbols = inf->distSymbols;
+	inf->outFunc = outFunc;
+	inf->arg = arg;
+	return inf;
+}
+
+void ICACHE_FLASH_ATTR inflateFree(Inflater *inf)
+{
+	os_free(inf);
+}
+
+int ICACHE_FLASH_ATTR inflateIsDone(const Inflater *inf)
+{
+	return inf->state == InflDone;
+}
+
+LOCAL void ICACHE_FLASH_ATTR fillBits(Inflater *inf)
+{
+	while (inf->bitCount <= 24 && inf->in < inf->inEnd)
+	{
+		inf->bitBuf |= (uint)*inf->in++ << inf->bitCount;
+		inf->bitCount += 8;
+	}
+}
+
+// n <= 16, caller has checked that bitCount >= n
+LOCAL uint ICACHE_FLASH_ATTR takeBits(Inflater *inf, int n)
+{
+	uint value = inf->bitBuf & ((1 << n) - 1);
+	inf->bitBuf >>= n;
+	inf->bitCount -= n;
+	return value;
+}
+
+// one whole byte, FALSE when there is none
+LOCAL int ICACHE_FLASH_ATTR takeByte(Inflater *inf, uint *value)
+{
+	fillBits(inf);
+	if (inf->bitCount < 8)
+	{
+		return FALSE;
+	}
+	*value = takeBits(inf, 8);
+	return TRUE;
+}
+
+LOCAL int ICACHE_FLASH_ATTR buildTable(HuffTable *table, const uchar *lens, int num)
+{
+	ushort offsets[MAX_CODE_LEN+1];
+	int i;
+	os_memset(table->counts, 0, sizeof(table->counts));
+	for (i = 0; i < num; i++)
+	{
+		table->counts[lens[i]]++;
+	}
+	table->counts[0] = 0;
+
+	int left = 1;
+	offsets[1] = 0;
+	for (i = 1; i <= MAX_CODE_LEN; i++)
+	{
+		left = (left << 1) - table->counts[i];
+		if (left < 0)
+		{
+			return ERROR;	// over-subscribed
+		}
+		if (i < MAX_CODE_LEN)
+		{
+			offsets[i+1] = offsets[i] + table->counts[i];
+		}
+	}
+	for (i = 0; i < num; i++)
+	{
+		if (lens[i])
+		{
+			table->symbols[offsets[lens[i]]++] = i;
+		}
+	}
+	return OK;
+}
+
+// canonical codes are walked one bit at a time, bits are only
+// consumed when the whole code is in the bit buffer
+LOCAL int ICACHE_FLASH_ATTR decodeSymbol(Inflater *inf, const HuffTable *table)
+{
+	int code = 0;
+	int first = 0;
+	int len;
+	for (len = 1; len <= MAX_CODE_LEN; len++)
+	{
+		if (len > inf->bitCount)
+		{
+			return NEED_MORE;
+		}
+		code = 2*code + ((inf->bitBuf >> (len-1)) & 1);
+		first += table->counts[len];
+		code -= table->counts[len];
+		if (code < 0)
+		{
+			takeBits(inf, len);
+			return table->symbols[first + code];
+		}
+	}
+	return BAD_CODE;
+}
+
+LOCAL void ICACHE_FLASH_ATTR flushWindow(Inflater *inf)
+{
+	if (inf->windowPos > inf->flushPos)
+	{
+		inf->outFunc(inf->arg, (const char*)&inf->window[inf->flushPos], inf->windowPos - inf->flushPos);
+	}
+	inf->flushPos = inf->windowPos & (inf->windowSize-1);
+	inf->windowPos = inf->flushPos;
+}
+
+LOCAL void ICACHE_FLASH_ATTR putByte(Inflater *inf, uchar byte)
+{
+	inf->window[inf->windowPos++] = byte;
+	inf->total++;
+	if (inf->windowPos == inf->windowSize)
+	{
+		flushWindow(inf);
+	}
+}
+
+LOCAL int ICACHE_FLASH_ATTR copyMatch(Inflater *inf, int length, uint distance)
+{
+	if (distance > inf->total || distance > inf->windowSize)
+	{
+		debug("inflate: distance %u beyond window\n", distance);
+		return ERROR;
+	}
+	while (length--)
+	{
+		putByte(inf, inf->window[(inf->windowPos - distance) & (inf->windowSize-1)]);
+	}
+	return OK;
+}
+
+LOCAL void ICACHE_FLASH_ATTR fixedTables(Inflater *inf)
+{
+	int i;
+	for (i = 0; i < 144; i++) inf->lens[i] = 8;
+	for (; i < 256; i++) inf->lens[i] = 9;
+	for (; i < 280; i++) inf->lens[i] = 7;
+	for (; i < 288; i++) inf->lens[i] = 8;
+	buildTable(&inf->lit, inf->lens, 288);
+	for (i = 0; i < 30; i++) inf->lens[i] = 5;
+	buildTable(&inf->dist, inf->lens, 30);
+}
+
+// gzip member header, fields we don't need are skipped
+LOCAL InflateState ICACHE_FLASH_ATTR gzipHeaderStep(Inflater *inf)
+{
+	uint byte;
+	switch (inf->state)
+	{
+	case InflGzipHeader:
+		while (inf->counter < 10)
+		{
+			if (!takeByte(inf, &byte))
+			{
+				return InflGzipHeader;
+			}
+			if ((inf->counter == 0 && byte != 0x1f) ||
+				(inf->counter == 1 && byte != 0x8b) ||
+				(inf->counter == 2 && byte != 8))	// deflate
+			{
+				return InflError;
+			}
+			if (inf->counter == 3)
+			{
+				inf->flags = byte;
+			}
+			inf->counter++;
+		}
+		inf->counter = 0;
+		return InflGzipExtraLen;
+	case InflGzipExtraLen:
+		if (!(inf->flags & GZIP_FEXTRA))
+		{
+			return InflGzipName;
+		}
+		fillBits(inf);
+		if (inf->bitCount < 16)
+		{
+			return InflGzipExtraLen;
+		}
+		inf->counter = takeBits(inf, 16);
+		return InflGzipExtra;
+	case InflGzipExtra:
+		while (inf->counter)
+		{
+			if (!takeByte(inf, &byte))
+			{
+				return InflGzipExtra;
+			}
+			inf->counter--;
+		}
+		return InflGzipName;
+	case InflGzipName:
+	case InflGzipComment:
+		if (inf->flags & (inf->state == InflGzipName ? GZIP_FNAME : GZIP_FCOMMENT))
+		{
+			do
+			{
+				if (!takeByte(inf, &byte))
+				{
+					return inf->state;
+				}
+			} while (byte);
+		}
+		return inf->state == InflGzipName ? InflGzipComment : InflGzipHcrc;
+	case InflGzipHcrc:
+		if (inf->flags & GZIP_FHCRC)
+		{
+			fillBits(inf);
+			if (inf->bitCount < 16)
+			{
+				return InflGzipHcrc;
+			}
+			takeBits(inf, 16);
+		}
+		return InflBlockHeader;
+	default:
+		return InflError;
+	}
+}
+
+LOCAL InflateState ICACHE_FLASH_ATTR blockHeaderStep(Inflater *inf)
+{
+	fillBits(inf);
+	if (inf->bitCount < 3)
+	{
+		return InflBlockHeader;
+	}
+	inf->final = takeBits(inf, 1);
+	switch (takeBits(inf, 2))
+	{
+	case 0:
+		takeBits(inf, inf->bitCount & 7);	// stored block starts at a byte boundary
+		return InflStoredLen;
+	case 1:
+		fixedTables(inf);
+		return InflLength;
+	case 2:
+		return InflTableSizes;
+	default:
+		return InflError;
+	}
+}
+
+LOCAL InflateState ICACHE_FLASH_ATTR storedStep(Inflater *inf)
+{
+	if (inf->state == InflStoredLen)
+	{
+		fillBits(inf);
+		if (inf->bitCount < 32)
+		{
+			return InflStoredLen;
+		}
+		uint len = takeBits(inf, 16);
+		uint nlen = takeBits(inf, 16);
+		if (len != (~nlen & 0xffff))
+		{
+			return InflError;
+		}
+		inf->counter = len;
+	}
+
+	// bytes already in the bit buffer first, then straight from the input
+	while (inf->counter && inf->bitCount >= 8)
+	{
+		putByte(inf, takeBits(inf, 8));
+		inf->counter--;
+	}
+	while (inf->counter && inf->in < inf->inEnd)
+	{
+		putByte(inf, *inf->in++);
+		inf->counter--;
+	}
+	if (inf->counter)
+	{
+		return InflStored;
+	}
+	return inf->final ? InflTrailer : InflBlockHeader;
+}
+
+LOCAL InflateState ICACHE_FLASH_ATTR dynamicTablesStep(Inflater *inf)
+{
+	switch (inf->state)
+	{
+	case InflTableSizes:
+		fillBits(inf);
+		if (inf->bitCount < 14)
+		{
+			return InflTableSizes;
+		}
+		inf->hlit = takeBits(inf, 5) + 257;
+		inf->hdist = takeBits(inf, 5) + 1;
+		inf->hclen = takeBits(inf, 4) + 4;
+		if (inf->hlit > 286 || inf->hdist > 30)
+		{
+			return InflError;
+		}
+		os_memset(inf->lens, 0, 19);
+		inf->counter = 0;
+		// fallthrough
+	case InflCodeLenLens:
+		while ((int)inf->counter < inf->hclen)
+		{
+			fillBits(inf);
+			if (inf->bitCount < 3)
+			{
+				return InflCodeLenLens;
+			}
+			inf->lens[codeLenOrder[inf->counter++]] = takeBits(inf, 3);
+		}
+		// code length code lives in the distance table until that is built
+		if (buildTable(&inf->dist, inf->lens, 19) != OK)
+		{
+			return InflError;
+		}
+		inf->counter = 0;
+		// fallthrough
+	case InflCodeLens:
+		while ((int)inf->counter < inf->hlit + inf->hdist)
+		{
+			fillBits(inf);
+			uint savedBuf = inf->bitBuf;
+			int savedCount = inf->bitCount;
+			int sym = decodeSymbol(inf, &inf->dist);
+			if (sym == NEED_MORE)
+			{
+				return InflCodeLens;
+			}
+			if (sym == BAD_CODE)
+			{
+				return InflError;
+			}
+			if (sym < 16)
+			{
+				inf->lens[inf->counter++] = sym;
+				continue;
+			}
+
+			int extraBits = sym == 16 ? 2 : sym == 17 ? 3 : 7;
+			if (inf->bitCount < extraBits)
+			{
+				// symbol is decoded again with its extra bits
+				inf->bitBuf = savedBuf;
+				inf->bitCount = savedCount;
+				return InflCodeLens;
+			}
+			int repeat = takeBits(inf, extraBits) + (sym == 16 ? 3 : sym == 17 ? 3 : 11);
+			uchar len = 0;
+			if (sym == 16)
+			{
+				if (!inf->counter)
+				{
+					return InflError;
+				}
+				len = inf->lens[inf->counter-1];
+			}
+			if (inf->counter + repeat > (uint)(inf->hlit + inf->hdist))
+			{
+				return InflError;
+			}
+			while (repeat--)
+			{
+				inf->lens[inf->counter++] = len;
+			}
+		}
+		if (!inf->lens[256] ||
+			buildTable(&inf->lit, inf->lens, inf->hlit) != OK ||
+			buildTable(&inf->dist, inf->lens + inf->hlit, inf->hdist) != OK)
+		{
+			return InflError;
+		}
+		return InflLength;
+	default:
+		return InflError;
+	}
+}
+
+// the hot loop, most of the input goes through here
+LOCAL InflateState ICACHE_FLASH_ATTR codesStep(Inflater *inf)
+{
+	for (;;)
+	{
+		fillBits(inf);
+		uint savedBuf = inf->bitBuf;
+		int savedCount = inf->bitCount;
+
+		if (inf->state == InflLength)
+		{
+			int sym = decodeSymbol(inf, &inf->lit);
+			if (sym == NEED_MORE)
+			{
+				return InflLength;
+			}
+			if (sym < 256)
+			{
+				if (sym == BAD_CODE)
+				{
+					return InflError;
+				}
+				putByte(inf, sym);
+				continue;
+			}
+			if (sym == 256)		// end of block
+			{
+				return inf->final ? InflTrailer : InflBlockHeader;
+			}
+			sym -= 257;
+			if (sym >= 29)
+			{
+				return InflError;
+			}
+			if (inf->bitCount < lengthExtra[sym])
+			{
+				inf->bitBuf = savedBuf;
+				inf->bitCount = savedCount;
+				return InflLength;
+			}
+			inf->length = lengthBase[sym] + takeBits(inf, lengthExtra[sym]);
+			inf->state = InflDistance;
+			fillBits(inf);
+			savedBuf = inf->bitBuf;
+			savedCount = inf->bitCount;
+		}
+
+		int sym = decodeSymbol(inf, &inf->dist);
+		if (sym == NEED_MORE)
+		{
+			return InflDistance;
+		}
+		if (sym == BAD_CODE || sym >= 30)
+		{
+			return InflError;
+		}
+		if (inf->bitCount < distExtra[sym])
+		{
+			inf->bitBuf = savedBuf;
+			inf->bitCount = savedCount;
+			return InflDistance;
+		}
+		uint distance = distBase[sym] + takeBits(inf, distExtra[sym]);
+		if (copyMatch(inf, inf->length, distance) != OK)
+		{
+			return InflError;
+		}
+		inf->state = InflLength;
+	}
+}
+
+LOCAL InflateState ICACHE_FLASH_ATTR trailerStep(Inflater *inf)
+{
+	uint byte;
+	takeBits(inf, inf->bitCount & 7);	// trailer starts at a byte boundary
+	while (inf->counter < 8)
+	{
+		if (!takeByte(inf, &byte))
+		{
+			return InflTrailer;
+		}
+		// CRC-32 is not checked, the size is enough to notice truncation
+		if (inf->counter >= 4)
+		{
+			inf->isize |= byte << (8*(inf->counter-4));
+		}
+		inf->counter++;
+	}
+	return inf->isize == inf->total ? InflDone : InflError;
+}
+
+// returns ERROR when the data is not valid gzip or needs a bigger window
+int ICACHE_FLASH_ATTR inflateFeed(Inflater *inf, const char *data, int length)
+{
+	inf->in = (const uchar*)data;
+	inf->inEnd = inf->in + length;
+
+	InflateState prevState;
+	do
+	{
+		prevState = inf->state;
+		switch (inf->state)
+		{
+		case InflGzipHeader:
+		case InflGzipExtraLen:
+		case InflGzipExtra:
+		case InflGzipName:
+		case InflGzipComment:
+		case InflGzipHcrc:
+			inf->state = gzipHeaderStep(inf);
+			break;
+		case InflBlockHeader:
+			inf->state = blockHeaderStep(inf);
+			break;
+		case InflStoredLen:
+		case InflStored:
+			inf->state = storedStep(inf);
+			break;
+		case InflTableSizes:
+		case InflCodeLenLens:
+		case InflCodeLens:
+			inf->state = dynamicTablesStep(inf);
+			break;
+		case InflLength:
+		case InflDistance:
+			inf->state = codesStep(inf);
+			break;
+		case InflTrailer:
+			inf->state = trailerStep(inf);
+			break;
+		case InflDone:
+		case InflError:
+			break;
+		}
+		if (inf->state == InflTrailer && prevState != InflTrailer)
+		{
+			inf->counter = 0;	// trailer bytes
+		}
+	} while (inf->state != prevState && inf->state != InflDone && inf->state != InflError);
+
+	flushWindow(inf);
+	return inf->state == InflError ? ERROR : OK;
+}
@@ -0,0 +1,21 @@
+#ifndef SRC_INFLATE_H_
+#define SRC_INFLATE_H_
+
+#include "typedefs.h"
+
+// servers compress with a 32 KB window, a smaller one is enough when the
+// whole output fits in it, references further back are an error
+#define INFLATE_MAX_WINDOW_BITS	15
+
+typedef struct Inflater Inflater;
+
+// called with inflated data, in pieces of at most the window size
+typedef void (*InflateOutFunc)(void *arg, const char *data, int length);
+
+Inflater* inflateNew(int windowBits, InflateOutFunc outFunc, void *arg);
+void inflateFree(Inflater *inf);
+int inflateFeed(Inflater *inf, const char *data, int length);
+int inflateIsDone(const Inflater *inf);
+
+
+#endif /* SRC_INFLATE_H_ */
@@ -0,0 +1,261 @@
+#include <os_type.h>
+#include <osapi.h>
+#include <user_interface.h>
+#include <spi_flash.h>
+#include "config.h"
+#include "debug.h"
+#include "apisched.h"
+#include "journal.h"
+
+// Actions are appended to the active sector and marked done in place,
+// flash bits only go from 1 to 0 for that. When the sector is full the
+// pending ones are moved to the other sector, so every record slot of
+// both sectors is written once per erase.
+
+#define JOURNAL_MAGIC			0x10A1E7AC
+#define JOURNAL_FREE			0xFFFFFFFF
+#define JOURNAL_PENDING			0x5A5AFFFF
+#define JOURNAL_DONE			0x5A5A0000	// pending with bits cleared
+
+#define JOURNAL_ARG_SIZE		((API_ARG_SIZE+3) & ~3)
+
+typedef struct{
+	uint magic;
+	uint generation;	// sector with the higher one is active
+	uint reserved[2];
+}JournalHeader;
+
+typedef struct{
+	uint state;
+	uint seq;
+	uint endpoint;
+	char arg[JOURNAL_ARG_SIZE];
+}JournalRecord;
+
+#define JOURNAL_RECORDS			((SPI_FLASH_SEC_SIZE - sizeof(JournalHeader)) / sizeof(JournalRecord))
+
+LOCAL int activeSector = 0;		// 0 .. JOURNAL_FLASH_SECTORS-1
+LOCAL uint generation = 0;
+LOCAL uint nextRecord = 0;		// first free slot
+LOCAL uint nextSeq = 1;
+
+LOCAL uint appended = 0;
+LOCAL uint completed = 0;
+LOCAL uint compactions = 0;
+LOCAL uint erases = 0;
+
+
+LOCAL uint ICACHE_FLASH_ATTR sectorAddr(int sector)
+{
+	return (JOURNAL_FLASH_SECTOR + sector) * SPI_FLASH_SEC_SIZE;
+}
+
+LOCAL uint ICACHE_FLASH_ATTR recordAddr(int sector, uint index)
+{
+	return sectorAddr(sector) + sizeof(JournalHeader) + index*sizeof(JournalRecord);
+}
+
+LOCAL void ICACHE_FLASH_ATTR readRecord(int sector, uint index, JournalRecord *record)
+{
+	spi_flash_read(recordAddr(sector, index), (uint*)record, sizeof(JournalRecord));
+}
+
+// a record interrupted by a reset is neither free nor pending
+LOCAL int ICACHE_FLASH_ATTR isBlank(const JournalRecord *record)
+{
+	const uint *word = (const uint*)record;
+	uint i;
+	for (i = 0; i < sizeof(JournalRecord)/sizeof(uint); i++)
+	{
+		if (word[i] != JOURNAL_FREE)
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// records are written before the header, the sector is not active until then
+LOCAL void ICACHE_FLASH_ATTR eraseSector(int sector)
+{
+	spi_flash_erase_sector(JOURNAL_FLASH_SECTOR + sector);
+	erases++;
+	activeSector = sector;
+	nextRecord = 0;
+}
+
+// the magic last, like the state word of a record: with only the magic
+// written the generation would stay 0xFFFFFFFF and win over every later one
+LOCAL void ICACHE_FLASH_ATTR writeHeader(int sector)
+{
+	JournalHeader header;
+	os_memset(&header, 0xFF, sizeof(JournalHeader));
+	header.magic = JOURNAL_MAGIC;
+	header.generation = ++generation;
+	spi_flash_write(sectorAddr(sector) + sizeof(uint), (uint*)&header + 1, sizeof(JournalHeader) - sizeof(uint));
+	spi_flash_write(sectorAddr(sector), &header.magic, sizeof(uint));
+}
+
+// body first, the state word last: a record only counts once it is whole
+LOCAL void ICACHE_FLASH_ATTR writeRecord(const JournalRecord *record)
+{
+	uint addr = recordAddr(activeSector, nextRecord++);
+	spi_flash_write(addr + sizeof(uint), (uint*)record + 1, sizeof(JournalRecord) - sizeof(uint));
+	spi_flash_write(addr, (uint*)&record->state, sizeof(uint));
+}
+
+void ICACHE_FLASH_ATTR journalInit(void)
+{
+	JournalHeader header;
+	int sector;
+	int found = FALSE;
+	for (sector = 0; sector < JOURNAL_FLASH_SECTORS; sector++)
+	{
+		spi_flash_read(sectorAddr(sector), (uint*)&header, sizeof(JournalHeader));
+		if (header.magic == JOURNAL_MAGIC && (!found || header.generation > generation))
+		{
+			found = TRUE;
+			activeSector = sector;
+			generation = header.generation;
+		}
+	}
+	if (!found)
+	{
+		eraseSector(0);
+		writeHeader(0);
+		return;
+	}
+
+	JournalRecord record;
+	uint i;
+	nextRecord = JOURNAL_RECORDS;
+	for (i = 0; i < JOURNAL_RECORDS; i++)
+	{
+		readRecord(activeSector, i, &record);
+		if (isBlank(&record))
+		{
+			nextRecord = i;
+			break;
+		}
+		if (record.state != JOURNAL_FREE && record.seq >= nextSeq)
+		{
+			nextSeq = record.seq + 1;
+		}
+	}
+}
+
+// moves pending records to the other sector, a reset before its header
+// is written leaves the old sector active with all its records
+LOCAL void ICACHE_FLASH_ATTR compact(void)
+{
+	int from = activeSector;
+	int to = (activeSector + 1) % JOURNAL_FLASH_SECTORS;
+	eraseSector(to);
+	compactions++;
+
+	JournalRecord record;
+	uint i;
+	for (i = 0; i < JOURNAL_RECORDS; i++)
+	{
+		readRecord(from, i, &record);
+		if (record.state == JOURNAL_PENDING)
+		{
+			writeRecord(&record);
+		}
+	}
+	writeHeader(to);
+}
+
+// seq identifies the record for journalDone, an identical
+// pending action is not written again
+int ICACHE_FLASH_ATTR journalAdd(int endpoint, const char *arg, uint *seq)
+{
+	if (os_strlen(arg) >= JOURNAL_ARG_SIZE)
+	{
+		return ERROR;
+	}
+
+	JournalRecord record;
+	uint i;
+	for (i = 0; i < nextRecord; i++)
+	{
+		readRecord(activeSector, i, &record);
+		if (record.state == JOURNAL_PENDING && record.endpoint == endpoint &&
+			!os_strncmp(record.arg, arg, JOURNAL_ARG_SIZE))
+		{
+			*seq = record.seq;
+			return OK;
+		}
+	}
+
+	if (nextRecord >= JOURNAL_RECORDS)
+	{
+		compact();
+		if (nextRecord >= JOURNAL_RECORDS)
+		{
+			return ERROR;	// all of them still pending
+		}
+	}
+
+	os_memset(&record, 0, sizeof(JournalRecord));
+	record.state = JOURNAL_PENDING;
+	record.seq = nextSeq++;
+	record.endpoint = endpoint;
+	os_strcpy(record.arg, arg);
+	writeRecord(&record);
+	appended++;
+	*seq = record.seq;
+	return OK;
+}
+
+void ICACHE_FLASH_ATTR journalDone(uint seq)
+{
+	JournalRecord record;
+	uint i;
+	for (i = 0; i < nextRecord; i++)
+	{
+		readRecord(activeSector, i, &record);
+		if (record.state == JOURNAL_PENDING && record.seq == seq)
+		{
+			uint state = JOURNAL_DONE;
+			spi_flash_write(recordAddr(activeSector, i), &state, sizeof(uint));
+			completed++;
+			return;
+		}
+	}
+}
+
+// pending records in the order they were added
+void ICACHE_FLASH_ATTR journalReplay(JournalReplayFunc replayFunc)
+{
+	JournalRecord record;
+	uint i;
+	for (i = 0; i < nextRecord; i++)
+	{
+		readRecord(activeSector, i, &record);
+		if (record.state == JOURNAL_PENDING)
+		{
+			record.arg[JOURNAL_ARG_SIZE-1] = '\0';
+			replayFunc(record.seq, record.endpoint, record.arg);
+		}
+	}
+}
+
+void ICACHE_FLASH_ATTR journalPrintStats(void)
+{
+	uint pending = 0;
+	JournalRecord record;
+	uint i;
+	for (i = 0; i < nextRecord; i++)
+	{
+		readRecord(activeSector, i, &record);
+		if (record.state == JOURNAL_PENDING)
+		{
+			pending++;
+		}
+	}
+	os_printf("journal: sector %d, generation %u, %u/%u records used, %u pending\n",
+			JOURNAL_FLASH_SECTOR + activeSector, generation, nextRecord, (uint)JOURNAL_RECORDS, pending);
+	os_printf("journal: %u appended, %u done, %u compactions, %u erases\n",
+			appended, completed, compactions, erases);
+}
@@ -0,0 +1,15 @@
+#ifndef SRC_JOURNAL_H_
+#define SRC_JOURNAL_H_
+
+#include "typedefs.h"
+
+typedef void (*JournalReplayFunc)(uint seq, int endpoint, const char *arg);
+
+void journalInit(void);
+int journalAdd(int endpoint, const char *arg, uint *seq);
+void journalDone(uint seq);
+void journalReplay(JournalReplayFunc replayFunc);
+void journalPrintStats(void);
+
+
+#endif /* SRC_JOURNAL_H_ */
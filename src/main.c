@@ -23,6 +23,13 @@
 #include "display.h"
 #include "menu.h"
 #include "mpu6500.h"
+#include "orientation.h"
+#include "spibus.h"
+#include "conn.h"
+#include "dnscache.h"
+#include "apisched.h"
+#include "journal.h"
+#include "mute.h"
 
 
 
@@ -48,7 +55,7 @@ typedef struct
 TweetInfo curTweet = {{0},0,0,0,0,0,0};
 
 LOCAL ushort *trackWstr = NULL;
-LOCAL StrList trackList = {NULL, 0};
+LOCAL KeywordTrie trackWords = {NULL, 0};
 void createTrackList(const char *trackStr);
 
 typedef enum{
@@ -62,62 +69,30 @@ TitleState titleState = titleStateNoTitle;
 LOCAL os_timer_t titleStateTmr;
 
 LOCAL os_timer_t gpTmr;
-LOCAL os_timer_t httpRxTmr;
 LOCAL os_timer_t buttonsTmr;
 LOCAL os_timer_t screenSaverTmr;
-LOCAL os_timer_t accelTmr;
-extern os_timer_t scrollTmr;
 
 LOCAL int mutePeriod = 0;
 LOCAL uint lastTweetRecvTs = 0;
 
-#define HTTP_RX_BUF_SIZE	8192
-char httpMsgRxBuf[HTTP_RX_BUF_SIZE];
-int httpRxMsgCurLen = 0;
-
-const uint dnsCheckInterval = 100;
-
-struct espconn espConn = {0};
-LOCAL struct _esp_tcp espConnTcp = {0};
-
-
-LOCAL void getUserInfo(void);
-LOCAL void parseApiReply(void);
+LOCAL void requestUserInfo(void);
+LOCAL void parseApiReply(const ApiAction *action, const HttpResp *resp, char *data, int length);
+LOCAL int getUserInfo(const char *arg);
+LOCAL int sendDirectMsg(const char *msg);
+LOCAL int retweet(const char *tweetId);
+LOCAL int like(const char *tweetId);
+LOCAL const ApiSendFunc apiSendFuncs[ApiEndpointCount] = {getUserInfo, sendDirectMsg, retweet, like};
 LOCAL void requestStream(void);
-LOCAL void parseStreamReply(void);
-
-typedef struct
-{
-	const char *host;
-	ip_addr_t ip;
-	void (*requestFunc)(void);
-	void (*parserFunc)(void);
-}ConnParams;
-ConnParams apiConnParams = {"api.twitter.com", {0}, getUserInfo, parseApiReply};
-ConnParams streamConnParams = {"userstream.twitter.com", {0}, requestStream, parseStreamReply};
-
-LOCAL int disconnExpected = FALSE;
-LOCAL int reconnCbCalled = FALSE;
+LOCAL void parseStreamReply(const HttpResp *resp, char *data, int length);
 
 LOCAL void connectToWiFiAP(void);
 LOCAL void checkWiFiConnStatus(void);
 LOCAL void checkSntpSync(void);
-LOCAL void connectToHost(ConnParams *params);
-LOCAL void connectFirstTime(ConnParams *params);
-LOCAL void checkDnsStatus(void *arg);
-LOCAL void getHostByNameCb(const char *name, ip_addr_t *ipaddr, void *arg);
-LOCAL void onTcpConnected(void *arg);
-LOCAL void onTcpDataSent(void *arg);
-LOCAL void onTcpDataRecv(void *arg, char *pusrdata, unsigned short length);
-LOCAL void onTcpDisconnected(void *arg);
-LOCAL void reconnect(void);
-LOCAL void onTcpReconnCb(void *arg, sint8 err);
 LOCAL void titleTmrCb(void);
 LOCAL void buttonsScanTmrCb(void);
 LOCAL void drawTwitterLogo(void);
 LOCAL void wakeupDisplay(void);
 LOCAL void screenSaverTmrCb(void);
-LOCAL void accelTmrCb(void);
 
 
 typedef enum{
@@ -142,11 +117,11 @@ LOCAL void ICACHE_FLASH_ATTR setAppState(AppState newState)
 void user_init(void)
 {
 	os_timer_disarm(&gpTmr);
-	os_timer_disarm(&httpRxTmr);
+	connInit(ConnStream, "userstream.twitter.com", parseStreamReply);
+	apiSchedInit("api.twitter.com", apiSendFuncs, parseApiReply);
 
 	os_timer_disarm(&titleStateTmr);
 	os_timer_setfn(&titleStateTmr, (os_timer_func_t*)titleTmrCb, NULL);
-	os_timer_disarm(&scrollTmr);
 
 	os_timer_disarm(&buttonsTmr);
 	os_timer_setfn(&buttonsTmr, (os_timer_func_t*)buttonsScanTmrCb, NULL);
@@ -154,9 +129,6 @@ void user_init(void)
 	os_timer_disarm(&screenSaverTmr);
 	os_timer_setfn(&screenSaverTmr, (os_timer_func_t*)screenSaverTmrCb, NULL);
 
-	os_timer_disarm(&accelTmr);
-	os_timer_setfn(&accelTmr, (os_timer_func_t*)accelTmrCb, NULL);
-
 	//uart_init(BIT_RATE_115200, BIT_RATE_115200);
 	uart_init(BIT_RATE_921600, BIT_RATE_921600);
 
@@ -166,9 +138,15 @@ void user_init(void)
 //configInit(&config);
 //configWrite(&config);
 	configRead(&config);
+	dnsCacheInit();
+	journalInit();
+	connSetStallTimeout(ConnStream, config.stallTimeout);
+	connSetIdleTimeout(ConnApi, config.apiIdleTimeout);
+	connSetGzip(ConnStream, config.gzipEn);
+	connSetGzip(ConnApi, config.gzipEn);
 
-	os_memset(&trackList, 0, sizeof(StrList));
 	createTrackList(config.trackStr);
+	muteSetRules(config.muteStr);
 	
 	debug("Built on %s %s\n", __DATE__, __TIME__);
 	debug("SDK version %s\n", system_get_sdk_version());
@@ -178,15 +156,13 @@ void user_init(void)
 
 	spi_init(HSPI, 20, 5, FALSE);	// spi clock = 800 kHz
 
-	// same spi settings for SSD1322 and MPU6500
-	// data is valid on clock trailing edge
-	// clock is high when inactive
-	spi_mode(HSPI, 1, 1);
+	// per device clock, mode and CS are set by spibus.c
+	spiBusInit();
 
 	if (mpu6500_init() == OK)
 	{
-		// accelerometer found -> read values twice per second
-		os_timer_arm(&accelTmr, 500, 1);
+		// accelerometer found -> orientation is read only when it moves
+		orientInit();
 	}
 
 	SSD1322_init();
@@ -261,39 +237,14 @@ LOCAL void ICACHE_FLASH_ATTR checkSntpSync(void)
 	}
 
 	// time synced -> connect to Twitter
-	connectFirstTime(&apiConnParams);
-}
-
-LOCAL void ICACHE_FLASH_ATTR connectToHost(ConnParams *params)
-{
-    setAppState(stateConnectToHost);
-        
-	espConn.reverse = params;
-	if (espConn.state == ESPCONN_CONNECT)		// if we are currently connected to some host -> disconnect
-	{											// and try to connect when disconnection occurs
-		disconnExpected = TRUE;
-		// disconnect should not be called directly from here
-		os_timer_setfn(&gpTmr, (os_timer_func_t*)espconn_secure_disconnect, &espConn);
-		os_timer_arm(&gpTmr, 100, 0);
-	}
-	else	// we are currently not connected to any host
-	{
-		if (params->ip.addr)	// we have ip of the host
-		{
-			// use this ip and try to connect
-			os_memcpy(&espConn.proto.tcp->remote_ip, &params->ip.addr, 4);
-			reconnect();
-		}
-		else	// we don't yet have ip of the host
-		{
-			connectFirstTime(params);
-		}
-	}
+	requestUserInfo();
+	apiSchedReplay();
 }
 
 void ICACHE_FLASH_ATTR connectToStreamHost(void)	// called from config.c
 {
-	connectToHost(&streamConnParams);
+	setAppState(stateConnectToHost);
+	connRestart(ConnStream, requestStream);
 }
 
 void ICACHE_FLASH_ATTR connectToApiHost(void)	// called from config.c
@@ -301,295 +252,88 @@ void ICACHE_FLASH_ATTR connectToApiHost(void)	// called from config.c
 	if (config.consumer_key[0] && config.access_token[0] &&
 		config.consumer_secret[0] && config.token_secret[0])
 	{
-		connectToHost(&apiConnParams);
-	}
-}
-
-LOCAL void ICACHE_FLASH_ATTR connectFirstTime(ConnParams *params)
-{
-	// connection with AP established -> get openweathermap server ip
-	//setAppState(stateGetTwitterIp);
-
-	espConn.proto.tcp = &espConnTcp;
-	espConn.type = ESPCONN_TCP;
-	espConn.state = ESPCONN_NONE;
-	espConn.reverse = params;
-	//serverIp.addr = 0;
-	//espconn_gethostbyname(&tcpSock, twitterApiHost, &serverIp, getHostByNameCb);
-	//espconn_gethostbyname(&tcpSock, twitterStreamHost, &serverIp, getHostByNameCb);
-
-	// register callbacks
-	espconn_regist_connectcb(&espConn, onTcpConnected);
-	espconn_regist_reconcb(&espConn, onTcpReconnCb);
-
-	espconn_gethostbyname(&espConn, params->host, &params->ip, getHostByNameCb);
-
-	os_timer_setfn(&gpTmr, (os_timer_func_t*)checkDnsStatus, params);
-	os_timer_arm(&gpTmr, dnsCheckInterval, 0);
-}
-
-LOCAL void ICACHE_FLASH_ATTR checkDnsStatus(void *arg)
-{
-    //struct espconn *pespconn = arg;
-	ConnParams *params = arg;
-    //if (appState == stateGetTwitterIp)
-    {
-		//espconn_gethostbyname(pespconn, twitterApiHost, &serverIp, getHostByNameCb);
-		espconn_gethostbyname(&espConn, params->host, &params->ip, getHostByNameCb);
-		os_timer_arm(&gpTmr, dnsCheckInterval, 0);
-    }
-}
-
-LOCAL void ICACHE_FLASH_ATTR getHostByNameCb(const char *name, ip_addr_t *ipaddr, void *arg)
-{
-    struct espconn *pespconn = (struct espconn *)arg;
-    ConnParams *params = pespconn->reverse;
-	os_timer_disarm(&gpTmr);
-
-	if (params->ip.addr != 0)
-	{
-		debug("getHostByNameCb serverIp != 0\n");
-		return;
+		requestUserInfo();
 	}
-	if (ipaddr == NULL || ipaddr->addr == 0)
-	{
-		debug("getHostByNameCb ip NULL\n");
-		return;
-	}
-	debug("getHostByNameCb ip: "IPSTR"\n", IP2STR(ipaddr));
-    
-	// connect to host
-	params->ip.addr = ipaddr->addr;
-	os_memcpy(pespconn->proto.tcp->remote_ip, &ipaddr->addr, 4);
-	pespconn->proto.tcp->remote_port = 443;	// use HTTPS port
-	pespconn->proto.tcp->local_port = espconn_port();	// get next free local port number
-	
-	espconn_secure_set_size(ESPCONN_CLIENT, 8192);
-	int rv = espconn_secure_connect(pespconn);	// tcp SSL connect
-	debug("espconn_secure_connect %d\n", rv);
-
-	os_timer_setfn(&gpTmr, (os_timer_func_t*)reconnect, 0);
-	os_timer_arm(&gpTmr, 10000, 0);
 }
 
-LOCAL void ICACHE_FLASH_ATTR onTcpConnected(void *arg)
-{
-    setAppState(stateConnected);
-    
-	debug("onTcpConnected\n");
-	struct espconn *pespconn = arg;
-	ConnParams *params = pespconn->reverse;
-	os_timer_disarm(&gpTmr);
-	// register callbacks
-	espconn_regist_recvcb(pespconn, onTcpDataRecv);
-	espconn_regist_sentcb(pespconn, onTcpDataSent);
-	espconn_regist_disconcb(pespconn, onTcpDisconnected);
 
-	params->requestFunc();
-	reconnCbCalled = FALSE;
-}
 
-LOCAL void ICACHE_FLASH_ATTR onTcpDataSent(void *arg)
-{
-	debug("onTcpDataSent\n");
-}
-
-
-LOCAL char* ICACHE_FLASH_ATTR findNewline(char *str, int length)
+void ICACHE_FLASH_ATTR createTrackList(const char *trackStr)
 {
-	while (length > 1)
+	int trackLen = os_strlen(trackStr);
+	int trackConvSize = trackLen+1;
+	os_free(trackWstr);
+	clearKeywordTrie(&trackWords);
+	trackWstr = (ushort*)os_malloc(trackConvSize*sizeof(ushort));
+	if (trackWstr)
 	{
-		if (*str == '\r' && *(str+1) == '\n')
+		trackLen = u8_toucs(trackWstr, trackConvSize, trackStr, trackLen);
+		if (trackLen > 0)
 		{
-			return str;
+			keywordTrieBuild(trackWstr, &trackWords);
 		}
-		str++;
-		length--;
 	}
-	return NULL;
 }
 
-LOCAL int ICACHE_FLASH_ATTR copyFilterNewlines(char *dst, int dstSize, char *src, int srcLen)
+LOCAL void ICACHE_FLASH_ATTR requestStream(void)
 {
-	char *pDst = dst;
-	char *prevNewline = src;
-	while (dstSize > 0 && srcLen > 0)
-	{
-		char *newline = findNewline(src, srcLen);
-		if (newline)
-		{
-			int diff = newline-prevNewline;
-			if (diff <= 6)
-			{
-				src += (diff+2);
-				srcLen -= (diff+2);
-			}
-			else
-			{
-				int bytes = MIN(dstSize, diff);
-				os_memcpy(pDst, src, bytes);
-				pDst += bytes;
-				src += bytes;
-				dstSize -= bytes;
-				srcLen -= bytes;
-			}
-			prevNewline = newline;
-		}
-		else	// no more newlines, copy rest
-		{
-			int bytes = MIN(dstSize, srcLen);
-			os_memcpy(pDst, src, bytes);
-			pDst += bytes;
-			src += bytes;
-			dstSize -= bytes;
-			srcLen -= bytes;
-		}
-	}
-	return (pDst-dst);
+    setAppState(stateConnected);
+    twitterRequestStream(connHost(ConnStream), 
+        config.trackStr, config.language, config.filter);
 }
 
-LOCAL void ICACHE_FLASH_ATTR onTcpDataRecv(void *arg, char *pusrdata, unsigned short length)
+LOCAL int ICACHE_FLASH_ATTR getUserInfo(const char *arg)
 {
-	debug("onTcpDataRecv %d\n", length);
-	os_timer_disarm(&httpRxTmr);
-	
-	ConnParams *params = espConn.reverse;
-	int spaceLeft = (HTTP_RX_BUF_SIZE-httpRxMsgCurLen-1);
-	httpRxMsgCurLen += copyFilterNewlines(httpMsgRxBuf+httpRxMsgCurLen, spaceLeft, pusrdata, length);
-	if (httpRxMsgCurLen > 0)
-	{
-		if (httpRxMsgCurLen < (HTTP_RX_BUF_SIZE-1))
-		{			
-			os_timer_setfn(&httpRxTmr, (os_timer_func_t*)params->parserFunc, NULL);
-			os_timer_arm(&httpRxTmr, 1000, 0);
-		}
-		else
-		{
-			debug("httpMsgRxBuf full\n");
-			params->parserFunc();
-		}
-	}
+    return twitterGetUserInfo(connHost(ConnApi));
 }
 
-LOCAL void ICACHE_FLASH_ATTR onTcpDisconnected(void *arg)
+LOCAL int ICACHE_FLASH_ATTR sendDirectMsg(const char *msg)
 {
-	// on unexpected disconnection the following might happen:
-	// usually: only onTcpReconnCb is called
-	// sometimes: only onTcpDisconnected is called
-	// rarely: both onTcpReconnCb and onTcpDisconnected are called
-
-	struct espconn *pespconn = arg;
-	ConnParams *params = pespconn->reverse;
-	debug("onTcpDisconnected\n");
-	debug("disconnExpected %d\n", disconnExpected);
-	if (!disconnExpected)	// we got unexpectedly disconnected
-	{
-		debug("reconnCbCalled %d\n", reconnCbCalled);
-		if (reconnCbCalled)		// if onTcpReconnCb was also called
-		{						// just ignore this callback
-			reconnCbCalled = FALSE;
-			return;
-		}
-
-		// onTcpReconnCb was not called -> try to reconnect from here
-		if (params != &streamConnParams)	// but only if we are reading stream
-		{
-			return;
-		}
-	}
-	else
-	{
-		disconnExpected = FALSE;
-	}
-
-	if (appState == stateMuted)		// don't reconnect when muted
-	{
-		return;
-	}
-
-	// in all other cases -> try to reconnect
-	if (params->ip.addr)	// we have ip of the host
-	{
-		// use this ip and try to connect
-		os_memcpy(&espConn.proto.tcp->remote_ip, &params->ip.addr, 4);
-		reconnect();
-	}
-	else	// we don't yet have ip of the host
-	{
-		connectFirstTime(params);
-	}
+    return twitterSendDirectMsg(connHost(ConnApi), msg, curUser.idStr);
 }
 
-LOCAL void ICACHE_FLASH_ATTR onTcpReconnCb(void *arg, sint8 err)
+LOCAL int ICACHE_FLASH_ATTR retweet(const char *tweetId)
 {
-	debug("onTcpReconnCb\n");
-
-	// ok, something went wrong and we got disconnected
-	// try to reconnect in 5 sec
-	os_timer_disarm(&gpTmr);
-	os_timer_setfn(&gpTmr, (os_timer_func_t*)reconnect, 0);
-	os_timer_arm(&gpTmr, 5000, 0);
-	reconnCbCalled = TRUE;
+    return twitterRetweetTweet(connHost(ConnApi), tweetId);
 }
 
-LOCAL void ICACHE_FLASH_ATTR reconnect(void)
-{
-	debug("reconnect\n");
-	int rv = espconn_secure_connect(&espConn);
-	debug("espconn_secure_connect %d\n", rv);
-
-	os_timer_disarm(&gpTmr);
-	os_timer_setfn(&gpTmr, (os_timer_func_t*)reconnect, 0);
-	os_timer_arm(&gpTmr, 10000, 0);
-}
-
-
-
-void ICACHE_FLASH_ATTR createTrackList(const char *trackStr)
+LOCAL int ICACHE_FLASH_ATTR like(const char *tweetId)
 {
-	int trackLen = os_strlen(trackStr);
-	int trackConvSize = trackLen+1;
-	os_free(trackWstr);
-	trackWstr = (ushort*)os_malloc(trackConvSize*sizeof(ushort));
-	if (trackWstr)
-	{
-		trackLen = u8_toucs(trackWstr, trackConvSize, trackStr, trackLen);
-		if (trackLen > 0)
-		{
-			clearStrList(&trackList);
-			strSplit(trackWstr, &trackList);
-		}
-	}
-}
-
-LOCAL void ICACHE_FLASH_ATTR requestStream(void)
-{    
-    twitterRequestStream(streamConnParams.host, 
-        config.trackStr, config.language, config.filter);
+    return twitterLikeTweet(connHost(ConnApi), tweetId);
 }
 
-LOCAL void ICACHE_FLASH_ATTR getUserInfo(void)
+LOCAL void ICACHE_FLASH_ATTR requestUserInfo(void)
 {
-    twitterGetUserInfo(apiConnParams.host);
+	apiSchedAdd(ApiUserInfo, "");
 }
 
+// menu actions are queued with the tweet they were selected for,
+// shown tweet may change before they are sent
 void ICACHE_FLASH_ATTR shareCurrentTweet(void)
 {
-	char msg[130];
+	char msg[API_ARG_SIZE];
 	int len = ets_snprintf(msg, sizeof(msg), "https://twitter.com/%s/status/%s", curTweet.user.screenName, curTweet.idStr);
-	if (len < 0 || len >= sizeof(msg)) return;
-
-    twitterSendDirectMsg(apiConnParams.host, msg, curUser.idStr);
+	if (len < 0 || len >= sizeof(msg) ||
+		apiSchedAdd(ApiDirectMsg, msg) != OK)
+	{
+		menu1execDone(ERROR);
+	}
 }
 
 void ICACHE_FLASH_ATTR retweetCurrentTweet(void)
 {
-    twitterRetweetTweet(apiConnParams.host, curTweet.idStr);
+	if (apiSchedAdd(ApiRetweet, curTweet.idStr) != OK)
+	{
+		menu1execDone(ERROR);
+	}
 }
 
 void ICACHE_FLASH_ATTR likeCurrentTweet(void)
 {
-    twitterLikeTweet(apiConnParams.host, curTweet.idStr);
+	if (apiSchedAdd(ApiLike, curTweet.idStr) != OK)
+	{
+		menu1execDone(ERROR);
+	}
 }
 
 
@@ -645,15 +389,15 @@ LOCAL void ICACHE_FLASH_ATTR drawTwitterLogo(void)
 }
 
 
-LOCAL int ICACHE_FLASH_ATTR parseTweet(TweetInfo *tweet, ushort **text)
+LOCAL int ICACHE_FLASH_ATTR parseTweet(char *data, int length, TweetInfo *tweet, ushort **text)
 {	
-	char *json = (char*)os_strstr(httpMsgRxBuf, "{\"created_at\"");
+	char *json = (char*)os_strstr(data, "{\"created_at\"");
 	if (!json)
 	{
 		return ERROR;
 	}
 	
-	int jsonLen = httpRxMsgCurLen - (json - httpMsgRxBuf);
+	int jsonLen = length - (json - data);
 	//debug("jsonLen %d\n", jsonLen);
 	
 	const int jsonValBufSize = 1024;
@@ -723,26 +467,35 @@ LOCAL void ICACHE_FLASH_ATTR showTweet(const TweetInfo *tweet, const ushort *tex
 {
 	os_timer_disarm(&titleStateTmr);
 	//os_timer_disarm(&scrollTmr);
-	dispSetActiveMemBuf(MainMemBuf);
-	dispFillMem(0, DISP_HEIGHT);
+	dispSetActiveMemBuf(CanvasMemBuf);
+	dispFillMem(0, CANVAS_HEIGHT);
 
-	if (!drawStrWordWrapped(0, TITLE_HEIGHT, DISP_WIDTH-1, DISP_HEIGHT-1, text, &arial13, &arial13b, &trackList, FALSE))
+	// prefer the big font, if the tweet doesn't fit on the screen
+	// lay it out over the whole canvas and let the user page through it
+	int canvasHeight = DISP_HEIGHT;
+	int textHeight = 0;
+	if (!drawStrWordWrapped(0, TITLE_HEIGHT, DISP_WIDTH-1, DISP_HEIGHT-1, text, &arial13, &arial13b, &trackWords, FALSE, NULL))
 	{
-		drawStrWordWrapped(0, TITLE_HEIGHT, DISP_WIDTH-1, DISP_HEIGHT-1, text, &arial10, &arial10b, &trackList, TRUE);
+		if (!drawStrWordWrapped(0, TITLE_HEIGHT, DISP_WIDTH-1, CANVAS_HEIGHT-1, text, &arial13, &arial13b, &trackWords, FALSE, &textHeight))
+		{
+			drawStrWordWrapped(0, TITLE_HEIGHT, DISP_WIDTH-1, CANVAS_HEIGHT-1, text, &arial10, &arial10b, &trackWords, TRUE, &textHeight);
+		}
+		canvasHeight = TITLE_HEIGHT + textHeight;
 	}
 
 	drawUserName(0, 0, &tweet->user);
+	dispSetActiveMemBuf(MainMemBuf);
 
 	uint ts = sntp_get_current_timestamp();
 	if (((ts - lastTweetRecvTs) < 5) || !config.dispScrollEn)
 	{
 		// if tweets are coming fast -> don't animate
-		dispUpdate(dispScrollCurLine == 0 ? Page0 : Page1);
+		dispRefresh(canvasHeight);
 		os_timer_arm(&titleStateTmr, TITLE_STATE_INTERVAL, 0);
 	}
 	else
 	{
-		scrollDisplay();
+		scrollDisplay(canvasHeight);
 	}
 	lastTweetRecvTs = ts;
 
@@ -751,21 +504,29 @@ LOCAL void ICACHE_FLASH_ATTR showTweet(const TweetInfo *tweet, const ushort *tex
 }
 
 
-LOCAL void ICACHE_FLASH_ATTR parseStreamReply(void)
+LOCAL void ICACHE_FLASH_ATTR parseStreamReply(const HttpResp *resp, char *data, int length)
 {
+	if (resp->status != 200)
+	{
+		// error message, connection is closed by the server
+		debug("stream status %d\n", resp->status);
+		return;
+	}
 	if (menuState != MenuHidden)
 	{
 		// ignore new tweets while menu is shown
-		httpRxMsgCurLen = 0;
 		return;
 	}
 
-	debug("parseStreamReply, len %d\n", httpRxMsgCurLen);
-	httpMsgRxBuf[httpRxMsgCurLen] = '\0';
-	//debug("%s\n", httpMsgRxBuf);
+	debug("parseStreamReply, len %d\n", length);
+	//debug("%s\n", data);
+	if (muteCheck(data, length))
+	{
+		return;
+	}
     
 	ushort *text = NULL;
-	if (parseTweet(&curTweet, &text) == OK && text)
+	if (parseTweet(data, length, &curTweet, &text) == OK && text)
 	{
 		showTweet(&curTweet, text);
 		os_free(text);
@@ -773,23 +534,21 @@ LOCAL void ICACHE_FLASH_ATTR parseStreamReply(void)
 	else
 	{
 		debug("NO TWEET FOUND\n");
-		if (httpRxMsgCurLen < 200)
-			debug("%s\n", httpMsgRxBuf);
+		if (length < 200)
+			debug("%s\n", data);
 	}
 	debug("free heap %d\n", system_get_free_heap_size());
-	
-	httpRxMsgCurLen = 0;
 }
 
-LOCAL int ICACHE_FLASH_ATTR parseCurUserName(void)
+LOCAL int ICACHE_FLASH_ATTR parseCurUserName(char *data, int length)
 {
-	char *json = (char*)os_strstr(httpMsgRxBuf, "{\"");
+	char *json = (char*)os_strstr(data, "{\"");
 	if (!json)
 	{
 		return ERROR;
 	}
 
-	int jsonLen = httpRxMsgCurLen - (json - httpMsgRxBuf);
+	int jsonLen = length - (json - data);
 
 	const int jsonValBufSize = 1024;
 	char *jsonValBuf = (char*)os_malloc(jsonValBufSize);
@@ -845,33 +604,58 @@ LOCAL void ICACHE_FLASH_ATTR showStreamReqParams(void)
 	xPos = drawStr_Latin(&arial10b, 0, 53, "Filter: ", -1);
 	drawStr_Latin(&arial10, xPos, 55, config.filter[0] ? config.filter : "none", -1);
 
-	scrollDisplay();
+	scrollDisplay(DISP_HEIGHT);
 	wakeupDisplay();
 }
 
-LOCAL void ICACHE_FLASH_ATTR parseApiReply(void)
+LOCAL void ICACHE_FLASH_ATTR parseApiReply(const ApiAction *action, const HttpResp *resp, char *data, int length)
 {
-	debug("parseApiReply, len %d\n", httpRxMsgCurLen);
-	httpMsgRxBuf[httpRxMsgCurLen] = '\0';
-	//debug("%s\n", httpMsgRxBuf);
+	if (!resp)	// rate limited, sent when the window resets
+	{
+		if (action->endpoint == ApiUserInfo)
+		{
+			if (!connIsConnected(ConnStream))
+			{
+				connectToStreamHost();
+			}
+		}
+		else
+		{
+			menu1execDone(MENU_EXEC_QUEUED);
+		}
+		return;
+	}
+
+	debug("parseApiReply, status %d, len %d\n", resp->status, length);
+	//debug("%s\n", data);
 
-	if (apiConnParams.requestFunc == getUserInfo)	// this is a reply to user info request
+	if (action->deferred)
+	{
+		// menu is long gone and the stream already runs
+		if (action->endpoint == ApiUserInfo && resp->status == 200)
+		{
+			parseCurUserName(data, length);
+		}
+	}
+	else if (action->endpoint == ApiUserInfo)	// this is a reply to user info request
 	{
-		if (parseCurUserName() == OK)
+		if (resp->status == 200 && parseCurUserName(data, length) == OK)
 		{
 			showStreamReqParams();
 		}
+		// (re)start stream with the verified user
+		connectToStreamHost();
 	}
-	else if (apiConnParams.requestFunc == shareCurrentTweet)
+	else if (action->endpoint == ApiDirectMsg)
 	{
-		char *ok = (char*)os_strstr(httpMsgRxBuf, "HTTP/1.1 200 OK");
-		menu1execDone(ok ? OK : ERROR);
+		menu1execDone(resp->status == 200 ? OK : ERROR);
 	}
-	else if (apiConnParams.requestFunc == retweetCurrentTweet ||
-			 apiConnParams.requestFunc == likeCurrentTweet)		// this is a reply to retweet or like request
+	else if (action->endpoint == ApiRetweet ||
+			 action->endpoint == ApiLike)		// this is a reply to retweet or like request
 	{
 		ushort *text = NULL;
-		if (parseTweet(&curTweet, &text) == OK && text)
+		if (resp->status == 200 &&
+			parseTweet(data, length, &curTweet, &text) == OK && text)
 		{
 			showTweet(&curTweet, text);
 			os_free(text);
@@ -883,11 +667,8 @@ LOCAL void ICACHE_FLASH_ATTR parseApiReply(void)
 			menu1execDone(ERROR);
 		}
 	}
-	httpRxMsgCurLen = 0;
-
-	//connectToHost(&streamConnParams);
-	os_timer_setfn(&gpTmr, (os_timer_func_t*)connectToHost, &streamConnParams);
-	os_timer_arm(&gpTmr, 1000, 0);
+	// stream gave its TLS session up for the request,
+	// conn reopens it once the REST replies are in
 }
 
 
@@ -956,11 +737,16 @@ void ICACHE_FLASH_ATTR displayScrollDone(void)
 	}
 }
 
+void ICACHE_FLASH_ATTR pagerScrollDone(void)
+{
+	os_timer_arm(&titleStateTmr, TITLE_STATE_INTERVAL, 0);
+}
+
 
 LOCAL void ICACHE_FLASH_ATTR unmuteDisplay(void)
 {
 	os_timer_disarm(&gpTmr);
-	connectToHost(&streamConnParams);
+	connectToStreamHost();
 }
 
 LOCAL void ICACHE_FLASH_ATTR unmuteTmrCb(void)
@@ -976,12 +762,7 @@ LOCAL void ICACHE_FLASH_ATTR muteDisplay(int period)
 {
 	setAppState(stateMuted);
 
-	ConnParams *params = espConn.reverse;
-	if (espConn.state != ESPCONN_NONE)
-	{
-		disconnExpected = TRUE;
-		espconn_secure_disconnect(&espConn);
-	}
+	connClose(ConnStream);
 
 	//dispSetActiveMemBuf(MainMemBuf);
 	//dispFillMem(0, DISP_HEIGHT);
@@ -1012,7 +793,7 @@ LOCAL Button adcValToButton(uint16 adcVal)
 
 LOCAL void ICACHE_FLASH_ATTR buttonsScanTmrCb(void)
 {
-	if (dispScrollCurLine != 0 && dispScrollCurLine != 64)
+	if (dispIsScrolling())
 	{
 		return;		// currently scrolling new tweet, ignore buttons
 	}
@@ -1033,7 +814,13 @@ LOCAL void ICACHE_FLASH_ATTR buttonsScanTmrCb(void)
 			else if (displayState == stateOn)
 			{
 				os_timer_disarm(&titleStateTmr);
-				menuStateMachine(buttons);
+				// long tweet: Button1 pages down, Button2 pages up,
+				// menus are activated on the last/first page
+				if (menuState != MenuHidden || !dispPagerScroll(buttons == Button1))
+				{
+					dispPagerHome();	// menus are drawn over the title
+					menuStateMachine(buttons);
+				}
 			}
 			wakeupDisplay();
 		}
@@ -1042,8 +829,9 @@ LOCAL void ICACHE_FLASH_ATTR buttonsScanTmrCb(void)
 
 void ICACHE_FLASH_ATTR menu1execCb(void *arg)
 {
-	apiConnParams.requestFunc = arg;
-	connectToHost(&apiConnParams);
+	// action is queued, the stream is closed while it is sent
+	// and reopened after its reply
+	((void (*)(void))arg)();
 }
 
 void ICACHE_FLASH_ATTR menu2execCb(void *arg)
@@ -1074,16 +862,3 @@ LOCAL void ICACHE_FLASH_ATTR screenSaverTmrCb(void)
 	}
 }
 
-
-LOCAL void ICACHE_FLASH_ATTR accelTmrCb(void)
-{
-	sint16 x = accelReadX();
-	if (x < -8192 && dispOrient != orient180deg)
-	{
-		dispSetOrientation(orient180deg);
-	}
-	else if (x > 8192 && dispOrient != orient0deg)
-	{
-		dispSetOrientation(orient0deg);
-	}
-}
@@ -9,6 +9,7 @@
 #include "menu.h"
 #include "graphics.h"
 #include "display.h"
+#include "anim.h"
 
 
 extern void menu1execCb(void *arg);
@@ -18,8 +19,6 @@ extern void retweetCurrentTweet(void);
 extern void likeCurrentTweet(void);
 extern void drawCurTweetUserName(void);
 
-extern os_timer_t scrollTmr;
-
 #define SCROLL_INTERVAL		10
 
 
@@ -105,40 +104,41 @@ LOCAL void ICACHE_FLASH_ATTR menuExecSelection(Menu *menu)
 	menu->exec(menu->items[menu->selected].arg);
 }
 
-LOCAL void ICACHE_FLASH_ATTR scrollMenuIn(void *arg)
+LOCAL int firstScrollStep = FALSE;
+LOCAL int ICACHE_FLASH_ATTR menuScrollStep(void)
 {
-	if (dispTitleScrollStep((int)arg))
-	{
-		os_timer_disarm(&scrollTmr);
-	}
-	dispUpdateTitle();
+	int done = dispTitleScrollStep(firstScrollStep);
+	firstScrollStep = FALSE;
+	animInvalidate(ANIM_DIRTY_TITLE);
+	return done;
 }
 
-LOCAL void ICACHE_FLASH_ATTR scrollMenuOut(void *arg)
+LOCAL int ICACHE_FLASH_ATTR scrollMenuIn(void)
 {
-	if (dispTitleScrollStep((int)arg))
-	{
-		os_timer_disarm(&scrollTmr);
-	}
+	return menuScrollStep() ? 0 : SCROLL_INTERVAL;
+}
+
+LOCAL int ICACHE_FLASH_ATTR scrollMenuOut(void)
+{
+	int done = menuScrollStep();
 	drawStrHighlight_Latin(&arial10b, curMenu->selectedPos, 0, curMenu->items[curMenu->selected].text);
-	dispUpdateTitle();
+	return done ? 0 : SCROLL_INTERVAL;
 }
 
-LOCAL void ICACHE_FLASH_ATTR scrollUserName(void *arg)
+LOCAL int ICACHE_FLASH_ATTR scrollUserName(void)
 {
-	if (dispTitleScrollStep((int)arg))
+	if (menuScrollStep())
 	{
-		os_timer_disarm(&scrollTmr);
 		menuState = MenuHidden;
+		return 0;
 	}
-	dispUpdateTitle();
+	return SCROLL_INTERVAL;
 }
 
-LOCAL void ICACHE_FLASH_ATTR startScroll(os_timer_func_t *func)
+LOCAL void ICACHE_FLASH_ATTR startScroll(AnimStepFunc step)
 {
-	func((void*)TRUE);
-	os_timer_setfn(&scrollTmr, func, FALSE);
-	os_timer_arm(&scrollTmr, SCROLL_INTERVAL, 1);
+	firstScrollStep = TRUE;
+	animStart(AnimChanTitle, step, 0);
 }
 
 LOCAL void ICACHE_FLASH_ATTR menuHide(void)
@@ -156,14 +156,14 @@ LOCAL void ICACHE_FLASH_ATTR menuDelayedHide(int delay)
 	os_timer_arm(&menuTmr, delay, 0);
 }
 
-LOCAL void ICACHE_FLASH_ATTR scrollStatus(void *arg)
+LOCAL int ICACHE_FLASH_ATTR scrollStatus(void)
 {
-	if (dispTitleScrollStep((int)arg))
+	if (menuScrollStep())
 	{
-		os_timer_disarm(&scrollTmr);
 		menuDelayedHide(3000);
+		return 0;
 	}
-	dispUpdateTitle();
+	return SCROLL_INTERVAL;
 }
 
 
@@ -191,7 +191,7 @@ void ICACHE_FLASH_ATTR menuStateMachine(Button buttons)
 
 		menuState = MenuShow;
 		curMenu->selected = 0;
-		os_timer_disarm(&scrollTmr);
+		animStop(AnimChanTitle);
 		menuDraw(curMenu, SecondaryMemBuf);
 		startScroll(scrollMenuIn);
 
@@ -202,7 +202,7 @@ void ICACHE_FLASH_ATTR menuStateMachine(Button buttons)
 		if (buttons == selectButton)
 		{
 			debug("selectButton\n");
-			os_timer_disarm(&scrollTmr);
+			animStop(AnimChanTitle);
 			menuIncSelection(curMenu);
 			menuDraw(curMenu, MainMemBuf);
 			dispUpdateTitle();
@@ -213,7 +213,7 @@ void ICACHE_FLASH_ATTR menuStateMachine(Button buttons)
 		{
 			debug("okButton\n");
 			menuState = MenuExec;
-			os_timer_disarm(&scrollTmr);
+			animStop(AnimChanTitle);
 			dispSetActiveMemBuf(SecondaryMemBuf);
 			dispFillMem(0, TITLE_HEIGHT);
 			dispSetActiveMemBuf(MainMemBuf);
@@ -231,6 +231,7 @@ void ICACHE_FLASH_ATTR menuStateMachine(Button buttons)
 void ICACHE_FLASH_ATTR menu1execDone(int rc)
 {
 	const char *text = rc == OK ? menu1.items[menu1.selected].okText :
+					   rc == MENU_EXEC_QUEUED ? "Queued, sent later" :
 								  menu1.items[menu1.selected].failedText;
 	if (text)
 	{
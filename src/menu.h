@@ -17,6 +17,9 @@ typedef enum{
 	Button2
 }Button;
 
+// action is sent later, besides OK and ERROR
+#define MENU_EXEC_QUEUED	1
+
 void menuStateMachine(Button buttons);
 void menu1execDone(int rc);
 void menu2execDone(int rc);
@@ -5,13 +5,22 @@
 #include <gpio.h>
 #include <mem.h>
 #include "drivers/spi.h"
+#include "spibus.h"
 #include "mpu6500.h"
 
 
 // MPU6500 register offsets
+#define REG_ACCEL_CONFIG2	0x1D
+#define REG_LP_ACCEL_ODR	0x1E
+#define REG_WOM_THR			0x1F
+#define REG_INT_PIN_CFG		0x37
+#define REG_INT_ENABLE		0x38
+#define REG_INT_STATUS		0x3A
 #define REG_ACCEL_XOUT_H	0x3B
+#define REG_MOT_DETECT_CTRL	0x69
 #define REG_USER_CTRL		0x6A
 #define REG_PWR_MGMT_1		0x6B
+#define REG_PWR_MGMT_2		0x6C
 #define REG_WHO_AM_I		0x75
 
 // MPU6500 CS pin
@@ -26,6 +35,7 @@ LOCAL uint8 ICACHE_FLASH_ATTR mpu6500_read8(uint8 offset)
 	GPIO_OUTPUT_SET(MPU_CS_GPIO, 0);
 	value = spi_transaction(HSPI, 0, 0, 8, 0x80 | offset, 0, 0, 8, 0);
 	GPIO_OUTPUT_SET(MPU_CS_GPIO, 1);
+	spiBusStats[SpiDevAccel].bits += 16;
 	return value;
 }
 
@@ -35,6 +45,7 @@ LOCAL uint16 ICACHE_FLASH_ATTR mpu6500_read16(uint8 offset)
 	GPIO_OUTPUT_SET(MPU_CS_GPIO, 0);
 	value = spi_transaction(HSPI, 0, 0, 8, 0x80 | offset, 0, 0, 16, 0);
 	GPIO_OUTPUT_SET(MPU_CS_GPIO, 1);
+	spiBusStats[SpiDevAccel].bits += 24;
 	return value;
 }
 
@@ -43,6 +54,7 @@ LOCAL void ICACHE_FLASH_ATTR mpu6500_write(uint8 offset, uint8 value)
 	GPIO_OUTPUT_SET(MPU_CS_GPIO, 0);
 	spi_transaction(HSPI, 0, 0, 8, offset, 8, value, 0, 0);
 	GPIO_OUTPUT_SET(MPU_CS_GPIO, 1);
+	spiBusStats[SpiDevAccel].bits += 16;
 }
 
 int ICACHE_FLASH_ATTR mpu6500_init(void)
@@ -51,9 +63,7 @@ int ICACHE_FLASH_ATTR mpu6500_init(void)
 	GPIO_OUTPUT_SET(MPU_CS_GPIO, 1);
 	PIN_FUNC_SELECT(MPU_CS_MUX, MPU_CS_FUNC);
 
-	// backup current spi config
-	spi_conf_regs regs;
-	spi_get_conf_regs(&regs);
+	spiBusSelect(SpiDevAccel);
 
 	if (mpu6500_read8(REG_WHO_AM_I) == 0x70)
 	{
@@ -63,28 +73,35 @@ int ICACHE_FLASH_ATTR mpu6500_init(void)
 		rv = OK;
 	}
 
-	// restore spi config
-	spi_set_conf_regs(&regs);
-
 	return rv;
 }
 
 sint16 ICACHE_FLASH_ATTR accelReadX(void)
 {
-	// backup current spi config
-	spi_conf_regs regs;
-	spi_get_conf_regs(&regs);
-
-	// disable hw-controlled CS for display
-	spi_hw_cs_disable();
-
-	sint16 x = mpu6500_read16(REG_ACCEL_XOUT_H);
-
-	// re-enable CS for display
-	spi_hw_cs_enable();
+	spiBusSelect(SpiDevAccel);
+	return mpu6500_read16(REG_ACCEL_XOUT_H);
+}
 
-	// restore spi config
-	spi_set_conf_regs(&regs);
+// Wake-on-motion: accelerometer only, low power cycle mode.
+// threshold is in 4 mg units, lpOdr selects 0.24 Hz (0) ... 500 Hz (11).
+// INT pin is active low, open drain and latched until INT_STATUS is read.
+void ICACHE_FLASH_ATTR mpu6500_wakeOnMotionEn(uint8 threshold, uint8 lpOdr)
+{
+	spiBusSelect(SpiDevAccel);
+	mpu6500_write(REG_PWR_MGMT_1, 0x00);		// wake up, no cycle yet
+	mpu6500_write(REG_PWR_MGMT_2, 0x07);		// gyro off
+	mpu6500_write(REG_ACCEL_CONFIG2, 0x09);		// accel low pass filter, 184 Hz
+	mpu6500_write(REG_INT_PIN_CFG, 0xE0);		// active low, open drain, latched
+	mpu6500_write(REG_INT_ENABLE, MPU_INT_WOM);
+	mpu6500_write(REG_MOT_DETECT_CTRL, 0xC0);	// compare samples to the previous one
+	mpu6500_write(REG_WOM_THR, threshold);
+	mpu6500_write(REG_LP_ACCEL_ODR, lpOdr);
+	mpu6500_write(REG_PWR_MGMT_1, 0x20);		// cycle mode
+}
 
-	return x;
+// reading the status also releases the latched INT pin
+uint8 ICACHE_FLASH_ATTR mpu6500_intStatus(void)
+{
+	spiBusSelect(SpiDevAccel);
+	return mpu6500_read8(REG_INT_STATUS);
 }
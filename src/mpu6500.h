@@ -4,8 +4,12 @@
 #include <c_types.h>
 #include "typedefs.h"
 
+#define MPU_INT_WOM		0x40
+
 int mpu6500_init(void);
 sint16 accelReadX(void);
+void mpu6500_wakeOnMotionEn(uint8 threshold, uint8 lpOdr);
+uint8 mpu6500_intStatus(void);
 
 
 #endif /* SRC_MPU6500_H_ */
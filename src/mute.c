@@ -0,0 +1,443 @@
+#include <os_type.h>
+#include <osapi.h>
+#include <mem.h>
+#include <user_interface.h>
+#include "common.h"
+#include "debug.h"
+#include "mute.h"
+
+// Stream messages are checked on their raw JSON before anything is
+// parsed or decoded: one pass which follows the nesting, keeps the keys
+// leading to the current value and only compares the values the rules
+// are about. Keywords are compiled to the bytes they appear as in the
+// JSON text, non-ASCII ones also as \u escapes.
+
+#define MUTE_MAX_KEYWORDS		8
+#define MUTE_MAX_USERS			4
+#define MUTE_MAX_LANGS			4
+#define MUTE_PATTERNS_SIZE		512
+#define MUTE_MAX_DEPTH			4		// keys kept below the message object
+
+#define LOWER(ch)	((ch) >= 'A' && (ch) <= 'Z' ? (ch) + ('a' - 'A') : (ch))
+
+typedef struct{
+	ushort offset;		// in patterns
+	ushort length;
+}MutePattern;
+
+typedef struct{
+	char patterns[MUTE_PATTERNS_SIZE];
+	int used;
+	MutePattern keywords[MUTE_MAX_KEYWORDS*2];	// raw and escaped
+	int keywordCount;
+	MutePattern users[MUTE_MAX_USERS];
+	int userCount;
+	MutePattern langs[MUTE_MAX_LANGS];
+	int langCount;
+	int retweets;
+	uchar firstBytes[32];	// of the keywords, a bit per byte value
+}MuteRules;
+
+LOCAL MuteRules rules = {{0}};
+
+typedef enum{
+	MuteNone,
+	MuteKeyword,
+	MuteUser,
+	MuteRetweet,
+	MuteLang,
+	MuteReasonCount
+}MuteReason;
+
+typedef enum{
+	KeyOther,
+	KeyText,
+	KeyFullText,
+	KeyLang,
+	KeyUser,
+	KeyIdStr,
+	KeyExtendedTweet,
+	KeyRetweetedStatus
+}JsonKey;
+
+LOCAL const char *keyNames[] = {"", "text", "full_text", "lang", "user", "id_str",
+		"extended_tweet", "retweeted_status"};
+
+typedef struct{
+	uint checked;
+	uint muted[MuteReasonCount];
+	uint scanTime;		// us
+	uint scanTimeMax;
+}MuteStats;
+
+LOCAL MuteStats stats = {0};
+
+
+LOCAL int ICACHE_FLASH_ATTR appendPattern(MuteRules *next, const char *data, int length)
+{
+	if (next->used + length > MUTE_PATTERNS_SIZE)
+	{
+		return ERROR;
+	}
+	os_memcpy(next->patterns + next->used, data, length);
+	next->used += length;
+	return OK;
+}
+
+LOCAL int ICACHE_FLASH_ATTR addPattern(MuteRules *next, MutePattern *list, int *count, int max,
+		const char *str, int length)
+{
+	if (length == 0 || *count >= max)
+	{
+		return ERROR;
+	}
+	list[*count].offset = next->used;
+	list[*count].length = length;
+	if (appendPattern(next, str, length) != OK)
+	{
+		return ERROR;
+	}
+	(*count)++;
+	return OK;
+}
+
+LOCAL int ICACHE_FLASH_ATTR appendEscapedChar(MuteRules *next, uint ch)
+{
+	const char *hexDigits = "0123456789abcdef";
+	char escaped[6] = {'\\', 'u',
+			hexDigits[(ch >> 12) & 0xF], hexDigits[(ch >> 8) & 0xF],
+			hexDigits[(ch >> 4) & 0xF], hexDigits[ch & 0xF]};
+	return appendPattern(next, escaped, sizeof(escaped));
+}
+
+// keyword as it is in a JSON string, with non-ASCII characters
+// as they are or as \u escapes, ASCII in lower case
+LOCAL int ICACHE_FLASH_ATTR addKeyword(MuteRules *next, const char *str, int length, int escapeUnicode)
+{
+	if (length == 0 || next->keywordCount >= NELEMENTS(next->keywords))
+	{
+		return ERROR;
+	}
+	MutePattern *keyword = &next->keywords[next->keywordCount];
+	keyword->offset = next->used;
+
+	const uchar *pos = (const uchar*)str;
+	const uchar *end = pos + length;
+	while (pos < end)
+	{
+		uint ch = *pos++;
+		int rc;
+		if (ch < 0x80 || !escapeUnicode)
+		{
+			char bytes[2] = {'\\', LOWER(ch)};
+			int quoted = ch == '"' || ch == '\\';
+			rc = appendPattern(next, bytes + !quoted, 1 + quoted);
+		}
+		else
+		{
+			int extra = (ch & 0xE0) == 0xC0 ? 1 : (ch & 0xF0) == 0xE0 ? 2 : (ch & 0xF8) == 0xF0 ? 3 : -1;
+			if (extra < 0 || end - pos < extra)
+			{
+				return ERROR;
+			}
+			ch &= 0x3F >> extra;
+			while (extra--)
+			{
+				ch = (ch << 6) | (*pos++ & 0x3F);
+			}
+			if (ch >= 0x10000)		// surrogate pair
+			{
+				ch -= 0x10000;
+				rc = appendEscapedChar(next, 0xD800 + (ch >> 10));
+				if (rc == OK)
+				{
+					rc = appendEscapedChar(next, 0xDC00 + (ch & 0x3FF));
+				}
+			}
+			else
+			{
+				rc = appendEscapedChar(next, ch);
+			}
+		}
+		if (rc != OK)
+		{
+			return ERROR;
+		}
+	}
+
+	keyword->length = next->used - keyword->offset;
+	uchar first = next->patterns[keyword->offset];
+	next->firstBytes[first >> 3] |= 1 << (first & 7);
+	next->keywordCount++;
+	return OK;
+}
+
+// previous rules are kept when these are not valid
+int ICACHE_FLASH_ATTR muteSetRules(const char *str)
+{
+	MuteRules *next = (MuteRules*)os_zalloc(sizeof(MuteRules));
+	if (!next)
+	{
+		return ERROR;
+	}
+
+	int rc = OK;
+	int keywords = 0;
+	while (*str && rc == OK)
+	{
+		const char *rule = str;
+		const char *comma = os_strchr(str, ',');
+		int length = comma ? comma - str : os_strlen(str);
+		str += comma ? length+1 : length;
+
+		if (length == 0)
+		{
+			continue;
+		}
+		if (length == 2 && !os_strncmp(rule, "rt", 2))
+		{
+			next->retweets = TRUE;
+		}
+		else if (length >= 5 && !os_strncmp(rule, "user:", 5))
+		{
+			rc = addPattern(next, next->users, &next->userCount, MUTE_MAX_USERS, rule+5, length-5);
+		}
+		else if (length >= 5 && !os_strncmp(rule, "lang:", 5))
+		{
+			rc = addPattern(next, next->langs, &next->langCount, MUTE_MAX_LANGS, rule+5, length-5);
+		}
+		else if (++keywords > MUTE_MAX_KEYWORDS)
+		{
+			rc = ERROR;
+		}
+		else
+		{
+			rc = addKeyword(next, rule, length, FALSE);
+			int i;
+			for (i = 0; i < length && rc == OK; i++)
+			{
+				if ((uchar)rule[i] >= 0x80)
+				{
+					rc = addKeyword(next, rule, length, TRUE);
+					break;
+				}
+			}
+		}
+	}
+
+	if (rc == OK)
+	{
+		os_memcpy(&rules, next, sizeof(MuteRules));
+	}
+	os_free(next);
+	return rc;
+}
+
+LOCAL JsonKey ICACHE_FLASH_ATTR keyFor(const char *name, int length)
+{
+	int i;
+	for (i = KeyText; i < NELEMENTS(keyNames); i++)
+	{
+		if (name[0] == keyNames[i][0] && os_strlen(keyNames[i]) == length &&
+			!os_strncmp(name, keyNames[i], length))
+		{
+			return (JsonKey)i;
+		}
+	}
+	return KeyOther;
+}
+
+LOCAL int ICACHE_FLASH_ATTR isPattern(const MutePattern *pattern, const char *str, int length)
+{
+	return pattern->length == length && !os_strncmp(rules.patterns + pattern->offset, str, length);
+}
+
+LOCAL int ICACHE_FLASH_ATTR isAnyPattern(const MutePattern *list, int count, const char *str, int length)
+{
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		if (isPattern(&list[i], str, length))
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// keywords only start where a character starts, not inside an escape
+LOCAL int ICACHE_FLASH_ATTR containsKeyword(const char *str, const char *end)
+{
+	int skip = 0;
+	for (; str < end; str++)
+	{
+		if (skip)
+		{
+			skip--;
+			continue;
+		}
+		uchar ch = LOWER((uchar)*str);
+		if (ch == '\\')
+		{
+			skip = (str+1 < end && str[1] == 'u') ? 5 : 1;
+		}
+		if (!(rules.firstBytes[ch >> 3] & (1 << (ch & 7))))
+		{
+			continue;
+		}
+		int i;
+		for (i = 0; i < rules.keywordCount; i++)
+		{
+			const MutePattern *keyword = &rules.keywords[i];
+			const char *pattern = rules.patterns + keyword->offset;
+			int j;
+			if (keyword->length > end - str)
+			{
+				continue;
+			}
+			for (j = 0; j < keyword->length && LOWER((uchar)str[j]) == (uchar)pattern[j]; j++);
+			if (j == keyword->length)
+			{
+				return TRUE;
+			}
+		}
+	}
+	return FALSE;
+}
+
+// string value with its keys from depth 1 on
+LOCAL MuteReason ICACHE_FLASH_ATTR checkString(const JsonKey *path, int depth, const char *str, const char *end)
+{
+	// a retweet has the original tweet in retweeted_status
+	if (depth > 1 && path[0] == KeyRetweetedStatus)
+	{
+		path++;
+		depth--;
+	}
+	if ((depth == 1 && path[0] == KeyText) ||
+		(depth == 2 && path[0] == KeyExtendedTweet && path[1] == KeyFullText))
+	{
+		return (rules.keywordCount && containsKeyword(str, end)) ? MuteKeyword : MuteNone;
+	}
+	if (depth == 1 && path[0] == KeyLang)
+	{
+		return isAnyPattern(rules.langs, rules.langCount, str, end - str) ? MuteLang : MuteNone;
+	}
+	if (depth == 2 && path[0] == KeyUser && path[1] == KeyIdStr)
+	{
+		return isAnyPattern(rules.users, rules.userCount, str, end - str) ? MuteUser : MuteNone;
+	}
+	return MuteNone;
+}
+
+LOCAL MuteReason ICACHE_FLASH_ATTR scan(const char *pos, int length)
+{
+	const char *end = pos + length;
+	JsonKey path[MUTE_MAX_DEPTH];
+	uint objects = 0;		// a bit per depth, arrays have none
+	int depth = 0;
+	int expectKey = FALSE;
+	while (pos < end)
+	{
+		char ch = *pos++;
+		switch (ch)
+		{
+		case '{':
+		case '[':
+			depth++;
+			if (depth <= 32)
+			{
+				uint bit = 1 << (depth-1);
+				objects = ch == '{' ? (objects | bit) : (objects & ~bit);
+			}
+			if (depth <= MUTE_MAX_DEPTH)
+			{
+				path[depth-1] = KeyOther;
+			}
+			expectKey = ch == '{';
+			break;
+		case '}':
+		case ']':
+			if (--depth <= 0)
+			{
+				return MuteNone;	// end of the message
+			}
+			expectKey = FALSE;
+			break;
+		case ',':
+			expectKey = depth > 0 && depth <= 32 && (objects & (1 << (depth-1)));
+			break;
+		case '"':
+		{
+			const char *str = pos;
+			while (pos < end && *pos != '"')
+			{
+				pos += *pos == '\\' ? 2 : 1;
+			}
+			if (pos >= end)
+			{
+				return MuteNone;
+			}
+			const char *strEnd = pos++;
+			if (depth > MUTE_MAX_DEPTH)
+			{
+				expectKey = FALSE;
+			}
+			else if (expectKey)
+			{
+				expectKey = FALSE;
+				path[depth-1] = keyFor(str, strEnd - str);
+				if (depth == 1 && path[0] == KeyRetweetedStatus && rules.retweets)
+				{
+					return MuteRetweet;
+				}
+			}
+			else if (depth > 0)
+			{
+				MuteReason reason = checkString(path, depth, str, strEnd);
+				if (reason != MuteNone)
+				{
+					return reason;
+				}
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	return MuteNone;
+}
+
+// TRUE when the message is a tweet one of the rules is about
+int ICACHE_FLASH_ATTR muteCheck(const char *json, int length)
+{
+	if (!rules.keywordCount && !rules.userCount && !rules.langCount && !rules.retweets)
+	{
+		return FALSE;
+	}
+	uint start = system_get_time();
+	MuteReason reason = scan(json, length);
+	uint time = system_get_time() - start;
+	stats.checked++;
+	stats.scanTime += time;
+	stats.scanTimeMax = MAX(stats.scanTimeMax, time);
+	if (reason == MuteNone)
+	{
+		return FALSE;
+	}
+	stats.muted[reason]++;
+	debug("muted, reason %d\n", (int)reason);
+	return TRUE;
+}
+
+void ICACHE_FLASH_ATTR mutePrintStats(void)
+{
+	os_printf("mute: %d keyword patterns, %d users, %d languages, retweets %s\n",
+			rules.keywordCount, rules.userCount, rules.langCount, rules.retweets ? "on" : "off");
+	os_printf("mute: %u checked, muted %u by keyword, %u by user, %u retweets, %u by language\n",
+			stats.checked, stats.muted[MuteKeyword], stats.muted[MuteUser],
+			stats.muted[MuteRetweet], stats.muted[MuteLang]);
+	os_printf("mute: scan %u us average, %u us max\n",
+			stats.checked ? stats.scanTime/stats.checked : 0, stats.scanTimeMax);
+}
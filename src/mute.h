@@ -0,0 +1,16 @@
+#ifndef SRC_MUTE_H_
+#define SRC_MUTE_H_
+
+#include "typedefs.h"
+
+// Rules are separated by commas:
+//   rt          retweets
+//   user:<id>   tweets by the user, also retweeted ones
+//   lang:<code> tweets in the language
+//   <keyword>   tweets with it in the text, ASCII case insensitive
+int muteSetRules(const char *rules);
+int muteCheck(const char *json, int length);
+void mutePrintStats(void);
+
+
+#endif /* SRC_MUTE_H_ */
@@ -1,115 +1,89 @@
 #include <os_type.h>
 #include <osapi.h>
+#include <user_interface.h>
 #include <mem.h>
 #include "oauth.h"
 #include "config.h"
 #include "debug.h"
 #include "httpreq.h"
 
-int hmac_sha1(const u8 *key, size_t key_len, const u8 *data, size_t data_len, u8 *mac);
-unsigned char *base64_encode(const unsigned char *src, size_t len, size_t *out_len);
+#define SHA1_BLOCK_SIZE		64
+#define SHA1_DIGEST_SIZE	20
 
-int ICACHE_FLASH_ATTR base64encode(const char *src, int srcLen, char *dst, int dstSize)
-{
-	unsigned char *tempmem = (char*)os_malloc(80);
-	unsigned char *result;
-	int len;
-
-	if (!tempmem)
-	{
-		return 0;
-	}
+// HMAC-SHA1 state after the inner and outer key pad,
+// the key only changes with consumer_secret or token_secret
+LOCAL SHA1_CTX signKeyInner;
+LOCAL SHA1_CTX signKeyOuter;
+LOCAL int signKeyValid = FALSE;
 
-	// fake rom malloc init
-	mem_init(tempmem);
-	result = base64_encode(src, srcLen, &len);
-	if (len > dstSize)
-	{
-		os_free(tempmem);
-		return 0;
-	}
-
-	// copy result, filter newlines
-	char *pDst = dst;
-	while (len > 0)
-	{
-		if (*result != '\n')
-		{
-			*pDst = *result;
-			pDst++;
-		}
-		result++;
-		len--;
-	}
-	*pDst = '\0';
+typedef struct{
+	uint signatures;
+	uint keySetups;
+	uint signTime;		// us, base string and HMAC
+}OAuthStats;
 
-	os_free(tempmem);
-	return pDst-dst;
-}
+LOCAL OAuthStats stats = {0};
 
+// unreserved characters of RFC 3986, one bit per byte value
+LOCAL const uint unreservedChars[8] = {
+	0x00000000,
+	0x03FF6000,		// - . 0-9
+	0x87FFFFFE,		// A-Z _
+	0x47FFFFFE,		// a-z ~
+	0x00000000, 0x00000000, 0x00000000, 0x00000000
+};
 
-LOCAL void ICACHE_FLASH_ATTR asciiHex(unsigned char byte, char *ascii)
-{
-	const char *hex = "0123456789ABCDEF";
-	ascii[0] = hex[byte >> 4];
-	ascii[1] = hex[byte & 0x0F];
-}
+#define IS_UNRESERVED(ch)	(unreservedChars[(uchar)(ch) >> 5] & (1 << ((uchar)(ch) & 31)))
 
-LOCAL int ICACHE_FLASH_ATTR charNeedEscape(char ch)
-{
-	if ((ch >= '0' && ch <= '9') ||
-		(ch >= 'A' && ch <= 'Z') ||
-		(ch >= 'a' && ch <= 'z') ||
-		 ch == '-' || ch == '.'  ||
-		 ch == '_' || ch == '~')
-	{
-		return 0;
-	}
-	return 1;
-}
+LOCAL const char hexDigits[] = "0123456789ABCDEF";
 
-int ICACHE_FLASH_ATTR percentEncode(const char *src, int srcLen, char *dst, int dstSize)
+// escape is "%", or "%25" to encode the encoded string in one pass
+LOCAL int ICACHE_FLASH_ATTR encode(const char *src, int srcLen, char *dst, int dstSize,
+		const char *escape, int escapeLen)
 {
-	char ch;
-	int len = 0;
+	char *start = dst;
+	char *end = dst + dstSize - 1;	// room for '\0'
 	while (srcLen--)
 	{
-		ch = *src++;
-		if (charNeedEscape(ch))
+		uchar ch = *src++;
+		if (IS_UNRESERVED(ch))
 		{
-			if ((len+2) < dstSize)
-			{
-				*dst = '%';
-				dst++;
-				asciiHex(ch, dst);
-				dst += 2;
-				len += 3;
-			}
-			else
+			if (dst >= end)
 			{
 				return 0;
 			}
+			*dst++ = ch;
 		}
 		else
 		{
-			if (len < dstSize)
-			{
-				*dst = ch;
-				dst++;
-				len++;
-			}
-			else
+			if (end - dst < escapeLen + 2)
 			{
 				return 0;
 			}
+			os_memcpy(dst, escape, escapeLen);
+			dst += escapeLen;
+			*dst++ = hexDigits[ch >> 4];
+			*dst++ = hexDigits[ch & 0x0F];
 		}
 	}
-	if (len >= dstSize)
+	if (dstSize < 1)
 	{
 		return 0;
 	}
 	*dst = '\0';
-	return len;
+	return dst - start;
+}
+
+// returns the length, 0 when it does not fit
+int ICACHE_FLASH_ATTR percentEncode(const char *src, int srcLen, char *dst, int dstSize)
+{
+	return encode(src, srcLen, dst, dstSize, "%", 1);
+}
+
+// same as percentEncode applied twice, "%XX" becomes "%25XX"
+int ICACHE_FLASH_ATTR percentEncodeTwice(const char *src, int srcLen, char *dst, int dstSize)
+{
+	return encode(src, srcLen, dst, dstSize, "%25", 3);
 }
 
 int ICACHE_FLASH_ATTR percentEncodedStrLen(const char *str, int strLen)
@@ -117,7 +91,7 @@ int ICACHE_FLASH_ATTR percentEncodedStrLen(const char *str, int strLen)
 	int length = 0;
 	while (*str && strLen)
 	{
-		length += charNeedEscape(*str) ? 3 : 1;
+		length += IS_UNRESERVED(*str) ? 1 : 3;
 		str++;
 		strLen--;
 	}
@@ -125,154 +99,162 @@ int ICACHE_FLASH_ATTR percentEncodedStrLen(const char *str, int strLen)
 }
 
 
-LOCAL int ICACHE_FLASH_ATTR random(int min, int max)
+LOCAL const char alphanumericChars[] =
+	"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+// from the hardware RNG, 6 bit values past the 62 characters are
+// skipped so that each one is equally likely
+void ICACHE_FLASH_ATTR randomAlphanumericString(char *str, int len)
 {
-   return (rand() % (max - min + 1)) + min;
+	uint bits = 0;
+	int bitsLeft = 0;
+	while (len > 0)
+	{
+		if (bitsLeft < 6)
+		{
+			bits = os_random();
+			bitsLeft = 32;
+		}
+		uint index = bits & 0x3F;
+		bits >>= 6;
+		bitsLeft -= 6;
+		if (index < sizeof(alphanumericChars)-1)
+		{
+			*str++ = alphanumericChars[index];
+			len--;
+		}
+	}
+	*str = '\0';
 }
 
-LOCAL char ICACHE_FLASH_ATTR randomAlphanumeric(void)
-{
-	char ranges[3][2] = {
-		{'0','9'},
-		{'A','Z'},
-		{'a','z'}};
+// '=' is the padding
+LOCAL const char base64Chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=";
 
-	int range = rand() % 3;
-	return random(ranges[range][0], ranges[range][1]);
-}
+#define BASE64_PAD				64
 
-void ICACHE_FLASH_ATTR randomAlphanumericString(char *str, int len)
+LOCAL char* ICACHE_FLASH_ATTR appendSignatureChar(char *dst, uint index)
 {
-	static int randInit = FALSE;
-	if (!randInit)
+	char ch = base64Chars[index];
+	if (IS_UNRESERVED(ch))
 	{
-		srand(sntp_get_current_timestamp());
-		randInit = TRUE;
+		*dst++ = ch;
 	}
-
-	while (len--)
+	else
 	{
-		*str = randomAlphanumeric();
-		str++;
+		*dst++ = '%';
+		*dst++ = hexDigits[ch >> 4];
+		*dst++ = hexDigits[ch & 0x0F];
 	}
-	*str = '\0';
+	return dst;
 }
 
-LOCAL int ICACHE_FLASH_ATTR appendParamPercentEncode(char *dst, int dstSize, const char *param, const char *value, int valueLen)
+// base64 of the digest written percent encoded, as the header needs it
+LOCAL int ICACHE_FLASH_ATTR encodeSignature(const uchar *digest, char *dst, int dstSize)
 {
-	char *pDst = dst;
-	int len = ets_snprintf(pDst, dstSize, "%s%%3D", param);
-	if (len < 0 || len >= dstSize) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	len = percentEncode(value, valueLen, pDst, dstSize);
-	if (len == 0 && valueLen > 0) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	len = ets_snprintf(pDst, dstSize, "%%26");
-	if (len < 0 || len >= dstSize) return 0;
-	pDst += len;
-
-	return pDst - dst;
+	if (dstSize <= OAUTH_SIGNATURE_MAX_LEN)
+	{
+		return 0;
+	}
+	char *start = dst;
+	int i;
+	for (i = 0; i < SHA1_DIGEST_SIZE; i += 3)
+	{
+		uint group = digest[i] << 16;
+		if (i+1 < SHA1_DIGEST_SIZE) group |= digest[i+1] << 8;
+		if (i+2 < SHA1_DIGEST_SIZE) group |= digest[i+2];
+		dst = appendSignatureChar(dst, group >> 18);
+		dst = appendSignatureChar(dst, (group >> 12) & 0x3F);
+		dst = appendSignatureChar(dst, i+1 < SHA1_DIGEST_SIZE ? (group >> 6) & 0x3F : BASE64_PAD);
+		dst = appendSignatureChar(dst, i+2 < SHA1_DIGEST_SIZE ? group & 0x3F : BASE64_PAD);
+	}
+	*dst = '\0';
+	return dst - start;
 }
 
-LOCAL int ICACHE_FLASH_ATTR createSignatureParamStr(char *dst, int dstSize,
-	const char *nonce, const char *timestamp,
-	const ParamList *paramList,
-	const char *consumer_key, const char *oauth_token)
+LOCAL void ICACHE_FLASH_ATTR hashStr(SHA1_CTX *ctx, const char *str)
 {
-	char *pDst = dst;
-	int len = 0;
+	SHA1Update(ctx, str, os_strlen(str));
+}
 
-	ParamItem *param = paramList->first;
-	while (param)
+// percent encodes into the hash in small chunks, no length limit,
+// twice for request parameter values
+LOCAL void ICACHE_FLASH_ATTR hashPercentEncoded(SHA1_CTX *ctx, const char *src, int twice)
+{
+	char chunk[64];
+	int srcLen = os_strlen(src);
+	while (srcLen > 0)
 	{
-		if (param->param[0] >= 'o')
-		{
-			break;
-		}
-		len = appendParamPercentEncode(pDst, dstSize, param->param, param->valueEncoded, param->valueLen);
-		if (len == 0) return 0;
-		pDst += len;
-		dstSize -= len;
-		param = param->next;
+		int n = MIN(srcLen, 12);	// 5 bytes each at most
+		int len = twice ? percentEncodeTwice(src, n, chunk, sizeof(chunk)) :
+						  percentEncode(src, n, chunk, sizeof(chunk));
+		SHA1Update(ctx, chunk, len);
+		src += n;
+		srcLen -= n;
 	}
+}
 
-	len = appendParamPercentEncode(pDst, dstSize, "oauth_consumer_key", consumer_key, os_strlen(consumer_key));
-	if (len == 0) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	len = ets_snprintf(pDst, dstSize, "oauth_nonce%%3D%s%%26", nonce);
-	if (len == 0) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	len = ets_snprintf(pDst, dstSize, "oauth_signature_method%%3DHMAC-SHA1%%26");
-	if (len < 0 || len >= dstSize) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	len = ets_snprintf(pDst, dstSize, "oauth_timestamp%%3D%s%%26", timestamp);
-	if (len < 0 || len >= dstSize) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	len = appendParamPercentEncode(pDst, dstSize, "oauth_token", oauth_token, os_strlen(oauth_token));
-	if (len == 0) return 0;
-	pDst += len;
-	dstSize -= len;
+// name=value of the parameter string, itself percent encoded
+LOCAL void ICACHE_FLASH_ATTR hashParam(SHA1_CTX *ctx, int *count, const char *param, const char *value, int twice)
+{
+	if ((*count)++)
+	{
+		hashStr(ctx, "%26");
+	}
+	hashStr(ctx, param);
+	hashStr(ctx, "%3D");
+	hashPercentEncoded(ctx, value, twice);
+}
 
-	len = ets_snprintf(pDst, dstSize, "oauth_version%%3D1.0%%26");
-	if (len < 0 || len >= dstSize) return 0;
-	pDst += len;
-	dstSize -= len;
+// request parameters sort either before or after the oauth_* block,
+// names starting with oauth_ are reserved for the protocol
+LOCAL int ICACHE_FLASH_ATTR sortsBeforeOAuth(const char *param)
+{
+	return os_strcmp(param, "oauth_") < 0;
+}
 
-	while (param)
+// the base string is never stored, its pieces go straight into SHA-1:
+// method, URL and the parameters sorted before the nonce value
+LOCAL void ICACHE_FLASH_ATTR hashBaseStrPrefix(SHA1_CTX *ctx,
+	const char *httpMethod, const char *host, const char *url,
+	const ParamList *paramList)
+{
+	hashStr(ctx, httpMethod);
+	hashStr(ctx, "&https%3A%2F%2F");
+	hashPercentEncoded(ctx, host, FALSE);
+	hashPercentEncoded(ctx, url, FALSE);
+	hashStr(ctx, "&");
+
+	int count = 0;
+	int i;
+	for (i = 0; i < paramList->count && sortsBeforeOAuth(paramList->items[i].param); i++)
 	{
-		len = appendParamPercentEncode(pDst, dstSize, param->param, param->valueEncoded, param->valueLen);
-		if (len == 0) return 0;
-		pDst += len;
-		dstSize -= len;
-		param = param->next;
+		hashParam(ctx, &count, paramList->items[i].param, paramList->items[i].value, TRUE);
 	}
-
-	// remove last '&'
-	pDst -= 3;
-	return pDst - dst;
+	hashParam(ctx, &count, "oauth_consumer_key", config.consumer_key, FALSE);
+	hashParam(ctx, &count, "oauth_nonce", "", FALSE);
 }
 
-LOCAL int ICACHE_FLASH_ATTR createSignatureBaseStr(char *dst, int dstSize,
-	const char *httpMethod, const char *baseUrl,
+// the nonce value and the rest of the base string
+LOCAL void ICACHE_FLASH_ATTR hashBaseStrRest(SHA1_CTX *ctx,
 	const char *nonce, const char *timestamp,
 	const ParamList *paramList)
 {
-	char *pDst = dst;
-	int len = ets_snprintf(pDst, dstSize, "%s&", httpMethod);
-	if (len < 0 || len >= dstSize) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	len = percentEncode(baseUrl, os_strlen(baseUrl), pDst, dstSize);
-	if (len == 0) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	if (dstSize < 1) return 0;
-	*pDst++ = '&';
-	dstSize--;
-
-	len = createSignatureParamStr(pDst, dstSize, nonce, timestamp, paramList, config.consumer_key, config.access_token);
-	if (len == 0) return 0;
-	pDst += len;
-	dstSize -= len;
-
-	if (dstSize < 1) return 0;
-	*pDst = '\0';
-
-	return pDst - dst;
+	int count = 1;
+	hashStr(ctx, nonce);
+	hashParam(ctx, &count, "oauth_signature_method", "HMAC-SHA1", FALSE);
+	hashParam(ctx, &count, "oauth_timestamp", timestamp, FALSE);
+	hashParam(ctx, &count, "oauth_token", config.access_token, FALSE);
+	hashParam(ctx, &count, "oauth_version", "1.0", FALSE);
+
+	int i;
+	for (i = 0; i < paramList->count; i++)
+	{
+		if (!sortsBeforeOAuth(paramList->items[i].param))
+		{
+			hashParam(ctx, &count, paramList->items[i].param, paramList->items[i].value, TRUE);
+		}
+	}
 }
 
 LOCAL int ICACHE_FLASH_ATTR createSignatureKey(char *dst, int dstSize)
@@ -298,83 +280,143 @@ LOCAL int ICACHE_FLASH_ATTR createSignatureKey(char *dst, int dstSize)
 	return pDst - dst;
 }
 
-int ICACHE_FLASH_ATTR createSignature(char *dst, int dstSize,
-		const char *httpMethod, const char *baseUrl,
-		const char *nonce, const char *timestamp,
-		const ParamList *paramList)
+// inner and outer pad of the HMAC key (RFC 2104)
+LOCAL void ICACHE_FLASH_ATTR setHmacKey(const u8 *hmacKey, int len)
 {
-	int signatureLen = 0;
-	int baseStrSize = 1024;
-	char *baseStr = (char*)os_malloc(baseStrSize);
-	if (!baseStr)
+	// longer keys are replaced by their hash
+	u8 key[SHA1_BLOCK_SIZE];
+	os_memset(key, 0, sizeof(key));
+	if (len > SHA1_BLOCK_SIZE)
 	{
-		return 0;
+		SHA1_CTX ctx;
+		SHA1Init(&ctx);
+		SHA1Update(&ctx, hmacKey, len);
+		SHA1Final(key, &ctx);
 	}
-	int len = createSignatureBaseStr(
-				baseStr, baseStrSize,
-				httpMethod, baseUrl,
-				nonce, timestamp,
-				paramList);
-	if (len == 0)
+	else
 	{
-		debug("createSignatureBaseStr failed\n");
-		os_free(baseStr);
-		return 0;
+		os_memcpy(key, hmacKey, len);
 	}
 
-	//debug("baseStr len %d\n", len);
-	//debug("%s\n", baseStr);
-    
+	u8 pad[SHA1_BLOCK_SIZE];
+	int i;
+	for (i = 0; i < SHA1_BLOCK_SIZE; i++)
+	{
+		pad[i] = key[i] ^ 0x36;
+	}
+	SHA1Init(&signKeyInner);
+	SHA1Update(&signKeyInner, pad, SHA1_BLOCK_SIZE);
 
+	for (i = 0; i < SHA1_BLOCK_SIZE; i++)
+	{
+		pad[i] = key[i] ^ 0x5c;
+	}
+	SHA1Init(&signKeyOuter);
+	SHA1Update(&signKeyOuter, pad, SHA1_BLOCK_SIZE);
+
+	os_memset(key, 0, sizeof(key));
+	os_memset(pad, 0, sizeof(pad));
+}
+
+// call when consumer_secret or token_secret has changed
+void ICACHE_FLASH_ATTR oauthSetSignKey(void)
+{
+	signKeyValid = FALSE;
 	int signKeySize = 256;
 	char *signKey = (char*)os_malloc(signKeySize);
 	if (!signKey)
 	{
-		os_free(baseStr);
-		return 0;
+		return;
 	}
-
-	len = createSignatureKey(signKey, signKeySize);
+	int len = createSignatureKey(signKey, signKeySize);
 	if (len == 0)
 	{
 		debug("createSignatureKey failed\n");
-		goto out;
+		os_free(signKey);
+		return;
 	}
+	setHmacKey((const u8*)signKey, len);
+	os_free(signKey);
+	signKeyValid = TRUE;
+	stats.keySetups++;
+}
 
-	//debug("signKey len %d\n", len);
-	//debug("%s\n", signKey);
+// ctx has the message after the inner key pad
+LOCAL void ICACHE_FLASH_ATTR signHmacSha1Finish(SHA1_CTX *ctx, u8 *mac)
+{
+	SHA1Final(mac, ctx);
+	*ctx = signKeyOuter;
+	SHA1Update(ctx, mac, SHA1_DIGEST_SIZE);
+	SHA1Final(mac, ctx);
+}
 
+// hashes the part of the base string that stays the same for
+// repeated requests, e.g. the stream request after a reconnect
+int ICACHE_FLASH_ATTR oauthSignPrefixInit(OAuthSignPrefix *prefix,
+		const char *httpMethod, const char *host, const char *url,
+		const ParamList *paramList)
+{
+	if (!signKeyValid)
+	{
+		oauthSetSignKey();
+		if (!signKeyValid)
+		{
+			return ERROR;
+		}
+	}
+	uint t0 = system_get_time();
+	prefix->ctx = signKeyInner;
+	hashBaseStrPrefix(&prefix->ctx, httpMethod, host, url, paramList);
+	prefix->keySetup = stats.keySetups;
+	stats.signTime += system_get_time() - t0;
+	return OK;
+}
 
-	char sha1result[20];
-	char base64str[40];
+// FALSE after the signing key has changed
+int ICACHE_FLASH_ATTR oauthSignPrefixValid(const OAuthSignPrefix *prefix)
+{
+	return signKeyValid && prefix->keySetup == stats.keySetups;
+}
 
-	int rv = hmac_sha1(signKey, os_strlen(signKey), baseStr, os_strlen(baseStr), sha1result);
-	if (rv != OK)
+int ICACHE_FLASH_ATTR createSignaturePrefixed(char *dst, int dstSize,
+		const OAuthSignPrefix *prefix,
+		const char *nonce, const char *timestamp,
+		const ParamList *paramList)
+{
+	if (!oauthSignPrefixValid(prefix))
 	{
-		debug("hmac_sha1 failed\n");
-		goto out;
+		return 0;
 	}
 
-//	int i;
-//	for (i = 0; i < 20; i++)
-//	{
-//		debug("%02X ", sha1result[i]);
-//	}
-//	debug("\n");
+	uchar sha1result[SHA1_DIGEST_SIZE];
 
-	len = base64encode(sha1result, sizeof(sha1result), base64str, sizeof(base64str));
-	if (len == 0)
+	// only the message blocks are hashed, the key pads are done
+	uint t0 = system_get_time();
+	SHA1_CTX ctx = prefix->ctx;
+	hashBaseStrRest(&ctx, nonce, timestamp, paramList);
+	signHmacSha1Finish(&ctx, sha1result);
+	int len = encodeSignature(sha1result, dst, dstSize);
+	stats.signTime += system_get_time() - t0;
+	stats.signatures++;
+	return len;
+}
+
+int ICACHE_FLASH_ATTR createSignature(char *dst, int dstSize,
+		const char *httpMethod, const char *host, const char *url,
+		const char *nonce, const char *timestamp,
+		const ParamList *paramList)
+{
+	OAuthSignPrefix prefix;
+	if (oauthSignPrefixInit(&prefix, httpMethod, host, url, paramList) != OK)
 	{
-		debug("base64encode failed\n");
-		goto out;
+		return 0;
 	}
-	//debug("base64 len %d\n", len);
-	//debug("base64:\n%s\n", base64str);
-
-	signatureLen = percentEncode(base64str, len, dst, dstSize);
+	return createSignaturePrefixed(dst, dstSize, &prefix, nonce, timestamp, paramList);
+}
 
-out:
-	os_free(baseStr);
-	os_free(signKey);
-	return signatureLen;
+void ICACHE_FLASH_ATTR oauthPrintStats(void)
+{
+	os_printf("oauth: %u signatures, %u us avg, %u key setups\n",
+			stats.signatures, stats.signatures ? stats.signTime/stats.signatures : 0,
+			stats.keySetups);
 }
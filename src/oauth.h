@@ -4,19 +4,46 @@
 #include "common.h"
 
 
-int base64encode(const char *src, int srcLen, char *dst, int dstSize);
-
 int percentEncode(const char *src, int srcLen, char *dst, int dstSize);
+int percentEncodeTwice(const char *src, int srcLen, char *dst, int dstSize);
 int percentEncodedStrLen(const char *str, int strLen);
 
 void randomAlphanumericString(char *str, int len);
 
 
+// SHA-1 context of the ROM functions
+typedef struct{
+	uint state[5];
+	uint count[2];
+	uchar buffer[64];
+}SHA1_CTX;
+void SHA1Init(SHA1_CTX *context);
+void SHA1Update(SHA1_CTX *context, const void *data, uint len);
+void SHA1Final(uchar digest[20], SHA1_CTX *context);
+
+#define OAUTH_SIGNATURE_MAX_LEN		(28*3)	// base64 digest, each character percent encoded
+
+// base string hashed up to the nonce value
+typedef struct{
+	SHA1_CTX ctx;
+	uint keySetup;		// signing key it was hashed with
+}OAuthSignPrefix;
+
 typedef struct ParamList ParamList;
+void oauthSetSignKey(void);
+int oauthSignPrefixInit(OAuthSignPrefix *prefix,
+	const char *httpMethod, const char *host, const char *url,
+	const ParamList *paramList);
+int oauthSignPrefixValid(const OAuthSignPrefix *prefix);
+int createSignaturePrefixed(char *dst, int dstSize,
+	const OAuthSignPrefix *prefix,
+	const char *nonce, const char *timestamp,
+	const ParamList *paramList);
 int createSignature(char *dst, int dstSize,
-	const char *httpMethod, const char *baseUrl,
+	const char *httpMethod, const char *host, const char *url,
 	const char *nonce, const char *timestamp,
 	const ParamList *paramList);
+void oauthPrintStats(void);
 
 
 #endif /* SRC_OAUTH_H_ */
@@ -0,0 +1,180 @@
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+#include <gpio.h>
+#include "common.h"
+#include "debug.h"
+#include "display.h"
+#include "mpu6500.h"
+#include "orientation.h"
+
+
+#define ORIENT_TASK_PRIO		USER_TASK_PRIO_1
+#define ORIENT_TASK_QUEUE_LEN	1
+
+#define WOM_THRESHOLD			64		// * 4 mg
+#define WOM_LP_ODR				6		// 15.63 Hz
+
+#define SAMPLE_INTERVAL			100
+#define SAMPLES_PER_WINDOW		20
+#define DEBOUNCE_SAMPLES		3
+// +-1 g is +-16384, flip only well past 90 deg, flip back only past the opposite threshold
+#define FLIP_THRESHOLD			10000
+
+#ifndef MPU_INT_GPIO
+#define INT_STATUS_POLL_INTERVAL	1000
+#endif
+
+LOCAL os_timer_t orientTmr;
+#ifdef MPU_INT_GPIO
+LOCAL os_event_t orientTaskQueue[ORIENT_TASK_QUEUE_LEN];
+#endif
+LOCAL int samplesLeft = 0;
+LOCAL int debounceCount = 0;
+LOCAL Orientation candidate = orient0deg;
+
+LOCAL void sampleTmrCb(void);
+#ifndef MPU_INT_GPIO
+LOCAL void pollIntStatusTmrCb(void);
+#endif
+
+
+LOCAL void ICACHE_FLASH_ATTR startSampling(void)
+{
+	if (samplesLeft > 0)
+	{
+		samplesLeft = SAMPLES_PER_WINDOW;	// still moving, extend the window
+		return;
+	}
+	samplesLeft = SAMPLES_PER_WINDOW;
+	debounceCount = 0;
+	os_timer_disarm(&orientTmr);
+	os_timer_setfn(&orientTmr, (os_timer_func_t*)sampleTmrCb, NULL);
+	os_timer_arm(&orientTmr, SAMPLE_INTERVAL, 1);
+}
+
+LOCAL void ICACHE_FLASH_ATTR stopSampling(void)
+{
+	os_timer_disarm(&orientTmr);
+	samplesLeft = 0;
+#ifndef MPU_INT_GPIO
+	os_timer_setfn(&orientTmr, (os_timer_func_t*)pollIntStatusTmrCb, NULL);
+	os_timer_arm(&orientTmr, INT_STATUS_POLL_INTERVAL, 1);
+#endif
+}
+
+LOCAL void ICACHE_FLASH_ATTR readSample(void)
+{
+	// motion since the previous sample extends the window,
+	// reading the status also releases the INT pin
+	if (mpu6500_intStatus() & MPU_INT_WOM)
+	{
+		startSampling();
+	}
+
+	sint16 x = accelReadX();
+
+	Orientation orient = dispOrient;
+	if (x < -FLIP_THRESHOLD)
+	{
+		orient = orient180deg;
+	}
+	else if (x > FLIP_THRESHOLD)
+	{
+		orient = orient0deg;
+	}
+
+	if (orient == dispOrient)
+	{
+		debounceCount = 0;
+		return;
+	}
+	if (orient != candidate)
+	{
+		candidate = orient;
+		debounceCount = 0;
+	}
+	if (++debounceCount >= DEBOUNCE_SAMPLES)
+	{
+		debug("orientation %d\n", (int)orient);
+		dispSetOrientation(orient);		// refused while scrolling, retried on the next sample
+		if (dispOrient == orient)
+		{
+			debounceCount = 0;
+		}
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR sampleTmrCb(void)
+{
+	readSample();
+	if (--samplesLeft <= 0)
+	{
+		if (debounceCount >= DEBOUNCE_SAMPLES && dispOrient != candidate)
+		{
+			samplesLeft = 1;	// flip refused while scrolling, keep retrying until it ends
+			return;
+		}
+		// device is at rest, re-arm the motion interrupt
+		mpu6500_intStatus();
+		stopSampling();
+	}
+}
+
+#ifdef MPU_INT_GPIO
+LOCAL void ICACHE_FLASH_ATTR orientTask(os_event_t *event)
+{
+	startSampling();
+}
+
+LOCAL void mpuIntHandler(void *arg)
+{
+	uint32 status = GPIO_REG_READ(GPIO_STATUS_ADDRESS);
+	GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, status);
+	if (status & BIT(MPU_INT_GPIO))
+	{
+		// no spi from interrupt context
+		system_os_post(ORIENT_TASK_PRIO, 0, 0);
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR intPinInit(void)
+{
+	system_os_task(orientTask, ORIENT_TASK_PRIO, orientTaskQueue, ORIENT_TASK_QUEUE_LEN);
+
+	ETS_GPIO_INTR_DISABLE();
+	ETS_GPIO_INTR_ATTACH(mpuIntHandler, NULL);
+	PIN_FUNC_SELECT(MPU_INT_MUX, MPU_INT_FUNC);
+	GPIO_DIS_OUTPUT(GPIO_ID_PIN(MPU_INT_GPIO));
+	GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, BIT(MPU_INT_GPIO));
+	gpio_pin_intr_state_set(GPIO_ID_PIN(MPU_INT_GPIO), GPIO_PIN_INTR_NEGEDGE);
+	ETS_GPIO_INTR_ENABLE();
+}
+#else
+LOCAL void ICACHE_FLASH_ATTR pollIntStatusTmrCb(void)
+{
+	if (mpu6500_intStatus() & MPU_INT_WOM)
+	{
+		startSampling();
+	}
+}
+#endif
+
+LOCAL void ICACHE_FLASH_ATTR orientSetupTmrCb(void)
+{
+	mpu6500_wakeOnMotionEn(WOM_THRESHOLD, WOM_LP_ODR);
+#ifdef MPU_INT_GPIO
+	intPinInit();
+#endif
+	// find out initial orientation
+	startSampling();
+}
+
+void ICACHE_FLASH_ATTR orientInit(void)
+{
+	// mpu6500 needs 100 ms after reset
+	os_timer_disarm(&orientTmr);
+	os_timer_setfn(&orientTmr, (os_timer_func_t*)orientSetupTmrCb, NULL);
+	os_timer_arm(&orientTmr, 100, 0);
+}
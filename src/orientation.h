@@ -0,0 +1,19 @@
+#ifndef SRC_ORIENTATION_H_
+#define SRC_ORIENTATION_H_
+
+#include "typedefs.h"
+
+// INT_STATUS is polled unless built with MPU_INT_GPIO=10,
+// MPU6500 INT wired to SD3 (GPIO10, free in DIO flash mode)
+#ifdef MPU_INT_GPIO
+#if MPU_INT_GPIO != 10
+#error MPU6500 INT is only supported on GPIO10
+#endif
+#define MPU_INT_MUX			PERIPHS_IO_MUX_SD_DATA3_U
+#define MPU_INT_FUNC		FUNC_GPIO10
+#endif
+
+void orientInit(void);
+
+
+#endif /* SRC_ORIENTATION_H_ */
@@ -0,0 +1,105 @@
+#include <ets_sys.h>
+#include <osapi.h>
+#include <os_type.h>
+#include <user_interface.h>
+#include "drivers/spi.h"
+#include "common.h"
+#include "spibus.h"
+
+
+typedef struct{
+	uint16 prediv;
+	uint8 cntdiv;
+	uint8 cpha;
+	uint8 cpol;
+	uint8 hwCs;
+}SpiProfile;
+
+// SPI clock = 80 MHz / (prediv*cntdiv)
+LOCAL const SpiProfile profiles[SpiDevCount] = {
+	{0, 0, 0, 0, FALSE},	// SpiDevNone
+	{5, 2, 1, 1, TRUE},		// SpiDevDisplay: 8 MHz, CS controlled by hw (GPIO15)
+	{20, 4, 1, 1, FALSE},	// SpiDevAccel: 1 MHz, CS controlled by driver (GPIO4)
+};
+
+LOCAL SpiDevice curDevice = SpiDevNone;
+
+SpiBusDevStats spiBusStats[SpiDevCount];
+LOCAL uint reconfigs = 0;
+LOCAL uint statsStartTime = 0;
+
+
+void ICACHE_FLASH_ATTR spiBusInit(void)
+{
+	curDevice = SpiDevNone;
+	os_memset(spiBusStats, 0, sizeof(spiBusStats));
+	reconfigs = 0;
+	statsStartTime = system_get_time();
+}
+
+// called once per transfer, transfers run to completion in the task that
+// started them, so the bus is only reconfigured if the device changes
+void ICACHE_FLASH_ATTR spiBusSelect(SpiDevice dev)
+{
+	if (dev == SpiDevNone)
+	{
+		return;
+	}
+	spiBusStats[dev].transactions++;
+	if (dev == curDevice)
+	{
+		return;
+	}
+	const SpiProfile *profile = &profiles[dev];
+
+	while (spi_busy(HSPI))
+	{
+		// let previous transfer complete
+	}
+
+	if (profile->hwCs)
+	{
+		spi_hw_cs_enable();
+	}
+	else
+	{
+		spi_hw_cs_disable();
+	}
+	spi_clock(HSPI, profile->prediv, profile->cntdiv);
+	spi_mode(HSPI, profile->cpha, profile->cpol);
+
+	if (dev == SpiDevDisplay)
+	{
+		// SSD1322_write sends 9-bit words in the command phase only
+		CLEAR_PERI_REG_MASK(SPI_USER(HSPI), SPI_USR_MOSI|SPI_USR_MISO|SPI_USR_ADDR|SPI_USR_DUMMY);
+		SET_PERI_REG_MASK(SPI_USER(HSPI), SPI_USR_COMMAND);
+	}
+
+	curDevice = dev;
+	reconfigs++;
+}
+
+void ICACHE_FLASH_ATTR spiBusPrintStats(void)
+{
+	uint elapsedMs = (system_get_time() - statsStartTime) / 1000;
+	uint busyUs = 0;
+	int dev;
+	for (dev = SpiDevDisplay; dev < SpiDevCount; dev++)
+	{
+		// time on wire: bits * (prediv*cntdiv) / 80 MHz
+		uint us = (uint)(((uint64)spiBusStats[dev].bits * profiles[dev].prediv * profiles[dev].cntdiv) / 80);
+		busyUs += us;
+		os_printf("spi dev %d: %u transactions, %u bits, %u ms\n",
+				dev, spiBusStats[dev].transactions, spiBusStats[dev].bits, us/1000);
+	}
+	os_printf("spi bus: %u reconfigs, utilisation %u.%u%% of %u ms\n",
+			reconfigs,
+			elapsedMs ? busyUs/(elapsedMs*10) : 0,
+			elapsedMs ? (busyUs/elapsedMs)%10 : 0,
+			elapsedMs);
+
+	// next report covers the time from now on
+	os_memset(spiBusStats, 0, sizeof(spiBusStats));
+	reconfigs = 0;
+	statsStartTime = system_get_time();
+}
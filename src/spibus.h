@@ -0,0 +1,25 @@
+#ifndef SRC_SPIBUS_H_
+#define SRC_SPIBUS_H_
+
+#include "typedefs.h"
+
+// devices sharing the HSPI bus
+typedef enum{
+	SpiDevNone,
+	SpiDevDisplay,
+	SpiDevAccel,
+	SpiDevCount
+}SpiDevice;
+
+typedef struct{
+	uint transactions;
+	uint bits;
+}SpiBusDevStats;
+extern SpiBusDevStats spiBusStats[SpiDevCount];
+
+void spiBusInit(void);
+void spiBusSelect(SpiDevice dev);
+void spiBusPrintStats(void);
+
+
+#endif /* SRC_SPIBUS_H_ */
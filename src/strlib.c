@@ -7,6 +7,7 @@
 #include "common.h"
 #include "debug.h"
 #include "strlib.h"
+#include "conv.h"
 
 
 typedef struct WordListItem WordListItem;
@@ -43,11 +44,12 @@ struct LineList
 
 
 LOCAL StrListItem* allocStrListItem(const ushort *str, int length);
-LOCAL int strListContains(const StrList *list, const ushort *str, int length, int caseInsensitive);
+LOCAL int keywordTrieFind(const KeywordTrie *trie, int node, ushort ch);
+LOCAL int keywordTrieMatches(const KeywordTrie *trie, const ushort *str, int length);
 LOCAL WordListItem* allocWordListItem(const Font *font, const ushort *str, int length);
 LOCAL void clearWordList(WordList *wordList);
 LOCAL void drawWordList(int x, int y, const WordList *wordList);
-LOCAL void strListToWordList(const StrList *strList, WordList *wordList, const Font *fontReg, const Font *fontBold, const StrList *boldStrList);
+LOCAL void strListToWordList(const StrList *strList, WordList *wordList, const Font *fontReg, const Font *fontBold, const KeywordTrie *boldWords);
 LOCAL LineListItem* allocLineListItem(void);
 LOCAL void clearLineList(LineList *lineList);
 LOCAL void drawLineList(int x0, int y0, int maxHeight, const LineList *lineList, int compressed);
@@ -69,7 +71,6 @@ LOCAL int isAlphanumeric(ushort ch);
 LOCAL int isDelimeter(ushort ch);
 LOCAL int strNextWordLength(const ushort *str);
 LOCAL ushort chToLower(ushort ch);
-LOCAL int strStartsWith(const ushort *str1, int len1, const ushort *str2, int len2, int caseInsensitive);
 LOCAL int strIsEqual(const ushort *str1, const ushort *str2, int length);
 LOCAL const ushort* wstrnstr(const ushort *haystack, int haystackLen, const ushort *needle, int needleLen);
 
@@ -129,24 +130,113 @@ void ICACHE_FLASH_ATTR clearStrList(StrList *list)
     list->count = 0;
 }
 
-LOCAL int ICACHE_FLASH_ATTR strListContains(const StrList *list, const ushort *str, int length, int caseInsensitive)
+// child of node for the (case folded) character, -1 when there is none
+LOCAL int ICACHE_FLASH_ATTR keywordTrieFind(const KeywordTrie *trie, int node, ushort ch)
 {
-	if (!list || !str)
+	int child = trie->nodes[node].child;
+	while (child >= 0 && trie->nodes[child].ch != ch)
+	{
+		child = trie->nodes[child].next;
+	}
+	return child;
+}
+
+void ICACHE_FLASH_ATTR keywordTrieBuild(const ushort *str, KeywordTrie *trie)
+{
+	trie->nodes = NULL;
+	trie->count = 0;
+	if (!str || !*str)
+	{
+		return;
+	}
+	int size = strLength(str) + 1;	// a node per character at most
+	if (size > SHRT_MAX)
+	{
+		return;
+	}
+	trie->nodes = (KeywordTrieNode*)os_malloc(size*sizeof(KeywordTrieNode));
+	if (!trie->nodes)
+	{
+		return;
+	}
+	os_memset(&trie->nodes[0], 0, sizeof(KeywordTrieNode));
+	trie->nodes[0].child = -1;
+	trie->nodes[0].next = -1;
+	trie->count = 1;
+
+	while (*str)
+	{
+		const ushort *word = str;
+		int length = strNextWordLength(str);
+		str += length;
+		// like the words of the text, without the delimiter and the hashtag
+		if (isDelimeter(word[length-1])) length--;
+		if (length > 0 && *word == '#')
+		{
+			word++;
+			length--;
+		}
+		if (length == 0)
+		{
+			continue;	// would match every word
+		}
+
+		int node = 0;
+		int i;
+		for (i = 0; i < length; i++)
+		{
+			ushort ch = chToLower(word[i]);
+			int child = keywordTrieFind(trie, node, ch);
+			if (child < 0)
+			{
+				child = trie->count++;
+				trie->nodes[child].ch = ch;
+				trie->nodes[child].child = -1;
+				trie->nodes[child].next = trie->nodes[node].child;
+				trie->nodes[child].keywordEnd = FALSE;
+				trie->nodes[node].child = child;
+			}
+			node = child;
+		}
+		trie->nodes[node].keywordEnd = TRUE;
+	}
+}
+
+void ICACHE_FLASH_ATTR clearKeywordTrie(KeywordTrie *trie)
+{
+	os_free(trie->nodes);
+	trie->nodes = NULL;
+	trie->count = 0;
+}
+
+// one step per character of the word, whatever the number of keywords
+LOCAL int ICACHE_FLASH_ATTR keywordTrieMatches(const KeywordTrie *trie, const ushort *str, int length)
+{
+	if (!trie || !trie->nodes || !str)
 	{
 		return FALSE;
 	}
-    int i = 0;
-	StrListItem *item = list->first;
-    while (i < list->count && item)
-    {
-    	if (strStartsWith(str, length, item->str, item->length, caseInsensitive))
-    	{
-    		return TRUE;
-    	}
-        item = item->next;
-        i++;
-    }
-    return FALSE;
+	if (length > 0 && isDelimeter(str[length-1])) length--;
+	if (length > 0 && *str == '#')
+	{
+		str++;
+		length--;
+	}
+	int node = 0;
+	int i;
+	for (i = 0; i < length; i++)
+	{
+		node = keywordTrieFind(trie, node, chToLower(str[i]));
+		if (node < 0)
+		{
+			return FALSE;
+		}
+		if (trie->nodes[node].keywordEnd)
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
 }
 
 
@@ -195,7 +285,7 @@ LOCAL void ICACHE_FLASH_ATTR drawWordList(int x, int y, const WordList *wordList
     }
 }
 
-LOCAL void ICACHE_FLASH_ATTR strListToWordList(const StrList *strList, WordList *wordList, const Font *fontReg, const Font *fontBold, const StrList *boldStrList)
+LOCAL void ICACHE_FLASH_ATTR strListToWordList(const StrList *strList, WordList *wordList, const Font *fontReg, const Font *fontBold, const KeywordTrie *boldWords)
 {
     if (!strList->first || strList->count == 0)
     {
@@ -205,7 +295,7 @@ LOCAL void ICACHE_FLASH_ATTR strListToWordList(const StrList *strList, WordList
     }
     StrListItem *str = strList->first;
 
-    const Font *font = (fontBold && strListContains(boldStrList, str->str, str->length, TRUE)) ? fontBold : fontReg;
+    const Font *font = (fontBold && keywordTrieMatches(boldWords, str->str, str->length)) ? fontBold : fontReg;
     WordListItem *item = allocWordListItem(font, str->str, str->length);
     if (!item)
     {
@@ -216,7 +306,7 @@ LOCAL void ICACHE_FLASH_ATTR strListToWordList(const StrList *strList, WordList
     str = str->next;
     while (str)
     {
-    	font = (fontBold && strListContains(boldStrList, str->str, str->length, TRUE)) ? fontBold : fontReg;
+    	font = (fontBold && keywordTrieMatches(boldWords, str->str, str->length)) ? fontBold : fontReg;
         item->next = allocWordListItem(font, str->str, str->length);
         item = item->next;
         if (!item)
@@ -421,7 +511,7 @@ LOCAL void ICACHE_FLASH_ATTR splitWordsToLines(WordList *wordList, LineList *lin
 
 
 int ICACHE_FLASH_ATTR drawStrWordWrapped(int x0, int y0, int x1, int y1, const ushort *str,
-		const Font *fontReg, const Font *fontBold, const StrList *boldStrList, int forceDraw)
+		const Font *fontReg, const Font *fontBold, const KeywordTrie *boldWords, int forceDraw, int *textHeight)
 {
     x0 = clampInt(x0, 0, DISP_WIDTH-1);
     x1 = clampInt(x1, 0, DISP_WIDTH-1);
@@ -435,7 +525,7 @@ int ICACHE_FLASH_ATTR drawStrWordWrapped(int x0, int y0, int x1, int y1, const u
     strSplit(str, &list);
 
     WordList words;
-    strListToWordList(&list, &words, fontReg, fontBold, boldStrList);
+    strListToWordList(&list, &words, fontReg, fontBold, boldWords);
     //printWordList(&words);
 
     LineList lines;
@@ -448,10 +538,12 @@ int ICACHE_FLASH_ATTR drawStrWordWrapped(int x0, int y0, int x1, int y1, const u
 //		drawLineList(x0, y0, height, &lines, lines.height > height);
 //	}
     int fit;
+    int drawnHeight = 0;
     if (forceDraw)
     {
     	fit = lines.compressedHeight <= height;
     	drawLineList(x0, y0, height, &lines, lines.height > height);
+    	drawnHeight = lines.height > height ? lines.compressedHeight : lines.height;
     }
     else
     {
@@ -459,8 +551,13 @@ int ICACHE_FLASH_ATTR drawStrWordWrapped(int x0, int y0, int x1, int y1, const u
     	if (fit)
     	{
         	drawLineList(x0, y0, height, &lines, FALSE);
+        	drawnHeight = lines.height;
     	}
     }
+    if (textHeight)
+    {
+    	*textHeight = MIN(drawnHeight, height);
+    }
 
 	clearLineList(&lines);
     clearWordList(&words);
@@ -861,48 +958,6 @@ LOCAL ushort ICACHE_FLASH_ATTR chToLower(ushort ch)
 	return ch;
 }
 
-/// Case insensitive only works for Latin, Latin supp., Latin ExtA and Cyrillic.
-LOCAL int ICACHE_FLASH_ATTR strStartsWith(const ushort *str1, int len1, const ushort *str2, int len2, int caseInsensitive)
-{
-	if (len1 < 1 || len2 < 1)
-	{
-		return (len1 == len2);
-	}
-	// exclude delimeters
-	if (isDelimeter(str1[len1-1])) len1--;
-	if (isDelimeter(str2[len2-1])) len2--;
-	// exclude hashtags
-	if (*str1 == '#')
-	{
-		str1++;
-		len1--;
-	}
-	if (*str2 == '#')
-	{
-		str2++;
-		len2--;
-	}
-    
-	while (len2 > 0)
-	{
-		if (!*str1 || !*str2)
-		{
-			return FALSE;
-		}
-		if ((caseInsensitive && (chToLower(*str1) != chToLower(*str2))) ||
-		   (!caseInsensitive && (*str1 != *str2)))
-		{
-			return FALSE;
-		}
-		str1++;
-		str2++;
-		len2--;
-	}
-	return TRUE;
-}
-
-
-
 LOCAL int ICACHE_FLASH_ATTR strIsEqual(const ushort *str1, const ushort *str2, int length)
 {
 	if (length < 1)
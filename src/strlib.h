@@ -20,8 +20,25 @@ struct StrList
     int count;
 };
 
+// Track keywords, case folded, with a node per prefix. A word is
+// highlighted when one of the keywords is a prefix of it.
+typedef struct
+{
+    ushort ch;
+    short child;        // first one, -1 for none
+    short next;         // sibling, -1 for none
+    short keywordEnd;
+}KeywordTrieNode;
+typedef struct
+{
+    KeywordTrieNode *nodes;     // the root first
+    int count;
+}KeywordTrie;
+
 void strSplit(const ushort *str, StrList *list);
 void clearStrList(StrList *list);
+void keywordTrieBuild(const ushort *str, KeywordTrie *trie);
+void clearKeywordTrie(KeywordTrie *trie);
 
 int drawChar(const Font *font, int x, int y, ushort ch);
 int drawStr(const Font *font, int x, int y, const ushort *str, int length);
@@ -29,7 +46,7 @@ int drawStr_Latin(const Font *font, int x, int y, const char *str, int length);
 int drawStrHighlight_Latin(const Font *font, int x, int y, const char *str);
 void drawStrWidthLim(const Font *font, int x, int y, const ushort *str, int width);
 int drawStrWordWrapped(int x0, int y0, int x1, int y1, const ushort *str,
-		const Font *fontReg, const Font *fontBold, const StrList *boldStrList, int forceDraw);
+		const Font *fontReg, const Font *fontBold, const KeywordTrie *boldWords, int forceDraw, int *textHeight);
 int replaceLinks(ushort *str, int length);
 int replaceHtmlEntities(ushort *str, int length);
 
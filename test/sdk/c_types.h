@@ -0,0 +1,43 @@
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+// Host stand-ins for the SDK headers, declaring only what the modules
+// under test use. The types keep their sizes on a 64-bit host.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint8_t uint8;
+typedef uint8_t u8;
+typedef int8_t sint8;
+typedef int8_t int8;
+typedef int8_t s8;
+typedef uint16_t uint16;
+typedef uint16_t u16;
+typedef int16_t sint16;
+typedef int16_t s16;
+typedef uint32_t uint32;
+typedef uint32_t u32;
+typedef uint32_t u_int;
+typedef int32_t sint32;
+typedef int32_t int32;
+typedef int32_t s32;
+typedef int64_t sint64;
+typedef uint64_t uint64;
+typedef uint64_t u64;
+
+#define LOCAL static
+
+#define BIT(nr) (1UL << (nr))
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define ICACHE_RAM_ATTR
+#define STORE_ATTR __attribute__((aligned(4)))
+
+#define BOOL bool
+#define TRUE true
+#define FALSE false
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef __ESPCONN_H__
+#define __ESPCONN_H__
+
+#include "c_types.h"
+#include "lwip/dns.h"
+
+typedef void (*espconn_connect_callback)(void *arg);
+typedef void (*espconn_reconnect_callback)(void *arg, sint8 err);
+typedef void (*espconn_recv_callback)(void *arg, char *pdata, unsigned short len);
+typedef void (*espconn_sent_callback)(void *arg);
+
+#define ESPCONN_OK			0
+#define ESPCONN_MEM			-1
+#define ESPCONN_TIMEOUT		-3
+#define ESPCONN_RTE			-4
+#define ESPCONN_INPROGRESS	-5
+#define ESPCONN_MAXNUM		-7
+#define ESPCONN_ABRT		-8
+#define ESPCONN_RST			-9
+#define ESPCONN_CLSD		-10
+#define ESPCONN_CONN		-11
+#define ESPCONN_ARG			-12
+#define ESPCONN_IF			-14
+#define ESPCONN_ISCONN		-15
+#define ESPCONN_HANDSHAKE	-28
+#define ESPCONN_SSL_INVALID_DATA	-61
+
+enum espconn_type{
+	ESPCONN_INVALID = 0,
+	ESPCONN_TCP = 0x10,
+	ESPCONN_UDP = 0x20
+};
+
+enum espconn_state{
+	ESPCONN_NONE,
+	ESPCONN_WAIT,
+	ESPCONN_LISTEN,
+	ESPCONN_CONNECT,
+	ESPCONN_WRITE,
+	ESPCONN_READ,
+	ESPCONN_CLOSE
+};
+
+typedef struct _esp_tcp{
+	int remote_port;
+	int local_port;
+	uint8 local_ip[4];
+	uint8 remote_ip[4];
+	espconn_connect_callback connect_callback;
+	espconn_reconnect_callback reconnect_callback;
+	espconn_connect_callback disconnect_callback;
+	espconn_connect_callback write_finish_fn;
+}esp_tcp;
+
+struct espconn{
+	enum espconn_type type;
+	enum espconn_state state;
+	union{
+		esp_tcp *tcp;
+	}proto;
+	espconn_recv_callback recv_callback;
+	espconn_sent_callback sent_callback;
+	uint8 link_cnt;
+	void *reverse;
+};
+
+#define ESPCONN_CLIENT	0x01
+
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb);
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb);
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb);
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb);
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb);
+err_t espconn_gethostbyname(struct espconn *pespconn, const char *hostname, ip_addr_t *addr, dns_found_callback found);
+uint32 espconn_port(void);
+
+sint8 espconn_secure_connect(struct espconn *espconn);
+sint8 espconn_secure_disconnect(struct espconn *espconn);
+sint8 espconn_secure_send(struct espconn *espconn, uint8 *psent, uint16 length);
+bool espconn_secure_set_size(uint8 level, uint16 size);
+
+#endif
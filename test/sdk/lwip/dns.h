@@ -0,0 +1,9 @@
+#ifndef __LWIP_DNS_H__
+#define __LWIP_DNS_H__
+
+#include "ip_addr.h"
+#include "lwip/err.h"
+
+typedef void (*dns_found_callback)(const char *name, ip_addr_t *ipaddr, void *callback_arg);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __LWIP_ERR_H__
+#define __LWIP_ERR_H__
+
+typedef sint8 err_t;
+
+#define ERR_OK			0
+#define ERR_MEM			-1
+#define ERR_INPROGRESS	-5
+#define ERR_ARG			-14
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include "c_types.h"
+
+void *pvPortMalloc(size_t size, const char *file, unsigned line);
+void *pvPortZalloc(size_t size, const char *file, unsigned line);
+void *pvPortRealloc(void *ptr, size_t size, const char *file, unsigned line);
+void vPortFree(void *ptr, const char *file, unsigned line);
+
+#define os_malloc(s) pvPortMalloc(s, __FILE__, __LINE__)
+#define os_zalloc(s) pvPortZalloc(s, __FILE__, __LINE__)
+#define os_realloc(p, s) pvPortRealloc(p, s, __FILE__, __LINE__)
+#define os_free(s) vPortFree(s, __FILE__, __LINE__)
+
+#endif
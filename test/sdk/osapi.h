@@ -0,0 +1,40 @@
+#ifndef _OSAPI_H_
+#define _OSAPI_H_
+
+#include <string.h>
+#include "os_type.h"
+
+int ets_sprintf(char *str, const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+int ets_snprintf(char *str, unsigned int size, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+int os_printf_plus(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+void ets_timer_arm_new(os_timer_t *ptimer, uint32 time, bool repeat_flag, bool ms_flag);
+void ets_timer_disarm(os_timer_t *ptimer);
+void ets_timer_setfn(os_timer_t *ptimer, os_timer_func_t *pfunction, void *parg);
+
+unsigned long os_random(void);
+
+#define os_bzero(s, n) memset(s, 0, n)
+#define os_memcmp memcmp
+#define os_memcpy memcpy
+#define os_memmove memmove
+#define os_memset memset
+#define os_strcat strcat
+#define os_strchr strchr
+#define os_strcmp strcmp
+#define os_strcpy strcpy
+#define os_strlen strlen
+#define os_strncmp strncmp
+#define os_strncpy strncpy
+#define os_strstr strstr
+
+#define os_sprintf ets_sprintf
+#define os_snprintf ets_snprintf
+#define os_printf os_printf_plus
+
+#define os_timer_arm(a, b, c) ets_timer_arm_new(a, b, c, 1)
+#define os_timer_arm_us(a, b, c) ets_timer_arm_new(a, b, c, 0)
+#define os_timer_disarm ets_timer_disarm
+#define os_timer_setfn ets_timer_setfn
+
+#endif
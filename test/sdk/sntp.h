@@ -0,0 +1,8 @@
+#ifndef __SNTP_H__
+#define __SNTP_H__
+
+#include "c_types.h"
+
+uint32 sntp_get_current_timestamp(void);
+
+#endif
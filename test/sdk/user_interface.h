@@ -0,0 +1,18 @@
+#ifndef __USER_INTERFACE_H__
+#define __USER_INTERFACE_H__
+
+#include "os_type.h"
+#include "ip_addr.h"
+#include "spi_flash.h"
+
+#define USER_TASK_PRIO_0	0
+#define USER_TASK_PRIO_1	1
+#define USER_TASK_PRIO_2	2
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen);
+bool system_os_post(uint8 prio, os_signal_t sig, os_param_t par);
+
+uint32 system_get_time(void);
+uint32 system_get_free_heap_size(void);
+
+#endif
@@ -0,0 +1,733 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <os_type.h>
+#include <osapi.h>
+#include <mem.h>
+#include <user_interface.h>
+#include <sntp.h>
+#include <spi_flash.h>
+#include <espconn.h>
+#include "common.h"
+#include "shim.h"
+#include "oauth.h"
+
+#define SHIM_RANDOM_SEED	2463534242u
+#define NET_CLOSE_TIME		1000	// us, until a disconnect by the device is done
+
+typedef enum{
+	netConnected,
+	netSent,
+	netToServer,
+	netToDevice,
+	netClosed
+}NetEventType;
+
+typedef struct NetEvent{
+	struct NetEvent *next;
+	uint64 due;				// us
+	NetEventType type;
+	uint serial;			// of the session it belongs to
+	int byServer;			// closed by the server
+	char *data;
+	int length;
+}NetEvent;
+
+ShimHeap shimHeap = {0};
+ShimNet shimNet = {0};
+int shimQuiet = FALSE;
+
+LOCAL uint64 nowUs = 0;
+LOCAL uint timestampBase = 0;		// sntp time at timestampSetUs
+LOCAL uint64 timestampSetUs = 0;
+LOCAL uint randomState = SHIM_RANDOM_SEED;
+LOCAL os_timer_t *timers = NULL;	// armed, in no particular order
+LOCAL const SHA1_CTX *captureContext = NULL;
+LOCAL char *captureBuf;
+LOCAL uint captureSize;
+LOCAL uint captureLen;
+LOCAL uchar flash[SHIM_FLASH_SECTORS * SPI_FLASH_SEC_SIZE];
+LOCAL int flashErased = FALSE;
+LOCAL uint flashOps = 0;			// writes and erases
+LOCAL int flashOpsLeft = -1;		// until the power cut, -1 when none is coming
+LOCAL uint flashCutBytes;			// of the operation which is cut
+LOCAL int flashCut = FALSE;
+LOCAL const ShimServer *netServer = NULL;
+LOCAL uint netHandshake;			// ms
+LOCAL uint netRtt;					// ms
+LOCAL NetEvent *netEvents = NULL;	// by due time, in order among equal ones
+LOCAL os_timer_t netTmr;
+LOCAL struct espconn *netSession = NULL;
+LOCAL uint netSerial = 0;
+LOCAL int netUp = FALSE;			// handshake done
+LOCAL int netClosing = FALSE;
+
+
+int ets_sprintf(char *str, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int len = vsprintf(str, format, args);
+	va_end(args);
+	return len;
+}
+
+int ets_snprintf(char *str, unsigned int size, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(str, size, format, args);
+	va_end(args);
+	return len;
+}
+
+int os_printf_plus(const char *format, ...)
+{
+	if (shimQuiet)
+	{
+		return 0;
+	}
+	va_list args;
+	va_start(args, format);
+	int len = vprintf(format, args);
+	va_end(args);
+	return len;
+}
+
+
+uint32 system_get_time(void)
+{
+	return (uint32)nowUs;
+}
+
+uint32 sntp_get_current_timestamp(void)
+{
+	if (!timestampBase)
+	{
+		return 0;
+	}
+	return timestampBase + (uint)((nowUs - timestampSetUs) / 1000000);
+}
+
+void shimSetTimestamp(uint timestamp)
+{
+	timestampBase = timestamp;
+	timestampSetUs = nowUs;
+}
+
+uint shimNow(void)
+{
+	return (uint)(nowUs / 1000);
+}
+
+
+unsigned long os_random(void)		// xorshift32
+{
+	uint x = randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	randomState = x;
+	return x;
+}
+
+void shimSeedRandom(uint seed)
+{
+	randomState = seed;
+}
+
+
+// the size is kept in front of the block
+#define BLOCK_HEADER	16
+
+void *pvPortMalloc(size_t size, const char *file, unsigned line)
+{
+	uchar *block = (uchar*)malloc(BLOCK_HEADER + size);
+	if (!block)
+	{
+		return NULL;
+	}
+	*(size_t*)block = size;
+	shimHeap.current += size;
+	shimHeap.peak = MAX(shimHeap.peak, shimHeap.current);
+	shimHeap.allocs++;
+	return block + BLOCK_HEADER;
+}
+
+void *pvPortZalloc(size_t size, const char *file, unsigned line)
+{
+	void *ptr = pvPortMalloc(size, file, line);
+	if (ptr)
+	{
+		memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+void vPortFree(void *ptr, const char *file, unsigned line)
+{
+	if (!ptr)
+	{
+		return;
+	}
+	uchar *block = (uchar*)ptr - BLOCK_HEADER;
+	shimHeap.current -= *(size_t*)block;
+	shimHeap.frees++;
+	free(block);
+}
+
+void *pvPortRealloc(void *ptr, size_t size, const char *file, unsigned line)
+{
+	void *newPtr = pvPortMalloc(size, file, line);
+	if (newPtr && ptr)
+	{
+		size_t oldSize = *(size_t*)((uchar*)ptr - BLOCK_HEADER);
+		memcpy(newPtr, ptr, MIN(oldSize, size));
+		vPortFree(ptr, file, line);
+	}
+	return newPtr;
+}
+
+uint32 system_get_free_heap_size(void)
+{
+	return shimHeap.current < SHIM_HEAP_SIZE ? SHIM_HEAP_SIZE - shimHeap.current : 0;
+}
+
+void shimHeapResetPeak(void)
+{
+	shimHeap.peak = shimHeap.current;
+}
+
+
+void ets_timer_disarm(os_timer_t *ptimer)
+{
+	os_timer_t **link;
+	for (link = &timers; *link; link = &(*link)->timer_next)
+	{
+		if (*link == ptimer)
+		{
+			*link = ptimer->timer_next;
+			break;
+		}
+	}
+	ptimer->timer_next = NULL;
+}
+
+void ets_timer_setfn(os_timer_t *ptimer, os_timer_func_t *pfunction, void *parg)
+{
+	ets_timer_disarm(ptimer);
+	ptimer->timer_func = pfunction;
+	ptimer->timer_arg = parg;
+}
+
+void ets_timer_arm_new(os_timer_t *ptimer, uint32 time, bool repeat_flag, bool ms_flag)
+{
+	ets_timer_disarm(ptimer);
+	uint32 delay = ms_flag ? time * 1000 : time;
+	ptimer->timer_expire = (uint32)nowUs + delay;
+	ptimer->timer_period = repeat_flag ? MAX(delay, 1) : 0;
+	ptimer->timer_next = timers;
+	timers = ptimer;
+}
+
+// the armed timer due first, if it is due by the time given
+LOCAL os_timer_t *nextTimer(uint64 until)
+{
+	os_timer_t *next = NULL;
+	os_timer_t *timer;
+	for (timer = timers; timer; timer = timer->timer_next)
+	{
+		if (!next || (sint32)(timer->timer_expire - next->timer_expire) < 0)
+		{
+			next = timer;
+		}
+	}
+	if (next && (sint32)(next->timer_expire - (uint32)until) > 0)
+	{
+		return NULL;
+	}
+	return next;
+}
+
+void shimAdvance(uint ms)
+{
+	uint64 until = nowUs + (uint64)ms * 1000;
+	os_timer_t *timer;
+	while ((timer = nextTimer(until)) != NULL)
+	{
+		nowUs += (uint32)(timer->timer_expire - (uint32)nowUs);
+		ets_timer_disarm(timer);
+		if (timer->timer_period)
+		{
+			ets_timer_arm_new(timer, timer->timer_period, TRUE, FALSE);
+		}
+		timer->timer_func(timer->timer_arg);
+	}
+	nowUs = until;
+}
+
+
+// NOR flash: erasing sets the bits of a sector, writing only clears bits
+
+LOCAL int flashRange(uint32 addr, uint32 size)
+{
+	if (!flashErased)
+	{
+		shimFlashErase();
+	}
+	return addr % 4 == 0 && size % 4 == 0 && addr + size <= sizeof(flash) && addr + size >= addr;
+}
+
+// bytes of the operation which make it before the power is cut,
+// the device doesn't know, it goes on until the test reboots it
+LOCAL uint32 flashPowered(uint32 size)
+{
+	flashOps++;
+	if (flashCut)
+	{
+		return 0;
+	}
+	if (flashOpsLeft < 0 || flashOpsLeft-- > 0)
+	{
+		return size;
+	}
+	flashCut = TRUE;
+	return MIN(size, flashCutBytes);
+}
+
+SpiFlashOpResult spi_flash_erase_sector(uint16 sec)
+{
+	if (!flashRange(sec * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE))
+	{
+		return SPI_FLASH_RESULT_ERR;
+	}
+	memset(flash + sec * SPI_FLASH_SEC_SIZE, 0xFF, flashPowered(SPI_FLASH_SEC_SIZE));
+	return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size)
+{
+	if (!flashRange(des_addr, size))
+	{
+		return SPI_FLASH_RESULT_ERR;
+	}
+	const uchar *src = (const uchar*)src_addr;
+	uint32 i;
+	size = flashPowered(size);
+	for (i = 0; i < size; i++)
+	{
+		flash[des_addr + i] &= src[i];
+	}
+	return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size)
+{
+	if (!flashRange(src_addr, size))
+	{
+		return SPI_FLASH_RESULT_ERR;
+	}
+	memcpy(des_addr, flash + src_addr, size);
+	return SPI_FLASH_RESULT_OK;
+}
+
+void shimFlashErase(void)
+{
+	memset(flash, 0xFF, sizeof(flash));
+	flashErased = TRUE;
+}
+
+void shimFlashPowerCut(int ops, uint bytes)
+{
+	flashOpsLeft = ops;
+	flashCutBytes = bytes;
+	flashCut = FALSE;
+}
+
+int shimFlashIsCut(void)
+{
+	return flashCut;
+}
+
+uint shimFlashOps(void)
+{
+	return flashOps;
+}
+
+
+// what is hashed into context from now on is copied to buf as well
+void shimSha1Capture(const SHA1_CTX *context, char *buf, int size)
+{
+	captureContext = context;
+	captureBuf = buf;
+	captureSize = size - 1;		// room for '\0'
+	captureLen = 0;
+	if (buf)
+	{
+		*buf = '\0';
+	}
+}
+
+
+// TLS connections of espconn_secure_*, the events are on one timer
+// so that the ones due at the same time come in the order they were made
+
+LOCAL void netTmrCb(void);
+
+LOCAL void netArm(void)
+{
+	ets_timer_disarm(&netTmr);
+	if (netEvents)
+	{
+		ets_timer_setfn(&netTmr, (os_timer_func_t*)netTmrCb, NULL);
+		ets_timer_arm_new(&netTmr, netEvents->due > nowUs ? (uint32)(netEvents->due - nowUs) : 0, FALSE, FALSE);
+	}
+}
+
+// delay in us
+LOCAL NetEvent *netPost(NetEventType type, uint delay, const char *data, int length)
+{
+	NetEvent *event = (NetEvent*)calloc(1, sizeof(NetEvent));
+	event->due = nowUs + delay;
+	event->type = type;
+	event->serial = netSerial;
+	if (length)
+	{
+		event->data = (char*)malloc(length);
+		memcpy(event->data, data, length);
+		event->length = length;
+	}
+	NetEvent **link = &netEvents;
+	while (*link && (*link)->due <= event->due)
+	{
+		link = &(*link)->next;
+	}
+	event->next = *link;
+	*link = event;
+	netArm();
+	return event;
+}
+
+LOCAL void netDeliver(NetEvent *event)
+{
+	struct espconn *conn = netSession;
+	if (!conn || event->serial != netSerial || (netClosing && event->type != netClosed))
+	{
+		return;		// the connection is gone
+	}
+	switch (event->type)
+	{
+	case netConnected:
+		netUp = TRUE;
+		conn->proto.tcp->connect_callback(conn);
+		if (netSession == conn && netServer->connected)
+		{
+			netServer->connected(conn);
+		}
+		break;
+	case netSent:
+		if (conn->sent_callback)
+		{
+			conn->sent_callback(conn);
+		}
+		break;
+	case netToServer:
+		netServer->received(conn, event->data, event->length);
+		break;
+	case netToDevice:
+		shimNet.bytesReceived += event->length;
+		conn->recv_callback(conn, event->data, event->length);
+		break;
+	case netClosed:
+		netSession = NULL;
+		netUp = FALSE;
+		netClosing = FALSE;
+		if (!event->byServer && netServer->closed)
+		{
+			netServer->closed(conn);
+		}
+		if (conn->proto.tcp->disconnect_callback)
+		{
+			conn->proto.tcp->disconnect_callback(conn);
+		}
+		break;
+	}
+}
+
+LOCAL void netTmrCb(void)
+{
+	while (netEvents && netEvents->due <= nowUs)
+	{
+		NetEvent *event = netEvents;
+		netEvents = event->next;
+		netDeliver(event);
+		free(event->data);
+		free(event);
+	}
+	netArm();
+}
+
+void shimNetServe(const ShimServer *server, uint handshake, uint rtt)
+{
+	netServer = server;
+	netHandshake = handshake;
+	netRtt = rtt;
+}
+
+void shimNetSend(struct espconn *conn, const char *data, int length)
+{
+	if (conn == netSession && netUp && !netClosing)
+	{
+		netPost(netToDevice, netRtt*500, data, length);
+	}
+}
+
+void shimNetClose(struct espconn *conn)
+{
+	if (conn == netSession && !netClosing)
+	{
+		netClosing = TRUE;
+		netPost(netClosed, netRtt*500, NULL, 0)->byServer = TRUE;
+	}
+}
+
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb)
+{
+	espconn->proto.tcp->connect_callback = connect_cb;
+	return ESPCONN_OK;
+}
+
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb)
+{
+	espconn->proto.tcp->reconnect_callback = recon_cb;
+	return ESPCONN_OK;
+}
+
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb)
+{
+	espconn->proto.tcp->disconnect_callback = discon_cb;
+	return ESPCONN_OK;
+}
+
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb)
+{
+	espconn->recv_callback = recv_cb;
+	return ESPCONN_OK;
+}
+
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb)
+{
+	espconn->sent_callback = sent_cb;
+	return ESPCONN_OK;
+}
+
+// every host is in the resolver's table
+err_t espconn_gethostbyname(struct espconn *pespconn, const char *hostname, ip_addr_t *addr, dns_found_callback found)
+{
+	IP4_ADDR(addr, 10, 0, 0, 1);
+	return ESPCONN_OK;
+}
+
+uint32 espconn_port(void)
+{
+	static uint32 port = 1024;
+	return ++port;
+}
+
+bool espconn_secure_set_size(uint8 level, uint16 size)
+{
+	return TRUE;
+}
+
+sint8 espconn_secure_connect(struct espconn *espconn)
+{
+	if (netSession)
+	{
+		shimNet.refused++;
+		return ESPCONN_ISCONN;
+	}
+	netSession = espconn;
+	netSerial++;
+	netUp = FALSE;
+	netClosing = FALSE;
+	shimNet.connects++;
+	netPost(netConnected, netHandshake*1000, NULL, 0);
+	return ESPCONN_OK;
+}
+
+sint8 espconn_secure_disconnect(struct espconn *espconn)
+{
+	if (espconn != netSession || netClosing)
+	{
+		return ESPCONN_ARG;
+	}
+	netClosing = TRUE;
+	netPost(netClosed, NET_CLOSE_TIME, NULL, 0);
+	return ESPCONN_OK;
+}
+
+sint8 espconn_secure_send(struct espconn *espconn, uint8 *psent, uint16 length)
+{
+	if (espconn != netSession || !netUp || netClosing)
+	{
+		return ESPCONN_CONN;
+	}
+	shimNet.sends++;
+	shimNet.bytesSent += length;
+	netPost(netToServer, netRtt*500, (const char*)psent, length);
+	netPost(netSent, netRtt*1000, NULL, 0);
+	return ESPCONN_OK;
+}
+
+
+void shimReset(void)
+{
+	while (timers)
+	{
+		ets_timer_disarm(timers);
+	}
+	while (netEvents)
+	{
+		NetEvent *event = netEvents;
+		netEvents = event->next;
+		free(event->data);
+		free(event);
+	}
+	netSession = NULL;
+	netUp = FALSE;
+	netClosing = FALSE;
+	memset(&shimNet, 0, sizeof(shimNet));
+	nowUs = 0;
+	timestampBase = 0;
+	timestampSetUs = 0;
+	randomState = SHIM_RANDOM_SEED;
+	flashOpsLeft = -1;
+	flashCut = FALSE;
+}
+
+
+// SHA-1 in ROM on the device, FIPS 180-1 here
+
+#define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+LOCAL void sha1Transform(uint state[5], const uchar block[64])
+{
+	uint w[80];
+	int i;
+	for (i = 0; i < 16; i++)
+	{
+		w[i] = (uint)block[4*i] << 24 | (uint)block[4*i+1] << 16 | (uint)block[4*i+2] << 8 | block[4*i+3];
+	}
+	for (; i < 80; i++)
+	{
+		w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+	}
+
+	uint a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for (i = 0; i < 80; i++)
+	{
+		uint f, k;
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		uint t = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void SHA1Init(SHA1_CTX *context)
+{
+	context->state[0] = 0x67452301;
+	context->state[1] = 0xEFCDAB89;
+	context->state[2] = 0x98BADCFE;
+	context->state[3] = 0x10325476;
+	context->state[4] = 0xC3D2E1F0;
+	context->count[0] = 0;
+	context->count[1] = 0;
+}
+
+// count[0] is the low word of the length in bits
+LOCAL void sha1Update(SHA1_CTX *context, const void *data, uint len)
+{
+	const uchar *src = (const uchar*)data;
+	uint used = (context->count[0] >> 3) & 63;
+	uint bits = len << 3;
+	context->count[0] += bits;
+	if (context->count[0] < bits)
+	{
+		context->count[1]++;
+	}
+	context->count[1] += len >> 29;
+
+	while (len > 0)
+	{
+		uint n = MIN(len, 64 - used);
+		memcpy(context->buffer + used, src, n);
+		used += n;
+		src += n;
+		len -= n;
+		if (used == 64)
+		{
+			sha1Transform(context->state, context->buffer);
+			used = 0;
+		}
+	}
+}
+
+void SHA1Update(SHA1_CTX *context, const void *data, uint len)
+{
+	if (context == captureContext && captureLen + len <= captureSize)
+	{
+		memcpy(captureBuf + captureLen, data, len);
+		captureLen += len;
+		captureBuf[captureLen] = '\0';
+	}
+	sha1Update(context, data, len);
+}
+
+void SHA1Final(uchar digest[20], SHA1_CTX *context)
+{
+	uchar length[8];
+	int i;
+	for (i = 0; i < 4; i++)
+	{
+		length[i] = context->count[1] >> (24 - 8*i);
+		length[4+i] = context->count[0] >> (24 - 8*i);
+	}
+	sha1Update(context, "\x80", 1);
+	while (((context->count[0] >> 3) & 63) != 56)
+	{
+		sha1Update(context, "", 1);
+	}
+	sha1Update(context, length, 8);
+	for (i = 0; i < 20; i++)
+	{
+		digest[i] = context->state[i/4] >> (24 - 8*(i%4));
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef TEST_SHIM_H_
+#define TEST_SHIM_H_
+
+#include "typedefs.h"
+#include "oauth.h"
+
+// The SDK functions of sdk/*.h on the host: a virtual clock which
+// system_get_time, sntp and the timers follow, a heap which counts,
+// a seeded random source, so that every run is the same, the first
+// sectors of the flash in RAM, and TLS connections to a server in the
+// test which take their time on the clock.
+
+#define SHIM_HEAP_SIZE		40000	// free on the device with both connections idle
+#define SHIM_FLASH_SECTORS	16		// the saved sectors are below 0x10
+
+typedef struct{
+	uint current;		// bytes allocated
+	uint peak;
+	uint allocs;
+	uint frees;
+}ShimHeap;
+
+struct espconn;
+
+// the other end of the connections, called as the data arrives
+typedef struct{
+	void (*connected)(struct espconn *conn);
+	void (*received)(struct espconn *conn, const char *data, int length);
+	void (*closed)(struct espconn *conn);		// by the device
+}ShimServer;
+
+typedef struct{
+	uint connects;		// handshakes started
+	uint refused;		// connects while the session was taken
+	uint sends;
+	uint bytesSent;
+	uint bytesReceived;
+}ShimNet;
+
+extern ShimHeap shimHeap;
+extern ShimNet shimNet;
+extern int shimQuiet;			// os_printf prints nothing
+
+void shimReset(void);			// clock to 0, timers disarmed, seed and time set back, power on
+void shimAdvance(uint ms);		// timers due on the way fire in order
+uint shimNow(void);				// ms
+void shimSetTimestamp(uint timestamp);	// sntp time now, 0 when not synced
+void shimSeedRandom(uint seed);
+void shimHeapResetPeak(void);
+void shimFlashErase(void);		// all of it, kept by shimReset()
+// ops more writes and erases get through, the next one only its first
+// bytes, none after it until shimReset() turns the power back on
+void shimFlashPowerCut(int ops, uint bytes);
+int shimFlashIsCut(void);		// the cut operation is done
+uint shimFlashOps(void);		// writes and erases so far
+void shimSha1Capture(const SHA1_CTX *context, char *buf, int size);	// NULL context stops
+// like the SDK one TLS session at a time, a connect takes handshake ms,
+// the data rtt/2 each way and its sent callback comes after rtt
+void shimNetServe(const ShimServer *server, uint handshake, uint rtt);
+void shimNetSend(struct espconn *conn, const char *data, int length);	// to the device
+void shimNetClose(struct espconn *conn);		// by the server
+
+
+#endif /* TEST_SHIM_H_ */
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <c_types.h>
+#include "config.h"
+#include "test.h"
+
+Config config;
+
+LOCAL int checks = 0;
+LOCAL int failures = 0;
+
+
+int testCheck(int ok, const char *expr, const char *file, int line)
+{
+	checks++;
+	if (!ok)
+	{
+		failures++;
+		printf("%s:%d: FAILED %s\n", file, line, expr);
+	}
+	return ok;
+}
+
+int testCheckInt(long value, long expected, const char *expr, const char *file, int line)
+{
+	checks++;
+	if (value != expected)
+	{
+		failures++;
+		printf("%s:%d: FAILED %s is %ld, expected %ld\n", file, line, expr, value, expected);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int testCheckStr(const char *str, const char *expected, const char *expr, const char *file, int line)
+{
+	checks++;
+	if (!str || strcmp(str, expected))
+	{
+		failures++;
+		printf("%s:%d: FAILED %s is \"%s\", expected \"%s\"\n", file, line, expr, str ? str : "(null)", expected);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int testCheckMem(const void *data, const void *expected, int len, const char *expr, const char *file, int line)
+{
+	checks++;
+	const uchar *a = (const uchar*)data;
+	const uchar *b = (const uchar*)expected;
+	int i;
+	for (i = 0; i < len; i++)
+	{
+		if (a[i] != b[i])
+		{
+			failures++;
+			printf("%s:%d: FAILED %s differs at byte %d: %02x, expected %02x\n", file, line, expr, i, a[i], b[i]);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+int testDone(const char *name)
+{
+	printf("%s: %d checks, %d failed\n", name, checks, failures);
+	return failures ? 1 : 0;
+}
+
+
+double testSeconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+char *testReadFile(const char *path, int *length)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char *data = (char*)malloc(size + 1);
+	if (data && fread(data, 1, size, file) != size)
+	{
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	if (data)
+	{
+		data[size] = '\0';
+		*length = size;
+	}
+	return data;
+}
+
+int testWriteFile(const char *path, const char *data, int length)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+	{
+		return ERROR;
+	}
+	int written = fwrite(data, 1, length, file);
+	fclose(file);
+	return written == length ? OK : ERROR;
+}
+
+
+void testExampleCredentials(void)
+{
+	strcpy(config.consumer_key, "xvz1evFS4wEEPTGEFPHBog");
+	strcpy(config.consumer_secret, "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw");
+	strcpy(config.access_token, "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb");
+	strcpy(config.token_secret, "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+}
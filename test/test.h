@@ -0,0 +1,28 @@
+#ifndef TEST_TEST_H_
+#define TEST_TEST_H_
+
+#include "typedefs.h"
+
+// A failed check prints where it is and the run goes on,
+// testDone() gives the exit code.
+
+#define CHECK(cond)				testCheck(!!(cond), #cond, __FILE__, __LINE__)
+#define CHECK_INT(a, b)			testCheckInt((a), (b), #a, __FILE__, __LINE__)
+#define CHECK_STR(a, b)			testCheckStr((a), (b), #a, __FILE__, __LINE__)
+#define CHECK_MEM(a, b, len)	testCheckMem((a), (b), (len), #a, __FILE__, __LINE__)
+
+int testCheck(int ok, const char *expr, const char *file, int line);
+int testCheckInt(long value, long expected, const char *expr, const char *file, int line);
+int testCheckStr(const char *str, const char *expected, const char *expr, const char *file, int line);
+int testCheckMem(const void *data, const void *expected, int len, const char *expr, const char *file, int line);
+int testDone(const char *name);
+
+double testSeconds(void);		// monotonic, for the benchmarks
+
+char *testReadFile(const char *path, int *length);	// malloc'd, null terminated
+int testWriteFile(const char *path, const char *data, int length);
+
+void testExampleCredentials(void);	// of Twitter's request signing example
+
+
+#endif /* TEST_TEST_H_ */
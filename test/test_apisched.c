@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/apisched.c"
+#include "shim.h"
+#include "test.h"
+
+// The REST queue against a mock server: conn.c is replaced by a
+// connection which the test brings up and down, the requests written
+// to it are kept in order, and the server answers them with canned
+// replies which go through httpRespFeed like the received data does.
+
+#define TIMESTAMP			1318622958
+#define CONNECT_TIME		300		// ms, TLS handshake
+#define SEND_TIME			5		// ms, until the sent callback
+#define REPLY_PIECE_LEN		7		// received in pieces this long
+#define REQUESTS_MAX		32
+#define REPLIES_MAX			32
+#define RATE_LIMIT			15		// of the like endpoint, per window
+
+typedef struct{
+	ApiEndpoint endpoint;
+	char arg[API_ARG_SIZE];
+}Request;
+
+typedef struct{
+	ApiEndpoint endpoint;
+	char arg[API_ARG_SIZE];
+	int status;				// -1 when deferred
+	char body[64];
+	uint time;				// ms
+}Reply;
+
+// conn.c
+LOCAL ConnParserFunc parserFunc;
+LOCAL ConnRequestFunc requestFunc;
+LOCAL int online = FALSE;			// the server can be reached
+LOCAL int connected = FALSE;
+LOCAL int connecting = FALSE;
+LOCAL int txBusy = FALSE;
+LOCAL int requestsPending = 0;
+LOCAL uint serial = 0;
+LOCAL int sendFailures = 0;			// next sends which fail
+LOCAL os_timer_t connectTmr;
+LOCAL os_timer_t sentTmr;
+
+// the server
+LOCAL Request requests[REQUESTS_MAX];	// not yet answered, in order
+LOCAL int requestCount = 0;
+LOCAL int requestsTotal = 0;
+
+// what the application got
+LOCAL Reply replies[REPLIES_MAX];
+LOCAL int replyCount = 0;
+
+// journal.c
+LOCAL uint journalSeq = 0;
+LOCAL uint journalDoneSeqs[REPLIES_MAX];
+LOCAL int journalDoneCount = 0;
+LOCAL Request journaled[API_QUEUE_LEN];		// for the replay after a reset
+LOCAL int journaledCount = 0;
+
+
+LOCAL void ICACHE_FLASH_ATTR connectDone(void)
+{
+	connecting = FALSE;
+	if (!online)
+	{
+		return;		// tried again by the next request
+	}
+	connected = TRUE;
+	txBusy = FALSE;
+	serial++;
+	if (requestFunc)
+	{
+		requestFunc();
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR startConnect(void)
+{
+	if (!connecting)
+	{
+		connecting = TRUE;
+		os_timer_disarm(&connectTmr);
+		os_timer_setfn(&connectTmr, (os_timer_func_t*)connectDone, NULL);
+		os_timer_arm(&connectTmr, CONNECT_TIME, 0);
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR dataSent(void)
+{
+	txBusy = FALSE;
+	if (requestsPending && requestFunc)
+	{
+		requestFunc();
+	}
+}
+
+void connInit(ConnId id, const char *host, ConnParserFunc func)
+{
+	parserFunc = func;
+}
+
+void connRequest(ConnId id, ConnRequestFunc func)
+{
+	requestFunc = func;
+	requestsPending++;
+	if (connected)
+	{
+		if (!txBusy)
+		{
+			requestFunc();
+		}
+	}
+	else
+	{
+		startConnect();
+	}
+}
+
+void connCancelRequest(ConnId id)
+{
+	if (requestsPending)
+	{
+		requestsPending--;
+	}
+}
+
+int connCanSend(ConnId id)
+{
+	return connected && !txBusy;
+}
+
+uint connSerial(ConnId id)
+{
+	return serial;
+}
+
+// the server drops the connection, the requests are sent again on the next
+LOCAL void drop(void)
+{
+	connected = FALSE;
+	requestCount = 0;
+	if (requestsPending)
+	{
+		startConnect();
+	}
+}
+
+LOCAL int sendRequest(ApiEndpoint endpoint, const char *arg)
+{
+	if (!connCanSend(ConnApi))
+	{
+		return ERROR;
+	}
+	if (sendFailures)
+	{
+		sendFailures--;
+		return ERROR;
+	}
+	Request *request = &requests[requestCount++];
+	request->endpoint = endpoint;
+	strcpy(request->arg, arg);
+	requestsTotal++;
+	txBusy = TRUE;
+	os_timer_disarm(&sentTmr);
+	os_timer_setfn(&sentTmr, (os_timer_func_t*)dataSent, NULL);
+	os_timer_arm(&sentTmr, SEND_TIME, 0);
+	return OK;
+}
+
+LOCAL int sendUserInfo(const char *arg) { return sendRequest(ApiUserInfo, arg); }
+LOCAL int sendDirectMsg(const char *arg) { return sendRequest(ApiDirectMsg, arg); }
+LOCAL int sendRetweet(const char *arg) { return sendRequest(ApiRetweet, arg); }
+LOCAL int sendLike(const char *arg) { return sendRequest(ApiLike, arg); }
+
+LOCAL const ApiSendFunc sendFuncList[ApiEndpointCount] = {
+	sendUserInfo, sendDirectMsg, sendRetweet, sendLike
+};
+
+LOCAL char body[256];
+LOCAL int bodyLen;
+
+LOCAL int collectBody(void *arg, const char *data, int length)
+{
+	memcpy(body + bodyLen, data, length);
+	bodyLen += length;
+	return OK;
+}
+
+// answers the oldest request, rateLimitReset is relative, in seconds,
+// no rate limit headers when remaining is -1
+LOCAL void serverReply(int status, int remaining, int rateLimitReset, const char *text)
+{
+	char reply[512];
+	int len = snprintf(reply, sizeof(reply), "HTTP/1.1 %d %s\r\n"
+			"content-type: application/json;charset=utf-8\r\n"
+			"Content-Length: %d\r\n", status, status == 200 ? "OK" : "Too Many Requests", (int)strlen(text));
+	if (remaining >= 0)
+	{
+		len += snprintf(reply + len, sizeof(reply) - len, "x-rate-limit-limit: %d\r\n"
+				"x-rate-limit-remaining: %d\r\nx-rate-limit-reset: %u\r\n",
+				RATE_LIMIT, remaining, sntp_get_current_timestamp() + rateLimitReset);
+	}
+	len += snprintf(reply + len, sizeof(reply) - len, "\r\n%s", text);
+
+	if (!CHECK(requestCount > 0))
+	{
+		return;
+	}
+	HttpResp resp;
+	httpRespInit(&resp, collectBody, NULL);
+	bodyLen = 0;
+	int pos;
+	for (pos = 0; pos < len; pos += REPLY_PIECE_LEN)
+	{
+		int piece = MIN(REPLY_PIECE_LEN, len - pos);
+		CHECK_INT(httpRespFeed(&resp, reply + pos, piece), piece);
+	}
+	CHECK_INT(resp.state, HttpRespDone);
+	body[bodyLen] = '\0';
+
+	requestCount--;
+	memmove(&requests[0], &requests[1], requestCount*sizeof(Request));
+	requestsPending--;
+	parserFunc(&resp, body, bodyLen);
+}
+
+LOCAL void replyCb(const ApiAction *action, const HttpResp *resp, char *data, int length)
+{
+	Reply *reply = &replies[replyCount++];
+	reply->endpoint = action->endpoint;
+	strcpy(reply->arg, action->arg);
+	reply->status = resp ? resp->status : -1;
+	snprintf(reply->body, sizeof(reply->body), "%s", data ? data : "");
+	reply->time = shimNow();
+}
+
+int journalAdd(int endpoint, const char *arg, uint *seq)
+{
+	*seq = ++journalSeq;
+	return OK;
+}
+
+void journalDone(uint seq)
+{
+	journalDoneSeqs[journalDoneCount++] = seq;
+}
+
+void journalReplay(JournalReplayFunc replayFunc)
+{
+	int i;
+	for (i = 0; i < journaledCount; i++)
+	{
+		replayFunc(100 + i, journaled[i].endpoint, journaled[i].arg);
+	}
+}
+
+// a fresh scheduler on a fresh connection, the clock set
+LOCAL void setup(int serverOnline)
+{
+	shimReset();
+	shimSetTimestamp(TIMESTAMP);
+	os_memset(queue, 0, sizeof(queue));
+	queueLen = 0;
+	inFlight = 0;
+	sent = 0;
+	sentSerial = 0;
+	os_memset(&stats, 0, sizeof(stats));
+	connected = FALSE;
+	connecting = FALSE;
+	txBusy = FALSE;
+	requestsPending = 0;
+	requestFunc = NULL;
+	serial = 0;
+	sendFailures = 0;
+	online = serverOnline;
+	requestCount = 0;
+	requestsTotal = 0;
+	replyCount = 0;
+	journalSeq = 0;
+	journalDoneCount = 0;
+	journaledCount = 0;
+	apiSchedInit("api.twitter.com", sendFuncList, replyCb);
+}
+
+LOCAL int checkRequest(int index, ApiEndpoint endpoint, const char *arg)
+{
+	return CHECK(index < requestCount) &&
+			CHECK_INT(requests[index].endpoint, endpoint) &&
+			CHECK_STR(requests[index].arg, arg);
+}
+
+LOCAL int checkReply(int index, ApiEndpoint endpoint, const char *arg, int status)
+{
+	return CHECK(index < replyCount) &&
+			CHECK_INT(replies[index].endpoint, endpoint) &&
+			CHECK_STR(replies[index].arg, arg) &&
+			CHECK_INT(replies[index].status, status);
+}
+
+// three requests go out on one connection before the first reply,
+// the fourth when a reply makes room, all answered in order
+LOCAL void testQueue(void)
+{
+	setup(TRUE);
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	CHECK_INT(apiSchedAdd(ApiRetweet, "1002"), OK);
+	CHECK_INT(apiSchedAdd(ApiDirectMsg, "text=hello&screen_name=someone"), OK);
+	CHECK_INT(apiSchedAdd(ApiUserInfo, "someone"), OK);
+	CHECK_INT(apiSchedAdd(ApiLike, "1005"), ERROR);		// queue full
+	CHECK_INT(stats.rejected, 1);
+	CHECK_INT(requestCount, 0);
+
+	shimAdvance(CONNECT_TIME + 3*SEND_TIME);
+	CHECK_INT(serial, 1);
+	CHECK_INT(requestCount, PIPELINE_DEPTH);
+	checkRequest(0, ApiLike, "1001");
+	checkRequest(1, ApiRetweet, "1002");
+	checkRequest(2, ApiDirectMsg, "text=hello&screen_name=someone");
+
+	serverReply(200, RATE_LIMIT-1, 900, "{\"id\":1001,\"favorited\":true}");
+	CHECK_INT(replyCount, 1);
+	checkReply(0, ApiLike, "1001", 200);
+	CHECK_STR(replies[0].body, "{\"id\":1001,\"favorited\":true}");
+	shimAdvance(DISPATCH_DELAY + SEND_TIME);
+	CHECK_INT(requestCount, PIPELINE_DEPTH);
+	checkRequest(2, ApiUserInfo, "someone");
+
+	serverReply(200, -1, 0, "{}");
+	serverReply(200, -1, 0, "{}");
+	serverReply(200, -1, 0, "{\"screen_name\":\"someone\"}");
+	shimAdvance(DEFER_TIMEOUT);
+	CHECK_INT(replyCount, 4);
+	checkReply(1, ApiRetweet, "1002", 200);
+	checkReply(2, ApiDirectMsg, "text=hello&screen_name=someone", 200);
+	checkReply(3, ApiUserInfo, "someone", 200);
+	CHECK_INT(requestsTotal, 4);
+	CHECK_INT(serial, 1);
+	CHECK_INT(queueLen, 0);
+	CHECK_INT(stats.deferred, 0);
+
+	// each user action is done in the journal once its reply is in,
+	// the user info isn't journaled
+	CHECK_INT(journalDoneCount, 3);
+	CHECK_INT(journalDoneSeqs[0], 1);
+	CHECK_INT(journalDoneSeqs[1], 2);
+	CHECK_INT(journalDoneSeqs[2], 3);
+	CHECK_INT(limits[ApiLike].remaining, RATE_LIMIT-1);
+}
+
+// the same action twice is sent once, e.g. a double Like
+LOCAL void testMerge(void)
+{
+	setup(TRUE);
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	CHECK_INT(apiSchedAdd(ApiRetweet, "1001"), OK);		// another endpoint
+	CHECK_INT(queueLen, 2);
+	CHECK_INT(stats.merged, 1);
+	shimAdvance(CONNECT_TIME + 2*SEND_TIME);
+	CHECK_INT(requestCount, 2);
+
+	// also while its request is in flight
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	CHECK_INT(stats.merged, 2);
+	serverReply(200, -1, 0, "{}");
+	serverReply(200, -1, 0, "{}");
+	shimAdvance(DISPATCH_DELAY);
+	CHECK_INT(replyCount, 2);
+	CHECK_INT(requestsTotal, 2);
+
+	// but not once it is done
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	shimAdvance(DISPATCH_DELAY + SEND_TIME);
+	CHECK_INT(requestsTotal, 3);
+	CHECK_INT(stats.merged, 2);
+}
+
+// no reply for 15 s: the user is told the action is deferred, it is
+// sent when the server can be reached again
+LOCAL void testDeferral(void)
+{
+	setup(FALSE);
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	shimAdvance(DEFER_TIMEOUT - 1);
+	CHECK_INT(replyCount, 0);
+	shimAdvance(1);
+	CHECK_INT(replyCount, 1);
+	checkReply(0, ApiLike, "1001", -1);
+	CHECK_INT(replies[0].time, DEFER_TIMEOUT);
+	CHECK_INT(stats.deferred, 1);
+
+	// a merged one is deferred right away
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	CHECK_INT(replyCount, 2);
+	checkReply(1, ApiLike, "1001", -1);
+	CHECK_INT(queueLen, 1);
+
+	// one added later waits its own 15 s behind the stuck one
+	CHECK_INT(apiSchedAdd(ApiRetweet, "1002"), OK);
+	shimAdvance(DEFER_TIMEOUT - 1);
+	CHECK_INT(replyCount, 2);
+	shimAdvance(1);
+	CHECK_INT(replyCount, 3);
+	checkReply(2, ApiRetweet, "1002", -1);
+	CHECK_INT(stats.deferred, 2);
+
+	online = TRUE;
+	CHECK_INT(apiSchedAdd(ApiUserInfo, "someone"), OK);	// tries to connect again
+	shimAdvance(CONNECT_TIME + 3*SEND_TIME);
+	CHECK_INT(requestCount, 3);
+	serverReply(200, -1, 0, "{}");
+	serverReply(200, -1, 0, "{}");
+	serverReply(200, -1, 0, "{}");
+	CHECK_INT(replyCount, 6);
+	checkReply(3, ApiLike, "1001", 200);
+	checkReply(4, ApiRetweet, "1002", 200);
+	checkReply(5, ApiUserInfo, "someone", 200);
+	CHECK_INT(queueLen, 0);
+}
+
+// 429 with the rate limit headers: deferred until the window resets,
+// the other endpoints go on
+LOCAL void testRateLimited(void)
+{
+	setup(TRUE);
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	CHECK_INT(apiSchedAdd(ApiRetweet, "1002"), OK);
+	shimAdvance(CONNECT_TIME + 2*SEND_TIME);
+	serverReply(429, 0, 60, "{\"errors\":[{\"code\":88}]}");
+	CHECK_INT(stats.limited, 1);
+	CHECK_INT(replyCount, 0);
+	CHECK_INT(queueLen, 2);
+	shimAdvance(DISPATCH_DELAY);
+	CHECK_INT(replyCount, 1);
+	checkReply(0, ApiLike, "1001", -1);
+
+	serverReply(200, -1, 0, "{}");
+	shimAdvance(DISPATCH_DELAY);
+	checkReply(1, ApiRetweet, "1002", 200);
+
+	// another like waits with the first one, a retweet doesn't
+	CHECK_INT(apiSchedAdd(ApiLike, "1003"), OK);
+	CHECK_INT(apiSchedAdd(ApiRetweet, "1004"), OK);
+	shimAdvance(SEND_TIME);
+	CHECK_INT(replyCount, 3);
+	checkReply(2, ApiLike, "1003", -1);
+	CHECK_INT(requestCount, 1);
+	checkRequest(0, ApiRetweet, "1004");
+	serverReply(200, -1, 0, "{}");
+	CHECK_INT(requestsTotal, 3);
+
+	// sent again after the reset, which has a resolution of a second,
+	// in the order they were added
+	shimAdvance(60000 - shimNow());
+	CHECK_INT(requestsTotal, 3);
+	shimAdvance(2000);
+	CHECK_INT(requestsTotal, 5);
+	checkRequest(0, ApiLike, "1001");
+	checkRequest(1, ApiLike, "1003");
+	serverReply(200, RATE_LIMIT-1, 900, "{}");
+	serverReply(200, RATE_LIMIT-2, 900, "{}");
+	checkReply(4, ApiLike, "1001", 200);
+	checkReply(5, ApiLike, "1003", 200);
+	CHECK(replies[4].time >= 60000);
+	CHECK_INT(queueLen, 0);
+}
+
+// 420 and 429 without the headers: the whole 15 minute window
+LOCAL void testRateLimitedNoHeaders(void)
+{
+	const int statuses[] = {420, 429};
+	int i;
+	for (i = 0; i < NELEMENTS(statuses); i++)
+	{
+		setup(TRUE);
+		CHECK_INT(apiSchedAdd(ApiDirectMsg, "text=hi&screen_name=someone"), OK);
+		shimAdvance(CONNECT_TIME + SEND_TIME);
+		serverReply(statuses[i], -1, 0, "");
+		shimAdvance(DISPATCH_DELAY);
+		checkReply(0, ApiDirectMsg, "text=hi&screen_name=someone", -1);
+		CHECK_INT(limits[ApiDirectMsg].reset, TIMESTAMP + RATE_LIMIT_WINDOW);
+
+		shimAdvance(RATE_LIMIT_WINDOW*1000 - CONNECT_TIME);
+		CHECK_INT(requestsTotal, 1);
+		shimAdvance(1000 + CONNECT_TIME + SEND_TIME);
+		CHECK_INT(requestsTotal, 2);
+		serverReply(200, -1, 0, "{}");
+		checkReply(1, ApiDirectMsg, "text=hi&screen_name=someone", 200);
+		CHECK_INT(stats.limited, 1);
+	}
+}
+
+// the requests without a reply are sent again on the next connection
+LOCAL void testDropped(void)
+{
+	setup(TRUE);
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	CHECK_INT(apiSchedAdd(ApiRetweet, "1002"), OK);
+	shimAdvance(CONNECT_TIME + 2*SEND_TIME);
+	serverReply(200, -1, 0, "{}");
+	drop();
+	shimAdvance(CONNECT_TIME + SEND_TIME);
+	CHECK_INT(serial, 2);
+	CHECK_INT(requestCount, 1);
+	checkRequest(0, ApiRetweet, "1002");
+	CHECK_INT(stats.resent, 1);
+	serverReply(200, -1, 0, "{}");
+	CHECK_INT(replyCount, 2);
+	checkReply(1, ApiRetweet, "1002", 200);
+}
+
+// a request which can't be written is retried after 2 and 4 s,
+// then dropped with status 0
+LOCAL void testSendErrors(void)
+{
+	setup(TRUE);
+	sendFailures = SEND_ATTEMPTS;
+	CHECK_INT(apiSchedAdd(ApiLike, "1001"), OK);
+	shimAdvance(CONNECT_TIME);
+	CHECK_INT(stats.sendErrors, 1);
+	shimAdvance(SEND_RETRY_DELAY*1000 + 1000 + 2*DISPATCH_DELAY);
+	CHECK_INT(stats.sendErrors, 2);
+	shimAdvance(2*SEND_RETRY_DELAY*1000 + 1000 + 2*DISPATCH_DELAY);
+	CHECK_INT(stats.sendErrors, 3);
+	CHECK_INT(stats.dropped, 1);
+	checkReply(replyCount-1, ApiLike, "1001", 0);
+	CHECK_INT(journalDoneCount, 1);
+	CHECK_INT(queueLen, 0);
+	CHECK_INT(requestsPending, 0);
+}
+
+// the journal's actions after a reset are sent without anyone waiting
+LOCAL void testReplay(void)
+{
+	setup(TRUE);
+	journaled[0].endpoint = ApiLike;
+	strcpy(journaled[0].arg, "1001");
+	journaled[1].endpoint = ApiRetweet;
+	strcpy(journaled[1].arg, "1002");
+	journaledCount = 2;
+	apiSchedReplay();
+	apiSchedReplay();		// already queued
+	CHECK_INT(queueLen, 2);
+	CHECK_INT(stats.replayed, 2);
+	shimAdvance(CONNECT_TIME + 2*SEND_TIME);
+	serverReply(200, -1, 0, "{}");
+	serverReply(200, -1, 0, "{}");
+	CHECK_INT(replyCount, 2);
+	CHECK_INT(journalDoneCount, 2);
+	CHECK_INT(journalDoneSeqs[0], 100);
+	CHECK_INT(journalDoneSeqs[1], 101);
+}
+
+int main(int argc, char **argv)
+{
+	shimQuiet = TRUE;
+	testQueue();
+	testMerge();
+	testDeferral();
+	testRateLimited();
+	testRateLimitedNoHeaders();
+	testDropped();
+	testSendErrors();
+	testReplay();
+	return testDone("apisched");
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <c_types.h>
+#include <osapi.h>
+#include "common.h"
+#include "backoff.h"
+#include "shim.h"
+#include "test.h"
+
+// The delay sequence of each failure class against the reconnect
+// guidelines, the jitter bounds, and devices reconnecting on the
+// timers of the shim through outages of the server.
+
+#define ATTEMPTS			40		// well past every cap
+#define JITTER_DRAWS		100000
+#define JITTER_BUCKETS		10
+#define OUTAGE_RUNS			200		// devices, each with its own seed
+#define FLEET_SIZE			1000
+#define FLEET_SECONDS		120
+
+typedef struct{
+	uint initial;
+	uint cap;
+	int linear;
+}Policy;
+
+// as the guidelines give them, independently of backoff.c
+LOCAL const Policy guidelines[FailClassCount] = {
+	{1000, 60000, FALSE},		// dns
+	{250, 16000, TRUE},			// tcp
+	{2000, 120000, FALSE},		// tls
+	{5000, 320000, FALSE},		// http
+	{60000, 960000, FALSE}		// rate limit
+};
+
+LOCAL uint nominalDelay(FailClass failClass, int attempt)
+{
+	const Policy *policy = &guidelines[failClass];
+	unsigned long long delay = policy->linear ?
+			(unsigned long long)policy->initial * (attempt + 1) :
+			(unsigned long long)policy->initial << (attempt < 32 ? attempt : 32);
+	return delay < policy->cap ? (uint)delay : policy->cap;
+}
+
+// no jitter drawn gives half the delay, the most gives all of it
+LOCAL void testSequences(void)
+{
+	FailClass failClass;
+	for (failClass = 0; failClass < FailClassCount; failClass++)
+	{
+		Backoff low, high;
+		memset(&low, 0, sizeof(low));
+		memset(&high, 0, sizeof(high));
+		int attempt;
+		for (attempt = 0; attempt < ATTEMPTS; attempt++)
+		{
+			uint nominal = nominalDelay(failClass, attempt);
+			int ok = CHECK_INT(backoffNext(&low, failClass, 0), nominal/2) &&
+					CHECK_INT(backoffNext(&high, failClass, nominal/2), nominal) &&
+					CHECK_INT(high.lastDelay, nominal);
+			if (!ok)
+			{
+				printf("test_backoff: %s attempt %d\n", backoffClassName(failClass), attempt);
+				break;
+			}
+		}
+		CHECK_INT(low.consecutive, ATTEMPTS);
+		CHECK_INT(low.failures[failClass], ATTEMPTS);
+		printf("backoff: %-10s %6u, %6u, %6u, %6u ms ... capped at %u ms\n", backoffClassName(failClass),
+				nominalDelay(failClass, 0), nominalDelay(failClass, 1), nominalDelay(failClass, 2),
+				nominalDelay(failClass, 3), guidelines[failClass].cap);
+	}
+
+	// the stream guidelines, literally
+	CHECK_INT(nominalDelay(FailTcp, 63), 16000);
+	CHECK_INT(nominalDelay(FailHttp, 6), 320000);
+	CHECK_INT(nominalDelay(FailRateLimit, 4), 960000);
+}
+
+LOCAL void testClassChange(void)
+{
+	Backoff backoff;
+	memset(&backoff, 0, sizeof(backoff));
+	backoffNext(&backoff, FailHttp, 0);
+	backoffNext(&backoff, FailHttp, 0);
+	CHECK_INT(backoffNext(&backoff, FailHttp, 0), 20000/2);
+
+	// another class starts its own sequence, the total goes on
+	CHECK_INT(backoffNext(&backoff, FailTcp, 0), 250/2);
+	CHECK_INT(backoffNext(&backoff, FailHttp, 0), 5000/2);
+	CHECK_INT(backoff.consecutive, 5);
+	CHECK_INT(backoff.failures[FailHttp], 4);
+	CHECK_INT(backoff.failures[FailTcp], 1);
+
+	// data again: from the start, the counts since boot stay
+	backoffReset(&backoff);
+	CHECK_INT(backoff.consecutive, 0);
+	CHECK_INT(backoff.lastDelay, 0);
+	CHECK_INT(backoffNext(&backoff, FailHttp, 0), 5000/2);
+	CHECK_INT(backoff.failures[FailHttp], 5);
+	CHECK_STR(backoffClassName(FailRateLimit), "rate limit");
+}
+
+// equal jitter over the random source of the device
+LOCAL void testJitter(void)
+{
+	FailClass failClass;
+	shimReset();
+	for (failClass = 0; failClass < FailClassCount; failClass++)
+	{
+		uint nominal = nominalDelay(failClass, 2);
+		uint buckets[JITTER_BUCKETS];
+		uint min = UINT_MAX;
+		uint max = 0;
+		double sum = 0;
+		memset(buckets, 0, sizeof(buckets));
+		int i;
+		for (i = 0; i < JITTER_DRAWS; i++)
+		{
+			Backoff backoff;
+			memset(&backoff, 0, sizeof(backoff));
+			backoffNext(&backoff, failClass, os_random());
+			backoffNext(&backoff, failClass, os_random());
+			uint delay = backoffNext(&backoff, failClass, os_random());
+			min = MIN(min, delay);
+			max = MAX(max, delay);
+			sum += delay;
+			buckets[MIN((delay - nominal/2) * JITTER_BUCKETS / (nominal/2 + 1), JITTER_BUCKETS-1)]++;
+		}
+		CHECK(min >= nominal/2);
+		CHECK(max <= nominal);
+		// within a percent of the ends and of the mean
+		CHECK(min < nominal/2 + nominal/200);
+		CHECK(max > nominal - nominal/200);
+		double mean = sum / JITTER_DRAWS;
+		CHECK(mean > 0.74*nominal && mean < 0.76*nominal);
+		for (i = 0; i < JITTER_BUCKETS; i++)
+		{
+			CHECK(buckets[i] > JITTER_DRAWS/JITTER_BUCKETS*9/10 && buckets[i] < JITTER_DRAWS/JITTER_BUCKETS*11/10);
+		}
+	}
+}
+
+typedef struct{
+	Backoff backoff;
+	ETSTimer tmr;
+	FailClass failClass;
+	uint outageEnd;			// ms
+	uint attempts;
+	uint connectedAt;		// ms, 0 while it isn't
+}Device;
+
+LOCAL void ICACHE_FLASH_ATTR attempt(void *arg)
+{
+	Device *device = (Device*)arg;
+	device->attempts++;
+	if (shimNow() >= device->outageEnd)
+	{
+		backoffReset(&device->backoff);
+		device->connectedAt = shimNow();
+		return;
+	}
+	os_timer_arm(&device->tmr, backoffNext(&device->backoff, device->failClass, os_random()), 0);
+}
+
+LOCAL void deviceStart(Device *device, FailClass failClass, uint outage)
+{
+	memset(device, 0, sizeof(Device));
+	device->failClass = failClass;
+	device->outageEnd = shimNow() + outage;
+	os_timer_setfn(&device->tmr, (os_timer_func_t*)attempt, device);
+	// dropped now, the first reconnect waits like the ones after it
+	os_timer_arm(&device->tmr, backoffNext(&device->backoff, failClass, os_random()), 0);
+}
+
+// a device reconnecting through an outage, how often it tries and how
+// long after the server is back it has reconnected
+LOCAL void simulateOutages(void)
+{
+	const uint outages[] = {10000, 60000, 600000, 3600000};
+	FailClass failClass;
+	for (failClass = 0; failClass < FailClassCount; failClass++)
+	{
+		int i;
+		for (i = 0; i < NELEMENTS(outages); i++)
+		{
+			uint attempts = 0;
+			uint lateMax = 0;
+			double lateSum = 0;
+			int run;
+			for (run = 0; run < OUTAGE_RUNS; run++)
+			{
+				Device device;
+				shimReset();
+				shimSeedRandom(run + 1);
+				deviceStart(&device, failClass, outages[i]);
+				while (!device.connectedAt)
+				{
+					shimAdvance(100);
+				}
+				uint late = device.connectedAt - device.outageEnd;
+				attempts += device.attempts;
+				lateMax = MAX(lateMax, late);
+				lateSum += late;
+				// never later than the capped delay
+				CHECK(late <= guidelines[failClass].cap);
+				CHECK_INT(device.backoff.consecutive, 0);
+			}
+			printf("backoff: %-10s outage %5u s, %5.1f attempts, reconnected %6.1f s after it (at most %6.1f s)\n",
+					backoffClassName(failClass), outages[i]/1000, (double)attempts/OUTAGE_RUNS,
+					lateSum/OUTAGE_RUNS/1000, lateMax/1000.0);
+		}
+	}
+}
+
+// devices dropped together by the server come back spread out
+LOCAL void simulateFleet(void)
+{
+	static Device fleet[FLEET_SIZE];
+	uint perSecond[FLEET_SECONDS];
+	int i;
+	shimReset();
+	memset(perSecond, 0, sizeof(perSecond));
+	for (i = 0; i < FLEET_SIZE; i++)
+	{
+		deviceStart(&fleet[i], FailHttp, 20000);
+	}
+	shimAdvance(FLEET_SECONDS*1000);
+	uint first = UINT_MAX;
+	uint last = 0;
+	for (i = 0; i < FLEET_SIZE; i++)
+	{
+		CHECK(fleet[i].connectedAt != 0);
+		first = MIN(first, fleet[i].connectedAt);
+		last = MAX(last, fleet[i].connectedAt);
+		perSecond[fleet[i].connectedAt/1000]++;
+		os_timer_disarm(&fleet[i].tmr);
+	}
+	uint busiest = 0;
+	for (i = 0; i < FLEET_SECONDS; i++)
+	{
+		busiest = MAX(busiest, perSecond[i]);
+	}
+	// without the jitter they would all be back at once
+	CHECK(last - first > 5000);
+	CHECK(busiest < FLEET_SIZE/4);
+	printf("backoff: %d devices dropped at once with http errors, reconnected over %.1f s, at most %u in a second\n",
+			FLEET_SIZE, (last - first)/1000.0, busiest);
+}
+
+int main(int argc, char **argv)
+{
+	testSequences();
+	testClassChange();
+	testJitter();
+	simulateOutages();
+	simulateFleet();
+	return testDone("backoff");
+}
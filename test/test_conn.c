@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/conn.c"
+#include "shim.h"
+#include "test.h"
+
+// conn.c on the TLS connections of the shim, against a mock server of
+// the stream and the REST host. The stream gives the one session up for
+// the REST requests, which are pipelined on one connection and reuse it
+// within the idle timeout. The benchmark runs N actions queued at once,
+// spaced apart, and one connection each as before the queue.
+
+#define HANDSHAKE_TIME		1500	// ms, the RSA key exchange on the device
+#define RTT					150		// ms
+#define MESSAGE_INTERVAL	250		// ms between the messages of the stream
+#define STALL_TIMEOUT		90		// s
+#define SETTLE_TIME			5000	// ms, for the stream to be up
+#define RUN_TIMEOUT			120000	// ms
+#define STEP				10		// ms
+#define ACTIONS_MAX			16
+
+typedef enum{
+	FlowQueued,			// all of them at once
+	FlowSpaced,			// one every spacing ms
+	FlowOneByOne		// each after the previous reply, once the stream is back
+}Flow;
+
+typedef struct{
+	uint lastReply;			// ms after the first action
+	uint latencySum;		// ms from each action to its reply
+	uint handshakes;		// of the REST connection
+	uint gaps;
+	uint gapSum;			// ms
+	uint missed;			// stream messages sent while the stream was down
+	uint estimated;			// hundredths, as stats:conn estimates them
+}Result;
+
+// the server
+LOCAL ShimServer server;
+LOCAL int streamOpen = FALSE;		// the stream's reply head was sent
+LOCAL uint messagesSent = 0;		// by the stream, whether it was up or not
+LOCAL int requestsServed = 0;
+LOCAL os_timer_t messageTmr;
+
+// the device
+LOCAL uint messagesReceived = 0;
+LOCAL uint lastMessageId = 0;
+LOCAL int actionsAdded = 0;
+LOCAL int actionsSent = 0;
+LOCAL int repliesReceived = 0;
+LOCAL uint actionTime[ACTIONS_MAX];	// ms
+LOCAL uint replyTime[ACTIONS_MAX];
+
+LOCAL Flow flow;
+LOCAL int flowActions;
+LOCAL uint flowSpacing;				// ms
+LOCAL uint nextActionTime;
+LOCAL os_timer_t driverTmr;
+
+
+LOCAL int isStream(struct espconn *conn)
+{
+	return conn == &slots[ConnStream].espConn;
+}
+
+LOCAL void serverReceived(struct espconn *conn, const char *data, int length)
+{
+	char request[256];
+	snprintf(request, sizeof(request), "%.*s", length, data);
+	if (isStream(conn))
+	{
+		const char head[] = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+		CHECK(strncmp(request, "GET /stream ", 12) == 0);
+		shimNetSend(conn, head, sizeof(head) - 1);
+		streamOpen = TRUE;
+		return;
+	}
+	// one request per send, answered in order
+	int action = -1;
+	CHECK_INT(sscanf(request, "POST /action/%d ", &action), 1);
+	char body[32];
+	char reply[128];
+	int bodyLen = sprintf(body, "{\"action\":%d}", action);
+	int len = sprintf(reply, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s", bodyLen, body);
+	shimNetSend(conn, reply, len);
+	requestsServed++;
+}
+
+LOCAL void serverClosed(struct espconn *conn)
+{
+	if (isStream(conn))
+	{
+		streamOpen = FALSE;
+	}
+}
+
+// the stream goes on whether the device listens or not
+LOCAL void ICACHE_FLASH_ATTR messageTmrCb(void)
+{
+	messagesSent++;
+	if (streamOpen)
+	{
+		char message[64];
+		char chunk[80];
+		int len = sprintf(message, "{\"id\":%u}\r\n", messagesSent);
+		len = sprintf(chunk, "%x\r\n%s\r\n", len, message);
+		shimNetSend(&slots[ConnStream].espConn, chunk, len);
+	}
+}
+
+LOCAL void streamParser(const HttpResp *resp, char *data, int length)
+{
+	uint id = 0;
+	CHECK_INT(sscanf(data, "{\"id\":%u}", &id), 1);
+	CHECK(id > lastMessageId);
+	lastMessageId = id;
+	messagesReceived++;
+}
+
+LOCAL void apiParser(const HttpResp *resp, char *data, int length)
+{
+	int action = -1;
+	CHECK_INT(resp->status, 200);
+	CHECK_INT(sscanf(data, "{\"action\":%d}", &action), 1);
+	// replies come in the order of the requests
+	CHECK_INT(action, repliesReceived);
+	if (repliesReceived < ACTIONS_MAX)
+	{
+		replyTime[repliesReceived] = shimNow();
+	}
+	repliesReceived++;
+}
+
+LOCAL void ICACHE_FLASH_ATTR streamRequest(void)
+{
+	const char request[] = "GET /stream HTTP/1.1\r\nHost: stream.example.com\r\n\r\n";
+	connSend(ConnStream, request, sizeof(request) - 1);
+}
+
+// the next action not yet sent, one per call like sendPipeline
+LOCAL void ICACHE_FLASH_ATTR apiRequest(void)
+{
+	if (actionsSent < actionsAdded && connCanSend(ConnApi))
+	{
+		char request[128];
+		int len = sprintf(request, "POST /action/%d HTTP/1.1\r\nHost: api.example.com\r\n"
+				"Connection: keep-alive\r\nContent-Length: 0\r\n\r\n", actionsSent);
+		if (connSend(ConnApi, request, len) == OK)
+		{
+			actionsSent++;
+		}
+	}
+}
+
+LOCAL void addAction(void)
+{
+	actionTime[actionsAdded++] = shimNow();
+	connRequest(ConnApi, apiRequest);
+}
+
+LOCAL void ICACHE_FLASH_ATTR driverTmrCb(void)
+{
+	while (actionsAdded < flowActions)
+	{
+		if (flow == FlowSpaced && shimNow() < nextActionTime)
+		{
+			return;
+		}
+		if (flow == FlowOneByOne && (repliesReceived < actionsAdded || !connIsConnected(ConnStream)))
+		{
+			return;
+		}
+		addAction();
+		nextActionTime = shimNow() + flowSpacing;
+		if (flow != FlowQueued)
+		{
+			return;
+		}
+	}
+}
+
+// the device with its stream up, the REST host not connected yet
+LOCAL void start(uint idleTimeout)
+{
+	shimReset();
+	server.connected = NULL;
+	server.received = serverReceived;
+	server.closed = serverClosed;
+	shimNetServe(&server, HANDSHAKE_TIME, RTT);
+	streamOpen = FALSE;
+	messagesSent = 0;
+	requestsServed = 0;
+	messagesReceived = 0;
+	lastMessageId = 0;
+	actionsAdded = 0;
+	actionsSent = 0;
+	repliesReceived = 0;
+	flowActions = 0;
+
+	sessionOwner = NULL;
+	sessionWaiter = NULL;
+	streamRepliesDuringRequests = 0;
+	connInit(ConnStream, "stream.example.com", streamParser);
+	connInit(ConnApi, "api.example.com", apiParser);
+	connSetStallTimeout(ConnStream, STALL_TIMEOUT);
+	connSetIdleTimeout(ConnApi, idleTimeout);
+
+	os_timer_setfn(&messageTmr, (os_timer_func_t*)messageTmrCb, NULL);
+	os_timer_arm(&messageTmr, MESSAGE_INTERVAL, 1);
+	connRestart(ConnStream, streamRequest);
+	shimAdvance(SETTLE_TIME);
+	CHECK(connIsConnected(ConnStream));
+	CHECK(messagesReceived > 0);
+}
+
+LOCAL int runDone(void)
+{
+	return repliesReceived == flowActions && connIsConnected(ConnStream) &&
+			slots[ConnApi].state == connIdle && !sessionWaiter;
+}
+
+LOCAL Result run(Flow runFlow, int actions, uint spacing, uint idleTimeout)
+{
+	Result result;
+	memset(&result, 0, sizeof(result));
+	start(idleTimeout);
+	flow = runFlow;
+	flowActions = actions;
+	flowSpacing = spacing;
+	nextActionTime = 0;
+	uint sent = messagesSent;
+	uint received = messagesReceived;
+	uint t0 = shimNow();
+	os_timer_setfn(&driverTmr, (os_timer_func_t*)driverTmrCb, NULL);
+	os_timer_arm(&driverTmr, STEP, 1);
+	while (!runDone() && shimNow() - t0 < RUN_TIMEOUT)
+	{
+		shimAdvance(STEP);
+	}
+	CHECK(runDone());
+	os_timer_disarm(&driverTmr);
+	shimAdvance(SETTLE_TIME);		// messages on the way are in
+
+	int i;
+	for (i = 0; i < actions && i < ACTIONS_MAX; i++)
+	{
+		result.latencySum += replyTime[i] - actionTime[i];
+	}
+	result.lastReply = replyTime[MIN(actions, ACTIONS_MAX) - 1] - t0;
+	result.handshakes = slots[ConnApi].stats.connects;
+	ConnStats *stream = &slots[ConnStream].stats;
+	result.gaps = stream->gaps;
+	result.gapSum = stream->gapSum;
+	result.missed = (messagesSent - sent) - (messagesReceived - received);
+	result.estimated = stream->upTime ? (uint)((uint64)stream->messages * stream->gapSum * 100 / stream->upTime) : 0;
+
+	// one session at a time, never asked for a second
+	CHECK_INT(shimNet.refused, 0);
+	CHECK_INT(requestsServed, actions);
+	CHECK_INT(slots[ConnApi].stats.replies, actions);
+	// until the stream has given the session up
+	CHECK(streamRepliesDuringRequests <= stream->gaps);
+	CHECK_INT(slots[ConnStream].stats.drops, 0);
+	return result;
+}
+
+LOCAL void testQueued(void)
+{
+	Result result = run(FlowQueued, 3, 0, 0);
+	// one handshake for all of them, the stream down once
+	CHECK_INT(result.handshakes, 1);
+	CHECK_INT(result.gaps, 1);
+	CHECK_INT(slots[ConnApi].stats.pipelineMax, 3);
+	CHECK_INT(slots[ConnStream].stats.connects, 2);
+}
+
+LOCAL void testOneByOne(void)
+{
+	Result result = run(FlowOneByOne, 3, 0, 0);
+	CHECK_INT(result.handshakes, 3);
+	CHECK_INT(result.gaps, 3);
+	CHECK_INT(slots[ConnApi].stats.pipelineMax, 1);
+}
+
+// actions a few seconds apart share a connection kept for the idle timeout
+LOCAL void testIdleReuse(void)
+{
+	Result result = run(FlowSpaced, 3, 4000, 0);
+	CHECK_INT(result.handshakes, 3);
+	CHECK_INT(result.gaps, 3);
+	result = run(FlowSpaced, 3, 4000, 5);
+	CHECK_INT(result.handshakes, 1);
+	CHECK_INT(result.gaps, 1);
+	// given back 5 s after the last reply
+	CHECK(result.gapSum >= 2*4000 + 5000);
+	CHECK(result.gapSum < 2*4000 + 5000 + 2*HANDSHAKE_TIME + 4*RTT + 1000);
+
+	// nobody waits for the session: closed by the liveness check
+	start(5);
+	connClose(ConnStream);
+	shimAdvance(1000);
+	CHECK(!connIsConnected(ConnStream));
+	flowActions = 1;
+	addAction();
+	shimAdvance(HANDSHAKE_TIME + 2*RTT + 100);
+	CHECK_INT(repliesReceived, 1);
+	CHECK(connIsConnected(ConnApi));
+	shimAdvance(4000);
+	CHECK(connIsConnected(ConnApi));
+	CHECK_INT(slots[ConnApi].stats.idleCloses, 0);
+	shimAdvance(LIVENESS_CHECK_INTERVAL + 1000);
+	CHECK(!connIsConnected(ConnApi));
+	CHECK_INT(slots[ConnApi].stats.idleCloses, 1);
+	CHECK_INT(slots[ConnApi].stats.connects, 1);
+}
+
+LOCAL void printResult(const char *name, int actions, const Result *result)
+{
+	printf("conn: %2d actions %-21s last reply after %5u ms, %5u ms avg, %2u handshakes, "
+			"stream down %2u times for %5u ms, %3u messages missed (estimated %u.%02u)\n",
+			actions, name, result->lastReply, result->latencySum / actions, result->handshakes,
+			result->gaps, result->gapSum, result->missed, result->estimated / 100, result->estimated % 100);
+}
+
+// N actions queued at once against one connection each, as it was before
+LOCAL void benchmark(void)
+{
+	const int counts[] = {1, 3, 5, 10};
+	int i;
+	for (i = 0; i < NELEMENTS(counts); i++)
+	{
+		Result queued = run(FlowQueued, counts[i], 0, 0);
+		printResult("queued:", counts[i], &queued);
+		Result spaced = run(FlowSpaced, counts[i], 2000, 5);
+		printResult("2 s apart, idle 5:", counts[i], &spaced);
+		Result single = run(FlowOneByOne, counts[i], 0, 0);
+		printResult("one connection each:", counts[i], &single);
+		CHECK(queued.lastReply <= single.lastReply);
+		CHECK(queued.missed <= single.missed);
+		CHECK_INT(single.handshakes, counts[i]);
+		CHECK_INT(queued.handshakes, 1);
+		CHECK_INT(spaced.handshakes, 1);
+		// the estimate of stats:conn against what the server sent
+		CHECK(queued.estimated/100 + 3 >= queued.missed && queued.missed + 3 >= queued.estimated/100);
+		CHECK(single.estimated/100 + 3*counts[i] >= single.missed &&
+				single.missed + 3*counts[i] >= single.estimated/100);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	shimQuiet = TRUE;
+	shimFlashErase();
+	dnsCacheInit();
+	testQueued();
+	testOneByOne();
+	testIdleReuse();
+	benchmark();
+	return testDone("conn");
+}
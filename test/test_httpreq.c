@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/httpreq.c"
+#include "shim.h"
+#include "test.h"
+
+// Every twitter* request built with the clock and the random source of
+// the shim and compared with its file in golden/, "-u" writes them anew.
+// They were checked against an independent OAuth 1.0 implementation when
+// first written, a change to a request shows up in their diff.
+
+#define GOLDEN_DIR			"golden/"
+#define TIMESTAMP			1318622958		// of the signing example
+#define LONG_TEXT_CHARS		280
+#define BENCH_REQUESTS		5000		// of each case
+
+LOCAL char sent[4*HTTP_REQ_MAX_LEN];
+LOCAL int sentLen = 0;
+LOCAL int gzipEn = FALSE;
+LOCAL char *longText;
+
+
+// conn.c, what is sent is collected in sent
+
+int connAcceptsGzip(ConnId id)
+{
+	return gzipEn;
+}
+
+int connSend(ConnId id, const char *data, int length)
+{
+	if (sentLen + length > sizeof(sent))
+	{
+		return ERROR;
+	}
+	memcpy(sent + sentLen, data, length);
+	sentLen += length;
+	return OK;
+}
+
+int connSendStreamed(ConnId id, const char *data, int length, ConnBodyFunc bodyFunc)
+{
+	if (connSend(id, data, length) != OK)
+	{
+		bodyFunc(NULL);
+		return ERROR;
+	}
+	while ((length = bodyFunc(&data)) > 0)
+	{
+		connSend(id, data, length);
+	}
+	return OK;
+}
+
+
+LOCAL int verifyCredentials(void)
+{
+	return twitterGetUserInfo("api.twitter.com");
+}
+
+LOCAL int verifyCredentialsGzip(void)
+{
+	gzipEn = TRUE;
+	int rc = twitterGetUserInfo("api.twitter.com");
+	gzipEn = FALSE;
+	return rc;
+}
+
+// twice, the second one from the template
+LOCAL int userStream(void)
+{
+	twitterStreamChanged();
+	int rc = twitterRequestStream("stream.twitter.com", "esp8266,#iot caf\xc3\xa9", "en", "low");
+	if (rc == OK)
+	{
+		rc = twitterRequestStream("stream.twitter.com", "esp8266,#iot caf\xc3\xa9", "en", "low");
+	}
+	return rc;
+}
+
+LOCAL int directMessage(void)
+{
+	return twitterSendDirectMsg("api.twitter.com", "Hello Ladies + Gentlemen, a signed OAuth request! 100%", "12345");
+}
+
+LOCAL int retweet(void)
+{
+	return twitterRetweetTweet("api.twitter.com", "785522345669050368");
+}
+
+LOCAL int like(void)
+{
+	return twitterLikeTweet("api.twitter.com", "785522345669050368");
+}
+
+LOCAL int statusUpdate(void)
+{
+	return twitterPostTweet("api.twitter.com", "Hello Ladies + Gentlemen, a signed OAuth request!");
+}
+
+// does not fit into httpRequest, the body is streamed
+LOCAL int statusUpdateLong(void)
+{
+	return twitterPostTweet("api.twitter.com", longText);
+}
+
+typedef struct{
+	const char *name;
+	int (*build)(void);
+}RequestCase;
+
+LOCAL const RequestCase requestCases[] = {
+	{"verify_credentials", verifyCredentials},
+	{"verify_credentials_gzip", verifyCredentialsGzip},
+	{"user_stream", userStream},
+	{"direct_message", directMessage},
+	{"retweet", retweet},
+	{"like", like},
+	{"status_update", statusUpdate},
+	{"status_update_long", statusUpdateLong},
+};
+
+
+LOCAL int buildCase(const RequestCase *requestCase)
+{
+	shimSeedRandom(2463534242u);
+	shimSetTimestamp(TIMESTAMP);
+	sentLen = 0;
+	return requestCase->build();
+}
+
+// Content-Length of each request in sent matches its body
+LOCAL void checkContentLengths(const char *name)
+{
+	const char *pos = sent;
+	const char *end = sent + sentLen;
+	while (pos < end)
+	{
+		const char *header = strstr(pos, "\r\nContent-Length: ");
+		const char *body = strstr(pos, "\r\n\r\n");
+		if (!testCheck(header && body && header < body, name, __FILE__, __LINE__))
+		{
+			return;
+		}
+		body += 4;
+		const char *next = strstr(body, "GET /");	// the second stream request
+		int bodyLen = (next ? next : end) - body;
+		if (!testCheckInt(bodyLen, atoi(header + 18), name, __FILE__, __LINE__))
+		{
+			return;
+		}
+		pos = body + bodyLen;
+	}
+}
+
+LOCAL void testGolden(int update)
+{
+	int i;
+	for (i = 0; i < NELEMENTS(requestCases); i++)
+	{
+		const RequestCase *requestCase = &requestCases[i];
+		char path[128];
+		snprintf(path, sizeof(path), GOLDEN_DIR "%s.http", requestCase->name);
+
+		uint heap = shimHeap.current;
+		if (!testCheck(buildCase(requestCase) == OK, requestCase->name, __FILE__, __LINE__))
+		{
+			continue;
+		}
+		if (requestCase->build != userStream)	// the template stays
+		{
+			CHECK_INT(shimHeap.current, heap);
+		}
+		checkContentLengths(requestCase->name);
+
+		if (update)
+		{
+			CHECK(testWriteFile(path, sent, sentLen) == OK);
+			printf("httpreq: %s written, %d bytes\n", path, sentLen);
+			continue;
+		}
+		int goldenLen;
+		char *golden = testReadFile(path, &goldenLen);
+		if (!testCheck(golden != NULL, path, __FILE__, __LINE__))
+		{
+			continue;
+		}
+		if (testCheckInt(sentLen, goldenLen, path, __FILE__, __LINE__))
+		{
+			testCheckMem(sent, golden, sentLen, path, __FILE__, __LINE__);
+		}
+		free(golden);
+	}
+}
+
+// the stream request from the template has the bytes of a full build
+LOCAL void testStreamTemplate(void)
+{
+	ParamItem params[] = {
+		{"filter_level", "low"},
+		{"language", "en"},
+		{"track", "esp8266,#iot caf\xc3\xa9"}};
+	shimSeedRandom(1);
+	sentLen = 0;
+	CHECK(sendRequest(ConnStream, httpGET, "stream.twitter.com", twitterStreamUrl, params, 3) == OK);
+	char full[HTTP_REQ_MAX_LEN];
+	int fullLen = sentLen;
+	memcpy(full, sent, sentLen);
+
+	twitterStreamChanged();
+	shimSeedRandom(1);
+	sentLen = 0;
+	uint uses = stats.templateUses;
+	CHECK(twitterRequestStream("stream.twitter.com", "esp8266,#iot caf\xc3\xa9", "en", "low") == OK);
+	CHECK_INT(stats.templateUses, uses + 1);
+	if (CHECK_INT(sentLen, fullLen))
+	{
+		CHECK_MEM(sent, full, fullLen);
+	}
+}
+
+// the documented signature of Twitter's example
+LOCAL void testSignature(void)
+{
+	ParamItem params[] = {
+		{"include_entities", "true"},
+		{"status", "Hello Ladies + Gentlemen, a signed OAuth request!"}};
+	ParamList paramList = {params, 2};
+	char signature[OAUTH_SIGNATURE_MAX_LEN+1];
+	CHECK(createSignature(signature, sizeof(signature), "POST", "api.twitter.com", "/1.1/statuses/update.json",
+			"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg", "1318622958", &paramList) > 0);
+	CHECK_STR(signature, "hCtSmYh%2BiHYCEqBWrE7C7hYmtUk%3D");
+}
+
+// time and allocations per request of each case, and the peak heap
+LOCAL void benchmark(void)
+{
+	shimHeapResetPeak();
+	uint heap = shimHeap.current;
+	int total = 0;
+	double totalTime = 0;
+	int i;
+	for (i = 0; i < NELEMENTS(requestCases); i++)
+	{
+		const RequestCase *requestCase = &requestCases[i];
+		uint allocs = shimHeap.allocs;
+		double t0 = testSeconds();
+		int j;
+		for (j = 0; j < BENCH_REQUESTS; j++)
+		{
+			buildCase(requestCase);
+		}
+		double time = testSeconds() - t0;
+		int requests = requestCase->build == userStream ? 2 * BENCH_REQUESTS : BENCH_REQUESTS;
+		double allocsPerRequest = (double)(shimHeap.allocs - allocs) / requests;
+		printf("httpreq: %-24s %5.2f us, %.2f allocations per request\n",
+				requestCase->name, time * 1e6 / requests, allocsPerRequest);
+		if (requestCase->build == statusUpdateLong)
+		{
+			CHECK(allocsPerRequest == 1);		// the body values
+		}
+		else if (requestCase->build != userStream)
+		{
+			CHECK(allocsPerRequest == 0);
+		}
+		total += requests;
+		totalTime += time;
+	}
+	printf("httpreq: %d requests, %.0f requests/s on the host, peak heap %u bytes above idle\n",
+			total, total / totalTime, shimHeap.peak - heap);
+}
+
+int main(int argc, char **argv)
+{
+	int update = argc > 1 && !strcmp(argv[1], "-u");
+
+	testExampleCredentials();
+	oauthSetSignKey();
+
+	longText = (char*)malloc(LONG_TEXT_CHARS*3 + 1);
+	int i;
+	for (i = 0; i < LONG_TEXT_CHARS; i++)
+	{
+		memcpy(longText + 3*i, "\xe6\xbc\xa2", 3);	// U+6F22
+	}
+	longText[LONG_TEXT_CHARS*3] = '\0';
+
+	testSignature();
+	testGolden(update);
+	testStreamTemplate();
+	benchmark();
+	httpReqPrintStats();
+
+	free(longText);
+	return testDone("httpreq");
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <c_types.h>
+#include "inflate.h"
+#include "shim.h"
+#include "test.h"
+
+// Recorded replies inflated in the segment sizes of the connection:
+// byte by byte, odd pieces and a full TCP segment. The files in gzip/
+// were made from the .json ones with
+//   gzip -1 -c stream.json > stream_1.gz, gzip -9 -c stream.json > stream_9.gz
+//   gzip -9 -n -c reply.json > reply_9.gz, gzip -n -c < /dev/null > empty.gz
+//   python3 gzip.compress(data, compresslevel=0, mtime=0) > stream_stored.gz
+// stream.json is a 40 KB run of the user stream, longer than the window.
+
+#define GZIP_DIR			"gzip/"
+#define STREAM_WINDOW_BITS	15
+#define REPLY_WINDOW_BITS	13		// of the REST replies
+#define SEGMENT_LEN			1460
+#define CORRUPT_CASES		2000
+#define BENCH_ROUNDS		200
+
+typedef struct{
+	char *data;
+	int length;
+	int size;
+	int pieces;
+	int maxPiece;
+}Output;
+
+typedef struct{
+	char *data;
+	int length;
+}File;
+
+LOCAL void collect(void *arg, const char *data, int length)
+{
+	Output *out = (Output*)arg;
+	if (out->length + length <= out->size)
+	{
+		memcpy(out->data + out->length, data, length);
+	}
+	out->length += length;
+	out->pieces++;
+	if (length > out->maxPiece)
+	{
+		out->maxPiece = length;
+	}
+}
+
+LOCAL File readDataFile(const char *name)
+{
+	char path[64];
+	File file;
+	snprintf(path, sizeof(path), GZIP_DIR "%s", name);
+	file.data = testReadFile(path, &file.length);
+	if (!testCheck(file.data != NULL, path, __FILE__, __LINE__))
+	{
+		exit(1);
+	}
+	return file;
+}
+
+LOCAL void outputInit(Output *out, int size)
+{
+	memset(out, 0, sizeof(Output));
+	out->size = size;
+	out->data = (char*)malloc(size);
+}
+
+// data in pieces of chunk bytes, ERROR as soon as one is refused
+LOCAL int feed(Inflater *inf, const char *data, int length, int chunk)
+{
+	int pos;
+	for (pos = 0; pos < length; pos += chunk)
+	{
+		int len = (length - pos < chunk) ? length - pos : chunk;
+		if (inflateFeed(inf, data + pos, len) != OK)
+		{
+			return ERROR;
+		}
+	}
+	return OK;
+}
+
+LOCAL void replay(const char *name, const File *gz, const File *plain, int windowBits, int chunk)
+{
+	Output out;
+	outputInit(&out, plain->length + 1);
+	uint heap = shimHeap.current;
+	Inflater *inf = inflateNew(windowBits, collect, &out);
+	CHECK(inf != NULL);
+	CHECK(shimHeap.current - heap >= (1 << windowBits));	// the window with it
+
+	int ok = CHECK_INT(feed(inf, gz->data, gz->length - 1, chunk), OK) &&
+			CHECK(!inflateIsDone(inf)) &&
+			CHECK_INT(inflateFeed(inf, gz->data + gz->length - 1, 1), OK) &&
+			CHECK(inflateIsDone(inf)) &&
+			CHECK_INT(out.length, plain->length) &&
+			CHECK_MEM(out.data, plain->data, plain->length) &&
+			CHECK(out.maxPiece <= (1 << windowBits));
+	if (!ok)
+	{
+		printf("test_inflate: %s in %d byte pieces, window of %d bits\n", name, chunk, windowBits);
+	}
+	inflateFree(inf);
+	CHECK_INT(shimHeap.current, heap);
+	free(out.data);
+}
+
+LOCAL void testReplay(void)
+{
+	const char *streams[] = {"stream_1.gz", "stream_9.gz", "stream_stored.gz"};
+	const int chunks[] = {1, 7, SEGMENT_LEN};
+	File stream = readDataFile("stream.json");
+	File reply = readDataFile("reply.json");
+	File replyGz = readDataFile("reply_9.gz");
+	int i, j;
+	for (i = 0; i < NELEMENTS(streams); i++)
+	{
+		File gz = readDataFile(streams[i]);
+		for (j = 0; j < NELEMENTS(chunks); j++)
+		{
+			replay(streams[i], &gz, &stream, STREAM_WINDOW_BITS, chunks[j]);
+		}
+		free(gz.data);
+	}
+	for (j = 0; j < NELEMENTS(chunks); j++)
+	{
+		replay("reply_9.gz", &replyGz, &reply, REPLY_WINDOW_BITS, chunks[j]);
+	}
+
+	// the optional header fields are skipped, the name is in stream_*.gz
+	const char header[] = {0x1f, 0x8b, 8, 0x02|0x04|0x08|0x10, 0, 0, 0, 0, 0, 3,
+			5, 0, 'e', 'x', 't', 'r', 'a',			// FEXTRA, its length first
+			'r', 'e', 'p', 'l', 'y', 0,				// FNAME
+			'c', 'o', 'm', 'm', 'e', 'n', 't', 0,	// FCOMMENT
+			0x12, 0x34};							// FHCRC, not checked
+	File flagged;
+	flagged.length = sizeof(header) + replyGz.length - 10;
+	flagged.data = (char*)malloc(flagged.length);
+	memcpy(flagged.data, header, sizeof(header));
+	memcpy(flagged.data + sizeof(header), replyGz.data + 10, replyGz.length - 10);
+	for (j = 0; j < NELEMENTS(chunks); j++)
+	{
+		replay("all header fields", &flagged, &reply, REPLY_WINDOW_BITS, chunks[j]);
+	}
+	free(flagged.data);
+
+	File empty = readDataFile("empty.gz");
+	File nothing = {"", 0};
+	replay("empty.gz", &empty, &nothing, REPLY_WINDOW_BITS, 1);
+	free(empty.data);
+
+	free(stream.data);
+	free(reply.data);
+	free(replyGz.data);
+}
+
+// a cut reply isn't an error, it waits for the rest and gives what it has
+LOCAL void testTruncated(void)
+{
+	File reply = readDataFile("reply.json");
+	File replyGz = readDataFile("reply_9.gz");
+	File stream = readDataFile("stream.json");
+	File streamGz = readDataFile("stream_9.gz");
+	int cuts = 0;
+	int len;
+	for (len = 0; len < replyGz.length; len++)
+	{
+		Output out;
+		outputInit(&out, reply.length);
+		Inflater *inf = inflateNew(REPLY_WINDOW_BITS, collect, &out);
+		int ok = CHECK_INT(feed(inf, replyGz.data, len, 7), OK) &&
+				CHECK(!inflateIsDone(inf)) &&
+				CHECK(out.length <= reply.length) &&
+				CHECK_MEM(out.data, reply.data, out.length);
+		if (!ok)
+		{
+			printf("test_inflate: reply_9.gz cut at %d\n", len);
+		}
+		inflateFree(inf);
+		free(out.data);
+		cuts++;
+	}
+	for (len = 0; len < streamGz.length; len += 97)
+	{
+		Output out;
+		outputInit(&out, stream.length);
+		Inflater *inf = inflateNew(STREAM_WINDOW_BITS, collect, &out);
+		int ok = CHECK_INT(feed(inf, streamGz.data, len, SEGMENT_LEN), OK) &&
+				CHECK(!inflateIsDone(inf)) &&
+				CHECK_MEM(out.data, stream.data, out.length);
+		if (!ok)
+		{
+			printf("test_inflate: stream_9.gz cut at %d\n", len);
+		}
+		inflateFree(inf);
+		free(out.data);
+		cuts++;
+	}
+	printf("inflate: %d truncated inputs, each waiting for more\n", cuts);
+	free(reply.data);
+	free(replyGz.data);
+	free(stream.data);
+	free(streamGz.data);
+}
+
+// ERROR for the whole file, and for anything fed after it
+LOCAL void checkRefused(const char *what, const File *gz, int windowBits)
+{
+	Output out;
+	outputInit(&out, 1 << 16);
+	Inflater *inf = inflateNew(windowBits, collect, &out);
+	if (!CHECK_INT(feed(inf, gz->data, gz->length, SEGMENT_LEN), ERROR) ||
+		!CHECK_INT(inflateFeed(inf, gz->data, 1), ERROR) ||
+		!CHECK(!inflateIsDone(inf)))
+	{
+		printf("test_inflate: %s\n", what);
+	}
+	inflateFree(inf);
+	free(out.data);
+}
+
+LOCAL File copyFile(const File *file)
+{
+	File copy;
+	copy.length = file->length;
+	copy.data = (char*)malloc(file->length);
+	memcpy(copy.data, file->data, file->length);
+	return copy;
+}
+
+LOCAL void testCorrupt(void)
+{
+	File replyGz = readDataFile("reply_9.gz");
+	File stored = readDataFile("stream_stored.gz");
+	File empty = readDataFile("empty.gz");
+	File streamGz = readDataFile("stream_9.gz");
+	File bad;
+
+	bad = copyFile(&replyGz);
+	bad.data[1] ^= 0x01;
+	checkRefused("gzip magic", &bad, REPLY_WINDOW_BITS);
+	free(bad.data);
+
+	bad = copyFile(&replyGz);
+	bad.data[2] = 7;
+	checkRefused("compression method", &bad, REPLY_WINDOW_BITS);
+	free(bad.data);
+
+	bad = copyFile(&empty);
+	bad.data[10] |= 0x06;
+	checkRefused("reserved block type", &bad, REPLY_WINDOW_BITS);
+	free(bad.data);
+
+	bad = copyFile(&stored);
+	bad.data[13] ^= 0x01;
+	checkRefused("stored length and its complement", &bad, STREAM_WINDOW_BITS);
+	free(bad.data);
+
+	bad = copyFile(&replyGz);
+	bad.data[bad.length-4] ^= 0x01;
+	checkRefused("length in the trailer", &bad, REPLY_WINDOW_BITS);
+	free(bad.data);
+
+	// the server's 32 KB window doesn't fit in the one of the REST replies
+	checkRefused("references beyond the window", &streamGz, REPLY_WINDOW_BITS);
+
+	// one byte of the compressed data flipped: the CRC isn't checked, so
+	// it may inflate to other text, but it stops and is never out of bounds
+	uint state = 2039;
+	int refused = 0;
+	int done = 0;
+	int i;
+	for (i = 0; i < CORRUPT_CASES; i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		bad = copyFile(&streamGz);
+		int pos = 10 + (state >> 8) % (bad.length - 18);
+		bad.data[pos] ^= 1 << (state & 7);
+
+		Output out;
+		outputInit(&out, 1 << 17);
+		uint heap = shimHeap.current;
+		Inflater *inf = inflateNew(STREAM_WINDOW_BITS, collect, &out);
+		if (feed(inf, bad.data, bad.length, SEGMENT_LEN) == ERROR)
+		{
+			refused++;
+			CHECK_INT(inflateFeed(inf, bad.data, 1), ERROR);
+		}
+		else if (inflateIsDone(inf))
+		{
+			done++;
+		}
+		CHECK(out.maxPiece <= (1 << STREAM_WINDOW_BITS));
+		inflateFree(inf);
+		CHECK_INT(shimHeap.current, heap);
+		free(out.data);
+		free(bad.data);
+	}
+	printf("inflate: %d corrupt streams, %d refused, %d inflated to the length in the trailer, %d waiting\n",
+			CORRUPT_CASES, refused, done, CORRUPT_CASES - refused - done);
+
+	free(replyGz.data);
+	free(stored.data);
+	free(empty.data);
+	free(streamGz.data);
+}
+
+LOCAL void benchmark(void)
+{
+	const char *names[] = {"stream_1.gz", "stream_9.gz", "stream_stored.gz"};
+	int i, j;
+	for (i = 0; i < NELEMENTS(names); i++)
+	{
+		File gz = readDataFile(names[i]);
+		Output out;
+		outputInit(&out, 0);
+		double t0 = testSeconds();
+		for (j = 0; j < BENCH_ROUNDS; j++)
+		{
+			out.length = 0;
+			Inflater *inf = inflateNew(STREAM_WINDOW_BITS, collect, &out);
+			feed(inf, gz.data, gz.length, SEGMENT_LEN);
+			CHECK(inflateIsDone(inf));
+			inflateFree(inf);
+		}
+		double t = testSeconds() - t0;
+		printf("inflate: %-16s %5d -> %d bytes, %.1f MB/s out on the host in %d byte segments\n",
+				names[i], gz.length, out.length, out.length * (double)BENCH_ROUNDS / t / 1e6, SEGMENT_LEN);
+		free(out.data);
+		free(gz.data);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	testReplay();
+	testTruncated();
+	testCorrupt();
+	benchmark();
+	return testDone("inflate");
+}
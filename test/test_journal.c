@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/journal.c"
+#include "shim.h"
+#include "test.h"
+
+// The action journal on the flash of the shim: actions pending until
+// done, the move to the other sector when the active one is full, and
+// the power cut at every write and erase of a run, after which the
+// journal must replay what was pending and nothing that was done.
+
+#define REPLAYED_MAX		(2*JOURNAL_RECORDS)
+#define SCRIPT_ACTIONS		80		// some compactions
+#define SCRIPT_PENDING		3		// done this many actions later
+
+typedef struct{
+	uint seq;
+	int endpoint;
+	char arg[JOURNAL_ARG_SIZE];
+}Replayed;
+
+LOCAL Replayed replayed[REPLAYED_MAX];
+LOCAL int replayedCount;
+
+LOCAL void collect(uint seq, int endpoint, const char *arg)
+{
+	if (replayedCount < REPLAYED_MAX)
+	{
+		Replayed *r = &replayed[replayedCount];
+		r->seq = seq;
+		r->endpoint = endpoint;
+		snprintf(r->arg, sizeof(r->arg), "%s", arg);
+	}
+	replayedCount++;
+}
+
+LOCAL void replay(void)
+{
+	replayedCount = 0;
+	journalReplay(collect);
+}
+
+// what the device knows is gone, the flash stays
+LOCAL void reboot(void)
+{
+	shimReset();
+	activeSector = 0;
+	generation = 0;
+	nextRecord = 0;
+	nextSeq = 1;
+	appended = 0;
+	completed = 0;
+	compactions = 0;
+	erases = 0;
+	journalInit();
+}
+
+LOCAL void actionArg(int action, char *arg)
+{
+	sprintf(arg, "%d", 1000000 + action);
+}
+
+LOCAL void testPendingDone(void)
+{
+	shimFlashErase();
+	reboot();
+	CHECK_INT(erases, 1);
+	uint seq1, seq2, seq3, seqDup;
+	CHECK_INT(journalAdd(ApiLike, "1001", &seq1), OK);
+	CHECK_INT(journalAdd(ApiRetweet, "1001", &seq2), OK);
+	CHECK_INT(journalAdd(ApiDirectMsg, "text=hello&screen_name=someone", &seq3), OK);
+	CHECK_INT(journalAdd(ApiLike, "1001", &seqDup), OK);	// still pending, not written again
+	CHECK_INT(seqDup, seq1);
+	CHECK_INT(nextRecord, 3);
+	CHECK(seq1 < seq2 && seq2 < seq3);
+
+	replay();
+	CHECK_INT(replayedCount, 3);
+	CHECK_INT(replayed[0].seq, seq1);
+	CHECK_INT(replayed[0].endpoint, ApiLike);
+	CHECK_STR(replayed[0].arg, "1001");
+	CHECK_INT(replayed[2].endpoint, ApiDirectMsg);
+	CHECK_STR(replayed[2].arg, "text=hello&screen_name=someone");
+
+	// done in place, the state word only loses bits
+	journalDone(seq2);
+	journalDone(seq2);
+	CHECK_INT(completed, 1);
+	replay();
+	CHECK_INT(replayedCount, 2);
+	CHECK_INT(replayed[1].seq, seq3);
+
+	// as it was after a reset, new ones numbered after the old
+	reboot();
+	CHECK_INT(nextRecord, 3);
+	replay();
+	CHECK_INT(replayedCount, 2);
+	CHECK_INT(replayed[0].seq, seq1);
+	CHECK_INT(replayed[1].seq, seq3);
+	uint seq4;
+	CHECK_INT(journalAdd(ApiRetweet, "1001", &seq4), OK);	// done before, a new one
+	CHECK(seq4 > seq3);
+	CHECK_INT(erases, 0);
+
+	char arg[JOURNAL_ARG_SIZE + 1];
+	memset(arg, 'x', sizeof(arg) - 1);
+	arg[sizeof(arg) - 1] = '\0';
+	CHECK_INT(journalAdd(ApiDirectMsg, arg, &seq4), ERROR);
+}
+
+// the 29th record goes to the other sector with the ones still pending
+LOCAL void testCompaction(void)
+{
+	CHECK_INT(JOURNAL_RECORDS, 28);
+	shimFlashErase();
+	reboot();
+	uint seqs[JOURNAL_RECORDS];
+	char arg[16];
+	int i;
+	for (i = 0; i < JOURNAL_RECORDS; i++)
+	{
+		actionArg(i, arg);
+		CHECK_INT(journalAdd(ApiLike, arg, &seqs[i]), OK);
+		if (i % 7 != 3)
+		{
+			journalDone(seqs[i]);
+		}
+	}
+	CHECK_INT(nextRecord, JOURNAL_RECORDS);
+	CHECK_INT(compactions, 0);
+	int from = activeSector;
+	uint fromGeneration = generation;
+
+	uint seq;
+	actionArg(JOURNAL_RECORDS, arg);
+	CHECK_INT(journalAdd(ApiLike, arg, &seq), OK);
+	CHECK_INT(compactions, 1);
+	CHECK_INT(erases, 2);
+	CHECK(activeSector != from);
+	CHECK_INT(generation, fromGeneration + 1);
+	CHECK_INT(nextRecord, JOURNAL_RECORDS/7 + 1);
+
+	replay();
+	CHECK_INT(replayedCount, JOURNAL_RECORDS/7 + 1);
+	for (i = 0; i < JOURNAL_RECORDS/7; i++)
+	{
+		CHECK_INT(replayed[i].seq, seqs[7*i + 3]);
+	}
+	CHECK_INT(replayed[i].seq, seq);
+
+	// the newer sector is found after a reset
+	int to = activeSector;
+	reboot();
+	CHECK_INT(activeSector, to);
+	replay();
+	CHECK_INT(replayedCount, JOURNAL_RECORDS/7 + 1);
+
+	// nothing to make room with when all are pending
+	shimFlashErase();
+	reboot();
+	for (i = 0; i < JOURNAL_RECORDS; i++)
+	{
+		actionArg(i, arg);
+		CHECK_INT(journalAdd(ApiRetweet, arg, &seq), OK);
+	}
+	actionArg(i, arg);
+	CHECK_INT(journalAdd(ApiRetweet, arg, &seq), ERROR);
+	replay();
+	CHECK_INT(replayedCount, JOURNAL_RECORDS);
+}
+
+// the record is written, the state word that makes it count isn't
+LOCAL void testCutBeforeState(void)
+{
+	shimFlashErase();
+	reboot();
+	uint seq1, seq2;
+	CHECK_INT(journalAdd(ApiLike, "1001", &seq1), OK);
+	shimFlashPowerCut(1, 0);		// the body goes through
+	CHECK_INT(journalAdd(ApiLike, "1002", &seq2), OK);
+	CHECK(shimFlashIsCut());
+
+	reboot();
+	CHECK_INT(nextRecord, 2);		// the slot isn't blank, it is skipped
+	replay();
+	CHECK_INT(replayedCount, 1);
+	CHECK_STR(replayed[0].arg, "1001");
+
+	// the next one after it, the seq isn't taken twice by a pending record
+	uint seq3;
+	CHECK_INT(journalAdd(ApiLike, "1003", &seq3), OK);
+	CHECK_INT(nextRecord, 3);
+	CHECK(seq3 > seq1);
+	reboot();
+	replay();
+	CHECK_INT(replayedCount, 2);
+	CHECK_STR(replayed[1].arg, "1003");
+
+	// half of the body
+	shimFlashPowerCut(0, 40);
+	CHECK_INT(journalAdd(ApiLike, "1004", &seq2), OK);
+	reboot();
+	replay();
+	CHECK_INT(replayedCount, 2);
+	CHECK_INT(nextRecord, 4);
+
+	// half of the done state word: not pending any more
+	shimFlashPowerCut(0, 1);
+	journalDone(seq1);
+	reboot();
+	replay();
+	CHECK_INT(replayedCount, 1);
+	CHECK_STR(replayed[0].arg, "1003");
+}
+
+typedef struct{
+	uint seq;
+	int added;		// the add was done when the power went
+	int done;
+}ScriptAction;
+
+// the script of adds and dones, until the power is cut; the action whose
+// add or done was cut is returned, -1 when the whole script ran
+LOCAL int runScript(ScriptAction *actions, int *cutIsDone)
+{
+	char arg[16];
+	int i;
+	memset(actions, 0, SCRIPT_ACTIONS*sizeof(ScriptAction));
+	for (i = 0; i < SCRIPT_ACTIONS + SCRIPT_PENDING; i++)
+	{
+		if (i < SCRIPT_ACTIONS)
+		{
+			actionArg(i, arg);
+			uint seq = 0;
+			int ok = journalAdd(i % ApiEndpointCount, arg, &seq);
+			if (shimFlashIsCut())
+			{
+				*cutIsDone = FALSE;
+				return i;
+			}
+			CHECK_INT(ok, OK);
+			actions[i].seq = seq;
+			actions[i].added = TRUE;
+		}
+		if (i >= SCRIPT_PENDING)
+		{
+			int done = i - SCRIPT_PENDING;
+			journalDone(actions[done].seq);
+			if (shimFlashIsCut())
+			{
+				*cutIsDone = TRUE;
+				return done;
+			}
+			actions[done].done = TRUE;
+		}
+	}
+	return -1;
+}
+
+// a cut in every write and erase of a run: after the reset the actions
+// pending at the cut are replayed once, done ones aren't, and the one
+// being added or done when it happened either way
+LOCAL void testPowerCuts(void)
+{
+	const uint cutBytes[] = {0, 1, 4, 6, SPI_FLASH_SEC_SIZE/2};
+	ScriptAction actions[SCRIPT_ACTIONS];
+	int cutIsDone;
+
+	shimFlashErase();
+	reboot();
+	uint ops = shimFlashOps();
+	CHECK_INT(runScript(actions, &cutIsDone), -1);
+	ops = shimFlashOps() - ops;
+	uint scriptCompactions = compactions;
+	CHECK(scriptCompactions >= 3);
+
+	int cuts = 0;
+	int failures = 0;
+	uint op;
+	int b;
+	for (op = 0; op < ops; op++)
+	{
+		for (b = 0; b < NELEMENTS(cutBytes); b++)
+		{
+			shimFlashErase();
+			reboot();
+			shimFlashPowerCut(op, cutBytes[b]);
+			int cut = runScript(actions, &cutIsDone);
+			CHECK(cut >= 0);
+			reboot();
+			replay();
+
+			int ok = TRUE;
+			int seen[SCRIPT_ACTIONS];
+			memset(seen, 0, sizeof(seen));
+			int i;
+			for (i = 0; i < replayedCount && i < REPLAYED_MAX; i++)
+			{
+				int action = atoi(replayed[i].arg) - 1000000;
+				ok = ok && CHECK(action >= 0 && action < SCRIPT_ACTIONS) &&
+						CHECK_INT(replayed[i].endpoint, action % ApiEndpointCount);
+				if (!ok)
+				{
+					break;
+				}
+				seen[action]++;
+			}
+			for (i = 0; i < SCRIPT_ACTIONS && ok; i++)
+			{
+				if (i == cut)
+				{
+					ok = CHECK(seen[i] <= 1);
+				}
+				else
+				{
+					ok = CHECK_INT(seen[i], actions[i].added && !actions[i].done);
+				}
+			}
+
+			// and it goes on from there, through two more compactions
+			uint seq;
+			for (i = 0; i < replayedCount && i < REPLAYED_MAX; i++)
+			{
+				journalDone(replayed[i].seq);
+			}
+			for (i = 0; i < 2*JOURNAL_RECORDS && ok; i++)
+			{
+				char arg[16];
+				uint lastGeneration = generation;
+				actionArg(SCRIPT_ACTIONS + i, arg);
+				ok = CHECK_INT(journalAdd(ApiRetweet, arg, &seq), OK);
+				journalDone(seq);
+				if (generation != lastGeneration)
+				{
+					reboot();
+					replay();
+					ok = ok && CHECK_INT(replayedCount, 0);
+				}
+			}
+			ok = ok && CHECK_INT(journalAdd(ApiLike, "after", &seq), OK);
+			reboot();
+			replay();
+			ok = ok && CHECK_INT(replayedCount, 1) && CHECK_STR(replayed[0].arg, "after");
+			if (!ok)
+			{
+				printf("test_journal: power cut at flash operation %u, %u bytes of it, %s of action %d\n",
+						op, cutBytes[b], cutIsDone ? "done" : "add", cut);
+				failures++;
+				if (failures > 3)
+				{
+					return;
+				}
+			}
+			cuts++;
+		}
+	}
+	printf("journal: %d power cuts over %u flash operations of %d actions, %d compactions, none lost or replayed done\n",
+			cuts, ops, SCRIPT_ACTIONS, scriptCompactions);
+}
+
+int main(int argc, char **argv)
+{
+	shimQuiet = TRUE;
+	testPendingDone();
+	testCompaction();
+	testCutBeforeState();
+	testPowerCuts();
+	return testDone("journal");
+}
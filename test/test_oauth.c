@@ -0,0 +1,687 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../src/oauth.c"
+#include "shim.h"
+#include "test.h"
+
+#define BENCH_SIGNATURES	100000
+#define BASE_STR_MAX_LEN	2048
+#define NONCE_LEN			42
+#define NONCE_COUNT			20000
+#define EXAMPLE_NONCE		"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg"
+#define EXAMPLE_TIMESTAMP	"1318622958"
+#define EXAMPLE_SIGN_KEY	"kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw&LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE"
+
+
+LOCAL void hmacSha1(const u8 *key, int keyLen, const void *data, int dataLen, u8 *mac)
+{
+	setHmacKey(key, keyLen);
+	SHA1_CTX ctx = signKeyInner;
+	SHA1Update(&ctx, data, dataLen);
+	signHmacSha1Finish(&ctx, mac);
+}
+
+LOCAL void toHex(const u8 *data, int len, char *hex)
+{
+	int i;
+	for (i = 0; i < len; i++)
+	{
+		sprintf(hex + 2*i, "%02x", data[i]);
+	}
+}
+
+typedef struct{
+	u8 keyByte;			// repeated, keyLen times
+	int keyLen;
+	const char *data;	// dataByte repeated dataLen times when NULL
+	u8 dataByte;
+	int dataLen;
+	const char *mac;
+}HmacCase;
+
+// RFC 2202 section 3, case 2 and 4 are below
+LOCAL const HmacCase rfc2202Cases[] = {
+	{0x0b, 20, "Hi There", 0, 8, "b617318655057264e28bc0b6fb378c8ef146be00"},
+	{0xaa, 20, NULL, 0xdd, 50, "125d7342b9ac11cd91a39af48aa17b4f63f175d3"},
+	{0x0c, 20, "Test With Truncation", 0, 20, "4c1a03424b55e07fe7f27be1d58bb9324a9a5a04"},
+	{0xaa, 80, "Test Using Larger Than Block-Size Key - Hash Key First", 0, 54,
+			"aa4ae5e15272d00e95705637ce8a3b55ed402112"},
+	{0xaa, 80, "Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data", 0, 73,
+			"e8e99d0f45237d786d6bbaa7965c7808bbff1a91"},
+};
+
+LOCAL void testRfc2202(void)
+{
+	u8 key[80];
+	u8 data[80];
+	u8 mac[SHA1_DIGEST_SIZE];
+	char hex[2*SHA1_DIGEST_SIZE+1];
+	int i;
+	for (i = 0; i < NELEMENTS(rfc2202Cases); i++)
+	{
+		const HmacCase *hmacCase = &rfc2202Cases[i];
+		memset(key, hmacCase->keyByte, hmacCase->keyLen);
+		if (hmacCase->data)
+		{
+			memcpy(data, hmacCase->data, hmacCase->dataLen);
+		}
+		else
+		{
+			memset(data, hmacCase->dataByte, hmacCase->dataLen);
+		}
+		hmacSha1(key, hmacCase->keyLen, data, hmacCase->dataLen, mac);
+		toHex(mac, SHA1_DIGEST_SIZE, hex);
+		CHECK_STR(hex, hmacCase->mac);
+	}
+
+	hmacSha1((const u8*)"Jefe", 4, "what do ya want for nothing?", 28, mac);
+	toHex(mac, SHA1_DIGEST_SIZE, hex);
+	CHECK_STR(hex, "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79");
+
+	for (i = 0; i < 25; i++)
+	{
+		key[i] = i + 1;
+	}
+	memset(data, 0xcd, 50);
+	hmacSha1(key, 25, data, 50, mac);
+	toHex(mac, SHA1_DIGEST_SIZE, hex);
+	CHECK_STR(hex, "4c9007f4026250c6bc8414f9bf50c86c2d7235da");
+}
+
+// the protected resource request of RFC 5849 section 1.2, its base
+// string has no oauth_version and an http URL, which the request
+// code does not build, so only the HMAC and the encoding are used
+LOCAL void testRfc5849(void)
+{
+	const char *baseStr = "GET&http%3A%2F%2Fphotos.example.net%2Fphotos&file%3Dvacation.jpg"
+			"%26oauth_consumer_key%3Ddpf43f3p2l4k3l03%26oauth_nonce%3DchapoH"
+			"%26oauth_signature_method%3DHMAC-SHA1%26oauth_timestamp%3D137131202"
+			"%26oauth_token%3Dnnch734d00sl2jdk%26size%3Doriginal";
+	const char *key = "kd94hf93k423kf44&pfkkdhi9sl3r4s00";
+	u8 mac[SHA1_DIGEST_SIZE];
+	hmacSha1((const u8*)key, strlen(key), baseStr, strlen(baseStr), mac);
+	char signature[OAUTH_SIGNATURE_MAX_LEN+1];
+	CHECK(encodeSignature(mac, signature, sizeof(signature)) > 0);
+	CHECK_STR(signature, "MdpQcU8iPSUjWoN%2FUDMsK2sui9I%3D");
+}
+
+// the key from the secrets, and the pads it gives
+LOCAL void testSignKey(void)
+{
+	testExampleCredentials();
+	oauthSetSignKey();
+	CHECK(signKeyValid);
+	SHA1_CTX inner = signKeyInner;
+	SHA1_CTX outer = signKeyOuter;
+
+	const char *key = EXAMPLE_SIGN_KEY;
+	setHmacKey((const u8*)key, strlen(key));
+	CHECK_MEM(&signKeyInner, &inner, sizeof(SHA1_CTX));
+	CHECK_MEM(&signKeyOuter, &outer, sizeof(SHA1_CTX));
+
+	// the key length is not limited by the block, nor is the heap kept
+	uint heap = shimHeap.current;
+	memset(config.consumer_secret, 'k', 100);
+	config.consumer_secret[100] = '\0';
+	oauthSetSignKey();
+	CHECK(signKeyValid);
+	CHECK_INT(shimHeap.current, heap);
+
+	testExampleCredentials();
+	oauthSetSignKey();
+}
+
+typedef struct{
+	char name[32];
+	char value[256];
+}EncodedParam;
+
+LOCAL int compareParams(const void *a, const void *b)
+{
+	const EncodedParam *pa = (const EncodedParam*)a;
+	const EncodedParam *pb = (const EncodedParam*)b;
+	int rc = strcmp(pa->name, pb->name);
+	return rc ? rc : strcmp(pa->value, pb->value);
+}
+
+LOCAL void addParam(EncodedParam *params, int *count, const char *name, const char *value)
+{
+	EncodedParam *param = &params[(*count)++];
+	percentEncode(name, strlen(name), param->name, sizeof(param->name));
+	percentEncode(value, strlen(value), param->value, sizeof(param->value));
+}
+
+// RFC 5849 section 3.4.1 the plain way: every parameter encoded,
+// all of them sorted, joined and the result encoded again
+LOCAL void referenceBaseStr(char *dst, int dstSize, const char *method,
+		const char *host, const char *url, const ParamList *paramList)
+{
+	EncodedParam params[16];
+	int count = 0;
+	int i;
+	for (i = 0; i < paramList->count; i++)
+	{
+		addParam(params, &count, paramList->items[i].param, paramList->items[i].value);
+	}
+	addParam(params, &count, "oauth_consumer_key", config.consumer_key);
+	addParam(params, &count, "oauth_nonce", EXAMPLE_NONCE);
+	addParam(params, &count, "oauth_signature_method", "HMAC-SHA1");
+	addParam(params, &count, "oauth_timestamp", EXAMPLE_TIMESTAMP);
+	addParam(params, &count, "oauth_token", config.access_token);
+	addParam(params, &count, "oauth_version", "1.0");
+	qsort(params, count, sizeof(EncodedParam), compareParams);
+
+	char joined[BASE_STR_MAX_LEN];
+	int len = 0;
+	for (i = 0; i < count; i++)
+	{
+		len += snprintf(joined + len, sizeof(joined) - len, "%s%s=%s", i ? "&" : "", params[i].name, params[i].value);
+	}
+	char uri[256];
+	snprintf(uri, sizeof(uri), "https://%s%s", host, url);
+	len = snprintf(dst, dstSize, "%s&", method);
+	len += percentEncode(uri, strlen(uri), dst + len, dstSize - len);
+	dst[len++] = '&';
+	percentEncode(joined, strlen(joined), dst + len, dstSize - len);
+}
+
+// request parameters sorting before, between and after the oauth_*
+// ones: '_' is 0x5F, so "oauthA" and "oauth0" go before the block
+// and "oauthz" after it, as does anything starting past 'o'
+LOCAL const ParamItem orderParams[][5] = {
+	{{NULL}},
+	{{"a", "1"}},
+	{{"oa", "1"}, {"oauth", "2"}, {"oauth0", "3"}, {"oauthA", "4"}},
+	{{"oauthz", "1"}, {"p", "2"}, {"status", "Hello Ladies + Gentlemen, a signed OAuth request!"}},
+	{{"filter_level", "low"}, {"language", "en"}, {"track", "esp8266,#iot caf\xc3\xa9"}},
+	{{"include_entities", "true"}, {"status", "Hello Ladies + Gentlemen, a signed OAuth request!"}},
+	{{"Z", "upper"}, {"_x", "underscore"}, {"oauth", "short"}, {"oauthz", "past"}, {"zz", "last"}},
+	{{"text", "100% sure"}, {"user_id", "12345"}},
+};
+
+LOCAL void testParamOrder(void)
+{
+	testExampleCredentials();
+	oauthSetSignKey();
+	const char *key = EXAMPLE_SIGN_KEY;
+
+	int i;
+	for (i = 0; i < NELEMENTS(orderParams); i++)
+	{
+		ParamList paramList = {orderParams[i], 0};
+		while (paramList.count < 5 && orderParams[i][paramList.count].param)
+		{
+			paramList.count++;
+		}
+
+		char expected[BASE_STR_MAX_LEN];
+		referenceBaseStr(expected, sizeof(expected), "POST", "api.twitter.com", "/1.1/test.json", &paramList);
+
+		char baseStr[BASE_STR_MAX_LEN];
+		SHA1_CTX ctx = signKeyInner;
+		shimSha1Capture(&ctx, baseStr, sizeof(baseStr));
+		hashBaseStrPrefix(&ctx, "POST", "api.twitter.com", "/1.1/test.json", &paramList);
+		hashBaseStrRest(&ctx, EXAMPLE_NONCE, EXAMPLE_TIMESTAMP, &paramList);
+		shimSha1Capture(NULL, NULL, 0);
+		CHECK_STR(baseStr, expected);
+
+		// the same through the signature
+		u8 mac[SHA1_DIGEST_SIZE];
+		char signature[OAUTH_SIGNATURE_MAX_LEN+1];
+		char expectedSignature[OAUTH_SIGNATURE_MAX_LEN+1];
+		createSignature(signature, sizeof(signature), "POST", "api.twitter.com", "/1.1/test.json",
+				EXAMPLE_NONCE, EXAMPLE_TIMESTAMP, &paramList);
+		hmacSha1((const u8*)key, strlen(key), expected, strlen(expected), mac);
+		encodeSignature(mac, expectedSignature, sizeof(expectedSignature));
+		CHECK_STR(signature, expectedSignature);
+		oauthSetSignKey();		// hmacSha1 replaced the pads
+	}
+}
+
+// RFC 3986 section 2.3 spelled out
+LOCAL int isUnreserved(uchar ch)
+{
+	return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') ||
+			ch == '-' || ch == '.' || ch == '_' || ch == '~';
+}
+
+LOCAL int referenceEncode(const char *src, int srcLen, char *dst)
+{
+	int len = 0;
+	int i;
+	for (i = 0; i < srcLen; i++)
+	{
+		uchar ch = src[i];
+		len += isUnreserved(ch) ? sprintf(dst + len, "%c", ch) : sprintf(dst + len, "%%%02X", ch);
+	}
+	dst[len] = '\0';
+	return len;
+}
+
+LOCAL void testPercentEncode(void)
+{
+	char dst[64];
+	CHECK_INT(percentEncode("", 0, dst, sizeof(dst)), 0);
+	CHECK_STR(dst, "");
+	CHECK_INT(percentEncode("Ladies + Gentlemen", 18, dst, sizeof(dst)), 24);
+	CHECK_STR(dst, "Ladies%20%2B%20Gentlemen");
+	CHECK_INT(percentEncode("An encoded string!", 18, dst, sizeof(dst)), 24);
+	CHECK_STR(dst, "An%20encoded%20string%21");
+	CHECK_INT(percentEncode("Dogs, Cats & Mice", 17, dst, sizeof(dst)), 27);
+	CHECK_STR(dst, "Dogs%2C%20Cats%20%26%20Mice");
+	CHECK_INT(percentEncode("\xe2\x98\x83", 3, dst, sizeof(dst)), 9);		// U+2603
+	CHECK_STR(dst, "%E2%98%83");
+	CHECK_INT(percentEncode("a-b.c_d~e", 9, dst, sizeof(dst)), 9);
+	CHECK_STR(dst, "a-b.c_d~e");
+	CHECK_INT(percentEncode("a b", 1, dst, sizeof(dst)), 1);		// srcLen counts
+	CHECK_STR(dst, "a");
+	CHECK_INT(percentEncodedStrLen("Dogs, Cats & Mice", 17), 27);
+	CHECK_INT(percentEncodedStrLen("Dogs, Cats & Mice", 100), 27);	// stops at '\0'
+	CHECK_INT(percentEncodedStrLen("Dogs, Cats & Mice", 5), 7);
+
+	// exactly fits with its '\0', one byte less and nothing is written
+	CHECK_INT(percentEncode("a b", 3, dst, 6), 5);
+	CHECK_STR(dst, "a%20b");
+	CHECK_INT(percentEncode("a b", 3, dst, 5), 0);
+	CHECK_INT(percentEncode("ab", 2, dst, 3), 2);
+	CHECK_INT(percentEncode("ab", 2, dst, 2), 0);
+	CHECK_INT(percentEncode("", 0, dst, 0), 0);
+
+	// random strings of any byte against the spelled out encoder
+	char src[32];
+	char expected[3*sizeof(src)+1];
+	char encoded[3*sizeof(src)+1];
+	int i;
+	for (i = 0; i < 10000; i++)
+	{
+		int srcLen = os_random() % sizeof(src);
+		int j;
+		for (j = 0; j < srcLen; j++)
+		{
+			src[j] = os_random() & 0xFF;
+		}
+		int len = referenceEncode(src, srcLen, expected);
+		int dstSize = len + 1 + (int)(os_random() % 3) - 1;		// too small by one, fits, one more
+		int encodedLen = percentEncode(src, srcLen, encoded, dstSize);
+		if (dstSize <= len)
+		{
+			if (!CHECK_INT(encodedLen, 0))
+			{
+				break;
+			}
+			continue;
+		}
+		if (!CHECK_INT(encodedLen, len) || !CHECK_MEM(encoded, expected, len + 1))
+		{
+			break;
+		}
+	}
+}
+
+// the encoder before the table, for comparison
+LOCAL int oldCharNeedEscape(char ch)
+{
+	if ((ch >= '0' && ch <= '9') ||
+		(ch >= 'A' && ch <= 'Z') ||
+		(ch >= 'a' && ch <= 'z') ||
+		 ch == '-' || ch == '.'  ||
+		 ch == '_' || ch == '~')
+	{
+		return 0;
+	}
+	return 1;
+}
+
+LOCAL int oldPercentEncode(const char *src, int srcLen, char *dst, int dstSize)
+{
+	const char *hex = "0123456789ABCDEF";
+	int len = 0;
+	while (srcLen--)
+	{
+		uchar ch = *src++;
+		if (oldCharNeedEscape(ch))
+		{
+			if (len + 2 >= dstSize)
+			{
+				return 0;
+			}
+			*dst++ = '%';
+			*dst++ = hex[ch >> 4];
+			*dst++ = hex[ch & 0x0F];
+			len += 3;
+		}
+		else
+		{
+			if (len >= dstSize)
+			{
+				return 0;
+			}
+			*dst++ = ch;
+			len++;
+		}
+	}
+	if (len >= dstSize)
+	{
+		return 0;
+	}
+	*dst = '\0';
+	return len;
+}
+
+LOCAL int oldPercentEncodeTwice(const char *src, int srcLen, char *dst, int dstSize)
+{
+	char once[3*256+1];
+	int len = oldPercentEncode(src, srcLen, once, sizeof(once));
+	if (len == 0 && srcLen > 0)
+	{
+		return 0;
+	}
+	return oldPercentEncode(once, len, dst, dstSize);
+}
+
+// every byte value, signed or not, against RFC 3986 and the old encoder
+LOCAL void testUnreservedTable(void)
+{
+	int unreserved = 0;
+	int i;
+	for (i = 0; i < 256; i++)
+	{
+		char str[2] = {(char)i, '\0'};
+		char ch = str[0];
+		char expected[16];
+		char encoded[16];
+		int ok = CHECK_INT(!!IS_UNRESERVED(ch), isUnreserved(i)) &&
+			CHECK_INT(!!IS_UNRESERVED((uchar)i), isUnreserved(i)) &&
+			CHECK_INT(!IS_UNRESERVED(ch), oldCharNeedEscape(ch));
+
+		int len = oldPercentEncode(&ch, 1, expected, sizeof(expected));
+		ok = ok && CHECK_INT(percentEncode(&ch, 1, encoded, sizeof(encoded)), len) &&
+			CHECK_STR(encoded, expected);
+		len = oldPercentEncodeTwice(&ch, 1, expected, sizeof(expected));
+		ok = ok && CHECK_INT(percentEncodeTwice(&ch, 1, encoded, sizeof(encoded)), len) &&
+			CHECK_STR(encoded, expected);
+		if (i > 0)
+		{
+			ok = ok && CHECK_INT(percentEncodedStrLen(str, 1), isUnreserved(i) ? 1 : 3);
+		}
+		if (!ok)
+		{
+			printf("test_oauth: byte 0x%02X\n", i);
+			break;
+		}
+		unreserved += isUnreserved(i);
+	}
+	CHECK_INT(unreserved, 66);
+
+	// random strings, both encoders, with the output size cut at random
+	char src[48];
+	char expected[5*sizeof(src)+1];
+	char encoded[5*sizeof(src)+1];
+	for (i = 0; i < 20000; i++)
+	{
+		int srcLen = os_random() % sizeof(src);
+		int j;
+		for (j = 0; j < srcLen; j++)
+		{
+			src[j] = os_random() & 0xFF;
+		}
+		int dstSize = os_random() % sizeof(encoded);
+		int twice = i & 1;
+		int len = twice ? oldPercentEncodeTwice(src, srcLen, expected, dstSize) :
+						  oldPercentEncode(src, srcLen, expected, dstSize);
+		int encodedLen = twice ? percentEncodeTwice(src, srcLen, encoded, dstSize) :
+								 percentEncode(src, srcLen, encoded, dstSize);
+		if (!CHECK_INT(encodedLen, len) || (len > 0 && !CHECK_STR(encoded, expected)))
+		{
+			break;
+		}
+	}
+}
+
+LOCAL double alphanumericChiSquare(const uint counts[256], int total, int *symbols)
+{
+	double expected = (double)total / 62;
+	double chiSquare = 0;
+	*symbols = 0;
+	int i;
+	for (i = 0; i < 256; i++)
+	{
+		if (counts[i])
+		{
+			CHECK(isalnum(i));
+			(*symbols)++;
+		}
+		if (isalnum(i))
+		{
+			chiSquare += (counts[i] - expected) * (counts[i] - expected) / expected;
+		}
+	}
+	return chiSquare;
+}
+
+// 42 alphanumeric characters each time, all 62 equally likely
+LOCAL void testNonce(void)
+{
+	char nonce[NONCE_LEN+2];
+	uint counts[256] = {0};
+	uint heap = shimHeap.allocs;
+	int i;
+	for (i = 0; i < NONCE_COUNT; i++)
+	{
+		nonce[NONCE_LEN+1] = '#';
+		randomAlphanumericString(nonce, NONCE_LEN);
+		if (!CHECK_INT(strlen(nonce), NONCE_LEN) || !CHECK(nonce[NONCE_LEN+1] == '#'))
+		{
+			return;
+		}
+		int j;
+		for (j = 0; j < NONCE_LEN; j++)
+		{
+			counts[(uchar)nonce[j]]++;
+		}
+	}
+	CHECK_INT(shimHeap.allocs, heap);
+
+	int symbols;
+	double chiSquare = alphanumericChiSquare(counts, NONCE_COUNT * NONCE_LEN, &symbols);
+	CHECK_INT(symbols, 62);
+	CHECK(chiSquare < 100.9);		// p = 0.001 at 61 degrees of freedom
+	printf("oauth: %d nonce characters, chi-square %.1f at 61 degrees of freedom\n",
+			NONCE_COUNT * NONCE_LEN, chiSquare);
+}
+
+// the nonce characters before, rand() picked one of the three ranges
+// first, so each digit was more likely than each letter
+LOCAL void oldRandomAlphanumericString(char *str, int len)
+{
+	const char ranges[3][2] = {{'0', '9'}, {'A', 'Z'}, {'a', 'z'}};
+	while (len--)
+	{
+		int range = rand() % 3;
+		*str++ = ranges[range][0] + rand() % (ranges[range][1] - ranges[range][0] + 1);
+	}
+	*str = '\0';
+}
+
+LOCAL void compareNonce(void)
+{
+	char nonce[NONCE_LEN+1];
+	uint counts[256] = {0};
+	srand(1318622958);
+	int i;
+	for (i = 0; i < NONCE_COUNT; i++)
+	{
+		oldRandomAlphanumericString(nonce, NONCE_LEN);
+		int j;
+		for (j = 0; j < NONCE_LEN; j++)
+		{
+			counts[(uchar)nonce[j]]++;
+		}
+	}
+	int symbols;
+	double chiSquare = alphanumericChiSquare(counts, NONCE_COUNT * NONCE_LEN, &symbols);
+	CHECK(chiSquare > 100.9);		// the bias shows
+	printf("oauth: the old nonces, chi-square %.0f, '0' %.2f%% and 'a' %.2f%% of the characters\n",
+			chiSquare, 100.0 * counts['0'] / (NONCE_COUNT * NONCE_LEN), 100.0 * counts['a'] / (NONCE_COUNT * NONCE_LEN));
+}
+
+// base64 as RFC 4648 writes it, then percent encoded
+LOCAL void referenceSignature(const u8 *digest, char *dst)
+{
+	const char *chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char base64[29];
+	int i;
+	for (i = 0; i < 18; i += 3)
+	{
+		uint group = digest[i] << 16 | digest[i+1] << 8 | digest[i+2];
+		base64[4*i/3] = chars[group >> 18];
+		base64[4*i/3+1] = chars[(group >> 12) & 63];
+		base64[4*i/3+2] = chars[(group >> 6) & 63];
+		base64[4*i/3+3] = chars[group & 63];
+	}
+	uint group = digest[18] << 16 | digest[19] << 8;
+	base64[24] = chars[group >> 18];
+	base64[25] = chars[(group >> 12) & 63];
+	base64[26] = chars[(group >> 6) & 63];
+	base64[27] = '=';
+	base64[28] = '\0';
+	referenceEncode(base64, 28, dst);
+}
+
+LOCAL void testEncodeSignature(void)
+{
+	u8 digest[SHA1_DIGEST_SIZE];
+	char signature[OAUTH_SIGNATURE_MAX_LEN+1];
+	char expected[OAUTH_SIGNATURE_MAX_LEN+1];
+
+	memset(digest, 0xFF, sizeof(digest));		// all '/', the longest
+	CHECK_INT(encodeSignature(digest, signature, sizeof(signature)), 82);
+	CHECK_STR(signature, "%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F%2F8%3D");
+	CHECK_INT(encodeSignature(digest, signature, OAUTH_SIGNATURE_MAX_LEN), 0);
+	memset(digest, 0, sizeof(digest));
+	CHECK_INT(encodeSignature(digest, signature, sizeof(signature)), 30);
+	CHECK_STR(signature, "AAAAAAAAAAAAAAAAAAAAAAAAAAA%3D");
+
+	int i;
+	for (i = 0; i < 10000; i++)
+	{
+		int j;
+		for (j = 0; j < SHA1_DIGEST_SIZE; j++)
+		{
+			digest[j] = os_random();
+		}
+		referenceSignature(digest, expected);
+		int len = encodeSignature(digest, signature, sizeof(signature));
+		if (!CHECK_INT(len, strlen(expected)) || !CHECK_STR(signature, expected))
+		{
+			break;
+		}
+	}
+}
+
+// a status update signed three ways: the whole base string built in a
+// buffer first by the reference above, hashed while it is generated,
+// and from the hashed prefix as the stream request after a reconnect
+LOCAL void benchSignature(void)
+{
+	testExampleCredentials();
+	oauthSetSignKey();
+	ParamItem params[] = {
+		{"include_entities", "true"},
+		{"status", "Hello Ladies + Gentlemen, a signed OAuth request!"}};
+	ParamList paramList = {params, 2};
+	char signature[OAUTH_SIGNATURE_MAX_LEN+1];
+	char expected[OAUTH_SIGNATURE_MAX_LEN+1];
+	char baseStr[BASE_STR_MAX_LEN];
+	u8 mac[SHA1_DIGEST_SIZE];
+	int i;
+
+	double t0 = testSeconds();
+	for (i = 0; i < BENCH_SIGNATURES; i++)
+	{
+		referenceBaseStr(baseStr, sizeof(baseStr), "POST", "api.twitter.com", "/1.1/statuses/update.json", &paramList);
+		SHA1_CTX ctx = signKeyInner;
+		SHA1Update(&ctx, baseStr, strlen(baseStr));
+		signHmacSha1Finish(&ctx, mac);
+		encodeSignature(mac, expected, sizeof(expected));
+	}
+	double buffered = testSeconds() - t0;
+
+	t0 = testSeconds();
+	for (i = 0; i < BENCH_SIGNATURES; i++)
+	{
+		createSignature(signature, sizeof(signature), "POST", "api.twitter.com", "/1.1/statuses/update.json",
+				EXAMPLE_NONCE, EXAMPLE_TIMESTAMP, &paramList);
+	}
+	double hashed = testSeconds() - t0;
+	CHECK_STR(signature, expected);
+	CHECK_STR(signature, "hCtSmYh%2BiHYCEqBWrE7C7hYmtUk%3D");
+
+	OAuthSignPrefix prefix;
+	oauthSignPrefixInit(&prefix, "POST", "api.twitter.com", "/1.1/statuses/update.json", &paramList);
+	t0 = testSeconds();
+	for (i = 0; i < BENCH_SIGNATURES; i++)
+	{
+		createSignaturePrefixed(signature, sizeof(signature), &prefix, EXAMPLE_NONCE, EXAMPLE_TIMESTAMP, &paramList);
+	}
+	double prefixed = testSeconds() - t0;
+	CHECK_STR(signature, expected);
+
+	printf("oauth: signature of a status update, %.2f us with the base string buffered, "
+			"%.2f us hashed as generated, %.2f us from the prefix\n",
+			buffered * 1e6 / BENCH_SIGNATURES, hashed * 1e6 / BENCH_SIGNATURES, prefixed * 1e6 / BENCH_SIGNATURES);
+}
+
+// HMAC over a base string of a status update, with the pads hashed
+// once at key setup against both pads hashed for each signature
+LOCAL void benchmark(void)
+{
+	char baseStr[400];
+	memset(baseStr, 'x', sizeof(baseStr));
+	const char *key = EXAMPLE_SIGN_KEY;
+	int keyLen = strlen(key);
+	u8 mac[SHA1_DIGEST_SIZE];
+	u8 macFull[SHA1_DIGEST_SIZE];
+	int i;
+
+	setHmacKey((const u8*)key, keyLen);
+	double t0 = testSeconds();
+	for (i = 0; i < BENCH_SIGNATURES; i++)
+	{
+		SHA1_CTX ctx = signKeyInner;
+		SHA1Update(&ctx, baseStr, sizeof(baseStr));
+		signHmacSha1Finish(&ctx, mac);
+	}
+	double precomputed = testSeconds() - t0;
+
+	t0 = testSeconds();
+	for (i = 0; i < BENCH_SIGNATURES; i++)
+	{
+		hmacSha1((const u8*)key, keyLen, baseStr, sizeof(baseStr), macFull);
+	}
+	double full = testSeconds() - t0;
+	CHECK_MEM(mac, macFull, SHA1_DIGEST_SIZE);
+
+	// SHA-1 blocks per signature: 7 for the message and 1 outer, when
+	// nothing is kept 2 more for the 86 byte key and 2 for the pads
+	printf("oauth: HMAC of %d bytes, %.0f/s with the key pads kept, %.0f/s with them hashed each time (%.2fx)\n",
+			(int)sizeof(baseStr), BENCH_SIGNATURES / precomputed, BENCH_SIGNATURES / full, full / precomputed);
+}
+
+int main(int argc, char **argv)
+{
+	testRfc2202();
+	testRfc5849();
+	testSignKey();
+	testParamOrder();
+	testPercentEncode();
+	testUnreservedTable();
+	testNonce();
+	compareNonce();
+	testEncodeSignature();
+	benchmark();
+	benchSignature();
+	return testDone("oauth");
+}
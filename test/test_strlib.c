@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/strlib.c"
+#include "shim.h"
+#include "test.h"
+
+#define BENCH_TWEETS		20000
+#define FUZZ_CASES			20000
+#define FUZZ_KEYWORDS_LEN	12
+#define FUZZ_TWEET_LEN		40
+
+// strlib.c draws through these, the word matching doesn't
+int memHeight;
+int inverseColor;
+void drawBitmapPixelByPixel(int x, int y, int bmWidth, int bmHeight, const uint *bitmap, int bitmapSize) {}
+void drawPixel(int x, int y, int color) {}
+void drawRect(int x0, int y0, int x1, int y1, char color) {}
+
+LOCAL const char *keywords[] = {
+	"esp8266", "Arduino", "#iot", "Maker", "raspberry", "python", "linux", "github", "rust", "sensor",
+	"wifi", "mqtt", "firmware", "solder", "oled", "display", "tweet", "twitter", "hack", "robot",
+	"drone", "laser", "printer", "3dprint", "kicad", "fpga", "verilog", "opensource", "electronics", "circuit",
+	"battery", "lipo", "motor", "servo", "stepper", "voltage", "current", "resistor", "capacitor", "inductor",
+	"antenna", "radio", "lora", "zigbee", "bluetooth", "usb", "serial", "uart", "spi", "i2c"
+};
+
+LOCAL const char *tweet = "Just finished my new #IoT weather station: ESP8266 + BME280 sensor, "
+		"OLED display and a LiPo battery. Firmware on GitHub, PCB done in KiCad. "
+		"Next up: LoRa radio and MQTT! https://t.co/abcdefghij @someone #maker #electronics";
+
+// the matcher before the trie, a list of the keywords walked for every word
+LOCAL int oldStrStartsWith(const ushort *str1, int len1, const ushort *str2, int len2, int caseInsensitive)
+{
+	if (len1 < 1 || len2 < 1) return (len1 == len2);
+	if (isDelimeter(str1[len1-1])) len1--;
+	if (isDelimeter(str2[len2-1])) len2--;
+	if (*str1 == '#') { str1++; len1--; }
+	if (*str2 == '#') { str2++; len2--; }
+	while (len2 > 0)
+	{
+		if (!*str1 || !*str2) return FALSE;
+		if ((caseInsensitive && (chToLower(*str1) != chToLower(*str2))) ||
+		   (!caseInsensitive && (*str1 != *str2))) return FALSE;
+		str1++; str2++; len2--;
+	}
+	return TRUE;
+}
+
+LOCAL int oldStrListContains(const StrList *list, const ushort *str, int length, int caseInsensitive)
+{
+	const StrListItem *item = list->first;
+	while (item)
+	{
+		if (oldStrStartsWith(str, length, item->str, item->length, caseInsensitive))
+		{
+			return TRUE;
+		}
+		item = item->next;
+	}
+	return FALSE;
+}
+
+// Latin-1 only, enough for the keywords and the tweet
+LOCAL ushort *toWstr(const char *str)
+{
+	int len = strlen(str);
+	ushort *wstr = (ushort*)malloc((len + 1)*sizeof(ushort));
+	int i;
+	for (i = 0; i <= len; i++)
+	{
+		wstr[i] = (uchar)str[i];
+	}
+	return wstr;
+}
+
+LOCAL int matches(const KeywordTrie *trie, const ushort *text, char *marks)
+{
+	StrList words;
+	strSplit(text, &words);
+	int count = 0;
+	const StrListItem *word;
+	for (word = words.first; word; word = word->next)
+	{
+		int bold = keywordTrieMatches(trie, word->str, word->length);
+		marks[count++] = bold ? '1' : '0';
+	}
+	marks[count] = '\0';
+	clearStrList(&words);
+	return count;
+}
+
+LOCAL void checkMatches(const char *track, const char *text, const char *expected)
+{
+	ushort *wtrack = toWstr(track);
+	ushort *wtext = toWstr(text);
+	KeywordTrie trie;
+	char marks[64];
+	keywordTrieBuild(wtrack, &trie);
+	matches(&trie, wtext, marks);
+	if (!CHECK_STR(marks, expected))
+	{
+		printf("test_strlib: \"%s\" in \"%s\"\n", track, text);
+	}
+	clearKeywordTrie(&trie);
+	free(wtrack);
+	free(wtext);
+}
+
+LOCAL void testMatches(void)
+{
+	checkMatches("esp", "ESP8266 esp32 and resp", "1100");
+	checkMatches("#iot", "IoT #iot #IOTA iota", "1111");
+	checkMatches("iot", "#iot IoT.", "11");
+	// a word takes the delimiter after it, a second one is a word of its own
+	checkMatches("esp8266,arduino", "Arduino! an esp8266", "1001");
+	// a mention isn't a keyword
+	checkMatches("Maker", "makers @maker make", "100");
+	// a blank keyword used to make every word bold
+	checkMatches("a, b", "apple banana cherry", "110");
+	checkMatches(", ,#", "apple banana", "00");
+	checkMatches("", "apple", "0");
+
+	// Cyrillic and Latin Extended-A are case folded too
+	const ushort track[] = {0x0416, 0x0423, 'K', ',', 0x0100, 0x0401, 0};	// "ЖУK,ĀЁ"
+	const ushort text[] = {'#', 0x0436, 0x0443, 'k', 0x0430, ' ',			// "#жуkа"
+			0x0101, 0x0451, 'z', ' ', 0x0101, 'z', 0};						// "āёz āz"
+	KeywordTrie trie;
+	char marks[8];
+	keywordTrieBuild(track, &trie);
+	CHECK_INT(matches(&trie, text, marks), 3);
+	CHECK_STR(marks, "110");
+	clearKeywordTrie(&trie);
+	CHECK(trie.nodes == NULL);
+	CHECK_INT(trie.count, 0);
+
+	KeywordTrie empty;
+	keywordTrieBuild(NULL, &empty);
+	CHECK(empty.nodes == NULL);
+	CHECK(!keywordTrieMatches(&empty, text, 5));
+	CHECK(!keywordTrieMatches(NULL, text, 5));
+}
+
+// one allocation, a node per distinct prefix, all of it freed
+LOCAL void testTrieHeap(void)
+{
+	ushort *track = toWstr("esp8266, esp32,#ESP,arduino");
+	shimHeapResetPeak();
+	uint allocs = shimHeap.allocs;
+	uint frees = shimHeap.frees;
+	uint current = shimHeap.current;
+	KeywordTrie trie;
+	keywordTrieBuild(track, &trie);
+	CHECK_INT(shimHeap.allocs - allocs, 1);
+	CHECK_INT(trie.count, 1 + 7 + 2 + 7);	// root, esp8266, 32, arduino
+	clearKeywordTrie(&trie);
+	CHECK_INT(shimHeap.current, current);
+	CHECK_INT(shimHeap.frees - frees, 1);
+	free(track);
+}
+
+LOCAL uint xorshift(uint *state)
+{
+	uint x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+LOCAL void randomWstr(uint *state, ushort *str, int len)
+{
+	// delimiters, hashtags, mentions, both cases of Latin, Latin Extended-A and Cyrillic
+	const ushort alphabet[] = {'a', 'A', 'b', 'B', '#', ',', ' ', '.', '@', '1',
+			0x0410, 0x0430, 0x0100, 0x0101, 0x0401, 0x0451};
+	int i;
+	for (i = 0; i < len; i++)
+	{
+		str[i] = alphabet[xorshift(state) % NELEMENTS(alphabet)];
+	}
+	str[len] = 0;
+}
+
+// a keyword made of a delimiter or a hashtag only, which the trie skips
+LOCAL int hasBlankKeyword(const StrList *keywords)
+{
+	const StrListItem *item;
+	for (item = keywords->first; item; item = item->next)
+	{
+		int length = item->length;
+		if (isDelimeter(item->str[length-1])) length--;
+		if (length > 0 && *item->str == '#') length--;
+		if (length == 0)
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// the trie against the old list on random input, blank keywords aside
+LOCAL void compareMatchers(void)
+{
+	uint state = 12345;
+	int compared = 0;
+	int words = 0;
+	int bold = 0;
+	int i;
+	for (i = 0; i < FUZZ_CASES; i++)
+	{
+		ushort track[FUZZ_KEYWORDS_LEN];
+		ushort text[FUZZ_TWEET_LEN];
+		randomWstr(&state, track, 1 + xorshift(&state) % (FUZZ_KEYWORDS_LEN - 1));
+		randomWstr(&state, text, 1 + xorshift(&state) % (FUZZ_TWEET_LEN - 1));
+
+		StrList list;
+		strSplit(track, &list);
+		if (hasBlankKeyword(&list))
+		{
+			clearStrList(&list);
+			continue;
+		}
+		KeywordTrie trie;
+		keywordTrieBuild(track, &trie);
+		StrList textWords;
+		strSplit(text, &textWords);
+		const StrListItem *word;
+		int ok = TRUE;
+		for (word = textWords.first; word && ok; word = word->next)
+		{
+			int expected = oldStrListContains(&list, word->str, word->length, TRUE);
+			ok = CHECK_INT(keywordTrieMatches(&trie, word->str, word->length), expected);
+			bold += expected;
+			words++;
+		}
+		if (!ok)
+		{
+			printf("test_strlib: random case %d\n", i);
+		}
+		clearStrList(&textWords);
+		clearKeywordTrie(&trie);
+		clearStrList(&list);
+		compared++;
+		if (!ok)
+		{
+			break;
+		}
+	}
+	printf("strlib: %d random keyword sets, %d words, %d bold, same as the keyword list\n",
+			compared, words, bold);
+}
+
+LOCAL void benchmark(void)
+{
+	const int counts[] = {1, 10, 50};
+	ushort *text = toWstr(tweet);
+	StrList words;
+	strSplit(text, &words);
+	volatile int sink = 0;
+	int k;
+	for (k = 0; k < NELEMENTS(counts); k++)
+	{
+		char track[1024] = "";
+		int i;
+		for (i = 0; i < counts[k]; i++)
+		{
+			strcat(track, keywords[i]);
+			strcat(track, i < counts[k] - 1 ? "," : "");
+		}
+		ushort *wtrack = toWstr(track);
+		StrList list;
+		strSplit(wtrack, &list);
+		KeywordTrie trie;
+		keywordTrieBuild(wtrack, &trie);
+
+		int boldOld = 0;
+		int boldNew = 0;
+		const StrListItem *word;
+		for (word = words.first; word; word = word->next)
+		{
+			boldOld += oldStrListContains(&list, word->str, word->length, TRUE);
+			boldNew += keywordTrieMatches(&trie, word->str, word->length);
+		}
+		CHECK_INT(boldNew, boldOld);
+
+		double t0 = testSeconds();
+		for (i = 0; i < BENCH_TWEETS; i++)
+		{
+			for (word = words.first; word; word = word->next)
+			{
+				sink += oldStrListContains(&list, word->str, word->length, TRUE);
+			}
+		}
+		double listed = testSeconds() - t0;
+		t0 = testSeconds();
+		for (i = 0; i < BENCH_TWEETS; i++)
+		{
+			for (word = words.first; word; word = word->next)
+			{
+				sink += keywordTrieMatches(&trie, word->str, word->length);
+			}
+		}
+		double trieTime = testSeconds() - t0;
+
+		printf("strlib: %2d keywords, %d of %d words bold, %.2f us per tweet with the list, %.2f us with the trie of %d nodes\n",
+				counts[k], boldNew, words.count, listed / BENCH_TWEETS * 1e6, trieTime / BENCH_TWEETS * 1e6, trie.count);
+		clearKeywordTrie(&trie);
+		clearStrList(&list);
+		free(wtrack);
+	}
+	clearStrList(&words);
+	free(text);
+}
+
+int main(int argc, char **argv)
+{
+	testMatches();
+	testTrieHeap();
+	compareMatchers();
+	benchmark();
+	return testDone("strlib");
+}